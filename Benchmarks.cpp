@@ -0,0 +1,156 @@
+//-----------------------------------------------------------------------------
+// File: Benchmarks.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "Scene.h"
+#include "ModelFile.h"
+#include "VertexPacking.h"
+#include "MeshCluster.h"
+#include "TransformHierarchy.h"
+#include "HeightField.h"
+#include "TerrainQuadtree.h"
+#include "TerrainTessellation.h"
+#include "TerrainGeomipmap.h"
+
+//Console target of the headless benchmarks (Benchmarks.vcxproj, which defines every _WITH_..._BENCHMARK): runs them
+//from the project directory with the models and the terrain of the scene, all of them or only those named on the
+//command line (Benchmarks.exe HeightQueries TerrainCulling), and exits with the number of failed checks
+
+void BenchmarkOutputDebugString(LPCTSTR pstrOutput)
+{
+	_fputts(pstrOutput, stdout);
+#ifdef UNICODE
+	::OutputDebugStringW(pstrOutput);
+#else
+	::OutputDebugStringA(pstrOutput);
+#endif
+}
+
+static bool IsBenchmarkSelected(LPCTSTR pstrName, int argc, _TCHAR *argv[])
+{
+	if (argc < 2) return(true);
+	for (int i = 1; i < argc; i++)
+	{
+		if (!_tcsicmp(argv[i], pstrName)) return(true);
+	}
+	return(false);
+}
+
+static int ReportBenchmark(LPCTSTR pstrName, int nFailures)
+{
+	TCHAR pstrDebug[256] = { 0 };
+	if (nFailures > 0)
+		_stprintf_s(pstrDebug, 256, _T("[FAILED] %s: %d\n\n"), pstrName, nFailures);
+	else
+		_stprintf_s(pstrDebug, 256, _T("[OK] %s\n\n"), pstrName);
+	OutputDebugString(pstrDebug);
+	return(nFailures);
+}
+
+int _tmain(int argc, _TCHAR *argv[])
+{
+	if (!::IsAVX2Supported())
+	{
+		_fputts(_T("This program needs a processor with AVX2.\n"), stderr);
+		return(1);
+	}
+
+	int nFailures = 0;
+#ifdef _WITH_MODEL_PARSE_BENCHMARK
+	if (::IsBenchmarkSelected(_T("ModelParsing"), argc, argv))
+	{
+		char *ppstrModelFileNames[3] = { "Model/Apache.bin", "Model/helicopter.bin", "Model/player.bin" };
+		nFailures += ::ReportBenchmark(_T("ModelParsing"), ::BenchmarkModelParsing(ppstrModelFileNames, 3, 20));
+	}
+#endif
+#ifdef _WITH_VERTEX_PACKING_BENCHMARK
+	if (::IsBenchmarkSelected(_T("VertexPacking"), argc, argv))
+	{
+		char *ppstrPackedFileNames[2] = { "Model/Apache.bin", "Model/helicopter.bin" };
+		nFailures += ::ReportBenchmark(_T("VertexPacking"), ::BenchmarkVertexPacking(ppstrPackedFileNames, 2));
+	}
+#endif
+#ifdef _WITH_MESH_CLUSTER_BENCHMARK
+	if (::IsBenchmarkSelected(_T("MeshClusterCulling"), argc, argv))
+	{
+		char *ppstrClusterFileNames[3] = { "Model/Apache.bin", "Model/helicopter.bin", "Model/player.bin" };
+		nFailures += ::ReportBenchmark(_T("MeshClusterCulling"), ::BenchmarkMeshClusterCulling(ppstrClusterFileNames, 3, 64));
+	}
+#endif
+#ifdef _WITH_TRANSFORM_HIERARCHY_BENCHMARK
+	if (::IsBenchmarkSelected(_T("TransformHierarchy"), argc, argv))
+	{
+		char *ppstrHierarchyFileNames[3] = { "Model/Apache.bin", "Model/helicopter.bin", "Model/player.bin" };
+		nFailures += ::ReportBenchmark(_T("TransformHierarchy"), ::BenchmarkTransformHierarchy(ppstrHierarchyFileNames, 3, 300, 10000, 200));
+	}
+#endif
+#ifdef _WITH_TRANSFORM_POSE_BENCHMARK
+	if (::IsBenchmarkSelected(_T("TransformPoses"), argc, argv))
+	{
+		int pnPoseInstances[2] = { 1000, 10000 };
+		int nPoseFailures = ::BenchmarkTransformPoses("Model/helicopter.bin", pnPoseInstances, 2, 100);
+		nPoseFailures += ::BenchmarkTransformPoses("Model/Apache.bin", pnPoseInstances, 2, 20);
+		nFailures += ::ReportBenchmark(_T("TransformPoses"), nPoseFailures);
+	}
+#endif
+#ifdef _WITH_OBJECT_REFERENCE_BENCHMARK
+	if (::IsBenchmarkSelected(_T("ObjectReferences"), argc, argv))
+	{
+		char *ppstrReferenceFileNames[2] = { "Model/helicopter.bin", "Model/Apache.bin" };
+		nFailures += ::ReportBenchmark(_T("ObjectReferences"), ::BenchmarkObjectReferences(ppstrReferenceFileNames, 2, 100000, 4));
+	}
+#endif
+#ifdef _WITH_BULLET_POOL_BENCHMARK
+	if (::IsBenchmarkSelected(_T("BulletPool"), argc, argv)) nFailures += ::ReportBenchmark(_T("BulletPool"), ::BenchmarkBulletPool(400, 600));
+#endif
+#ifdef _WITH_COLLISION_GRID_BENCHMARK
+	if (::IsBenchmarkSelected(_T("CollisionGrid"), argc, argv)) nFailures += ::ReportBenchmark(_T("CollisionGrid"), ::BenchmarkCollisionGrid(10000, 5000, 20));
+#endif
+#ifdef _WITH_SWEPT_COLLISION_BENCHMARK
+	if (::IsBenchmarkSelected(_T("SweptCollision"), argc, argv)) nFailures += ::ReportBenchmark(_T("SweptCollision"), ::BenchmarkSweptCollision(TERRAIN_HEIGHT_MAP_FILE, 100000, 10.0f));
+#endif
+#ifdef _WITH_BOX_BATCH_BENCHMARK
+	if (::IsBenchmarkSelected(_T("BoxBatch"), argc, argv)) nFailures += ::ReportBenchmark(_T("BoxBatch"), ::BenchmarkBoxBatch(4096, 2000));
+#endif
+#ifdef _WITH_TERRAIN_RAYCAST_BENCHMARK
+	if (::IsBenchmarkSelected(_T("TerrainRayCast"), argc, argv)) nFailures += ::ReportBenchmark(_T("TerrainRayCast"), ::BenchmarkTerrainRayCast(TERRAIN_HEIGHT_MAP_FILE, TERRAIN_WIDTH, TERRAIN_LENGTH, XMFLOAT3(4.0f, 6.0f, 4.0f), 200000));
+#endif
+#ifdef _WITH_FIXED_TIMESTEP_BENCHMARK
+	if (::IsBenchmarkSelected(_T("FixedTimestep"), argc, argv)) nFailures += ::ReportBenchmark(_T("FixedTimestep"), ::BenchmarkFixedTimestep(60.0f, 60.0f));
+#endif
+#ifdef _WITH_HEIGHT_QUERY_BENCHMARK
+	if (::IsBenchmarkSelected(_T("HeightQueries"), argc, argv)) nFailures += ::ReportBenchmark(_T("HeightQueries"), ::BenchmarkHeightQueries(TERRAIN_HEIGHT_MAP_FILE, TERRAIN_WIDTH, TERRAIN_LENGTH, XMFLOAT3(4.0f, 6.0f, 4.0f), 1000000));
+#endif
+#ifdef _WITH_HEIGHT_MAP_LAYOUT_BENCHMARK
+	if (::IsBenchmarkSelected(_T("HeightMapLayouts"), argc, argv)) nFailures += ::ReportBenchmark(_T("HeightMapLayouts"), ::BenchmarkHeightMapLayouts(4097, 4000000));
+#endif
+#ifdef _WITH_HEIGHT_FIELD_STREAMING_BENCHMARK
+	if (::IsBenchmarkSelected(_T("HeightFieldStreaming"), argc, argv)) nFailures += ::ReportBenchmark(_T("HeightFieldStreaming"), ::BenchmarkHeightFieldStreaming(8192, 64));
+#endif
+#ifdef _WITH_TERRAIN_CULLING_BENCHMARK
+	if (::IsBenchmarkSelected(_T("TerrainCulling"), argc, argv)) nFailures += ::ReportBenchmark(_T("TerrainCulling"), ::BenchmarkTerrainCulling(TERRAIN_HEIGHT_MAP_FILE, TERRAIN_HEIGHT_MAP_FORMAT, TERRAIN_WIDTH, TERRAIN_LENGTH, 9, 9, XMFLOAT3(4.0f, 6.0f, 4.0f), 720));
+#endif
+#ifdef _WITH_TERRAIN_SUBMISSION_BENCHMARK
+	if (::IsBenchmarkSelected(_T("TerrainSubmission"), argc, argv)) nFailures += ::ReportBenchmark(_T("TerrainSubmission"), ::BenchmarkTerrainSubmission(TERRAIN_HEIGHT_MAP_FILE, TERRAIN_HEIGHT_MAP_FORMAT, TERRAIN_WIDTH, TERRAIN_LENGTH, 9, 9, XMFLOAT3(4.0f, 6.0f, 4.0f), 720));
+#endif
+#ifdef _WITH_TERRAIN_TESSELLATION_BENCHMARK
+	if (::IsBenchmarkSelected(_T("TerrainTessellation"), argc, argv)) nFailures += ::ReportBenchmark(_T("TerrainTessellation"), ::BenchmarkTerrainTessellation(TERRAIN_HEIGHT_MAP_FILE, TERRAIN_HEIGHT_MAP_FORMAT, TERRAIN_WIDTH, TERRAIN_LENGTH, 9, 9, XMFLOAT3(4.0f, 6.0f, 4.0f), 1.0f, 720));
+#endif
+#ifdef _WITH_TERRAIN_GEOMIPMAP_BENCHMARK
+	if (::IsBenchmarkSelected(_T("TerrainGeomipmap"), argc, argv)) nFailures += ::ReportBenchmark(_T("TerrainGeomipmap"), ::BenchmarkTerrainGeomipmap(TERRAIN_HEIGHT_MAP_FILE, TERRAIN_HEIGHT_MAP_FORMAT, TERRAIN_WIDTH, TERRAIN_LENGTH, TERRAIN_GEOMIPMAP_PATCH_QUADS, XMFLOAT3(4.0f, 6.0f, 4.0f), 720));
+#endif
+#ifdef _WITH_TERRAIN_CONSTRUCTION_BENCHMARK
+	if (::IsBenchmarkSelected(_T("TerrainConstruction"), argc, argv))
+	{
+		int pnTerrainSizes[3] = { 257, 1025, 4097 };
+		nFailures += ::ReportBenchmark(_T("TerrainConstruction"), ::BenchmarkTerrainConstruction(pnTerrainSizes, 3, 9, 9, TERRAIN_GEOMIPMAP_PATCH_QUADS, XMFLOAT3(4.0f, 6.0f, 4.0f)));
+	}
+#endif
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("%d failed checks\n"), nFailures);
+	OutputDebugString(pstrDebug);
+
+	return(nFailures);
+}
@@ -0,0 +1,508 @@
+//-----------------------------------------------------------------------------
+// File: BoxBatch.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "BoxBatch.h"
+#include <cfloat>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//The scalar reference and the kernels must round alike: no fused multiply-adds (/arch:AVX2 allows them before VS 2022)
+#pragma fp_contract(off)
+
+static void GetBoxAxes(BoundingOrientedBox& xmBox, XMFLOAT3 *pxmf3Axes)
+{
+	XMMATRIX xmmtxRotation = XMMatrixRotationQuaternion(XMLoadFloat4(&xmBox.Orientation));
+	XMStoreFloat3(&pxmf3Axes[0], xmmtxRotation.r[0]);
+	XMStoreFloat3(&pxmf3Axes[1], xmmtxRotation.r[1]);
+	XMStoreFloat3(&pxmf3Axes[2], xmmtxRotation.r[2]);
+}
+
+//Separating axis test in the frame of box 1 (face axes of both boxes, then the nine edge cross products). The batch
+//kernels below evaluate every expression in the same order.
+bool IntersectOrientedBoxes(BoundingOrientedBox& xmBox1, BoundingOrientedBox& xmBox2)
+{
+	XMFLOAT3 pxmf3Axes1[3], pxmf3Axes2[3];
+	::GetBoxAxes(xmBox1, pxmf3Axes1);
+	::GetBoxAxes(xmBox2, pxmf3Axes2);
+	float a[3] = { xmBox1.Extents.x, xmBox1.Extents.y, xmBox1.Extents.z };
+	float b[3] = { xmBox2.Extents.x, xmBox2.Extents.y, xmBox2.Extents.z };
+	float d[3] = { xmBox2.Center.x - xmBox1.Center.x, xmBox2.Center.y - xmBox1.Center.y, xmBox2.Center.z - xmBox1.Center.z };
+
+	float t[3], R[3][3], AbsR[3][3];
+	for (int i = 0; i < 3; i++)
+	{
+		t[i] = d[0] * pxmf3Axes1[i].x + d[1] * pxmf3Axes1[i].y + d[2] * pxmf3Axes1[i].z;
+		for (int j = 0; j < 3; j++)
+		{
+			R[i][j] = pxmf3Axes1[i].x * pxmf3Axes2[j].x + pxmf3Axes1[i].y * pxmf3Axes2[j].y + pxmf3Axes1[i].z * pxmf3Axes2[j].z;
+			AbsR[i][j] = fabsf(R[i][j]) + BOX_BATCH_EPSILON;
+		}
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (fabsf(t[i]) > a[i] + b[0] * AbsR[i][0] + b[1] * AbsR[i][1] + b[2] * AbsR[i][2]) return(false);
+	}
+	for (int j = 0; j < 3; j++)
+	{
+		if (fabsf(t[0] * R[0][j] + t[1] * R[1][j] + t[2] * R[2][j]) > a[0] * AbsR[0][j] + a[1] * AbsR[1][j] + a[2] * AbsR[2][j] + b[j]) return(false);
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+		for (int j = 0; j < 3; j++)
+		{
+			int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+			if (fabsf(t[i2] * R[i1][j] - t[i1] * R[i2][j]) > a[i1] * AbsR[i2][j] + a[i2] * AbsR[i1][j] + b[j1] * AbsR[i][j2] + b[j2] * AbsR[i][j1]) return(false);
+		}
+	}
+	return(true);
+}
+
+static int GetLaneMask(FXMVECTOR xmvMask)
+{
+#if defined(_XM_SSE_INTRINSICS_)
+	return(_mm_movemask_ps(xmvMask));
+#else
+	XMUINT4 xmu4Mask;
+	XMStoreUInt4(&xmu4Mask, xmvMask);
+	return((xmu4Mask.x & 1) | ((xmu4Mask.y & 1) << 1) | ((xmu4Mask.z & 1) << 2) | ((xmu4Mask.w & 1) << 3));
+#endif
+}
+
+//One box (every lane the same) against the four boxes of a block; all-ones in the lanes that intersect
+static XMVECTOR IntersectBoxBlock(XMVECTOR *pxmvCenter, XMVECTOR *pxmvAxes, XMVECTOR *pxmvExtents, OBBBLOCK *pBlock)
+{
+	XMVECTOR xmvEpsilon = XMVectorReplicate(BOX_BATCH_EPSILON);
+	XMVECTOR b[3], d[3], t[3], R[3][3], AbsR[3][3];
+	for (int k = 0; k < 3; k++)
+	{
+		b[k] = XMLoadFloat4(&pBlock->m_pxmf4Extents[k]);
+		d[k] = XMVectorSubtract(XMLoadFloat4(&pBlock->m_pxmf4Centers[k]), pxmvCenter[k]);
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		t[i] = XMVectorAdd(XMVectorAdd(XMVectorMultiply(d[0], pxmvAxes[i * 3 + 0]), XMVectorMultiply(d[1], pxmvAxes[i * 3 + 1])), XMVectorMultiply(d[2], pxmvAxes[i * 3 + 2]));
+		for (int j = 0; j < 3; j++)
+		{
+			R[i][j] = XMVectorAdd(XMVectorAdd(XMVectorMultiply(pxmvAxes[i * 3 + 0], XMLoadFloat4(&pBlock->m_pxmf4Axes[j * 3 + 0])), XMVectorMultiply(pxmvAxes[i * 3 + 1], XMLoadFloat4(&pBlock->m_pxmf4Axes[j * 3 + 1]))), XMVectorMultiply(pxmvAxes[i * 3 + 2], XMLoadFloat4(&pBlock->m_pxmf4Axes[j * 3 + 2])));
+			AbsR[i][j] = XMVectorAdd(XMVectorAbs(R[i][j]), xmvEpsilon);
+		}
+	}
+
+	//Disabled lanes (negative extents) count as separated
+	XMVECTOR xmvSeparated = XMVectorLess(b[0], XMVectorZero());
+	for (int i = 0; i < 3; i++)
+	{
+		XMVECTOR xmvRadius = XMVectorAdd(XMVectorAdd(XMVectorAdd(pxmvExtents[i], XMVectorMultiply(b[0], AbsR[i][0])), XMVectorMultiply(b[1], AbsR[i][1])), XMVectorMultiply(b[2], AbsR[i][2]));
+		xmvSeparated = XMVectorOrInt(xmvSeparated, XMVectorGreater(XMVectorAbs(t[i]), xmvRadius));
+	}
+	for (int j = 0; j < 3; j++)
+	{
+		XMVECTOR xmvDistance = XMVectorAdd(XMVectorAdd(XMVectorMultiply(t[0], R[0][j]), XMVectorMultiply(t[1], R[1][j])), XMVectorMultiply(t[2], R[2][j]));
+		XMVECTOR xmvRadius = XMVectorAdd(XMVectorAdd(XMVectorAdd(XMVectorMultiply(pxmvExtents[0], AbsR[0][j]), XMVectorMultiply(pxmvExtents[1], AbsR[1][j])), XMVectorMultiply(pxmvExtents[2], AbsR[2][j])), b[j]);
+		xmvSeparated = XMVectorOrInt(xmvSeparated, XMVectorGreater(XMVectorAbs(xmvDistance), xmvRadius));
+	}
+	//Most pairs are separated by a face axis
+	if (::GetLaneMask(xmvSeparated) == 0xf) return(XMVectorFalseInt());
+
+	for (int i = 0; i < 3; i++)
+	{
+		int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+		for (int j = 0; j < 3; j++)
+		{
+			int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+			XMVECTOR xmvDistance = XMVectorSubtract(XMVectorMultiply(t[i2], R[i1][j]), XMVectorMultiply(t[i1], R[i2][j]));
+			XMVECTOR xmvRadius = XMVectorAdd(XMVectorAdd(XMVectorAdd(XMVectorMultiply(pxmvExtents[i1], AbsR[i2][j]), XMVectorMultiply(pxmvExtents[i2], AbsR[i1][j])), XMVectorMultiply(b[j1], AbsR[i][j2])), XMVectorMultiply(b[j2], AbsR[i][j1]));
+			xmvSeparated = XMVectorOrInt(xmvSeparated, XMVectorGreater(XMVectorAbs(xmvDistance), xmvRadius));
+		}
+	}
+	return(XMVectorNotEqualInt(xmvSeparated, XMVectorTrueInt()));
+}
+
+#if defined(__AVX2__)
+static inline __m256 LoadBlockLanes(XMFLOAT4& xmf4Lanes0, XMFLOAT4& xmf4Lanes1)
+{
+	return(_mm256_set_m128(_mm_loadu_ps(&xmf4Lanes1.x), _mm_loadu_ps(&xmf4Lanes0.x)));
+}
+
+static inline __m256 Abs8(__m256 v)
+{
+	return(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), v));
+}
+
+//IntersectBoxBlock on two blocks at once; returns the 8 lane bits of the boxes that intersect
+static int IntersectBoxBlocks8(__m256 *pCenter, __m256 *pAxes, __m256 *pExtents, OBBBLOCK *pBlock0, OBBBLOCK *pBlock1)
+{
+	__m256 vEpsilon = _mm256_set1_ps(BOX_BATCH_EPSILON);
+	__m256 b[3], d[3], t[3], R[3][3], AbsR[3][3], Bu[9];
+	for (int k = 0; k < 3; k++)
+	{
+		b[k] = ::LoadBlockLanes(pBlock0->m_pxmf4Extents[k], pBlock1->m_pxmf4Extents[k]);
+		d[k] = _mm256_sub_ps(::LoadBlockLanes(pBlock0->m_pxmf4Centers[k], pBlock1->m_pxmf4Centers[k]), pCenter[k]);
+	}
+	for (int k = 0; k < 9; k++) Bu[k] = ::LoadBlockLanes(pBlock0->m_pxmf4Axes[k], pBlock1->m_pxmf4Axes[k]);
+	for (int i = 0; i < 3; i++)
+	{
+		t[i] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], pAxes[i * 3 + 0]), _mm256_mul_ps(d[1], pAxes[i * 3 + 1])), _mm256_mul_ps(d[2], pAxes[i * 3 + 2]));
+		for (int j = 0; j < 3; j++)
+		{
+			R[i][j] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(pAxes[i * 3 + 0], Bu[j * 3 + 0]), _mm256_mul_ps(pAxes[i * 3 + 1], Bu[j * 3 + 1])), _mm256_mul_ps(pAxes[i * 3 + 2], Bu[j * 3 + 2]));
+			AbsR[i][j] = _mm256_add_ps(::Abs8(R[i][j]), vEpsilon);
+		}
+	}
+
+	__m256 vSeparated = _mm256_cmp_ps(b[0], _mm256_setzero_ps(), _CMP_LT_OQ);
+	for (int i = 0; i < 3; i++)
+	{
+		__m256 vRadius = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(pExtents[i], _mm256_mul_ps(b[0], AbsR[i][0])), _mm256_mul_ps(b[1], AbsR[i][1])), _mm256_mul_ps(b[2], AbsR[i][2]));
+		vSeparated = _mm256_or_ps(vSeparated, _mm256_cmp_ps(::Abs8(t[i]), vRadius, _CMP_GT_OQ));
+	}
+	for (int j = 0; j < 3; j++)
+	{
+		__m256 vDistance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t[0], R[0][j]), _mm256_mul_ps(t[1], R[1][j])), _mm256_mul_ps(t[2], R[2][j]));
+		__m256 vRadius = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(pExtents[0], AbsR[0][j]), _mm256_mul_ps(pExtents[1], AbsR[1][j])), _mm256_mul_ps(pExtents[2], AbsR[2][j])), b[j]);
+		vSeparated = _mm256_or_ps(vSeparated, _mm256_cmp_ps(::Abs8(vDistance), vRadius, _CMP_GT_OQ));
+	}
+	if (_mm256_movemask_ps(vSeparated) == 0xff) return(0);
+
+	for (int i = 0; i < 3; i++)
+	{
+		int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+		for (int j = 0; j < 3; j++)
+		{
+			int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+			__m256 vDistance = _mm256_sub_ps(_mm256_mul_ps(t[i2], R[i1][j]), _mm256_mul_ps(t[i1], R[i2][j]));
+			__m256 vRadius = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(pExtents[i1], AbsR[i2][j]), _mm256_mul_ps(pExtents[i2], AbsR[i1][j])), _mm256_mul_ps(b[j1], AbsR[i][j2])), _mm256_mul_ps(b[j2], AbsR[i][j1]));
+			vSeparated = _mm256_or_ps(vSeparated, _mm256_cmp_ps(::Abs8(vDistance), vRadius, _CMP_GT_OQ));
+		}
+	}
+	return(~_mm256_movemask_ps(vSeparated) & 0xff);
+}
+#endif
+
+//Slab test of the segment start + t * delta (t in [0, 1]) against the four boxes of a block; all-ones in the lanes
+//it enters, *pxmvHit the t where it enters them (0 when it starts inside)
+static XMVECTOR IntersectSegmentBlock(XMVECTOR *pxmvStart, XMVECTOR *pxmvDelta, OBBBLOCK *pBlock, XMVECTOR *pxmvHit)
+{
+	XMVECTOR xmvTiny = XMVectorReplicate(1.0e-20f);
+	XMVECTOR xmvEnter = XMVectorZero(), xmvLeave = XMVectorSplatOne();
+	XMVECTOR s[3];
+	for (int k = 0; k < 3; k++) s[k] = XMVectorSubtract(pxmvStart[k], XMLoadFloat4(&pBlock->m_pxmf4Centers[k]));
+	for (int k = 0; k < 3; k++)
+	{
+		XMVECTOR xmvAxisX = XMLoadFloat4(&pBlock->m_pxmf4Axes[k * 3 + 0]), xmvAxisY = XMLoadFloat4(&pBlock->m_pxmf4Axes[k * 3 + 1]), xmvAxisZ = XMLoadFloat4(&pBlock->m_pxmf4Axes[k * 3 + 2]);
+		XMVECTOR xmvOrigin = XMVectorAdd(XMVectorAdd(XMVectorMultiply(s[0], xmvAxisX), XMVectorMultiply(s[1], xmvAxisY)), XMVectorMultiply(s[2], xmvAxisZ));
+		XMVECTOR xmvDirection = XMVectorAdd(XMVectorAdd(XMVectorMultiply(pxmvDelta[0], xmvAxisX), XMVectorMultiply(pxmvDelta[1], xmvAxisY)), XMVectorMultiply(pxmvDelta[2], xmvAxisZ));
+		//Parallel to the slab: a huge finite reciprocal keeps inside origins at -inf..+inf without 0 * inf
+		xmvDirection = XMVectorSelect(xmvDirection, xmvTiny, XMVectorLess(XMVectorAbs(xmvDirection), xmvTiny));
+		XMVECTOR xmvInverse = XMVectorReciprocal(xmvDirection);
+		XMVECTOR xmvExtent = XMLoadFloat4(&pBlock->m_pxmf4Extents[k]);
+		XMVECTOR t1 = XMVectorMultiply(XMVectorSubtract(XMVectorNegate(xmvExtent), xmvOrigin), xmvInverse);
+		XMVECTOR t2 = XMVectorMultiply(XMVectorSubtract(xmvExtent, xmvOrigin), xmvInverse);
+		xmvEnter = XMVectorMax(xmvEnter, XMVectorMin(t1, t2));
+		xmvLeave = XMVectorMin(xmvLeave, XMVectorMax(t1, t2));
+	}
+	*pxmvHit = xmvEnter;
+	XMVECTOR xmvEnabled = XMVectorGreaterOrEqual(XMLoadFloat4(&pBlock->m_pxmf4Extents[0]), XMVectorZero());
+	return(XMVectorAndInt(xmvEnabled, XMVectorLessOrEqual(xmvEnter, xmvLeave)));
+}
+
+static inline void SetLane(XMFLOAT4& xmf4Lanes, int nLane, float fValue)
+{
+	(&xmf4Lanes.x)[nLane] = fValue;
+}
+
+static void DisableLane(OBBBLOCK *pBlock, int nLane)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		::SetLane(pBlock->m_pxmf4Centers[k], nLane, 0.0f);
+		::SetLane(pBlock->m_pxmf4Extents[k], nLane, -1.0f);
+	}
+	for (int k = 0; k < 9; k++) ::SetLane(pBlock->m_pxmf4Axes[k], nLane, 0.0f);
+}
+
+CBoxBatch::CBoxBatch(int nMaxBoxes)
+{
+	m_nMaxBoxes = nMaxBoxes;
+	m_pBlocks = new OBBBLOCK[(nMaxBoxes + 3) / 4];
+}
+
+CBoxBatch::~CBoxBatch()
+{
+	if (m_pBlocks) delete[] m_pBlocks;
+}
+
+void CBoxBatch::SetBoxes(BoundingOrientedBox *pxmBoxes, int nBoxes, XMFLOAT3& xmf3Margin)
+{
+	if (nBoxes > m_nMaxBoxes)
+	{
+		if (m_pBlocks) delete[] m_pBlocks;
+		m_nMaxBoxes = nBoxes;
+		m_pBlocks = new OBBBLOCK[(nBoxes + 3) / 4];
+	}
+	m_nBoxes = nBoxes;
+
+	XMFLOAT3 pxmf3Axes[3];
+	for (int i = 0; i < nBoxes; i++)
+	{
+		OBBBLOCK *pBlock = &m_pBlocks[i / 4];
+		int nLane = i % 4;
+		::GetBoxAxes(pxmBoxes[i], pxmf3Axes);
+		::SetLane(pBlock->m_pxmf4Centers[0], nLane, pxmBoxes[i].Center.x);
+		::SetLane(pBlock->m_pxmf4Centers[1], nLane, pxmBoxes[i].Center.y);
+		::SetLane(pBlock->m_pxmf4Centers[2], nLane, pxmBoxes[i].Center.z);
+		for (int k = 0; k < 3; k++)
+		{
+			::SetLane(pBlock->m_pxmf4Axes[k * 3 + 0], nLane, pxmf3Axes[k].x);
+			::SetLane(pBlock->m_pxmf4Axes[k * 3 + 1], nLane, pxmf3Axes[k].y);
+			::SetLane(pBlock->m_pxmf4Axes[k * 3 + 2], nLane, pxmf3Axes[k].z);
+		}
+		::SetLane(pBlock->m_pxmf4Extents[0], nLane, pxmBoxes[i].Extents.x + xmf3Margin.x);
+		::SetLane(pBlock->m_pxmf4Extents[1], nLane, pxmBoxes[i].Extents.y + xmf3Margin.y);
+		::SetLane(pBlock->m_pxmf4Extents[2], nLane, pxmBoxes[i].Extents.z + xmf3Margin.z);
+	}
+	for (int i = nBoxes; i < ((nBoxes + 3) / 4) * 4; i++) ::DisableLane(&m_pBlocks[i / 4], i % 4);
+}
+
+void CBoxBatch::DisableBox(int nBox)
+{
+	::DisableLane(&m_pBlocks[nBox / 4], nBox % 4);
+}
+
+int CBoxBatch::IntersectBox(BoundingOrientedBox& xmBox, int *pnHits)
+{
+	XMFLOAT3 pxmf3Axes[3];
+	::GetBoxAxes(xmBox, pxmf3Axes);
+	float pfCenter[3] = { xmBox.Center.x, xmBox.Center.y, xmBox.Center.z };
+	float pfExtents[3] = { xmBox.Extents.x, xmBox.Extents.y, xmBox.Extents.z };
+	float *pfAxes = &pxmf3Axes[0].x;
+
+	int nHits = 0, nBlocks = (m_nBoxes + 3) / 4, b = 0;
+#if defined(__AVX2__)
+	__m256 pCenter[3], pAxes[9], pExtents[3];
+	for (int k = 0; k < 3; k++)
+	{
+		pCenter[k] = _mm256_set1_ps(pfCenter[k]);
+		pExtents[k] = _mm256_set1_ps(pfExtents[k]);
+	}
+	for (int k = 0; k < 9; k++) pAxes[k] = _mm256_set1_ps(pfAxes[k]);
+	for ( ; b + 1 < nBlocks; b += 2)
+	{
+		int nMask = ::IntersectBoxBlocks8(pCenter, pAxes, pExtents, &m_pBlocks[b], &m_pBlocks[b + 1]);
+		for (int j = 0; nMask; j++, nMask >>= 1)
+		{
+			if (nMask & 1) pnHits[nHits++] = b * 4 + j;
+		}
+	}
+#endif
+	XMVECTOR pxmvCenter[3], pxmvAxes[9], pxmvExtents[3];
+	for (int k = 0; k < 3; k++)
+	{
+		pxmvCenter[k] = XMVectorReplicate(pfCenter[k]);
+		pxmvExtents[k] = XMVectorReplicate(pfExtents[k]);
+	}
+	for (int k = 0; k < 9; k++) pxmvAxes[k] = XMVectorReplicate(pfAxes[k]);
+	for ( ; b < nBlocks; b++)
+	{
+		int nMask = ::GetLaneMask(::IntersectBoxBlock(pxmvCenter, pxmvAxes, pxmvExtents, &m_pBlocks[b]));
+		for (int j = 0; nMask; j++, nMask >>= 1)
+		{
+			if (nMask & 1) pnHits[nHits++] = b * 4 + j;
+		}
+	}
+	return(nHits);
+}
+
+int CBoxBatch::IntersectSegment(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, int *pnBoxes, int nBoxes, float *pfHit)
+{
+	XMVECTOR pxmvStart[3] = { XMVectorReplicate(xmf3Start.x), XMVectorReplicate(xmf3Start.y), XMVectorReplicate(xmf3Start.z) };
+	XMVECTOR pxmvDelta[3] = { XMVectorReplicate(xmf3End.x - xmf3Start.x), XMVectorReplicate(xmf3End.y - xmf3Start.y), XMVectorReplicate(xmf3End.z - xmf3Start.z) };
+
+	if (!pnBoxes) nBoxes = m_nBoxes;
+	int nHit = -1;
+	float fHit = FLT_MAX;
+	OBBBLOCK xGathered;
+	for (int b = 0; b < (nBoxes + 3) / 4; b++)
+	{
+		OBBBLOCK *pBlock = &m_pBlocks[b];
+		if (pnBoxes)
+		{
+			//The listed boxes four at a time, copied lane by lane (the members of OBBBLOCK are all XMFLOAT4)
+			pBlock = &xGathered;
+			for (int j = 0; j < 4; j++)
+			{
+				if (b * 4 + j >= nBoxes)
+				{
+					::DisableLane(pBlock, j);
+					continue;
+				}
+				int nBox = pnBoxes[b * 4 + j];
+				float *pfSource = &m_pBlocks[nBox / 4].m_pxmf4Centers[0].x, *pfDestination = &pBlock->m_pxmf4Centers[0].x;
+				for (int k = 0; k < int(sizeof(OBBBLOCK) / sizeof(XMFLOAT4)); k++) pfDestination[k * 4 + j] = pfSource[k * 4 + (nBox % 4)];
+			}
+		}
+
+		XMVECTOR xmvHit;
+		int nMask = ::GetLaneMask(::IntersectSegmentBlock(pxmvStart, pxmvDelta, pBlock, &xmvHit));
+		if (!nMask) continue;
+		XMFLOAT4 xmf4Hit;
+		XMStoreFloat4(&xmf4Hit, xmvHit);
+		for (int j = 0; nMask; j++, nMask >>= 1)
+		{
+			if (!(nMask & 1)) continue;
+			int nBox = (pnBoxes) ? pnBoxes[b * 4 + j] : (b * 4 + j);
+			float t = (&xmf4Hit.x)[j];
+			if ((t < fHit) || ((t == fHit) && (nBox < nHit)))
+			{
+				fHit = t;
+				nHit = nBox;
+			}
+		}
+	}
+	if (nHit >= 0) *pfHit = fHit;
+	return(nHit);
+}
+
+#ifdef _WITH_BOX_BATCH_BENCHMARK
+#include "CollisionGrid.h"
+
+static float RandomBenchmarkValue(UINT *pnRandom, float fMin, float fMax)
+{
+	*pnRandom = *pnRandom * 1664525 + 1013904223;
+	return(fMin + (fMax - fMin) * ((*pnRandom >> 8) / float(1 << 24)));
+}
+
+static BoundingOrientedBox RandomBenchmarkBox(UINT *pnRandom, float fRange, float fMinExtent, float fMaxExtent)
+{
+	XMFLOAT4 xmf4Rotation;
+	XMVECTOR xmvAxis = XMVectorSet(::RandomBenchmarkValue(pnRandom, -1.0f, 1.0f), ::RandomBenchmarkValue(pnRandom, -1.0f, 1.0f), ::RandomBenchmarkValue(pnRandom, -1.0f, 1.0f), 0.0f);
+	XMStoreFloat4(&xmf4Rotation, XMQuaternionRotationAxis(XMVector3Normalize(XMVectorAdd(xmvAxis, XMVectorSet(0.0f, 1.0e-3f, 0.0f, 0.0f))), ::RandomBenchmarkValue(pnRandom, 0.0f, XM_2PI)));
+	XMFLOAT3 xmf3Center(::RandomBenchmarkValue(pnRandom, 0.0f, fRange), ::RandomBenchmarkValue(pnRandom, 0.0f, fRange), ::RandomBenchmarkValue(pnRandom, 0.0f, fRange));
+	XMFLOAT3 xmf3Extents(::RandomBenchmarkValue(pnRandom, fMinExtent, fMaxExtent), ::RandomBenchmarkValue(pnRandom, fMinExtent, fMaxExtent), ::RandomBenchmarkValue(pnRandom, fMinExtent, fMaxExtent));
+	return(BoundingOrientedBox(xmf3Center, xmf3Extents, xmf4Rotation));
+}
+
+int BenchmarkBoxBatch(int nBoxes, int nQueries)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	UINT nRandom = 1;
+	BoundingOrientedBox *pxmBoxes = new BoundingOrientedBox[nBoxes];
+	for (int i = 0; i < nBoxes; i++) pxmBoxes[i] = ::RandomBenchmarkBox(&nRandom, 400.0f, 1.0f, 10.0f);
+	BoundingOrientedBox *pxmQueries = new BoundingOrientedBox[nQueries];
+	for (int i = 0; i < nQueries; i++) pxmQueries[i] = ::RandomBenchmarkBox(&nRandom, 400.0f, 1.0f, 10.0f);
+
+	CBoxBatch *pBatch = new CBoxBatch(nBoxes);
+	XMFLOAT3 xmf3NoMargin(0.0f, 0.0f, 0.0f);
+	pBatch->SetBoxes(pxmBoxes, nBoxes, xmf3NoMargin);
+	int *pnHits = new int[nBoxes];
+	char *pnReferenceHits = new char[nBoxes];
+	double fPairs = double(nBoxes) * double(nQueries);
+
+	//Separating axis tests: batch, scalar reference and DirectXCollision
+	long long nBatchHits = 0;
+	::QueryPerformanceCounter(&nBegin);
+	for (int q = 0; q < nQueries; q++) nBatchHits += pBatch->IntersectBox(pxmQueries[q], pnHits);
+	::QueryPerformanceCounter(&nEnd);
+	double fBatchSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+	long long nReferenceHits = 0;
+	::QueryPerformanceCounter(&nBegin);
+	for (int q = 0; q < nQueries; q++)
+	{
+		for (int i = 0; i < nBoxes; i++) nReferenceHits += ::IntersectOrientedBoxes(pxmQueries[q], pxmBoxes[i]) ? 1 : 0;
+	}
+	::QueryPerformanceCounter(&nEnd);
+	double fReferenceSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+	long long nDirectXHits = 0;
+	::QueryPerformanceCounter(&nBegin);
+	for (int q = 0; q < nQueries; q++)
+	{
+		for (int i = 0; i < nBoxes; i++) nDirectXHits += pxmQueries[q].Intersects(pxmBoxes[i]) ? 1 : 0;
+	}
+	::QueryPerformanceCounter(&nEnd);
+	double fDirectXSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+	int nMismatches = 0, nDirectXMismatches = 0;
+	for (int q = 0; q < nQueries; q++)
+	{
+		memset(pnReferenceHits, 0, nBoxes);
+		int nHits = pBatch->IntersectBox(pxmQueries[q], pnHits);
+		for (int i = 0; i < nHits; i++) pnReferenceHits[pnHits[i]] = 1;
+		for (int i = 0; i < nBoxes; i++)
+		{
+			if (pnReferenceHits[i] != (::IntersectOrientedBoxes(pxmQueries[q], pxmBoxes[i]) ? 1 : 0)) nMismatches++;
+			if (pnReferenceHits[i] != (pxmQueries[q].Intersects(pxmBoxes[i]) ? 1 : 0)) nDirectXMismatches++;
+		}
+	}
+
+	//Segments (bullet steps of 10 units) against the boxes grown by the bullet's half extents: batch against IntersectSegmentBox
+	XMFLOAT3 xmf3BulletExtents(0.4f, 0.4f, 1.0f);
+	pBatch->SetBoxes(pxmBoxes, nBoxes, xmf3BulletExtents);
+	XMFLOAT3 *pxmf3Starts = new XMFLOAT3[nQueries], *pxmf3Ends = new XMFLOAT3[nQueries];
+	for (int q = 0; q < nQueries; q++)
+	{
+		pxmf3Starts[q] = pxmQueries[q].Center;
+		pxmf3Ends[q] = XMFLOAT3(pxmf3Starts[q].x + ::RandomBenchmarkValue(&nRandom, -10.0f, 10.0f), pxmf3Starts[q].y + ::RandomBenchmarkValue(&nRandom, -10.0f, 10.0f), pxmf3Starts[q].z + ::RandomBenchmarkValue(&nRandom, -10.0f, 10.0f));
+	}
+	int *pnSegmentHits = new int[nQueries];
+	float *pfSegmentHits = new float[nQueries];
+	::QueryPerformanceCounter(&nBegin);
+	for (int q = 0; q < nQueries; q++) pnSegmentHits[q] = pBatch->IntersectSegment(pxmf3Starts[q], pxmf3Ends[q], NULL, 0, &pfSegmentHits[q]);
+	::QueryPerformanceCounter(&nEnd);
+	double fSegmentSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+	int nSegmentMismatches = 0, nSegmentHits = 0;
+	::QueryPerformanceCounter(&nBegin);
+	for (int q = 0; q < nQueries; q++)
+	{
+		int nFirst = -1;
+		float fFirst = FLT_MAX, fHit;
+		for (int i = 0; i < nBoxes; i++)
+		{
+			if (::IntersectSegmentBox(pxmBoxes[i], xmf3BulletExtents, pxmf3Starts[q], pxmf3Ends[q], &fHit) && (fHit < fFirst))
+			{
+				fFirst = fHit;
+				nFirst = i;
+			}
+		}
+		if (nFirst >= 0) nSegmentHits++;
+		//Different boxes are fine when they are entered at the same point
+		if ((nFirst != pnSegmentHits[q]) && ((nFirst < 0) || (pnSegmentHits[q] < 0) || (fabsf(fFirst - pfSegmentHits[q]) > 1.0e-4f))) nSegmentMismatches++;
+		else if ((nFirst >= 0) && (fabsf(fFirst - pfSegmentHits[q]) > 1.0e-4f)) nSegmentMismatches++;
+	}
+	::QueryPerformanceCounter(&nEnd);
+	double fSegmentReferenceSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+	TCHAR pstrDebug[256] = { 0 };
+#if defined(__AVX2__)
+	_stprintf_s(pstrDebug, 256, _T("Box batch (AVX2, 8 lanes): %d boxes x %d queries\n"), nBoxes, nQueries);
+#else
+	_stprintf_s(pstrDebug, 256, _T("Box batch (4 lanes): %d boxes x %d queries\n"), nBoxes, nQueries);
+#endif
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    boxes: batch %.1f M pairs/s, scalar reference %.1f M pairs/s, DirectXCollision %.1f M pairs/s; %lld hits (%lld, %lld), %d mismatches (%d against DirectXCollision)\n"), fPairs / fBatchSeconds * 1.0e-6, fPairs / fReferenceSeconds * 1.0e-6, fPairs / fDirectXSeconds * 1.0e-6, nBatchHits, nReferenceHits, nDirectXHits, nMismatches, nDirectXMismatches);
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    segments: batch %.1f M pairs/s, IntersectSegmentBox %.1f M pairs/s; %d hits, %d mismatches\n"), fPairs / fSegmentSeconds * 1.0e-6, fPairs / fSegmentReferenceSeconds * 1.0e-6, nSegmentHits, nSegmentMismatches);
+	OutputDebugString(pstrDebug);
+
+	delete pBatch;
+	delete[] pxmBoxes;
+	delete[] pxmQueries;
+	delete[] pnHits;
+	delete[] pnReferenceHits;
+	delete[] pxmf3Starts;
+	delete[] pxmf3Ends;
+	delete[] pnSegmentHits;
+	delete[] pfSegmentHits;
+
+	return(nMismatches + nSegmentMismatches);
+}
+#endif
@@ -0,0 +1,55 @@
+//-----------------------------------------------------------------------------
+// File: BoxBatch.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+//Oriented boxes in SoA blocks of four for one-against-many tests: one box (separating axis test) or one segment
+//(slab test, the swept bullets of CGameScene::BulletCollision) against four boxes per vector instruction. With AVX2
+//(/arch:AVX2, every configuration of the project), IntersectBox tests two blocks (eight boxes) per instruction.
+//IntersectOrientedBoxes is the scalar separating axis test the kernels are checked against (BenchmarkBoxBatch).
+
+#define BOX_BATCH_EPSILON				1.0e-5f //Added to |R| so near-parallel edge pairs do not separate by rounding
+
+//Four boxes; the axes are the rotated x, y and z of each box. Unused or disabled lanes have negative extents and never intersect.
+struct OBBBLOCK
+{
+	XMFLOAT4						m_pxmf4Centers[3]; //x, y, z
+	XMFLOAT4						m_pxmf4Axes[9]; //Axis i, component j at [i * 3 + j]
+	XMFLOAT4						m_pxmf4Extents[3];
+};
+
+bool IntersectOrientedBoxes(BoundingOrientedBox& xmBox1, BoundingOrientedBox& xmBox2);
+
+class CBoxBatch
+{
+public:
+	CBoxBatch(int nMaxBoxes);
+	virtual ~CBoxBatch();
+
+private:
+	int								m_nBoxes = 0;
+	int								m_nMaxBoxes = 0;
+	OBBBLOCK						*m_pBlocks = NULL;
+
+public:
+	int GetBoxes() { return(m_nBoxes); }
+
+	//The extents of every box are grown by xmf3Margin (the half extents of the bullet for IntersectSegment)
+	void SetBoxes(BoundingOrientedBox *pxmBoxes, int nBoxes, XMFLOAT3& xmf3Margin);
+	void DisableBox(int nBox);
+
+	//Indices of all boxes that intersect xmBox, in ascending order; returns their number
+	int IntersectBox(BoundingOrientedBox& xmBox, int *pnHits);
+	//The box the segment enters first (the lowest index on ties), -1 for none, and where as a fraction of the
+	//segment. pnBoxes: only these boxes (NULL: all).
+	int IntersectSegment(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, int *pnBoxes, int nBoxes, float *pfHit);
+};
+
+#ifdef _WITH_BOX_BATCH_BENCHMARK
+//nQueries random boxes and segments against nBoxes random boxes: the batch kernels against the scalar reference and
+//DirectXCollision (mismatches), and the pairs tested per second by each; returns the mismatches against the scalar
+//reference (DirectXCollision differs on touching boxes and is only reported)
+int BenchmarkBoxBatch(
+int nBoxes, int nQueries);
+#endif
@@ -0,0 +1,238 @@
+//-----------------------------------------------------------------------------
+// File: BulletPool.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "BulletPool.h"
+#include "Object.h"
+
+CBulletPool::CBulletPool(int nCapacity)
+{
+	m_nCapacity = nCapacity;
+	m_pxmf3Positions = new XMFLOAT3[nCapacity];
+	m_pxmf3Velocities = new XMFLOAT3[nCapacity];
+	m_pxmf4Rotations = new XMFLOAT4[nCapacity];
+	m_pfLifetimes = new float[nCapacity];
+}
+
+CBulletPool::~CBulletPool()
+{
+	if (m_pxmf3Positions) delete[] m_pxmf3Positions;
+	if (m_pxmf3Velocities) delete[] m_pxmf3Velocities;
+	if (m_pxmf4Rotations) delete[] m_pxmf4Rotations;
+	if (m_pfLifetimes) delete[] m_pfLifetimes;
+}
+
+bool CBulletPool::Spawn(XMFLOAT4X4 *pxmf4x4Transform, float fSpeed, float fLifetime)
+{
+	if (m_nBullets >= m_nCapacity) return(false);
+
+	int i = m_nBullets++;
+	m_pxmf3Positions[i] = XMFLOAT3(pxmf4x4Transform->_41, pxmf4x4Transform->_42, pxmf4x4Transform->_43);
+	XMVECTOR xmvLook = XMVector3Normalize(XMVectorSet(pxmf4x4Transform->_31, pxmf4x4Transform->_32, pxmf4x4Transform->_33, 0.0f));
+	XMStoreFloat3(&m_pxmf3Velocities[i], XMVectorScale(xmvLook, fSpeed));
+	XMStoreFloat4(&m_pxmf4Rotations[i], XMQuaternionRotationMatrix(XMLoadFloat4x4(pxmf4x4Transform)));
+	m_pfLifetimes[i] = fLifetime;
+
+	return(true);
+}
+
+void CBulletPool::Despawn(int nBullet)
+{
+	int nLast = --m_nBullets;
+	if (nBullet == nLast) return;
+
+	m_pxmf3Positions[nBullet] = m_pxmf3Positions[nLast];
+	m_pxmf3Velocities[nBullet] = m_pxmf3Velocities[nLast];
+	m_pxmf4Rotations[nBullet] = m_pxmf4Rotations[nLast];
+	m_pfLifetimes[nBullet] = m_pfLifetimes[nLast];
+}
+
+void CBulletPool::Move(float fTimeElapsed)
+{
+	//Positions and velocities as flat float arrays: one loop the compiler vectorizes
+	float *pfPositions = &m_pxmf3Positions[0].x, *pfVelocities = &m_pxmf3Velocities[0].x;
+	for (int i = 0; i < m_nBullets * 3; i++) pfPositions[i] += pfVelocities[i] * fTimeElapsed;
+
+	//Backwards: the bullet Despawn moves into slot i has already been visited
+	for (int i = m_nBullets - 1; i >= 0; i--)
+	{
+		m_pfLifetimes[i] -= fTimeElapsed;
+		if (m_pfLifetimes[i] <= 0.0f) Despawn(i);
+	}
+}
+
+void CBulletPool::GetWorldTransform(int nBullet, XMFLOAT4X4 *pxmf4x4World, float fTimeBehind)
+{
+	XMMATRIX xmmtxWorld = XMMatrixRotationQuaternion(XMLoadFloat4(&m_pxmf4Rotations[nBullet]));
+	XMVECTOR xmvPosition = XMLoadFloat3(&m_pxmf3Positions[nBullet]) - XMLoadFloat3(&m_pxmf3Velocities[nBullet]) * fTimeBehind;
+	xmmtxWorld.r[3] = XMVectorSetW(xmvPosition, 1.0f);
+	XMStoreFloat4x4(pxmf4x4World, xmmtxWorld);
+}
+
+void CBulletPool::Render(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, CGameObject *pModel, float fTimeBehind)
+{
+	XMFLOAT4X4 xmf4x4Bullet, xmf4x4World;
+	for (int i = 0; i < m_nBullets; i++)
+	{
+		GetWorldTransform(i, &xmf4x4Bullet, fTimeBehind);
+		xmf4x4World = Matrix4x4::Multiply(pModel->m_xmf4x4Transform, xmf4x4Bullet);
+		pModel->RenderFrame(pd3dCommandList, pCamera, &xmf4x4World);
+	}
+}
+
+#ifdef _WITH_BULLET_POOL_BENCHMARK
+#include <list>
+#ifdef _DEBUG
+#include <crtdbg.h>
+#endif
+
+#define BENCHMARK_BULLET_SPEED			100.0f
+#define BENCHMARK_BULLET_LIFETIME		3.0f
+#define BENCHMARK_BULLET_TARGETS		6
+
+static long gnBenchmarkAllocations = 0;
+
+#ifdef _DEBUG
+static int BenchmarkAllocHook(int nAllocType, void *pvData, size_t nSize, int nBlockUse, long lRequest, const unsigned char *pstrFileName, int nLine)
+{
+	if (nAllocType != _HOOK_FREE) gnBenchmarkAllocations++;
+	return(TRUE);
+}
+#endif
+
+//Gun above the middle of a 900 x 900 ground, fired in random directions 2 to 30 degrees below the horizon
+static void GetBenchmarkGunTransform(UINT *pnRandom, XMFLOAT4X4 *pxmf4x4Transform)
+{
+	*pnRandom = *pnRandom * 1664525 + 1013904223;
+	float fYaw = XM_2PI * ((*pnRandom >> 8) / float(1 << 24));
+	*pnRandom = *pnRandom * 1664525 + 1013904223;
+	float fPitch = XMConvertToRadians(2.0f + 28.0f * ((*pnRandom >> 8) / float(1 << 24)));
+	XMStoreFloat4x4(pxmf4x4Transform, XMMatrixRotationRollPitchYaw(fPitch, fYaw, 0.0f));
+	pxmf4x4Transform->_41 = 450.0f;
+	pxmf4x4Transform->_42 = 50.0f;
+	pxmf4x4Transform->_43 = 450.0f;
+}
+
+//The checks of CGameScene::BulletCollision against a flat ground
+static bool BenchmarkBulletCollision(XMFLOAT3& xmf3Position, BoundingOrientedBox *pxmTargets)
+{
+	if (xmf3Position.y < 0.0f) return(true);
+	if ((xmf3Position.x < 0.0f) || (xmf3Position.x > 900.0f) || (xmf3Position.z < 0.0f) || (xmf3Position.z > 900.0f)) return(true);
+
+	BoundingOrientedBox xmBulletBox(xmf3Position, XMFLOAT3(0.4f, 0.4f, 1.0f), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+	for (int i = 0; i < BENCHMARK_BULLET_TARGETS; i++)
+	{
+		if (xmBulletBox.Intersects(pxmTargets[i])) return(true);
+	}
+	return(false);
+}
+
+struct BENCHMARKBULLET
+{
+	CGameObject						*m_pObject;
+	float							m_fLifetime;
+};
+
+int BenchmarkBulletPool(int nSpawnsPerFrame, int nFrames)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+	float fTimeElapsed = 1.0f / 60.0f;
+
+	BoundingOrientedBox pxmTargets[BENCHMARK_BULLET_TARGETS];
+	for (int i = 0; i < BENCHMARK_BULLET_TARGETS; i++) pxmTargets[i] = BoundingOrientedBox(XMFLOAT3(250.0f + 80.0f * i, 10.0f, 600.0f), XMFLOAT3(8.0f, 3.0f, 10.0f), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+
+	XMFLOAT4X4 xmf4x4Gun;
+	UINT nRandom;
+	int nPoolPeak = 0, nPoolFailed = 0;
+	long nPoolAllocations = -1;
+
+	CBulletPool *pPool = new CBulletPool(BULLET_POOL_CAPACITY);
+	gnBenchmarkAllocations = 0;
+#ifdef _DEBUG
+	_CRT_ALLOC_HOOK pfnPrevHook = _CrtSetAllocHook(::BenchmarkAllocHook);
+#endif
+	nRandom = 1;
+	::QueryPerformanceCounter(&nBegin);
+	for (int f = 0; f < nFrames; f++)
+	{
+		for (int i = 0; i < nSpawnsPerFrame; i++)
+		{
+			::GetBenchmarkGunTransform(&nRandom, &xmf4x4Gun);
+			if (!pPool->Spawn(&xmf4x4Gun, BENCHMARK_BULLET_SPEED, BENCHMARK_BULLET_LIFETIME)) nPoolFailed++;
+		}
+		pPool->Move(fTimeElapsed);
+		for (int i = pPool->GetBullets() - 1; i >= 0; i--)
+		{
+			if (::BenchmarkBulletCollision(*pPool->GetPosition(i), pxmTargets)) pPool->Despawn(i);
+		}
+		if (pPool->GetBullets() > nPoolPeak) nPoolPeak = pPool->GetBullets();
+	}
+	::QueryPerformanceCounter(&nEnd);
+#ifdef _DEBUG
+	_CrtSetAllocHook(pfnPrevHook);
+	nPoolAllocations = gnBenchmarkAllocations;
+#endif
+	double fPoolSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+	delete pPool;
+
+	//The old storage: a CBullet (here a plain CGameObject) per bullet holding the model by reference, moved with
+	//MoveForward and UpdateTransform
+	CGameObject *pModel = new CGameObject();
+	pModel->AddRef();
+	std::list<BENCHMARKBULLET> xBullets;
+	int nListPeak = 0;
+	long nListAllocations = -1;
+
+	gnBenchmarkAllocations = 0;
+#ifdef _DEBUG
+	pfnPrevHook = _CrtSetAllocHook(::BenchmarkAllocHook);
+#endif
+	nRandom = 1;
+	::QueryPerformanceCounter(&nBegin);
+	for (int f = 0; f < nFrames; f++)
+	{
+		for (int i = 0; i < nSpawnsPerFrame; i++)
+		{
+			::GetBenchmarkGunTransform(&nRandom, &xmf4x4Gun);
+			CGameObject *pBullet = new CGameObject();
+			pBullet->SetChild(pModel, true);
+			pBullet->m_xmf4x4Transform = xmf4x4Gun;
+			pBullet->UpdateTransform(NULL);
+			xBullets.push_back({ pBullet, BENCHMARK_BULLET_LIFETIME });
+		}
+		for (std::list<BENCHMARKBULLET>::iterator iter = xBullets.begin(); iter != xBullets.end(); )
+		{
+			iter->m_pObject->MoveForward(fTimeElapsed * BENCHMARK_BULLET_SPEED);
+			iter->m_pObject->UpdateTransform(NULL);
+			iter->m_fLifetime -= fTimeElapsed;
+			XMFLOAT3 xmf3Position = iter->m_pObject->GetPosition();
+			if ((iter->m_fLifetime <= 0.0f) || ::BenchmarkBulletCollision(xmf3Position, pxmTargets))
+			{
+				iter->m_pObject->Release();
+				iter = xBullets.erase(iter);
+			}
+			else
+				iter++;
+		}
+		if (int(xBullets.size()) > nListPeak) nListPeak = int(xBullets.size());
+	}
+	::QueryPerformanceCounter(&nEnd);
+#ifdef _DEBUG
+	_CrtSetAllocHook(pfnPrevHook);
+	nListAllocations = gnBenchmarkAllocations;
+#endif
+	double fListSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+	for (auto& xBullet : xBullets) xBullet.m_pObject->Release();
+	pModel->Release();
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Bullet pool: %d spawns per frame for %d frames, peak %d live bullets (%d spawns failed), %.3f ms per frame, %ld allocations during the frames\n"), nSpawnsPerFrame, nFrames, nPoolPeak, nPoolFailed, fPoolSeconds * 1.0e3 / nFrames, nPoolAllocations);
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    list of objects: peak %d live bullets, %.3f ms per frame, %ld allocations during the frames (-1: release build, not counted)\n"), nListPeak, fListSeconds * 1.0e3 / nFrames, nListAllocations);
+	OutputDebugString(pstrDebug);
+
+	return((nPoolAllocations > 0) ? 1 : 0);
+}
+#endif
@@ -0,0 +1,66 @@
+//-----------------------------------------------------------------------------
+// File: BulletPool.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+class CGameObject;
+class CCamera;
+
+//Fixed-capacity bullet storage of the game scene. Every bullet is one slot in the position, velocity, rotation and
+//lifetime arrays, all allocated once by the constructor. The live bullets are always the first m_nBullets slots:
+//Spawn appends one and Despawn moves the last one into the freed slot, so both are O(1) and a frame never
+//allocates. The order of the bullets therefore changes on every despawn; loops that despawn run backwards.
+//The bullets have no CGameObject of their own: one shared model is drawn at each of them (Render).
+
+#define BULLET_POOL_CAPACITY			65536
+#define BULLET_SPEED					100.0f
+#define BULLET_LIFETIME					15.0f //Seconds; longer than any flight across the 900 x 900 terrain
+#define BULLET_EXTENTS					XMFLOAT3(0.4f, 0.4f, 1.0f) //Half extents of the bullet box
+//Radius of the sphere around the bullet box (|BULLET_EXTENTS|, rounded up): a box grown by it on every axis holds the
+//bullet box in any orientation, so the villain boxes are grown by it for the swept test and the grid
+#define BULLET_BOUNDING_RADIUS			1.15f
+
+class CBulletPool
+{
+public:
+	CBulletPool(int nCapacity);
+	virtual ~CBulletPool();
+
+private:
+	int								m_nCapacity = 0;
+	int								m_nBullets = 0;
+	XMFLOAT3						*m_pxmf3Positions = NULL;
+	XMFLOAT3						*m_pxmf3Velocities = NULL;
+	XMFLOAT4						*m_pxmf4Rotations = NULL; //Quaternions, only for drawing
+	float							*m_pfLifetimes = NULL; //Seconds left
+
+public:
+	int GetCapacity() { return(m_nCapacity); }
+	int GetBullets() { return(m_nBullets); }
+	XMFLOAT3 *GetPosition(int nBullet) { return(&m_pxmf3Positions[nBullet]); }
+	XMFLOAT3 *GetVelocity(int nBullet) { return(&m_pxmf3Velocities[nBullet]); }
+
+	//A bullet at the position and flying along the look vector of the (orthonormal) transform; false when the pool is full
+	bool Spawn(XMFLOAT4X4 *pxmf4x4Transform, float fSpeed, float fLifetime);
+	void Despawn(int nBullet);
+	void Clear() { m_nBullets = 0; }
+
+	//Moves every bullet and despawns the ones whose lifetime has run out
+	void Move(float fTimeElapsed);
+
+	//fTimeBehind: seconds back along the velocity (the render interpolation of the fixed timestep)
+	void GetWorldTransform(int nBullet, XMFLOAT4X4 *pxmf4x4World, float fTimeBehind=0.0f);
+	//Draws pModel (its own transform relative to the bullet) at every bullet
+	void Render(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, CGameObject *pModel, float fTimeBehind=0.0f);
+};
+
+#ifdef _WITH_BULLET_POOL_BENCHMARK
+//Headless stress test: nSpawnsPerFrame bullets fired every frame from a gun above a flat ground for nFrames frames,
+//despawned on the ground, outside the bounds or at the end of their lifetime. The pool against the old storage
+//(one CGameObject per bullet with the model attached by reference, in a std::list); reports the frame times,
+//the live bullets and the heap allocations counted during the frames (debug CRT only). Returns 1 when the pool
+//allocated during the frames.
+int BenchmarkBulletPool(
+int nSpawnsPerFrame, int nFrames);
+#endif
@@ -0,0 +1,434 @@
+//-----------------------------------------------------------------------------
+// File: CollisionGrid.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "CollisionGrid.h"
+#include <cfloat>
+
+CCollisionGrid::CCollisionGrid(float fMinX, float fMinZ, float fWidth, float fDepth, float fCellSize)
+{
+	m_fMinX = fMinX;
+	m_fMinZ = fMinZ;
+	m_fInverseCellSize = 1.0f / fCellSize;
+	m_nCellsX = max(1, int(ceilf(fWidth / fCellSize)));
+	m_nCellsZ = max(1, int(ceilf(fDepth / fCellSize)));
+
+	int nCells = m_nCellsX * m_nCellsZ;
+	m_pnCellStarts = new int[nCells + 1];
+	memset(m_pnCellStarts, 0, sizeof(int) * (nCells + 1));
+	m_pnCellCursors = new int[nCells];
+}
+
+CCollisionGrid::~CCollisionGrid()
+{
+	if (m_pnCellStarts) delete[] m_pnCellStarts;
+	if (m_pnCellCursors) delete[] m_pnCellCursors;
+	if (m_pnItems) delete[] m_pnItems;
+	if (m_pnBoxCells) delete[] m_pnBoxCells;
+	if (m_pnCandidates) delete[] m_pnCandidates;
+	if (m_pnBoxQueries) delete[] m_pnBoxQueries;
+}
+
+int CCollisionGrid::GetCellX(float x)
+{
+	int nCell = int(floorf((x - m_fMinX) * m_fInverseCellSize));
+	return((nCell < 0) ? 0 : ((nCell >= m_nCellsX) ? (m_nCellsX - 1) : nCell));
+}
+
+int CCollisionGrid::GetCellZ(float z)
+{
+	int nCell = int(floorf((z - m_fMinZ) * m_fInverseCellSize));
+	return((nCell < 0) ? 0 : ((nCell >= m_nCellsZ) ? (m_nCellsZ - 1) : nCell));
+}
+
+void CCollisionGrid::Build(BoundingOrientedBox *pxmBoxes, int nBoxes, float fMargin)
+{
+	int nCells = m_nCellsX * m_nCellsZ;
+	if (nBoxes > m_nMaxBoxes)
+	{
+		if (m_pnBoxCells) delete[] m_pnBoxCells;
+		if (m_pnCandidates) delete[] m_pnCandidates;
+		if (m_pnBoxQueries) delete[] m_pnBoxQueries;
+		m_nMaxBoxes = nBoxes;
+		m_pnBoxCells = new int[nBoxes * 4];
+		m_pnCandidates = new int[nBoxes];
+		m_pnBoxQueries = new UINT[nBoxes];
+		memset(m_pnBoxQueries, 0, sizeof(UINT) * nBoxes);
+		m_nQueries = 0;
+	}
+
+	//Count the boxes of every cell
+	memset(m_pnCellStarts, 0, sizeof(int) * (nCells + 1));
+	XMFLOAT3 pxmf3Corners[BoundingOrientedBox::CORNER_COUNT];
+	for (int i = 0; i < nBoxes; i++)
+	{
+		pxmBoxes[i].GetCorners(pxmf3Corners);
+		float fMinX = FLT_MAX, fMaxX = -FLT_MAX, fMinZ = FLT_MAX, fMaxZ = -FLT_MAX;
+		for (int j = 0; j < BoundingOrientedBox::CORNER_COUNT; j++)
+		{
+			fMinX = min(fMinX, pxmf3Corners[j].x);
+			fMaxX = max(fMaxX, pxmf3Corners[j].x);
+			fMinZ = min(fMinZ, pxmf3Corners[j].z);
+			fMaxZ = max(fMaxZ, pxmf3Corners[j].z);
+		}
+		int *pnBoxCells = &m_pnBoxCells[i * 4];
+		pnBoxCells[0] = GetCellX(fMinX - fMargin);
+		pnBoxCells[1] = GetCellX(fMaxX + fMargin);
+		pnBoxCells[2] = GetCellZ(fMinZ - fMargin);
+		pnBoxCells[3] = GetCellZ(fMaxZ + fMargin);
+		for (int z = pnBoxCells[2]; z <= pnBoxCells[3]; z++)
+		{
+			for (int x = pnBoxCells[0]; x <= pnBoxCells[1]; x++) m_pnCellStarts[z * m_nCellsX + x]++;
+		}
+	}
+
+	//Counts to starts
+	int nItems = 0;
+	for (int i = 0; i < nCells; i++)
+	{
+		int nCount = m_pnCellStarts[i];
+		m_pnCellStarts[i] = m_pnCellCursors[i] = nItems;
+		nItems += nCount;
+	}
+	m_pnCellStarts[nCells] = nItems;
+
+	if (nItems > m_nMaxItems)
+	{
+		if (m_pnItems) delete[] m_pnItems;
+		m_nMaxItems = nItems + (nItems / 2);
+		m_pnItems = new int[m_nMaxItems];
+	}
+
+	//In box order, so every cell lists its boxes in ascending order
+	for (int i = 0; i < nBoxes; i++)
+	{
+		int *pnBoxCells = &m_pnBoxCells[i * 4];
+		for (int z = pnBoxCells[2]; z <= pnBoxCells[3]; z++)
+		{
+			for (int x = pnBoxCells[0]; x <= pnBoxCells[1]; x++) m_pnItems[m_pnCellCursors[z * m_nCellsX + x]++] = i;
+		}
+	}
+}
+
+int *CCollisionGrid::GetCandidates(XMFLOAT3& xmf3Position, int *pnCandidates)
+{
+	int nCell = GetCellZ(xmf3Position.z) * m_nCellsX + GetCellX(xmf3Position.x);
+	*pnCandidates = m_pnCellStarts[nCell + 1] - m_pnCellStarts[nCell];
+	return(m_pnItems + m_pnCellStarts[nCell]);
+}
+
+int *CCollisionGrid::GetCandidates(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, int *pnCandidates)
+{
+	int nMinX = GetCellX(min(xmf3Start.x, xmf3End.x)), nMaxX = GetCellX(max(xmf3Start.x, xmf3End.x));
+	int nMinZ = GetCellZ(min(xmf3Start.z, xmf3End.z)), nMaxZ = GetCellZ(max(xmf3Start.z, xmf3End.z));
+	//A bullet step is short against a cell: most segments stay in one
+	if ((nMinX == nMaxX) && (nMinZ == nMaxZ)) return(GetCandidates(xmf3Start, pnCandidates));
+
+	//A box overlapping several of the cells is listed once
+	if (++m_nQueries == 0)
+	{
+		memset(m_pnBoxQueries, 0, sizeof(UINT) * m_nMaxBoxes);
+		m_nQueries = 1;
+	}
+	int nCandidates = 0;
+	for (int z = nMinZ; z <= nMaxZ; z++)
+	{
+		for (int x = nMinX; x <= nMaxX; x++)
+		{
+			int nCell = z * m_nCellsX + x;
+			for (int i = m_pnCellStarts[nCell]; i < m_pnCellStarts[nCell + 1]; i++)
+			{
+				int nBox = m_pnItems[i];
+				if (m_pnBoxQueries[nBox] == m_nQueries) continue;
+				m_pnBoxQueries[nBox] = m_nQueries;
+
+				//Insertion keeps the result ascending; a handful of boxes at most
+				int j = nCandidates++;
+				for ( ; (j > 0) && (m_pnCandidates[j - 1] > nBox); j--) m_pnCandidates[j] = m_pnCandidates[j - 1];
+				m_pnCandidates[j] = nBox;
+			}
+		}
+	}
+	*pnCandidates = nCandidates;
+	return(m_pnCandidates);
+}
+
+bool IntersectSegmentBox(BoundingOrientedBox& xmBox, XMFLOAT3& xmf3Margin, XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, float *pfHit)
+{
+	BoundingOrientedBox xmGrownBox = xmBox;
+	xmGrownBox.Extents = Vector3::Add(xmBox.Extents, xmf3Margin);
+
+	XMVECTOR xmvStart = XMLoadFloat3(&xmf3Start);
+	XMVECTOR xmvDelta = XMVectorSubtract(XMLoadFloat3(&xmf3End), xmvStart);
+	float fLength = XMVectorGetX(XMVector3Length(xmvDelta));
+	if (fLength < 1.0e-6f)
+	{
+		*pfHit = 0.0f;
+		return(xmGrownBox.Contains(xmvStart) != DISJOINT);
+	}
+
+	//The distance is negative when the segment starts inside the box
+	float fDistance;
+	if (!xmGrownBox.Intersects(xmvStart, XMVectorScale(xmvDelta, 1.0f / fLength), fDistance) || (fDistance > fLength)) return(false);
+	*pfHit = max(fDistance, 0.0f) / fLength;
+	return(true);
+}
+
+#if defined(_WITH_COLLISION_GRID_BENCHMARK) || defined(_WITH_SWEPT_COLLISION_BENCHMARK)
+static float RandomBenchmarkValue(UINT *pnRandom, float fMin, float fMax)
+{
+	*pnRandom = *pnRandom * 1664525 + 1013904223;
+	return(fMin + (fMax - fMin) * ((*pnRandom >> 8) / float(1 << 24)));
+}
+#endif
+
+#ifdef _WITH_COLLISION_GRID_BENCHMARK
+int BenchmarkCollisionGrid(int nBullets, int nVillains, int nRepeats)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	//Villains as in the scene (40 x 40 x 40 boxes) but with random yaw; bullets near the villains' heights
+	UINT nRandom = 1;
+	BoundingOrientedBox *pxmVillains = new BoundingOrientedBox[nVillains];
+	for (int i = 0; i < nVillains; i++)
+	{
+		XMFLOAT4 xmf4Rotation;
+		XMStoreFloat4(&xmf4Rotation, XMQuaternionRotationRollPitchYaw(0.0f, ::RandomBenchmarkValue(&nRandom, 0.0f, XM_2PI), 0.0f));
+		pxmVillains[i] = BoundingOrientedBox(XMFLOAT3(::RandomBenchmarkValue(&nRandom, 0.0f, 900.0f), ::RandomBenchmarkValue(&nRandom, 100.0f, 200.0f), ::RandomBenchmarkValue(&nRandom, 0.0f, 900.0f)), XMFLOAT3(20.0f, 20.0f, 20.0f), xmf4Rotation);
+	}
+	BoundingOrientedBox *pxmBullets = new BoundingOrientedBox[nBullets];
+	for (int i = 0; i < nBullets; i++)
+	{
+		pxmBullets[i] = BoundingOrientedBox(XMFLOAT3(::RandomBenchmarkValue(&nRandom, 0.0f, 900.0f), ::RandomBenchmarkValue(&nRandom, 100.0f, 200.0f), ::RandomBenchmarkValue(&nRandom, 0.0f, 900.0f)), XMFLOAT3(0.4f, 0.4f, 1.0f), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+	}
+
+	//All pairs, the old BulletCollision, on every nSampleStep-th bullet
+	int nSampleStep = max(1, int(((long long)nBullets * nVillains) / 5000000));
+	int *pnBruteHits = new int[nBullets];
+	::QueryPerformanceCounter(&nBegin);
+	for (int i = 0; i < nBullets; i += nSampleStep)
+	{
+		pnBruteHits[i] = -1;
+		for (int j = 0; j < nVillains; j++)
+		{
+			if (pxmBullets[i].Intersects(pxmVillains[j]))
+			{
+				pnBruteHits[i] = j;
+				break;
+			}
+		}
+	}
+	::QueryPerformanceCounter(&nEnd);
+	double fBruteSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart) * nSampleStep;
+
+	CCollisionGrid *pGrid = new CCollisionGrid(0.0f, 0.0f, 900.0f, 900.0f, COLLISION_GRID_CELL_SIZE);
+	int *pnGridHits = new int[nBullets];
+	long long nCandidates = 0;
+	::QueryPerformanceCounter(&nBegin);
+	for (int r = 0; r < nRepeats; r++)
+	{
+		pGrid->Build(pxmVillains, nVillains, 1.0f);
+		for (int i = 0; i < nBullets; i++)
+		{
+			int nCellBoxes, *pnCellBoxes = pGrid->GetCandidates(pxmBullets[i].Center, &nCellBoxes);
+			pnGridHits[i] = -1;
+			for (int j = 0; j < nCellBoxes; j++)
+			{
+				if (pxmBullets[i].Intersects(pxmVillains[pnCellBoxes[j]]))
+				{
+					pnGridHits[i] = pnCellBoxes[j];
+					break;
+				}
+			}
+			nCandidates += nCellBoxes;
+		}
+	}
+	::QueryPerformanceCounter(&nEnd);
+	double fGridSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart) / nRepeats;
+
+	::QueryPerformanceCounter(&nBegin);
+	for (int r = 0; r < nRepeats; r++) pGrid->Build(pxmVillains, nVillains, 1.0f);
+	::QueryPerformanceCounter(&nEnd);
+	double fBuildSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart) / nRepeats;
+
+	int nMismatches = 0, nHits = 0;
+	for (int i = 0; i < nBullets; i += nSampleStep)
+	{
+		if (pnBruteHits[i] != pnGridHits[i]) nMismatches++;
+		if (pnGridHits[i] >= 0) nHits++;
+	}
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Collision grid: %d bullets x %d villains, %d x %d cells, %d cell entries, %.1f candidates per bullet\n"), nBullets, nVillains, int(ceilf(900.0f / COLLISION_GRID_CELL_SIZE)), int(ceilf(900.0f / COLLISION_GRID_CELL_SIZE)), pGrid->GetItems(), double(nCandidates) / (double(nBullets) * nRepeats));
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    all pairs %.2f ms (1 in %d bullets sampled), grid %.3f ms per frame (build %.3f ms), %d hits and %d mismatches in the sample\n"), fBruteSeconds * 1.0e3, nSampleStep, fGridSeconds * 1.0e3, fBuildSeconds * 1.0e3, nHits, nMismatches);
+	OutputDebugString(pstrDebug);
+
+	delete pGrid;
+	delete[] pnBruteHits;
+	delete[] pnGridHits;
+	delete[] pxmVillains;
+	delete[] pxmBullets;
+
+	return(nMismatches);
+}
+#endif
+
+#ifdef _WITH_SWEPT_COLLISION_BENCHMARK
+#include "Mesh.h"
+#include "BulletPool.h"
+
+#define SWEPT_BENCHMARK_SAMPLES			1024
+#define SWEPT_BENCHMARK_TOLERANCE		1.0e-3f //Depth a sample needs to count as a hit (grazing segments differ by rounding)
+
+struct SWEPTBENCHMARKREPORT
+{
+	int								m_nSweptHits = 0;
+	int								m_nEndPointHits = 0;
+	int								m_nTunneled = 0; //Swept hits the end point test misses
+	int								m_nErrors = 0; //Swept result not matching the sampled segment
+	double							m_fSweptSeconds = 0.0;
+	double							m_fEndPointSeconds = 0.0;
+};
+
+static void RandomBenchmarkSegment(UINT *pnRandom, XMFLOAT3& xmf3Start, float fLength, float fMinPitch, float fMaxPitch, XMFLOAT3 *pxmf3End)
+{
+	float fYaw = ::RandomBenchmarkValue(pnRandom, 0.0f, XM_2PI), fPitch = XMConvertToRadians(::RandomBenchmarkValue(pnRandom, fMinPitch, fMaxPitch));
+	pxmf3End->x = xmf3Start.x + fLength * cosf(fPitch) * sinf(fYaw);
+	pxmf3End->y = xmf3Start.y - fLength * sinf(fPitch);
+	pxmf3End->z = xmf3Start.z + fLength * cosf(fPitch) * cosf(fYaw);
+}
+
+static float GetBenchmarkTerrainHeight(CHeightMapImage *pHeightMapImage, XMFLOAT3& xmf3Position)
+{
+	return(pHeightMapImage->GetHeight(xmf3Position.x, xmf3Position.z) * pHeightMapImage->GetScale().y);
+}
+
+int BenchmarkSweptCollision(LPCTSTR pstrHeightMapFileName, int nSegments, float fStepsPerSecond)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	//The scene's terrain and villain box, bullet steps at the scene's bullet speed. The terrain steps stay on the quads
+	//of the height map (GetHeight reads past the last row and column).
+	CHeightMapImage *pHeightMapImage = new CHeightMapImage(pstrHeightMapFileName, 257, 257, XMFLOAT3(4.0f, 6.0f, 4.0f));
+	float fTerrainWidth = 256.0f * 4.0f, fStep = BULLET_SPEED / fStepsPerSecond;
+	BoundingOrientedBox xmVillainBox(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(20.0f, 20.0f, 20.0f), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+	XMFLOAT3 xmf3BulletExtents(0.4f, 0.4f, 1.0f);
+
+	XMFLOAT3 *pxmf3Starts = new XMFLOAT3[nSegments], *pxmf3Ends = new XMFLOAT3[nSegments];
+	bool *pbHits = new bool[nSegments];
+	float *pfHits = new float[nSegments];
+	SWEPTBENCHMARKREPORT pxReports[2];
+	UINT nRandom = 1;
+
+	for (int k = 0; k < 2; k++)
+	{
+		SWEPTBENCHMARKREPORT *pxReport = &pxReports[k];
+		//k = 0: steps a little above the terrain, mostly downwards; k = 1: steps around the villain box
+		for (int i = 0; i < nSegments; i++)
+		{
+			if (k == 0)
+			{
+				pxmf3Starts[i] = XMFLOAT3(::RandomBenchmarkValue(&nRandom, fStep, fTerrainWidth - fStep), 0.0f, ::RandomBenchmarkValue(&nRandom, fStep, fTerrainWidth - fStep));
+				pxmf3Starts[i].y = ::GetBenchmarkTerrainHeight(pHeightMapImage, pxmf3Starts[i]) + ::RandomBenchmarkValue(&nRandom, 0.0f, 10.0f);
+				::RandomBenchmarkSegment(&nRandom, pxmf3Starts[i], fStep, -10.0f, 30.0f, &pxmf3Ends[i]);
+			}
+			else
+			{
+				pxmf3Starts[i] = XMFLOAT3(::RandomBenchmarkValue(&nRandom, -25.0f, 25.0f), ::RandomBenchmarkValue(&nRandom, -25.0f, 25.0f), ::RandomBenchmarkValue(&nRandom, -25.0f, 25.0f));
+				if (xmVillainBox.Contains(XMLoadFloat3(&pxmf3Starts[i])) != DISJOINT) pxmf3Starts[i].y = 22.0f; //Start outside of the box
+				::RandomBenchmarkSegment(&nRandom, pxmf3Starts[i], fStep, -90.0f, 90.0f, &pxmf3Ends[i]);
+			}
+		}
+
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nSegments; i++)
+		{
+			if (k == 0)
+				pbHits[i] = pHeightMapImage->IntersectSegment(pxmf3Starts[i], pxmf3Ends[i], &pfHits[i]);
+			else
+				pbHits[i] = ::IntersectSegmentBox(xmVillainBox, xmf3BulletExtents, pxmf3Starts[i], pxmf3Ends[i], &pfHits[i]);
+		}
+		::QueryPerformanceCounter(&nEnd);
+		pxReport->m_fSweptSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		//The old BulletCollision: only the box at the end of the step
+		int nEndPointHits = 0;
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nSegments; i++)
+		{
+			if (k == 0)
+				nEndPointHits += (::GetBenchmarkTerrainHeight(pHeightMapImage, pxmf3Ends[i]) > pxmf3Ends[i].y) ? 1 : 0;
+			else
+				nEndPointHits += BoundingOrientedBox(pxmf3Ends[i], xmf3BulletExtents, XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f)).Intersects(xmVillainBox) ? 1 : 0;
+		}
+		::QueryPerformanceCounter(&nEnd);
+		pxReport->m_fEndPointSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+		pxReport->m_nEndPointHits = nEndPointHits;
+
+		//Against SWEPT_BENCHMARK_SAMPLES + 1 points on every segment: a sampled hit must not come before the swept one
+		//and a swept hit the samples miss has to lie on the surface
+		XMFLOAT3 xmf3Tolerance(SWEPT_BENCHMARK_TOLERANCE, SWEPT_BENCHMARK_TOLERANCE, SWEPT_BENCHMARK_TOLERANCE);
+		BoundingOrientedBox xmSampleBox = xmVillainBox, xmSurfaceBox = xmVillainBox;
+		xmSampleBox.Extents = Vector3::Add(xmVillainBox.Extents, xmf3BulletExtents);
+		xmSurfaceBox.Extents = Vector3::Add(xmSampleBox.Extents, xmf3Tolerance);
+		xmSampleBox.Extents = Vector3::Add(xmSampleBox.Extents, xmf3Tolerance, -1.0f);
+		for (int i = 0; i < nSegments; i++)
+		{
+			XMFLOAT3 xmf3Delta = Vector3::Subtract(pxmf3Ends[i], pxmf3Starts[i]);
+			float tSampled = -1.0f;
+			for (int j = 0; (j <= SWEPT_BENCHMARK_SAMPLES) && (tSampled < 0.0f); j++)
+			{
+				float t = j / float(SWEPT_BENCHMARK_SAMPLES);
+				XMFLOAT3 xmf3Point = Vector3::Add(pxmf3Starts[i], xmf3Delta, t);
+				bool bInside = (k == 0) ? (::GetBenchmarkTerrainHeight(pHeightMapImage, xmf3Point) > xmf3Point.y + SWEPT_BENCHMARK_TOLERANCE) : (xmSampleBox.Contains(XMLoadFloat3(&xmf3Point)) != DISJOINT);
+				if (bInside) tSampled = t;
+			}
+			if (pbHits[i])
+			{
+				pxReport->m_nSweptHits++;
+				XMFLOAT3 xmf3Hit = Vector3::Add(pxmf3Starts[i], xmf3Delta, pfHits[i]);
+				if (k == 0)
+				{
+					if ((tSampled >= 0.0f) ? (pfHits[i] > tSampled + 1.0e-4f) : (fabsf(::GetBenchmarkTerrainHeight(pHeightMapImage, xmf3Hit) - xmf3Hit.y) > 1.0e-2f)) pxReport->m_nErrors++;
+				}
+				else
+				{
+					if ((tSampled >= 0.0f) ? (pfHits[i] > tSampled + 1.0e-4f) : (xmSurfaceBox.Contains(XMLoadFloat3(&xmf3Hit)) == DISJOINT)) pxReport->m_nErrors++;
+				}
+				XMFLOAT3 xmf3End = pxmf3Ends[i];
+				bool bEndPointHit = (k == 0) ? (::GetBenchmarkTerrainHeight(pHeightMapImage, xmf3End) > xmf3End.y) : BoundingOrientedBox(xmf3End, xmf3BulletExtents, XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f)).Intersects(xmVillainBox);
+				if (!bEndPointHit) pxReport->m_nTunneled++;
+			}
+			else if (tSampled >= 0.0f)
+			{
+				pxReport->m_nErrors++;
+			}
+		}
+	}
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Swept collision: %d bullet steps of %.1f units (%.0f steps per second)\n"), nSegments, fStep, fStepsPerSecond);
+	OutputDebugString(pstrDebug);
+	int nErrors = 0;
+	for (int k = 0; k < 2; k++)
+	{
+		SWEPTBENCHMARKREPORT *pxReport = &pxReports[k];
+		nErrors += pxReport->m_nErrors;
+		_stprintf_s(pstrDebug, 256, _T("    %s: %d swept hits (%d missed by the end point test, which found %d), %d errors, %.1f ns per swept test, %.1f ns per end point test\n"), (k == 0) ? _T("terrain") : _T("villain box"), pxReport->m_nSweptHits, pxReport->m_nTunneled, pxReport->m_nEndPointHits, pxReport->m_nErrors, pxReport->m_fSweptSeconds * 1.0e9 / nSegments, pxReport->m_fEndPointSeconds * 1.0e9 / nSegments);
+		OutputDebugString(pstrDebug);
+	}
+
+	delete pHeightMapImage;
+	delete[] pxmf3Starts;
+	delete[] pxmf3Ends;
+	delete[] pbHits;
+	delete[] pfHits;
+
+	return(nErrors);
+}
+#endif
+
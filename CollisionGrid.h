@@ -0,0 +1,73 @@
+//-----------------------------------------------------------------------------
+// File: CollisionGrid.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+//Uniform grid over an XZ rectangle for the point-against-boxes broadphase of CGameScene::BulletCollision. Build
+//sorts the boxes into every cell their XZ bounds (grown by the query margin) overlap, as one counting sort into a
+//cell -> box index table, so a point only has to look at the one cell it lies in and a segment at the cells of its XZ
+//bounds. Positions outside the rectangle are clamped to the border cells; the result is the same as testing every box,
+//only faster.
+//The tables grow when needed and are kept, so rebuilding every frame does not allocate.
+
+#define COLLISION_GRID_CELL_SIZE		32.0f //Above the size of a villain box (40 x 40) so each box covers at most 3 x 3 cells
+
+class CCollisionGrid
+{
+public:
+	CCollisionGrid(float fMinX, float fMinZ, float fWidth, float fDepth, float fCellSize);
+	virtual ~CCollisionGrid();
+
+private:
+	float							m_fMinX = 0.0f;
+	float							m_fMinZ = 0.0f;
+	float							m_fInverseCellSize = 1.0f;
+	int								m_nCellsX = 0;
+	int								m_nCellsZ = 0;
+
+	int								*m_pnCellStarts = NULL; //Per cell (+1): the boxes of cell i are m_pnItems[m_pnCellStarts[i]] to m_pnItems[m_pnCellStarts[i + 1] - 1]
+	int								*m_pnCellCursors = NULL;
+	int								*m_pnItems = NULL; //Box indices, ascending within a cell
+	int								m_nMaxItems = 0;
+	int								*m_pnBoxCells = NULL; //Per box: first and last cell in x and z
+	int								m_nMaxBoxes = 0;
+	int								*m_pnCandidates = NULL; //Result of a segment query over more than one cell
+	UINT							*m_pnBoxQueries = NULL; //Per box: the last segment query that listed it
+	UINT							m_nQueries = 0;
+
+	int GetCellX(float x);
+	int GetCellZ(float z);
+
+public:
+	int GetCells() { return(m_nCellsX * m_nCellsZ); }
+	int GetItems() { return(m_pnCellStarts[m_nCellsX * m_nCellsZ]); }
+
+	//fMargin: the largest XZ half extent, in any orientation, of the boxes that will be tested against the query points
+	//or segments
+	void Build(BoundingOrientedBox *pxmBoxes, int nBoxes, float fMargin);
+	//The boxes that may intersect a query box centered at the position, in ascending order
+	int *GetCandidates(XMFLOAT3& xmf3Position, int *pnCandidates);
+	//The boxes that may intersect a query box moving from xmf3Start to xmf3End: every cell the XZ bounds of the segment
+	//overlap, in ascending order
+	int *GetCandidates(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, int *pnCandidates);
+};
+
+//First point of the segment inside xmBox grown by xmf3Margin (the half extents of the moving box; exact when both
+//boxes are axis aligned), as a fraction of the segment in *pfHit
+bool IntersectSegmentBox(BoundingOrientedBox& xmBox, XMFLOAT3& xmf3Margin, XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, float *pfHit);
+
+#ifdef _WITH_COLLISION_GRID_BENCHMARK
+//nBullets random bullet boxes against nVillains random villain boxes over the 900 x 900 terrain: the first hit of
+//every bullet by testing all villains (on a sample of the bullets) against the grid, which is rebuilt every repeat;
+//returns the sampled bullets whose hits differ
+int BenchmarkCollisionGrid(int nBullets, int nVillains, int nRepeats);
+#endif
+
+#ifdef _WITH_SWEPT_COLLISION_BENCHMARK
+//nSegments random bullet steps against the terrain height map and against villain boxes: the swept tests checked
+//against finely sampled segments, the hits the end point test of the old BulletCollision misses at a 1/fStepsPerSecond
+//step, and the throughput of both; returns the swept results that do not match the sampled segments
+int BenchmarkSweptCollision(
+LPCTSTR pstrHeightMapFileName, int nSegments, float fStepsPerSecond);
+#endif
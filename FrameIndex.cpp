@@ -0,0 +1,69 @@
+//-----------------------------------------------------------------------------
+// File: FrameIndex.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "FrameIndex.h"
+#include "Object.h"
+
+CFrameIndex::CFrameIndex(CGameObject *pRootFrame)
+{
+	int nFrames = 1 + ((pRootFrame->m_pChild) ? CountFrames(pRootFrame->m_pChild) : 0);
+
+	UINT nSlots = 16;
+	while (nSlots < UINT(nFrames) * 2) nSlots <<= 1;
+	m_nMask = nSlots - 1;
+	m_pEntries = new FRAMEINDEXENTRY[nSlots];
+	memset(m_pEntries, 0, sizeof(FRAMEINDEXENTRY) * nSlots);
+
+	//Same order as the old recursive FindFrame (self, siblings, children), so the first of duplicate names wins
+	Insert(pRootFrame);
+	if (pRootFrame->m_pChild) InsertFrames(pRootFrame->m_pChild);
+}
+
+CFrameIndex::~CFrameIndex()
+{
+	if (m_pEntries) delete[] m_pEntries;
+}
+
+int CFrameIndex::CountFrames(CGameObject *pFrame)
+{
+	int nFrames = 1;
+	if (pFrame->m_pSibling) nFrames += CountFrames(pFrame->m_pSibling);
+	if (pFrame->m_pChild) nFrames += CountFrames(pFrame->m_pChild);
+	return(nFrames);
+}
+
+void CFrameIndex::InsertFrames(CGameObject *pFrame)
+{
+	Insert(pFrame);
+	if (pFrame->m_pSibling) InsertFrames(pFrame->m_pSibling);
+	if (pFrame->m_pChild) InsertFrames(pFrame->m_pChild);
+}
+
+void CFrameIndex::Insert(CGameObject *pFrame)
+{
+	UINT nHash = pFrame->m_nFrameNameHash;
+	for (UINT i = nHash & m_nMask; ; i = (i + 1) & m_nMask)
+	{
+		FRAMEINDEXENTRY *pEntry = &m_pEntries[i];
+		if (!pEntry->m_pFrame)
+		{
+			pEntry->m_nHash = nHash;
+			pEntry->m_pFrame = pFrame;
+			m_nFrames++;
+			return;
+		}
+		if ((pEntry->m_nHash == nHash) && !strcmp(pEntry->m_pFrame->m_pstrFrameName, pFrame->m_pstrFrameName)) return;
+	}
+}
+
+CGameObject *CFrameIndex::Find(char *pstrFrameName, UINT nHash)
+{
+	for (UINT i = nHash & m_nMask; ; i = (i + 1) & m_nMask)
+	{
+		FRAMEINDEXENTRY *pEntry = &m_pEntries[i];
+		if (!pEntry->m_pFrame) return(NULL);
+		if ((pEntry->m_nHash == nHash) && !strcmp(pEntry->m_pFrame->m_pstrFrameName, pstrFrameName)) return(pEntry->m_pFrame);
+	}
+}
@@ -0,0 +1,37 @@
+//-----------------------------------------------------------------------------
+// File: FrameIndex.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+class CGameObject;
+
+//Per-model name -> frame table, built once by CGameObject::LoadGeometryFromFile over the loaded hierarchy.
+//Open addressing with linear probing on the precomputed frame name hashes (HashFrameName); names match exactly.
+//Frames attached below an indexed hierarchy after loading are not in the table.
+
+struct FRAMEINDEXENTRY
+{
+	UINT							m_nHash;
+	CGameObject						*m_pFrame; //NULL: empty slot
+};
+
+class CFrameIndex
+{
+public:
+	CFrameIndex(CGameObject *pRootFrame);
+	virtual ~CFrameIndex();
+
+private:
+	int								m_nFrames = 0;
+	UINT							m_nMask = 0; //Slots - 1, slots are a power of two and at least twice the frames
+	FRAMEINDEXENTRY					*m_pEntries = NULL;
+
+	int CountFrames(CGameObject *pFrame);
+	void InsertFrames(CGameObject *pFrame);
+	void Insert(CGameObject *pFrame);
+
+public:
+	int GetFrames() { return(m_nFrames); }
+	CGameObject *Find(char *pstrFrameName, UINT nHash);
+};
@@ -7,7 +7,7 @@
 #include <iostream>
 #include <fstream>
 
-CGameFramework::CGameFramework()
+CGameFramework::CGameFramework() : m_FixedTimestep(SIMULATION_TICK_RATE, SIMULATION_MAX_TICKS)
 {
 	m_pdxgiFactory = NULL;
 	m_pdxgiSwapChain = NULL;
@@ -55,7 +55,10 @@ void CGameFramework::SetWindowModeText()
 
 	size_t nLength = _tcslen(m_pszFrameRate);
 
-	_stprintf_s(m_pszFrameRate + nLength, 70 - nLength, _T("TessFactor : %1.1f)"), mode.x);
+	if (m_pTerrain->IsGeomipmapping())
+		_stprintf_s(m_pszFrameRate + nLength, 70 - nLength, _T("Geomipmap : %1.1f)"), mode.x);
+	else
+		_stprintf_s(m_pszFrameRate + nLength, 70 - nLength, _T("TessFactor : %1.1f)"), mode.x);
 
 	//_stprintf_s(m_pszFrameRate + nLength, 70 - nLength, _T("(%4f, %4f, %4f)"), xmf3Position.x, xmf3Position.y, xmf3Position.z);
 	::SetWindowText(m_hWnd, m_pszFrameRate);
@@ -398,6 +401,7 @@ void CGameFramework::OnProcessingKeyboardMessage(HWND hWnd, UINT nMessageID, WPA
 					ChangeSwapChainState();
 					break;
 				case VK_F5:
+					m_pTerrain->ChangeRenderMode();
 					break;
 				default:
 					break;
@@ -515,6 +519,8 @@ void CGameFramework::ProcessInput()
 	static UCHAR pKeysBuffer[256];
 	bool bProcessedByScene = false;
 	
+	m_dwDirection = m_dwRotation = 0;
+	m_bShootKey = false;
 	if (m_nSceneNum == 0) return;
 
 	if (GetKeyboardState(pKeysBuffer) && m_pScene) bProcessedByScene = m_pScene[m_nSceneNum]->ProcessInput(pKeysBuffer);
@@ -545,23 +551,34 @@ void CGameFramework::ProcessInput()
 			SetCursorPos(m_ptOldCursorPos.x, m_ptOldCursorPos.y);
 		}
 
-		if (dwRotation != 0)
-			m_pPlayer->Rotate(dwRotation, 3.f);
+		if (cxDelta || cyDelta)
+		{
+			if (pKeysBuffer[VK_RBUTTON] & 0xF0)
+				m_pPlayer->GetCamera()->Rotate(cyDelta, 0.0f, -cxDelta);
+			else
+				m_pPlayer->GetCamera()->Rotate(cyDelta, cxDelta, 0.0f);
+		}
+
+		m_dwDirection = dwDirection;
+		m_dwRotation = dwRotation;
+		m_bShootKey = (pKeysBuffer[VK_RBUTTON] & 0xF0) != 0;
+	}
+}
+
+void CGameFramework::AnimateObjects(float fTimeElapsed)
+{
+	if (!m_pScene[m_nSceneNum]) return;
+
+	m_pScene[m_nSceneNum]->BeginTick();
+	if (m_nSceneNum != 0)
+	{
+		if (m_dwRotation != 0)
+			m_pPlayer->Rotate(m_dwRotation, 3.f);
 		else
 			m_pPlayer->SetTurningState(false);
+		if (m_dwDirection) m_pPlayer->Move(m_dwDirection, fTimeElapsed, true);
 
-		if ((dwDirection != 0) || (cxDelta != 0.0f) || (cyDelta != 0.0f))
-		{
-			if (cxDelta || cyDelta)
-			{
-				if (pKeysBuffer[VK_RBUTTON] & 0xF0)
-					m_pPlayer->GetCamera()->Rotate(cyDelta, 0.0f, -cxDelta);
-				else
-					m_pPlayer->GetCamera()->Rotate(cyDelta, cxDelta, 0.0f);
-			}
-			if (dwDirection) m_pPlayer->Move(dwDirection, m_GameTimer.GetTimeElapsed(), true);
-		}
-		if (pKeysBuffer[VK_RBUTTON] & 0xF0)
+		if (m_bShootKey)
 		{
 			if (m_bShoot)
 			{
@@ -570,7 +587,7 @@ void CGameFramework::ProcessInput()
 			}
 			else
 			{
-				m_fShootTime += m_GameTimer.GetTimeElapsed();
+				m_fShootTime += fTimeElapsed;
 				if (m_fShootTime >= m_fShootSpeed)
 				{
 					m_bShoot = true;
@@ -582,16 +599,9 @@ void CGameFramework::ProcessInput()
 		{
 			m_bShoot = true; m_fShootTime = 0;
 		}
+		m_pPlayer->Update(fTimeElapsed);
 	}
-	m_pPlayer->Update(m_GameTimer.GetTimeElapsed());
-}
-
-void CGameFramework::AnimateObjects()
-{
-	float fTimeElapsed = m_GameTimer.GetTimeElapsed();
-
-	if (m_pScene[m_nSceneNum]) m_pScene[m_nSceneNum]->AnimateObjects(fTimeElapsed,m_pd3dCommandList);
-
+	m_pScene[m_nSceneNum]->AnimateObjects(fTimeElapsed, m_pd3dCommandList);
 }
 
 void CGameFramework::WaitForGpuComplete()
@@ -626,33 +636,44 @@ void CGameFramework::SaveBillboardInfos()
 
 	VS_VB_BILLBOARD_INSTANCE pInstanceInfo;
 	float fxWidth = 10.0f, fyHeight = 12.0f;
-	float xPosition, zPosition;
+	const int nBillboards = 200000;
+	float *pxPositions = new float[nBillboards], *pzPositions = new float[nBillboards], *pfHeights = new float[nBillboards];
 
-	for (int i = 0; i < 200000; i++)
+	for (int i = 0; i < nBillboards; i++)
 	{
+		pxPositions[i] = rand() % 1000;
+		pzPositions[i] = rand() % 1000;
+	}
+	m_pTerrain->GetHeightsAndNormals(pxPositions, pzPositions, nBillboards, pfHeights);
 
-		xPosition = rand() % 1000;
-		zPosition = rand() % 1000;
-
-		float fHeight = m_pTerrain->GetHeight(xPosition, zPosition);
-
-		pInstanceInfo.m_xmf3Position = XMFLOAT3(xPosition, fHeight + 10, zPosition);
+	for (int i = 0; i < nBillboards; i++)
+	{
+		pInstanceInfo.m_xmf3Position = XMFLOAT3(pxPositions[i], pfHeights[i] + 10, pzPositions[i]);
 		pInstanceInfo.m_xmf4BillboardInfo = XMFLOAT2(fxWidth, fyHeight);
 		output.write((char*)&pInstanceInfo, sizeof(VS_VB_BILLBOARD_INSTANCE));
-
 	}
 	output.close();
 
+	delete[] pxPositions;
+	delete[] pzPositions;
+	delete[] pfHeights;
+
 }
 //#define _WITH_PLAYER_TOP
 
 void CGameFramework::FrameAdvance()
 {    
 	m_GameTimer.Tick(0.0f);
+
+	CGameObject::ResetTransformStats();
 	
 	ProcessInput();
 
-    AnimateObjects();
+	//The simulation runs in fixed ticks (none in a short frame, several in a long one); the frame is drawn between the
+	//last two ticks
+	int nTicks = m_FixedTimestep.Advance(m_GameTimer.GetFrameTimeElapsed());
+	for (int i = 0; i < nTicks; i++) AnimateObjects(m_FixedTimestep.GetTickTime());
+	if (m_pScene[m_nSceneNum]) m_pScene[m_nSceneNum]->SetInterpolation(m_FixedTimestep.GetInterpolation());
 
 	HRESULT hResult = m_pd3dCommandAllocator->Reset();
 	hResult = m_pd3dCommandList->Reset(m_pd3dCommandAllocator, NULL);
@@ -726,5 +747,12 @@ void CGameFramework::FrameAdvance()
 
 	MoveToNextFrame();
 	SetWindowModeText();
+
+#ifdef _WITH_TRANSFORM_STATS
+	TRANSFORMSTATS *pStats = &CGameObject::m_xTransformStats;
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Transforms: %d updated, %d skipped, %d deferred (%d saved)\n"), pStats->m_nUpdated, pStats->m_nSkipped, pStats->m_nDeferred, pStats->m_nSkipped + pStats->m_nDeferred);
+	OutputDebugString(pstrDebug);
+#endif
 }
 
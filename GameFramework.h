@@ -5,6 +5,9 @@
 #include "Player.h"
 #include "Scene.h"
 
+#define SIMULATION_TICK_RATE			60.0f //Fixed simulation ticks per second (AnimateObjects)
+#define SIMULATION_MAX_TICKS			5 //Per frame; a longer stall is dropped, not caught up
+
 class CGameFramework
 {
 public:
@@ -31,7 +34,7 @@ public:
     void ReleaseObjects();
 
     void ProcessInput();
-    void AnimateObjects();
+    void AnimateObjects(float fTimeElapsed);
     void FrameAdvance();
 
 	void WaitForGpuComplete();
@@ -50,6 +53,11 @@ private:
 	float						m_fShootSpeed = 0.2f;
 	float						m_fShootTime;
 	bool						m_bShoot = true;
+	bool						m_bShootKey = false;
+
+	//Input of the last frame, applied on every simulation tick
+	DWORD						m_dwDirection = 0;
+	DWORD						m_dwRotation = 0;
 
 	HINSTANCE					m_hInstance;
 	HWND						m_hWnd; 
@@ -90,6 +98,7 @@ private:
 #endif
 
 	CGameTimer					m_GameTimer;
+	CFixedTimestep				m_FixedTimestep;
 
 	CScene						*m_pScene[2];
 	CPlayer						*m_pPlayer = NULL;
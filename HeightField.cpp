@@ -0,0 +1,738 @@
+//-----------------------------------------------------------------------------
+// File: HeightField.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "HeightField.h"
+#include <cfloat>
+
+static int GetHeightFieldTileLength(int nFormat)
+{
+	return(HEIGHT_FIELD_TILE_BYTES / (HEIGHT_FIELD_TILE_WIDTH * nFormat));
+}
+
+static float GetHeightFieldSample(BYTE *pSamples, int nSample, int nFormat)
+{
+	switch (nFormat)
+	{
+		case HEIGHT_FIELD_FORMAT_R8: return((float)pSamples[nSample]);
+		case HEIGHT_FIELD_FORMAT_R16: return((float)((USHORT *)pSamples)[nSample]);
+		default: return(((float *)pSamples)[nSample]);
+	}
+}
+
+//The levels of the pyramid of a field and, if pnWidths and pnLengths (16 each), the blocks across and along on each
+static int GetHeightFieldPyramidLevels(int nWidth, int nLength, int *pnWidths = NULL, int *pnLengths = NULL)
+{
+	int nBlocksX = ((nWidth - 1) + (1 << HEIGHT_FIELD_PYRAMID_SHIFT) - 1) >> HEIGHT_FIELD_PYRAMID_SHIFT;
+	int nBlocksZ = ((nLength - 1) + (1 << HEIGHT_FIELD_PYRAMID_SHIFT) - 1) >> HEIGHT_FIELD_PYRAMID_SHIFT;
+	int nLevels = 1;
+	for ( ; ; nLevels++)
+	{
+		if (pnWidths) pnWidths[nLevels - 1] = nBlocksX;
+		if (pnLengths) pnLengths[nLevels - 1] = nBlocksZ;
+		if ((nBlocksX == 1) && (nBlocksZ == 1)) break;
+		nBlocksX = (nBlocksX + 1) / 2;
+		nBlocksZ = (nBlocksZ + 1) / 2;
+	}
+	return(nLevels);
+}
+
+//The sample (x, z) into every level 0 block it is a corner of: blocks cover samples b * 16 to b * 16 + 16
+static void AddHeightFieldPyramidSample(float *pfBlocks, int nBlocksX, int nBlocksZ, int x, int z, float fSample)
+{
+	int bxLast = min(x >> HEIGHT_FIELD_PYRAMID_SHIFT, nBlocksX - 1), bxFirst = (x > 0) ? min((x - 1) >> HEIGHT_FIELD_PYRAMID_SHIFT, bxLast) : 0;
+	int bzLast = min(z >> HEIGHT_FIELD_PYRAMID_SHIFT, nBlocksZ - 1), bzFirst = (z > 0) ? min((z - 1) >> HEIGHT_FIELD_PYRAMID_SHIFT, bzLast) : 0;
+	for (int bz = bzFirst; bz <= bzLast; bz++)
+	{
+		for (int bx = bxFirst; bx <= bxLast; bx++)
+		{
+			float *pfBlock = &pfBlocks[(bx + (bz * nBlocksX)) * 2];
+			pfBlock[0] = min(pfBlock[0], fSample);
+			pfBlock[1] = max(pfBlock[1], fSample);
+		}
+	}
+}
+
+XMFLOAT3 GetHeightFieldNormal(float fHeight, float fNextXHeight, float fNextZHeight, XMFLOAT3& xmf3Scale)
+{
+	float fNormalX = xmf3Scale.z * (fHeight - fNextXHeight);
+	float fNormalY = xmf3Scale.z * xmf3Scale.x;
+	float fNormalZ = xmf3Scale.x * (fHeight - fNextZHeight);
+	float fLength = sqrtf(fNormalX * fNormalX + fNormalY * fNormalY + fNormalZ * fNormalZ);
+
+	return(XMFLOAT3(fNormalX / fLength, fNormalY / fLength, fNormalZ / fLength));
+}
+
+static bool ClipSegmentSlab(float fStart, float fDelta, float fMin, float fMax, float *pt0, float *pt1)
+{
+	if (fDelta == 0.0f) return((fStart >= fMin) && (fStart <= fMax));
+
+	float ta = (fMin - fStart) / fDelta, tb = (fMax - fStart) / fDelta;
+	if (ta > tb) { float t = ta; ta = tb; tb = t; }
+	*pt0 = max(*pt0, ta);
+	*pt1 = min(*pt1, tb);
+	return(*pt0 <= *pt1);
+}
+
+bool CookHeightField(LPCTSTR pstrRawFileName, int nWidth, int nLength, int nFormat, LPCTSTR pstrFileName)
+{
+	if ((nWidth < 2) || (nLength < 2) || (nWidth > HEIGHT_FIELD_MAX_SIZE) || (nLength > HEIGHT_FIELD_MAX_SIZE)) return(false);
+	if ((nFormat != HEIGHT_FIELD_FORMAT_R8) && (nFormat != HEIGHT_FIELD_FORMAT_R16) && (nFormat != HEIGHT_FIELD_FORMAT_R32F)) return(false);
+
+	HANDLE hRawFile = ::CreateFile(pstrRawFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hRawFile == INVALID_HANDLE_VALUE) return(false);
+	HANDLE hFile = ::CreateFile(pstrFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		::CloseHandle(hRawFile);
+		return(false);
+	}
+
+	HEIGHTFIELDHEADER Header;
+	::ZeroMemory(&Header, sizeof(HEIGHTFIELDHEADER));
+	Header.m_nMagic = HEIGHT_FIELD_MAGIC;
+	Header.m_nVersion = HEIGHT_FIELD_VERSION;
+	Header.m_nWidth = nWidth;
+	Header.m_nLength = nLength;
+	Header.m_nFormat = nFormat;
+	Header.m_nTileWidth = HEIGHT_FIELD_TILE_WIDTH;
+	Header.m_nTileLength = ::GetHeightFieldTileLength(nFormat);
+	Header.m_nTilesX = (nWidth + Header.m_nTileWidth - 1) / Header.m_nTileWidth;
+	Header.m_nTilesZ = (nLength + Header.m_nTileLength - 1) / Header.m_nTileLength;
+	Header.m_fMinSample = FLT_MAX;
+	Header.m_fMaxSample = -FLT_MAX;
+
+	int pnPyramidWidths[16], pnPyramidLengths[16], nPyramidFloats = 0;
+	Header.m_nPyramidLevels = ::GetHeightFieldPyramidLevels(nWidth, nLength, pnPyramidWidths, pnPyramidLengths);
+	for (UINT i = 0; i < Header.m_nPyramidLevels; i++) nPyramidFloats += pnPyramidWidths[i] * pnPyramidLengths[i] * 2;
+	float *pfPyramid = new float[nPyramidFloats];
+	for (int i = 0; i < nPyramidFloats; i += 2)
+	{
+		pfPyramid[i + 0] = FLT_MAX;
+		pfPyramid[i + 1] = -FLT_MAX;
+	}
+
+	int nTileLength = Header.m_nTileLength;
+	int nRowBytes = nWidth * nFormat;
+	BYTE *pBand = new BYTE[nTileLength * nRowBytes];
+	BYTE *pTile = new BYTE[HEIGHT_FIELD_TILE_BYTES];
+
+	//The header page now, its bounds once every sample has been seen
+	::ZeroMemory(pTile, HEIGHT_FIELD_TILE_BYTES);
+	DWORD nBytes = 0;
+	bool bCooked = ::WriteFile(hFile, pTile, HEIGHT_FIELD_TILE_BYTES, &nBytes, NULL) && (nBytes == HEIGHT_FIELD_TILE_BYTES);
+
+	for (UINT tz = 0; bCooked && (tz < Header.m_nTilesZ); tz++)
+	{
+		//Rows z0 to z1 - 1 are the rows (nLength - z1) to (nLength - 1 - z0) of the raw file; band row j is z0 + j
+		int z0 = tz * nTileLength, z1 = min(z0 + nTileLength, nLength);
+		LARGE_INTEGER nOffset;
+		nOffset.QuadPart = LONGLONG(nLength - z1) * nRowBytes;
+		DWORD nBandBytes = (z1 - z0) * nRowBytes;
+		bCooked = ::SetFilePointerEx(hRawFile, nOffset, NULL, FILE_BEGIN) && ::ReadFile(hRawFile, pBand, nBandBytes, &nBytes, NULL) && (nBytes == nBandBytes);
+		for (int z = z0; bCooked && (z < z1); z++)
+		{
+			BYTE *pRow = pBand + (z1 - 1 - z) * nRowBytes;
+			for (int x = 0; x < nWidth; x++)
+			{
+				float fSample = ::GetHeightFieldSample(pRow, x, nFormat);
+				Header.m_fMinSample = min(Header.m_fMinSample, fSample);
+				Header.m_fMaxSample = max(Header.m_fMaxSample, fSample);
+				::AddHeightFieldPyramidSample(pfPyramid, pnPyramidWidths[0], pnPyramidLengths[0], x, z, fSample);
+			}
+		}
+
+		for (UINT tx = 0; bCooked && (tx < Header.m_nTilesX); tx++)
+		{
+			int x0 = tx * HEIGHT_FIELD_TILE_WIDTH, nSamples = min(HEIGHT_FIELD_TILE_WIDTH, nWidth - x0);
+			for (int j = 0; j < nTileLength; j++)
+			{
+				int z = min(z0 + j, nLength - 1);
+				BYTE *pRow = pBand + (z1 - 1 - z) * nRowBytes + x0 * nFormat;
+				BYTE *pTileRow = pTile + j * HEIGHT_FIELD_TILE_WIDTH * nFormat;
+				memcpy(pTileRow, pRow, nSamples * nFormat);
+				for (int i = nSamples; i < HEIGHT_FIELD_TILE_WIDTH; i++) memcpy(pTileRow + i * nFormat, pRow + (nSamples - 1) * nFormat, nFormat);
+			}
+			bCooked = ::WriteFile(hFile, pTile, HEIGHT_FIELD_TILE_BYTES, &nBytes, NULL) && (nBytes == HEIGHT_FIELD_TILE_BYTES);
+		}
+	}
+
+	//The levels above 0 from the one below, after the last tile
+	float *pfLevel = pfPyramid;
+	for (UINT i = 1; i < Header.m_nPyramidLevels; i++)
+	{
+		int nChildWidth = pnPyramidWidths[i - 1], nChildLength = pnPyramidLengths[i - 1];
+		float *pfChildLevel = pfLevel;
+		pfLevel += nChildWidth * nChildLength * 2;
+		for (int z = 0; z < pnPyramidLengths[i]; z++)
+		{
+			for (int x = 0; x < pnPyramidWidths[i]; x++)
+			{
+				float *pfBlock = &pfLevel[(x + (z * pnPyramidWidths[i])) * 2];
+				for (int cz = z * 2; cz < min(z * 2 + 2, nChildLength); cz++)
+				{
+					for (int cx = x * 2; cx < min(x * 2 + 2, nChildWidth); cx++)
+					{
+						float *pfChild = &pfChildLevel[(cx + (cz * nChildWidth)) * 2];
+						pfBlock[0] = min(pfBlock[0], pfChild[0]);
+						pfBlock[1] = max(pfBlock[1], pfChild[1]);
+					}
+				}
+			}
+		}
+	}
+	DWORD nPyramidBytes = nPyramidFloats * sizeof(float);
+	bCooked = bCooked && ::WriteFile(hFile, pfPyramid, nPyramidBytes, &nBytes, NULL) && (nBytes == nPyramidBytes);
+
+	if (bCooked)
+	{
+		LARGE_INTEGER nOffset;
+		nOffset.QuadPart = 0;
+		bCooked = ::SetFilePointerEx(hFile, nOffset, NULL, FILE_BEGIN) && ::WriteFile(hFile, &Header, sizeof(HEIGHTFIELDHEADER), &nBytes, NULL) && (nBytes == sizeof(HEIGHTFIELDHEADER));
+	}
+
+	delete[] pBand;
+	delete[] pTile;
+	delete[] pfPyramid;
+	::CloseHandle(hRawFile);
+	::CloseHandle(hFile);
+	if (!bCooked) ::DeleteFile(pstrFileName);
+
+	return(bCooked);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+CHeightField::CHeightField(int nMaxResidentTiles)
+{
+	::ZeroMemory(&m_Header, sizeof(HEIGHTFIELDHEADER));
+	//GetHeight reads the four corners of a quad, which may lie in four tiles
+	m_nMaxResidentTiles = max(nMaxResidentTiles, 4);
+	m_pResidentTiles = new HEIGHTFIELDTILE[m_nMaxResidentTiles];
+}
+
+CHeightField::~CHeightField()
+{
+	Close();
+	if (m_pResidentTiles) delete[] m_pResidentTiles;
+}
+
+bool CHeightField::Open(LPCTSTR pstrFileName, XMFLOAT3 xmf3Scale)
+{
+	Close();
+
+	m_hFile = ::CreateFile(pstrFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE) return(false);
+
+	DWORD nBytes = 0;
+	LARGE_INTEGER nFileSize;
+	bool bValid = ::ReadFile(m_hFile, &m_Header, sizeof(HEIGHTFIELDHEADER), &nBytes, NULL) && (nBytes == sizeof(HEIGHTFIELDHEADER)) && ::GetFileSizeEx(m_hFile, &nFileSize);
+	bValid = bValid && (m_Header.m_nMagic == HEIGHT_FIELD_MAGIC) && (m_Header.m_nVersion == HEIGHT_FIELD_VERSION);
+	bValid = bValid && (m_Header.m_nWidth >= 2) && (m_Header.m_nLength >= 2) && (m_Header.m_nWidth <= HEIGHT_FIELD_MAX_SIZE) && (m_Header.m_nLength <= HEIGHT_FIELD_MAX_SIZE);
+	bValid = bValid && ((m_Header.m_nFormat == HEIGHT_FIELD_FORMAT_R8) || (m_Header.m_nFormat == HEIGHT_FIELD_FORMAT_R16) || (m_Header.m_nFormat == HEIGHT_FIELD_FORMAT_R32F));
+	bValid = bValid && (m_Header.m_nTileWidth == HEIGHT_FIELD_TILE_WIDTH) && (m_Header.m_nTileLength == (UINT)::GetHeightFieldTileLength(m_Header.m_nFormat));
+	bValid = bValid && (m_Header.m_nTilesX == (m_Header.m_nWidth + m_Header.m_nTileWidth - 1) / m_Header.m_nTileWidth) && (m_Header.m_nTilesZ == (m_Header.m_nLength + m_Header.m_nTileLength - 1) / m_Header.m_nTileLength);
+
+	int pnPyramidLengths[16], nPyramidFloats = 0;
+	m_pnPyramidWidths = new int[16];
+	bValid = bValid && (m_Header.m_nPyramidLevels == (UINT)::GetHeightFieldPyramidLevels(m_Header.m_nWidth, m_Header.m_nLength, m_pnPyramidWidths, pnPyramidLengths));
+	for (UINT i = 0; bValid && (i < m_Header.m_nPyramidLevels); i++) nPyramidFloats += m_pnPyramidWidths[i] * pnPyramidLengths[i] * 2;
+	UINT64 nPyramidOffset = UINT64(1 + m_Header.m_nTilesX * m_Header.m_nTilesZ) * HEIGHT_FIELD_TILE_BYTES;
+	DWORD nPyramidBytes = nPyramidFloats * sizeof(float);
+	bValid = bValid && (UINT64(nFileSize.QuadPart) >= nPyramidOffset + nPyramidBytes);
+	if (bValid)
+	{
+		//The pyramid stays in memory; the tiles are mapped by the queries
+		m_pfPyramid = new float[nPyramidFloats];
+		m_ppfPyramid = new float*[m_Header.m_nPyramidLevels];
+		for (UINT i = 0, nFloats = 0; i < m_Header.m_nPyramidLevels; nFloats += m_pnPyramidWidths[i] * pnPyramidLengths[i] * 2, i++) m_ppfPyramid[i] = m_pfPyramid + nFloats;
+		LARGE_INTEGER nOffset;
+		nOffset.QuadPart = LONGLONG(nPyramidOffset);
+		bValid = ::SetFilePointerEx(m_hFile, nOffset, NULL, FILE_BEGIN) && ::ReadFile(m_hFile, m_pfPyramid, nPyramidBytes, &nBytes, NULL) && (nBytes == nPyramidBytes);
+	}
+	if (bValid) m_hFileMapping = ::CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!m_hFileMapping)
+	{
+		Close();
+		return(false);
+	}
+
+	m_xmf3Scale = xmf3Scale;
+	int nTiles = m_Header.m_nTilesX * m_Header.m_nTilesZ;
+	m_pnTileSlots = new int[nTiles];
+	for (int i = 0; i < nTiles; i++) m_pnTileSlots[i] = -1;
+
+	return(true);
+}
+
+bool CHeightField::OpenRaw(LPCTSTR pstrRawFileName, int nWidth, int nLength, int nFormat, XMFLOAT3 xmf3Scale)
+{
+	TCHAR pstrFileName[MAX_PATH];
+	if (_tcslen(pstrRawFileName) + 6 > MAX_PATH) return(false);
+	_tcscpy_s(pstrFileName, MAX_PATH, pstrRawFileName);
+	LPTSTR pstrExtension = _tcsrchr(pstrFileName, _T('.'));
+	if (!pstrExtension || _tcspbrk(pstrExtension, _T("/\\"))) pstrExtension = pstrFileName + _tcslen(pstrFileName);
+	_tcscpy_s(pstrExtension, MAX_PATH - (pstrExtension - pstrFileName), _T(".hfld"));
+
+	WIN32_FILE_ATTRIBUTE_DATA xRawInfo, xInfo;
+	if (!::GetFileAttributesEx(pstrRawFileName, GetFileExInfoStandard, &xRawInfo)) return(false);
+	bool bCurrent = ::GetFileAttributesEx(pstrFileName, GetFileExInfoStandard, &xInfo) && (::CompareFileTime(&xInfo.ftLastWriteTime, &xRawInfo.ftLastWriteTime) >= 0);
+	if (bCurrent && Open(pstrFileName, xmf3Scale) && (GetWidth() == nWidth) && (GetLength() == nLength) && (GetFormat() == nFormat)) return(true);
+
+	Close();
+	return(::CookHeightField(pstrRawFileName, nWidth, nLength, nFormat, pstrFileName) && Open(pstrFileName, xmf3Scale));
+}
+
+void CHeightField::Close()
+{
+	for (int i = 0; i < m_nResidentTiles; i++) ::UnmapViewOfFile(m_pResidentTiles[i].m_pSamples);
+	if (m_hFileMapping) ::CloseHandle(m_hFileMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE) ::CloseHandle(m_hFile);
+	if (m_pnTileSlots) delete[] m_pnTileSlots;
+	if (m_pfPyramid) delete[] m_pfPyramid;
+	if (m_ppfPyramid) delete[] m_ppfPyramid;
+	if (m_pnPyramidWidths) delete[] m_pnPyramidWidths;
+
+	m_hFileMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_pnTileSlots = NULL;
+	m_pfPyramid = NULL;
+	m_ppfPyramid = NULL;
+	m_pnPyramidWidths = NULL;
+	m_nResidentTiles = 0;
+	m_nLastSlot = -1;
+	::ZeroMemory(&m_Header, sizeof(HEIGHTFIELDHEADER));
+}
+
+//Valid until the next call: mapping another tile may unmap this one. NULL when the view cannot be mapped (address space
+//or I/O), the tile is then not resident
+BYTE *CHeightField::GetTileSamples(int nTile)
+{
+	if ((m_nLastSlot >= 0) && (m_pResidentTiles[m_nLastSlot].m_nTile == nTile))
+	{
+		m_pResidentTiles[m_nLastSlot].m_nLastUse = ++m_nUses;
+		return(m_pResidentTiles[m_nLastSlot].m_pSamples);
+	}
+
+	int nSlot = m_pnTileSlots[nTile];
+	if (nSlot < 0)
+	{
+		if (m_nResidentTiles < m_nMaxResidentTiles)
+		{
+			nSlot = m_nResidentTiles++;
+			m_nPeakResidentTiles = max(m_nPeakResidentTiles, m_nResidentTiles);
+		}
+		else
+		{
+			nSlot = 0;
+			for (int i = 1; i < m_nResidentTiles; i++)
+			{
+				if (m_pResidentTiles[i].m_nLastUse < m_pResidentTiles[nSlot].m_nLastUse) nSlot = i;
+			}
+			::UnmapViewOfFile(m_pResidentTiles[nSlot].m_pSamples);
+			m_pnTileSlots[m_pResidentTiles[nSlot].m_nTile] = -1;
+		}
+
+		UINT64 nOffset = UINT64(1 + nTile) * HEIGHT_FIELD_TILE_BYTES;
+		m_pResidentTiles[nSlot].m_pSamples = (BYTE *)::MapViewOfFile(m_hFileMapping, FILE_MAP_READ, DWORD(nOffset >> 32), DWORD(nOffset & 0xFFFFFFFF), HEIGHT_FIELD_TILE_BYTES);
+		if (!m_pResidentTiles[nSlot].m_pSamples)
+		{
+			//Give the slot back (the last resident tile moves into it) so Close never unmaps it
+			int nLast = --m_nResidentTiles;
+			if (nSlot != nLast)
+			{
+				m_pResidentTiles[nSlot] = m_pResidentTiles[nLast];
+				m_pnTileSlots[m_pResidentTiles[nSlot].m_nTile] = nSlot;
+			}
+			m_pResidentTiles[nLast].m_nTile = -1;
+			m_pResidentTiles[nLast].m_pSamples = NULL;
+			m_nLastSlot = -1;
+			m_nMapFailures++;
+			return(NULL);
+		}
+		m_pResidentTiles[nSlot].m_nTile = nTile;
+		m_pnTileSlots[nTile] = nSlot;
+		m_nTileMaps++;
+	}
+	m_pResidentTiles[nSlot].m_nLastUse = ++m_nUses;
+	m_nLastSlot = nSlot;
+
+	return(m_pResidentTiles[nSlot].m_pSamples);
+}
+
+float CHeightField::GetSample(int x, int z)
+{
+	if (!m_pnTileSlots) return(0.0f);
+
+	x = max(0, min(x, int(m_Header.m_nWidth) - 1));
+	z = max(0, min(z, int(m_Header.m_nLength) - 1));
+	int tx = x / HEIGHT_FIELD_TILE_WIDTH, tz = z / m_Header.m_nTileLength;
+	BYTE *pSamples = GetTileSamples(tz * m_Header.m_nTilesX + tx);
+	if (!pSamples) return(0.0f);
+
+	return(::GetHeightFieldSample(pSamples, (z - tz * m_Header.m_nTileLength) * HEIGHT_FIELD_TILE_WIDTH + (x - tx * HEIGHT_FIELD_TILE_WIDTH), m_Header.m_nFormat));
+}
+
+float CHeightField::GetHeight(float fx, float fz, bool bReverseQuad)
+{
+	fx = fx / m_xmf3Scale.x;
+	fz = fz / m_xmf3Scale.z;
+	if ((fx < 0.0f) || (fz < 0.0f) || (fx >= m_Header.m_nWidth) || (fz >= m_Header.m_nLength)) return(0.0f);
+
+	int x = (int)fx;
+	int z = (int)fz;
+	float fxPercent = fx - x;
+	float fzPercent = fz - z;
+
+	float fBottomLeft = GetSample(x, z);
+	float fBottomRight = GetSample(x + 1, z);
+	float fTopLeft = GetSample(x, z + 1);
+	float fTopRight = GetSample(x + 1, z + 1);
+	if (bReverseQuad)
+	{
+		if (fzPercent >= fxPercent)
+			fBottomRight = fBottomLeft + (fTopRight - fTopLeft);
+		else
+			fTopLeft = fTopRight + (fBottomLeft - fBottomRight);
+	}
+	else
+	{
+		if (fzPercent < (1.0f - fxPercent))
+			fTopRight = fTopLeft + (fBottomRight - fBottomLeft);
+		else
+			fBottomLeft = fTopLeft + (fBottomRight - fTopRight);
+	}
+	float fTopHeight = fTopLeft * (1 - fxPercent) + fTopRight * fxPercent;
+	float fBottomHeight = fBottomLeft * (1 - fxPercent) + fBottomRight * fxPercent;
+	float fHeight = fBottomHeight * (1 - fzPercent) + fTopHeight * fzPercent;
+
+	return(fHeight * m_xmf3Scale.y);
+}
+
+XMFLOAT3 CHeightField::GetNormal(int x, int z)
+{
+	if ((x < 0) || (z < 0) || (x >= int(m_Header.m_nWidth)) || (z >= int(m_Header.m_nLength))) return(XMFLOAT3(0.0f, 1.0f, 0.0f));
+
+	int xNext = (x < int(m_Header.m_nWidth - 1)) ? x + 1 : x - 1;
+	int zNext = (z < int(m_Header.m_nLength - 1)) ? z + 1 : z - 1;
+	float y1 = GetSample(x, z) * m_xmf3Scale.y;
+	float y2 = GetSample(xNext, z) * m_xmf3Scale.y;
+	float y3 = GetSample(x, zNext) * m_xmf3Scale.y;
+
+	return(::GetHeightFieldNormal(y1, y2, y3, m_xmf3Scale));
+}
+
+bool CHeightField::GetHeights(int x, int z, int nWidth, int nLength, float *pfHeights)
+{
+	if (!m_pnTileSlots)
+	{
+		for (int i = 0; i < nWidth * nLength; i++) pfHeights[i] = 0.0f;
+		return(false);
+	}
+
+	int nFormat = m_Header.m_nFormat, nTileLength = m_Header.m_nTileLength;
+	for (int j = 0; j < nLength; j++)
+	{
+		int zSample = max(0, min(z + j, int(m_Header.m_nLength) - 1));
+		int tz = zSample / nTileLength;
+		int nRow = (zSample - tz * nTileLength) * HEIGHT_FIELD_TILE_WIDTH;
+		float *pfRow = pfHeights + j * nWidth;
+		//A run of samples per tile, so the tile is looked up once for each
+		for (int i = 0; i < nWidth; )
+		{
+			int xSample = max(0, min(x + i, int(m_Header.m_nWidth) - 1));
+			int tx = xSample / HEIGHT_FIELD_TILE_WIDTH;
+			BYTE *pSamples = GetTileSamples(tz * m_Header.m_nTilesX + tx);
+			if (!pSamples)
+			{
+				for (int k = j * nWidth + i; k < nWidth * nLength; k++) pfHeights[k] = 0.0f;
+				return(false);
+			}
+			int nRun = ((x + i) < 0) || ((x + i) >= int(m_Header.m_nWidth)) ? 1 : min(nWidth - i, (tx + 1) * HEIGHT_FIELD_TILE_WIDTH - (x + i));
+			for (int k = 0; k < nRun; k++, i++)
+			{
+				int xTile = max(0, min(x + i, int(m_Header.m_nWidth) - 1)) - tx * HEIGHT_FIELD_TILE_WIDTH;
+				pfRow[i] = ::GetHeightFieldSample(pSamples, nRow + xTile, nFormat) * m_xmf3Scale.y;
+			}
+		}
+	}
+
+	return(true);
+}
+
+void CHeightField::GetHeightsAndNormals(float *pfx, float *pfz, int nPoints, float *pfHeights, XMFLOAT3 *pxmf3Normals, bool bReverseQuad)
+{
+	for (int i = 0; i < nPoints; i++)
+	{
+		pfHeights[i] = GetHeight(pfx[i], pfz[i], bReverseQuad);
+		if (pxmf3Normals) pxmf3Normals[i] = GetNormal(int(pfx[i] / m_xmf3Scale.x), int(pfz[i] / m_xmf3Scale.z));
+	}
+}
+
+bool CHeightField::IntersectQuad(int x, int z, float x0, float y0, float z0, float dx, float dy, float dz, float ta, float tb, float *pfHit, XMFLOAT3 *pxmf3Normal)
+{
+	//The two triangles of GetHeight meet on u + v = 1; w(t) = u + v - 1 along the segment
+	float fBottomLeft = GetSample(x, z), fBottomRight = GetSample(x + 1, z), fTopLeft = GetSample(x, z + 1), fTopRight = GetSample(x + 1, z + 1);
+	float u0 = x0 - x, v0 = z0 - z, dw = dx + dz;
+	float wa = u0 + v0 - 1.0f + dw * ta, wb = u0 + v0 - 1.0f + dw * tb;
+	float ts = ((wa < 0.0f) != (wb < 0.0f)) ? (ta + (tb - ta) * wa / (wa - wb)) : tb;
+	float pfPieces[3] = { ta, ts, tb };
+	for (int i = 0; i < 2; i++)
+	{
+		float pa = pfPieces[i], pb = pfPieces[i + 1];
+		if ((i == 1) && (pb <= pa)) break;
+
+		//Height over the triangle as h0 + hu * u + hv * v, so f(t) = y(t) - h(t) is linear on the piece
+		float h0, hu, hv;
+		if ((u0 + v0 - 1.0f + dw * (pa + pb) * 0.5f) < 0.0f)
+		{
+			h0 = fBottomLeft; hu = fBottomRight - fBottomLeft; hv = fTopLeft - fBottomLeft;
+		}
+		else
+		{
+			h0 = fTopLeft + fBottomRight - fTopRight; hu = fTopRight - fTopLeft; hv = fTopRight - fBottomRight;
+		}
+		float fa = (y0 + dy * pa) - m_xmf3Scale.y * (h0 + hu * (u0 + dx * pa) + hv * (v0 + dz * pa));
+		float fb = (y0 + dy * pb) - m_xmf3Scale.y * (h0 + hu * (u0 + dx * pb) + hv * (v0 + dz * pb));
+		if (fa < 0.0f)
+			*pfHit = pa;
+		else if (fb < 0.0f)
+			*pfHit = pa + (pb - pa) * fa / (fa - fb);
+		else
+			continue;
+
+		if (pxmf3Normal)
+		{
+			XMFLOAT3 xmf3Normal(-m_xmf3Scale.y * hu / m_xmf3Scale.x, 1.0f, -m_xmf3Scale.y * hv / m_xmf3Scale.z);
+			*pxmf3Normal = Vector3::Normalize(xmf3Normal);
+		}
+		return(true);
+	}
+	return(false);
+}
+
+bool CHeightField::IntersectQuads(int x, int z, float x0, float y0, float z0, float dx, float dy, float dz, float ta, float tb, float *pfHit, XMFLOAT3 *pxmf3Normal)
+{
+	//2D DDA from the quad the segment is in at ta
+	int nStepX = (dx > 0.0f) ? 1 : -1, nStepZ = (dz > 0.0f) ? 1 : -1;
+	for ( ; ; )
+	{
+		float tNextX = (dx != 0.0f) ? ((x + ((dx > 0.0f) ? 1 : 0)) - x0) / dx : FLT_MAX;
+		float tNextZ = (dz != 0.0f) ? ((z + ((dz > 0.0f) ? 1 : 0)) - z0) / dz : FLT_MAX;
+		float tc = min(min(tNextX, tNextZ), tb);
+		if (tc < ta) tc = ta;
+		if (IntersectQuad(x, z, x0, y0, z0, dx, dy, dz, ta, tc, pfHit, pxmf3Normal)) return(true);
+
+		if (tc >= tb) break;
+		if (tNextX < tNextZ) x += nStepX; else z += nStepZ;
+		if ((x < 0) || (x > int(m_Header.m_nWidth) - 2) || (z < 0) || (z > int(m_Header.m_nLength) - 2)) break;
+		ta = tc;
+	}
+	return(false);
+}
+
+bool CHeightField::MarchPyramid(float x0, float y0, float z0, float dx, float dy, float dz, bool bAnyHit, float *pfHit, XMFLOAT3 *pxmf3Normal)
+{
+	if (!m_pfPyramid) return(false);
+
+	int nWidth = m_Header.m_nWidth, nLength = m_Header.m_nLength, nLevels = m_Header.m_nPyramidLevels;
+	float t0 = 0.0f, t1 = 1.0f;
+	if (!::ClipSegmentSlab(x0, dx, 0.0f, float(nWidth - 1), &t0, &t1) || !::ClipSegmentSlab(z0, dz, 0.0f, float(nLength - 1), &t0, &t1)) return(false);
+
+	//(x, z) is the quad the segment is in at ta; the block tested is the one containing it on level nLevel, of
+	//16 << nLevel quads a side. Level 0 blocks not passed above are walked quad by quad.
+	int x = int(floorf(x0 + dx * t0)), z = int(floorf(z0 + dz * t0));
+	x = (x < 0) ? 0 : ((x > nWidth - 2) ? (nWidth - 2) : x);
+	z = (z < 0) ? 0 : ((z > nLength - 2) ? (nLength - 2) : z);
+	int nLevel = nLevels - 1;
+	for (float ta = t0; ; )
+	{
+		int nShift = HEIGHT_FIELD_PYRAMID_SHIFT + nLevel, nSize = 1 << nShift, bx = x >> nShift, bz = z >> nShift;
+		float txExit = (dx > 0.0f) ? (((bx + 1) * nSize - x0) / dx) : ((dx < 0.0f) ? ((bx * nSize - x0) / dx) : FLT_MAX);
+		float tzExit = (dz > 0.0f) ? (((bz + 1) * nSize - z0) / dz) : ((dz < 0.0f) ? ((bz * nSize - z0) / dz) : FLT_MAX);
+		float tb = min(min(txExit, tzExit), t1);
+		if (tb < ta) tb = ta;
+
+		float *pfBlock = &m_ppfPyramid[nLevel][(bx + (bz * m_pnPyramidWidths[nLevel])) * 2];
+		float ya = y0 + dy * ta, yb = y0 + dy * tb;
+		if (min(ya, yb) >= pfBlock[1] * m_xmf3Scale.y)
+		{
+			//Above the whole block: skip it, and the next one may be skipped on a coarser level
+			if (nLevel < nLevels - 1) nLevel++;
+		}
+		else if (bAnyHit && (min(ya, yb) < pfBlock[0] * m_xmf3Scale.y))
+		{
+			//Partly below the whole block: some point is below the surface, not necessarily the first
+			*pfHit = (ya < yb) ? ta : tb;
+			return(true);
+		}
+		else if (nLevel > 0)
+		{
+			nLevel--;
+			continue;
+		}
+		else if (IntersectQuads(x, z, x0, y0, z0, dx, dy, dz, ta, tb, pfHit, pxmf3Normal))
+		{
+			return(true);
+		}
+
+		if (tb >= t1) break;
+		//Into the next block across the side crossed first; the other coordinate stays inside the block
+		if (txExit <= tzExit)
+		{
+			x = (dx > 0.0f) ? ((bx + 1) * nSize) : (bx * nSize - 1);
+			z = int(floorf(z0 + dz * tb));
+			z = (z < bz * nSize) ? (bz * nSize) : ((z > (bz + 1) * nSize - 1) ? ((bz + 1) * nSize - 1) : z);
+		}
+		else
+		{
+			z = (dz > 0.0f) ? ((bz + 1) * nSize) : (bz * nSize - 1);
+			x = int(floorf(x0 + dx * tb));
+			x = (x < bx * nSize) ? (bx * nSize) : ((x > (bx + 1) * nSize - 1) ? ((bx + 1) * nSize - 1) : x);
+		}
+		if ((x < 0) || (x > nWidth - 2) || (z < 0) || (z > nLength - 2)) break;
+		ta = tb;
+	}
+	return(false);
+}
+
+bool CHeightField::IntersectSegment(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, float *pfHit, XMFLOAT3 *pxmf3Normal)
+{
+	float x0 = xmf3Start.x / m_xmf3Scale.x, z0 = xmf3Start.z / m_xmf3Scale.z, y0 = xmf3Start.y;
+	return(MarchPyramid(x0, y0, z0, xmf3End.x / m_xmf3Scale.x - x0, xmf3End.y - y0, xmf3End.z / m_xmf3Scale.z - z0, false, pfHit, pxmf3Normal));
+}
+
+bool CHeightField::IntersectRay(XMFLOAT3& xmf3Origin, XMFLOAT3& xmf3Direction, float fMaxDistance, float *pfDistance, XMFLOAT3 *pxmf3Normal)
+{
+	XMFLOAT3 xmf3End = Vector3::Add(xmf3Origin, xmf3Direction, fMaxDistance);
+	float fHit;
+	if (!IntersectSegment(xmf3Origin, xmf3End, &fHit, pxmf3Normal)) return(false);
+	*pfDistance = fHit * fMaxDistance;
+	return(true);
+}
+
+bool CHeightField::IsVisible(XMFLOAT3& xmf3From, XMFLOAT3& xmf3To)
+{
+	float x0 = xmf3From.x / m_xmf3Scale.x, z0 = xmf3From.z / m_xmf3Scale.z, y0 = xmf3From.y, fHit;
+	return(!MarchPyramid(x0, y0, z0, xmf3To.x / m_xmf3Scale.x - x0, xmf3To.y - y0, xmf3To.z / m_xmf3Scale.z - z0, true, &fHit, NULL));
+}
+
+#ifdef _WITH_HEIGHT_FIELD_STREAMING_BENCHMARK
+#include <psapi.h>
+
+//The synthetic map: hashed noise over a slope, so every sample differs from its neighbours and any misplaced tile shows
+static USHORT GetBenchmarkSample(int x, int z)
+{
+	UINT nHash = UINT(x) * 73856093u ^ UINT(z) * 19349663u;
+	nHash ^= nHash >> 13;
+	return(USHORT(((x + z) * 3 + (nHash & 0x3FF)) & 0xFFFF));
+}
+
+static SIZE_T GetWorkingSetSize()
+{
+	PROCESS_MEMORY_COUNTERS pmc;
+	pmc.cb = sizeof(PROCESS_MEMORY_COUNTERS);
+	return(::GetProcessMemoryInfo(::GetCurrentProcess(), &pmc, sizeof(PROCESS_MEMORY_COUNTERS)) ? pmc.WorkingSetSize : 0);
+}
+
+int BenchmarkHeightFieldStreaming(int nSize, int nMaxResidentTiles)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+	TCHAR pstrDebug[256] = { 0 };
+
+	TCHAR pstrTempPath[MAX_PATH], pstrRawFileName[MAX_PATH], pstrFileName[MAX_PATH];
+	::GetTempPath(MAX_PATH, pstrTempPath);
+	_stprintf_s(pstrRawFileName, MAX_PATH, _T("%sHeightField%d.raw"), pstrTempPath, nSize);
+	_stprintf_s(pstrFileName, MAX_PATH, _T("%sHeightField%d.hfld"), pstrTempPath, nSize);
+
+	//The raw map, top row first, one row at a time
+	HANDLE hRawFile = ::CreateFile(pstrRawFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hRawFile == INVALID_HANDLE_VALUE) return(1);
+	USHORT *pnRow = new USHORT[nSize];
+	DWORD nBytes = 0;
+	bool bWritten = true;
+	for (int z = nSize - 1; bWritten && (z >= 0); z--)
+	{
+		for (int x = 0; x < nSize; x++) pnRow[x] = ::GetBenchmarkSample(x, z);
+		bWritten = ::WriteFile(hRawFile, pnRow, nSize * sizeof(USHORT), &nBytes, NULL) && (nBytes == nSize * sizeof(USHORT));
+	}
+	delete[] pnRow;
+	::CloseHandle(hRawFile);
+
+	::QueryPerformanceCounter(&nBegin);
+	bool bCooked = bWritten && ::CookHeightField(pstrRawFileName, nSize, nSize, HEIGHT_FIELD_FORMAT_R16, pstrFileName);
+	::QueryPerformanceCounter(&nEnd);
+	double fCookSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+	::DeleteFile(pstrRawFileName);
+
+	CHeightField *pHeightField = new CHeightField(nMaxResidentTiles);
+	XMFLOAT3 xmf3Scale(8.0f, 1.0f / 64.0f, 8.0f);
+	if (!bCooked || !pHeightField->Open(pstrFileName, xmf3Scale))
+	{
+		OutputDebugString(_T("Height field streaming: the synthetic map could not be written or cooked\n"));
+		delete pHeightField;
+		::DeleteFile(pstrFileName);
+		return(1);
+	}
+
+	//A viewer crossing the map diagonally; at each step the 3 x 3 terrain patches (33 x 33 samples) around it and
+	//collision queries within a patch of it
+	const int nPatchSamples = 33, nQueriesPerStep = 256;
+	float *pfPatch = new float[nPatchSamples * nPatchSamples];
+	int nSteps = nSize / 16, nMismatches = 0;
+	long long nPatchSamplesRead = 0, nQueries = 0;
+	UINT nRandom = 1;
+	SIZE_T nWorkingSetBefore = ::GetWorkingSetSize(), nPeakWorkingSet = nWorkingSetBefore;
+
+	::QueryPerformanceCounter(&nBegin);
+	for (int s = 0; s < nSteps; s++)
+	{
+		int xViewer = s * 16, zViewer = (s * 16 * 3) / 4;
+		int xPatch = (xViewer / 32) * 32, zPatch = (zViewer / 32) * 32;
+		for (int pz = -1; pz <= 1; pz++)
+		{
+			for (int px = -1; px <= 1; px++)
+			{
+				int x0 = xPatch + px * 32, z0 = zPatch + pz * 32;
+				pHeightField->GetHeights(x0, z0, nPatchSamples, nPatchSamples, pfPatch);
+				nPatchSamplesRead += nPatchSamples * nPatchSamples;
+				for (int j = 0; j < nPatchSamples; j++)
+				{
+					for (int i = 0; i < nPatchSamples; i++)
+					{
+						int x = max(0, min(x0 + i, nSize - 1)), z = max(0, min(z0 + j, nSize - 1));
+						if (pfPatch[j * nPatchSamples + i] != float(::GetBenchmarkSample(x, z)) * xmf3Scale.y) nMismatches++;
+					}
+				}
+			}
+		}
+		for (int q = 0; q < nQueriesPerStep; q++)
+		{
+			nRandom = nRandom * 1664525 + 1013904223;
+			int x = xViewer + int((nRandom >> 8) & 31) - 16, z = zViewer + int((nRandom >> 16) & 31) - 16;
+			if ((x < 0) || (z < 0) || (x >= nSize) || (z >= nSize)) continue;
+			//At a sample both triangles give the sample itself
+			if (pHeightField->GetHeight(x * xmf3Scale.x, z * xmf3Scale.z) != float(::GetBenchmarkSample(x, z)) * xmf3Scale.y) nMismatches++;
+			nQueries++;
+		}
+		if ((s & 63) == 0) nPeakWorkingSet = max(nPeakWorkingSet, ::GetWorkingSetSize());
+	}
+	::QueryPerformanceCounter(&nEnd);
+	double fWalkSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+	nPeakWorkingSet = max(nPeakWorkingSet, ::GetWorkingSetSize());
+
+	_stprintf_s(pstrDebug, 256, _T("Height field streaming: %d x %d 16-bit (%d MB), cooked in %.2f s, %d resident tiles at most (%d KB)\n"), nSize, nSize, int((long long)nSize * nSize * 2 >> 20), fCookSeconds, nMaxResidentTiles, nMaxResidentTiles * (HEIGHT_FIELD_TILE_BYTES >> 10));
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    %d steps: %.1f M patch samples/s, %.1f M queries/s; %d tile maps, %d resident at peak, working set +%d KB; %d mismatches\n"), nSteps, double(nPatchSamplesRead) / fWalkSeconds * 1.0e-6, double(nQueries) / fWalkSeconds * 1.0e-6, pHeightField->GetTileMaps(), pHeightField->GetPeakResidentTiles(), int((nPeakWorkingSet - nWorkingSetBefore) >> 10), nMismatches);
+	OutputDebugString(pstrDebug);
+	int nFailures = nMismatches + pHeightField->GetMapFailures();
+
+	delete[] pfPatch;
+	delete pHeightField;
+	::DeleteFile(pstrFileName);
+
+	return(nFailures);
+}
+#endif
@@ -0,0 +1,144 @@
+//-----------------------------------------------------------------------------
+// File: HeightField.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+//Large height maps (up to 16384 x 16384 samples of 8, 16 or 32-bit float) that are never loaded whole. A raw height map
+//is cooked once (CookHeightField) into tiles of 64 KB; CHeightField maps a view of each tile the first time a query
+//touches it and unmaps the least recently used one when m_nMaxResidentTiles are mapped, so a query, a terrain patch
+//(GetHeights) or a collision test only brings in the tiles around it. A min/max pyramid of the samples is cooked after
+//the tiles and read whole by Open, so segment tests skip the regions they pass above without mapping them.
+//Coordinates follow CHeightMapImage: x along the rows, z up from the last row of the raw file, world = sample * scale.
+//Not thread-safe: every query may map and unmap tiles.
+
+#define HEIGHT_FIELD_MAGIC				0x444C4648 //'HFLD'
+#define HEIGHT_FIELD_VERSION			2 //2: the pyramid
+#define HEIGHT_FIELD_TILE_BYTES			65536 //One view per tile; also the allocation granularity view offsets must be multiples of
+#define HEIGHT_FIELD_TILE_WIDTH			128 //Samples; the tile length follows from the sample size (512, 256 or 128 rows)
+#define HEIGHT_FIELD_MAX_SIZE			16384
+#define HEIGHT_FIELD_PYRAMID_SHIFT		4 //Blocks of 16 x 16 quads on level 0 of the pyramid: 8 MB for the largest field
+
+//Bytes per sample
+#define HEIGHT_FIELD_FORMAT_R8			1
+#define HEIGHT_FIELD_FORMAT_R16			2
+#define HEIGHT_FIELD_FORMAT_R32F		4
+
+//The first HEIGHT_FIELD_TILE_BYTES of the file; tile i follows at (i + 1) * HEIGHT_FIELD_TILE_BYTES, the tiles row by
+//row, each row-major. Tiles over the last row or column repeat it. The m_nPyramidLevels levels of the pyramid follow
+//the last tile, each rows of (lowest, highest) sample pairs in floats.
+struct HEIGHTFIELDHEADER
+{
+	UINT							m_nMagic;
+	UINT							m_nVersion;
+	UINT							m_nWidth;
+	UINT							m_nLength;
+	UINT							m_nFormat;
+	UINT							m_nTileWidth;
+	UINT							m_nTileLength;
+	UINT							m_nTilesX;
+	UINT							m_nTilesZ;
+	float							m_fMinSample;
+	float							m_fMaxSample;
+	UINT							m_nPyramidLevels;
+};
+
+struct HEIGHTFIELDTILE
+{
+	int								m_nTile = -1;
+	BYTE							*m_pSamples = NULL; //The mapped view
+	UINT64							m_nLastUse = 0;
+};
+
+class CHeightField
+{
+public:
+	CHeightField(int nMaxResidentTiles);
+	virtual ~CHeightField();
+
+private:
+	HANDLE							m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE							m_hFileMapping = NULL;
+	HEIGHTFIELDHEADER				m_Header;
+	XMFLOAT3						m_xmf3Scale = XMFLOAT3(1.0f, 1.0f, 1.0f);
+
+	int								m_nMaxResidentTiles = 0;
+	int								m_nResidentTiles = 0;
+	HEIGHTFIELDTILE					*m_pResidentTiles = NULL;
+	int								*m_pnTileSlots = NULL; //Per tile: its slot in m_pResidentTiles, -1 when not mapped
+	int								m_nLastSlot = -1; //Most queries fall in the tile of the previous one
+	UINT64							m_nUses = 0;
+
+	int								m_nTileMaps = 0;
+	int								m_nPeakResidentTiles = 0;
+	int								m_nMapFailures = 0;
+
+	//Level 0 has one block per 16 x 16 quads, every level above halves both counts (rounding up) up to a single
+	//block; rows of m_pnPyramidWidths[level] (lowest, highest) pairs of unscaled samples, all in m_pfPyramid
+	float							*m_pfPyramid = NULL;
+	float							**m_ppfPyramid = NULL;
+	int								*m_pnPyramidWidths = NULL;
+
+	BYTE *GetTileSamples(int nTile);
+
+	//Height field space: x and z in samples, y in world units; t along start + t * delta (CHeightMapImage)
+	bool IntersectQuad(int x, int z, float x0, float y0, float z0, float dx, float dy, float dz, float ta, float tb, float *pfHit, XMFLOAT3 *pxmf3Normal);
+	//The quads from (x, z) the segment crosses between ta and tb, in order
+	bool IntersectQuads(int x, int z, float x0, float y0, float z0, float dx, float dy, float dz, float ta, float tb, float *pfHit, XMFLOAT3 *pxmf3Normal);
+	bool MarchPyramid(float x0, float y0, float z0, float dx, float dy, float dz, bool bAnyHit, float *pfHit, XMFLOAT3 *pxmf3Normal);
+
+public:
+	bool Open(LPCTSTR pstrFileName, XMFLOAT3 xmf3Scale);
+	//The height field cooked from a raw height map, named after it with the extension .hfld; cooked again first when
+	//that is missing, older than the raw file or of another size or format
+	bool OpenRaw(LPCTSTR pstrRawFileName, int nWidth, int nLength, int nFormat, XMFLOAT3 xmf3Scale);
+	void Close();
+
+	int GetWidth() { return(m_Header.m_nWidth); }
+	int GetLength() { return(m_Header.m_nLength); }
+	int GetFormat() { return(m_Header.m_nFormat); }
+	XMFLOAT3 GetScale() { return(m_xmf3Scale); }
+	float GetMinHeight() { return(m_Header.m_fMinSample * m_xmf3Scale.y); }
+	float GetMaxHeight() { return(m_Header.m_fMaxSample * m_xmf3Scale.y); }
+
+	//Unscaled; x and z clamped to the field. A tile that cannot be mapped reads as 0 (GetMapFailures counts them)
+	float GetSample(int x, int z);
+	//World units; the triangles of CHeightMapImage::GetHeight, 0 outside the field
+	float GetHeight(float fx, float fz, bool bReverseQuad = false);
+	//The normal at sample (x, z), as CHeightMapImage::GetHeightMapNormal
+	XMFLOAT3 GetNormal(int x, int z);
+	//World heights of the nWidth x nLength samples from (x, z), row by row (a terrain patch); clamped to the field.
+	//false when a tile cannot be mapped, the heights from it on are then 0
+	bool GetHeights(int x, int z, int nWidth, int nLength, float *pfHeights);
+	//GetHeight of nPoints points (world x and z) and, if pxmf3Normals, GetNormal of the sample each is in
+	void GetHeightsAndNormals(float *pfx, float *pfz, int nPoints, float *pfHeights, XMFLOAT3 *pxmf3Normals = NULL, bool bReverseQuad = false);
+
+	//World units, as CHeightMapImage::IntersectSegment: the first point of the segment below the surface of GetHeight
+	//as a fraction of it, the part outside the field not tested. Maps only the tiles of the level 0 blocks of the
+	//pyramid the segment does not pass above.
+	bool IntersectSegment(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, float *pfHit, XMFLOAT3 *pxmf3Normal = NULL);
+	bool IntersectRay(XMFLOAT3& xmf3Origin, XMFLOAT3& xmf3Direction, float fMaxDistance, float *pfDistance, XMFLOAT3 *pxmf3Normal = NULL);
+	bool IsVisible(XMFLOAT3& xmf3From, XMFLOAT3& xmf3To);
+	int GetPyramidLevels() { return(m_Header.m_nPyramidLevels); }
+
+	int GetResidentTiles() { return(m_nResidentTiles); }
+	int GetPeakResidentTiles() { return(m_nPeakResidentTiles); }
+	int GetTileMaps() { return(m_nTileMaps); }
+	int GetMapFailures() { return(m_nMapFailures); }
+};
+
+//A raw height map (nFormat bytes per sample, rows top first like Image/terrain.raw) to a tiled height field file. Reads
+//one row of tiles at a time, so cooking a 16384 x 16384 map takes 8 MB and another 11 MB for the pyramid.
+bool CookHeightField(LPCTSTR pstrRawFileName, int nWidth, int nLength, int nFormat, LPCTSTR pstrFileName);
+
+//The normal of a sample from its world height and those of the next samples in x and z (CHeightMapImage::GetHeightMapNormal)
+XMFLOAT3 GetHeightFieldNormal(float fHeight, float fNextXHeight, float fNextZHeight, XMFLOAT3& xmf3Scale);
+
+#ifdef _WITH_HEIGHT_FIELD_STREAMING_BENCHMARK
+//Headless: writes a synthetic nSize x nSize 16-bit raw map to the temporary directory, cooks it and walks a viewer across
+//it building terrain patches and collision queries around it with nMaxResidentTiles tiles; checks the samples
+//against the generator and reports the tiles mapped, the resident peak and the growth of the working set. Returns
+//the samples that differ plus the tiles that could not be mapped (1 when the map cannot be written or cooked).
+int BenchmarkHeightFieldStreaming(
+int nSize, int nMaxResidentTiles);
+#endif
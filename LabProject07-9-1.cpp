@@ -4,6 +4,7 @@
 #include "stdafx.h"
 #include "LabProject07-9-1.h"
 #include "GameFramework.h"
+#include "ModelFile.h"
 
 #define MAX_LOADSTRING 100
 
@@ -23,6 +24,27 @@ int APIENTRY _tWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCm
 	UNREFERENCED_PARAMETER(hPrevInstance);
 	UNREFERENCED_PARAMETER(lpCmdLine);
 
+	if (!::IsAVX2Supported())
+	{
+		::MessageBox(NULL, _T("This program needs a processor with AVX2."), NULL, MB_OK | MB_ICONERROR);
+		return(FALSE);
+	}
+
+	//Offline model cooking: LabProject07-9-1.exe /cook [/force] Model/Apache.bin Model/helicopter.bin ...
+	//The messages go to the console of the command prompt; the exit code is the number of models that failed (run it with
+	//"start /wait" or from a batch file to wait for it and read %ERRORLEVEL%)
+	if ((__argc > 1) && !_tcscmp(__targv[1], _T("/cook")))
+	{
+		FILE *pConsoleFile = NULL;
+		if (::AttachConsole(ATTACH_PARENT_PROCESS))
+		{
+			::freopen_s(&pConsoleFile, "CONOUT$", "w", stdout);
+			::freopen_s(&pConsoleFile, "CONOUT$", "w", stderr);
+		}
+		return(::CookModelFiles(__argc - 2, __targv + 2));
+	}
+
+
 	MSG msg;
 	HACCEL hAccelTable;
 
@@ -4,21 +4,44 @@
 
 #include "stdafx.h"
 #include "Mesh.h"
+#include "Camera.h"
+#include "VertexPacking.h"
+#include "MeshSimplifier.h"
+#include "MeshCluster.h"
+#include "ThreadPool.h"
+#include "HeightField.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//GetHeightsAndNormals is bit-identical to GetHeight and GetHeightMapNormal only if neither fuses multiplies and adds
+//(/arch:AVX2 allows it before VS 2022)
+#pragma fp_contract(off)
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 //
 CMeshLoadInfo::~CMeshLoadInfo()
 {
-	if (m_pxmf3Positions) delete[] m_pxmf3Positions;
-	if (m_pxmf4Colors) delete[] m_pxmf4Colors;
-	if (m_pxmf3Normals) delete[] m_pxmf3Normals;
+	if (!m_bMappedArrays)
+	{
+		if (m_pxmf3Positions) delete[] m_pxmf3Positions;
+		if (m_pxmf4Colors) delete[] m_pxmf4Colors;
+		if (m_pxmf3Normals) delete[] m_pxmf3Normals;
+		if (m_pxmf2TexCoords) delete[] m_pxmf2TexCoords;
 
-	if (m_pnIndices) delete[] m_pnIndices;
-	
-	if (m_pnSubSetIndices) delete[] m_pnSubSetIndices;
+		if (m_pnIndices) delete[] m_pnIndices;
+
+		for (int i = 0; i < m_nSubMeshes; i++) if (m_ppnSubSetIndices[i]) delete[] m_ppnSubSetIndices[i];
+		for (int i = 0; i < (m_nLods - 1) * m_nSubMeshes; i++) if (m_ppnLodSubSetIndices && m_ppnLodSubSetIndices[i]) delete[] m_ppnLodSubSetIndices[i];
+		for (int i = 0; i < m_nLods * m_nSubMeshes; i++) if (m_ppSubSetClusters && m_ppSubSetClusters[i]) delete[] m_ppSubSetClusters[i];
+	}
 
-	for (int i = 0; i < m_nSubMeshes; i++) if (m_ppnSubSetIndices[i]) delete[] m_ppnSubSetIndices[i];
+	if (m_pnSubSetIndices) delete[] m_pnSubSetIndices;
 	if (m_ppnSubSetIndices) delete[] m_ppnSubSetIndices;
+	if (m_pnLodSubSetIndices) delete[] m_pnLodSubSetIndices;
+	if (m_ppnLodSubSetIndices) delete[] m_ppnLodSubSetIndices;
+	if (m_pnSubSetClusters) delete[] m_pnSubSetClusters;
+	if (m_ppSubSetClusters) delete[] m_ppSubSetClusters;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
@@ -34,6 +57,14 @@ CMeshFromFile::CMeshFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList
 	m_d3dPositionBufferView.StrideInBytes = sizeof(XMFLOAT3);
 	m_d3dPositionBufferView.SizeInBytes = sizeof(XMFLOAT3) * m_nVertices;
 
+	CreateSubSetIndexBuffers(pd3dDevice, pd3dCommandList, pMeshInfo);
+}
+
+void CMeshFromFile::CreateSubSetIndexBuffers(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, CMeshLoadInfo *pMeshInfo)
+{
+	m_xmf3AABBCenter = pMeshInfo->m_xmf3AABBCenter;
+	m_xmf3AABBExtents = pMeshInfo->m_xmf3AABBExtents;
+
 	m_nSubMeshes = pMeshInfo->m_nSubMeshes;
 	if (m_nSubMeshes > 0)
 	{
@@ -43,14 +74,75 @@ CMeshFromFile::CMeshFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList
 
 		m_pnSubSetIndices = new int[m_nSubMeshes];
 
+		m_nLods = (pMeshInfo->m_ppnLodSubSetIndices) ? pMeshInfo->m_nLods : 1;
+		for (int l = 0; l < m_nLods; l++) m_pfLodErrors[l] = pMeshInfo->m_pfLodErrors[l];
+		m_pnLodSubSetStarts = new int[m_nLods * m_nSubMeshes];
+		m_pnLodSubSetIndices = new int[m_nLods * m_nSubMeshes];
+
 		for (int i = 0; i < m_nSubMeshes; i++)
 		{
 			m_pnSubSetIndices[i] = pMeshInfo->m_pnSubSetIndices[i];
-			m_ppd3dSubSetIndexBuffers[i] = ::CreateBufferResource(pd3dDevice, pd3dCommandList, pMeshInfo->m_ppnSubSetIndices[i], sizeof(UINT) * m_pnSubSetIndices[i], D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_INDEX_BUFFER, &m_ppd3dSubSetIndexUploadBuffers[i]);
+
+			int nIndices = 0;
+			for (int l = 0; l < m_nLods; l++)
+			{
+				m_pnLodSubSetStarts[l * m_nSubMeshes + i] = nIndices;
+				m_pnLodSubSetIndices[l * m_nSubMeshes + i] = (l > 0) ? pMeshInfo->m_pnLodSubSetIndices[(l - 1) * m_nSubMeshes + i] : m_pnSubSetIndices[i];
+				nIndices += m_pnLodSubSetIndices[l * m_nSubMeshes + i];
+			}
+
+			UINT *pnIndices = pMeshInfo->m_ppnSubSetIndices[i];
+			if (m_nLods > 1)
+			{
+				pnIndices = new UINT[nIndices];
+				for (int l = 0; l < m_nLods; l++)
+				{
+					UINT *pnLodIndices = (l > 0) ? pMeshInfo->m_ppnLodSubSetIndices[(l - 1) * m_nSubMeshes + i] : pMeshInfo->m_ppnSubSetIndices[i];
+					if (m_pnLodSubSetIndices[l * m_nSubMeshes + i] > 0) memcpy(&pnIndices[m_pnLodSubSetStarts[l * m_nSubMeshes + i]], pnLodIndices, sizeof(UINT) * m_pnLodSubSetIndices[l * m_nSubMeshes + i]);
+				}
+			}
+
+			m_ppd3dSubSetIndexBuffers[i] = ::CreateBufferResource(pd3dDevice, pd3dCommandList, pnIndices, sizeof(UINT) * nIndices, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_INDEX_BUFFER, &m_ppd3dSubSetIndexUploadBuffers[i]);
+			if (pnIndices != pMeshInfo->m_ppnSubSetIndices[i]) delete[] pnIndices;
 
 			m_pd3dSubSetIndexBufferViews[i].BufferLocation = m_ppd3dSubSetIndexBuffers[i]->GetGPUVirtualAddress();
 			m_pd3dSubSetIndexBufferViews[i].Format = DXGI_FORMAT_R32_UINT;
-			m_pd3dSubSetIndexBufferViews[i].SizeInBytes = sizeof(UINT) * pMeshInfo->m_pnSubSetIndices[i];
+			m_pd3dSubSetIndexBufferViews[i].SizeInBytes = sizeof(UINT) * nIndices;
+		}
+
+		if (pMeshInfo->m_ppSubSetClusters) CreateClusterBlocks(pMeshInfo);
+	}
+}
+
+void CMeshFromFile::CreateClusterBlocks(CMeshLoadInfo *pMeshInfo)
+{
+	int nRanges = m_nLods * m_nSubMeshes, nBlocks = 0;
+	m_pnLodSubSetFirstBlocks = new int[nRanges];
+	m_pnLodSubSetClusters = new int[nRanges];
+	for (int i = 0; i < nRanges; i++)
+	{
+		m_pnLodSubSetFirstBlocks[i] = nBlocks;
+		m_pnLodSubSetClusters[i] = pMeshInfo->m_pnSubSetClusters[i];
+		nBlocks += (m_pnLodSubSetClusters[i] + 3) / 4;
+	}
+
+	m_pClusterBlocks = new MESHCLUSTERBLOCK[max(nBlocks, 1)];
+	m_pnClusterIndexStarts = new UINT[max(nBlocks, 1) * 4];
+	m_pnClusterIndices = new UINT[max(nBlocks, 1) * 4];
+	m_pnVisibleRangeStarts = new UINT[max(nBlocks, 1) * 4];
+	m_pnVisibleRangeIndices = new UINT[max(nBlocks, 1) * 4];
+	m_pnVisibleRanges = new int[m_nSubMeshes];
+	for (int i = 0; i < m_nSubMeshes; i++) m_pnVisibleRanges[i] = -1;
+
+	for (int i = 0; i < nRanges; i++)
+	{
+		MESHCLUSTER *pClusters = pMeshInfo->m_ppSubSetClusters[i];
+		int nFirst = m_pnLodSubSetFirstBlocks[i] * 4;
+		::CreateMeshClusterBlocks(pClusters, m_pnLodSubSetClusters[i], &m_pClusterBlocks[m_pnLodSubSetFirstBlocks[i]]);
+		for (int j = 0; j < m_pnLodSubSetClusters[i]; j++)
+		{
+			m_pnClusterIndexStarts[nFirst + j] = m_pnLodSubSetStarts[i] + pClusters[j].m_nIndexStart;
+			m_pnClusterIndices[nFirst + j] = pClusters[j].m_nIndices;
 		}
 	}
 }
@@ -69,6 +161,17 @@ CMeshFromFile::~CMeshFromFile()
 		if (m_pd3dSubSetIndexBufferViews) delete[] m_pd3dSubSetIndexBufferViews;
 
 		if (m_pnSubSetIndices) delete[] m_pnSubSetIndices;
+		if (m_pnLodSubSetStarts) delete[] m_pnLodSubSetStarts;
+		if (m_pnLodSubSetIndices) delete[] m_pnLodSubSetIndices;
+
+		if (m_pClusterBlocks) delete[] m_pClusterBlocks;
+		if (m_pnClusterIndexStarts) delete[] m_pnClusterIndexStarts;
+		if (m_pnClusterIndices) delete[] m_pnClusterIndices;
+		if (m_pnLodSubSetFirstBlocks) delete[] m_pnLodSubSetFirstBlocks;
+		if (m_pnLodSubSetClusters) delete[] m_pnLodSubSetClusters;
+		if (m_pnVisibleRanges) delete[] m_pnVisibleRanges;
+		if (m_pnVisibleRangeStarts) delete[] m_pnVisibleRangeStarts;
+		if (m_pnVisibleRangeIndices) delete[] m_pnVisibleRangeIndices;
 	}
 }
 
@@ -90,14 +193,23 @@ void CMeshFromFile::ReleaseUploadBuffers()
 	}
 }
 
-void CMeshFromFile::Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet)
+void CMeshFromFile::DrawSubSet(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet, int nLod)
 {
-	pd3dCommandList->IASetPrimitiveTopology(m_d3dPrimitiveTopology);
-	pd3dCommandList->IASetVertexBuffers(m_nSlot, 1, &m_d3dPositionBufferView);
 	if ((m_nSubMeshes > 0) && (nSubSet < m_nSubMeshes))
 	{
+		nLod = min(nLod, m_nLods - 1);
+		int nLodSubSet = nLod * m_nSubMeshes + nSubSet;
 		pd3dCommandList->IASetIndexBuffer(&(m_pd3dSubSetIndexBufferViews[nSubSet]));
-		pd3dCommandList->DrawIndexedInstanced(m_pnSubSetIndices[nSubSet], 1, 0, 0, 0);
+		if (m_pnVisibleRanges && (m_pnVisibleRanges[nSubSet] >= 0) && (m_nCulledLod == nLod))
+		{
+			int nFirst = m_pnLodSubSetFirstBlocks[nLodSubSet] * 4;
+			for (int i = 0; i < m_pnVisibleRanges[nSubSet]; i++) pd3dCommandList->DrawIndexedInstanced(m_pnVisibleRangeIndices[nFirst + i], 1, m_pnVisibleRangeStarts[nFirst + i], 0, 0);
+			m_pnVisibleRanges[nSubSet] = -1;
+		}
+		else
+		{
+			pd3dCommandList->DrawIndexedInstanced(m_pnLodSubSetIndices[nLodSubSet], 1, m_pnLodSubSetStarts[nLodSubSet], 0, 0);
+		}
 	}
 	else
 	{
@@ -105,6 +217,59 @@ void CMeshFromFile::Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubS
 	}
 }
 
+void CMeshFromFile::Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet, int nLod)
+{
+	pd3dCommandList->IASetPrimitiveTopology(m_d3dPrimitiveTopology);
+	pd3dCommandList->IASetVertexBuffers(m_nSlot, 1, &m_d3dPositionBufferView);
+
+	DrawSubSet(pd3dCommandList, nSubSet, nLod);
+}
+
+//Coarsest level whose geometric error, projected at the distance of the bounds, stays under MESH_LOD_PIXEL_ERROR
+int CMeshFromFile::SelectLod(CCamera *pCamera, XMFLOAT4X4 *pxmf4x4World)
+{
+	if ((m_nLods <= 1) || !pCamera) return(0);
+
+	XMMATRIX xmmtxWorld = XMLoadFloat4x4(pxmf4x4World);
+	float fScale = max(XMVectorGetX(XMVector3Length(xmmtxWorld.r[0])), max(XMVectorGetX(XMVector3Length(xmmtxWorld.r[1])), XMVectorGetX(XMVector3Length(xmmtxWorld.r[2]))));
+
+	XMVECTOR xmvCenter = XMVector3TransformCoord(XMLoadFloat3(&m_xmf3AABBCenter), xmmtxWorld);
+	float fRadius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&m_xmf3AABBExtents))) * fScale;
+	float fDistance = XMVectorGetX(XMVector3Length(xmvCenter - XMLoadFloat3(&pCamera->GetPosition()))) - fRadius;
+
+	float fPixelsPerUnit = pCamera->GetProjectionMatrix()._22 * pCamera->GetViewport().Height * 0.5f;
+
+	return(::SelectMeshLod(m_pfLodErrors, m_nLods, fScale, fDistance, fPixelsPerUnit));
+}
+
+//The ranges are kept per subset until that subset is drawn, so a mesh shared by several objects is culled again for each of them
+bool CMeshFromFile::CullClusters(CCamera *pCamera, XMFLOAT4X4 *pxmf4x4World, int nLod)
+{
+	if (!m_pClusterBlocks || !pCamera) return(true);
+
+	XMFLOAT4X4 xmf4x4View = pCamera->GetViewMatrix();
+	XMFLOAT4X4 xmf4x4Projection = pCamera->GetProjectionMatrix();
+	MESHCLUSTERCULLINFO xCullInfo;
+	::GetMeshClusterCullInfo(pxmf4x4World, &xmf4x4View, &xmf4x4Projection, &xCullInfo);
+
+	m_nCulledLod = min(nLod, m_nLods - 1);
+	int nVisibleRanges = 0;
+	for (int i = 0; i < m_nSubMeshes; i++)
+	{
+		int nLodSubSet = m_nCulledLod * m_nSubMeshes + i, nFirst = m_pnLodSubSetFirstBlocks[nLodSubSet] * 4;
+		m_pnVisibleRanges[i] = ::CullMeshClusters(&m_pClusterBlocks[m_pnLodSubSetFirstBlocks[nLodSubSet]], &m_pnClusterIndexStarts[nFirst], &m_pnClusterIndices[nFirst], m_pnLodSubSetClusters[nLodSubSet], &xCullInfo, &m_pnVisibleRangeStarts[nFirst], &m_pnVisibleRangeIndices[nFirst]);
+		nVisibleRanges += m_pnVisibleRanges[i];
+	}
+
+	if (nVisibleRanges == 0)
+	{
+		for (int i = 0; i < m_nSubMeshes; i++) m_pnVisibleRanges[i] = -1;
+		return(false);
+	}
+
+	return(true);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 //
 CMeshIlluminatedFromFile::CMeshIlluminatedFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, CMeshLoadInfo *pMeshInfo) : CMeshFromFile::CMeshFromFile(pd3dDevice, pd3dCommandList, pMeshInfo)
@@ -141,73 +306,202 @@ void CMeshIlluminatedFromFile::ReleaseUploadBuffers()
 	m_pd3dNormalUploadBuffer = NULL;
 }
 
-void CMeshIlluminatedFromFile::Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet)
+void CMeshIlluminatedFromFile::Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet, int nLod)
 {
 	pd3dCommandList->IASetPrimitiveTopology(m_d3dPrimitiveTopology);
 
 	D3D12_VERTEX_BUFFER_VIEW pVertexBufferViews[3] = { m_d3dPositionBufferView, m_d3dNormalBufferView, m_d3dTexCoordBufferView };
 	pd3dCommandList->IASetVertexBuffers(m_nSlot, 3, pVertexBufferViews);
 
-	if ((m_nSubMeshes > 0) && (nSubSet < m_nSubMeshes))
-	{
-		pd3dCommandList->IASetIndexBuffer(&(m_pd3dSubSetIndexBufferViews[nSubSet]));
-		pd3dCommandList->DrawIndexedInstanced(m_pnSubSetIndices[nSubSet], 1, 0, 0, 0);
-	}
-	else
-	{
-		pd3dCommandList->DrawInstanced(m_nVertices, 1, m_nOffset, 0);
-	}
+	DrawSubSet(pd3dCommandList, nSubSet, nLod);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+//
+CMeshPackedFromFile::CMeshPackedFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, CMeshLoadInfo *pMeshInfo)
+{
+	m_nVertices = pMeshInfo->m_nVertices;
+	m_nType = pMeshInfo->m_nType | VERTEXT_PACKED;
+
+	PACKEDVERTEXLAYOUT xLayout;
+	::GetPackedVertexLayout(pMeshInfo, PACKED_VERTEX_FLAGS, &xLayout);
+	m_xmf4PositionScale = xLayout.m_xmf4PositionScale;
+	m_xmf4PositionBias = xLayout.m_xmf4PositionBias;
+
+	BYTE *pVertices = ::PackVertices(pMeshInfo, &xLayout);
+	m_pd3dPositionBuffer = ::CreateBufferResource(pd3dDevice, pd3dCommandList, pVertices, xLayout.m_nStride * m_nVertices, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, &m_pd3dPositionUploadBuffer);
+	delete[] pVertices;
+
+	m_d3dPositionBufferView.BufferLocation = m_pd3dPositionBuffer->GetGPUVirtualAddress();
+	m_d3dPositionBufferView.StrideInBytes = xLayout.m_nStride;
+	m_d3dPositionBufferView.SizeInBytes = xLayout.m_nStride * m_nVertices;
+
+	CreateSubSetIndexBuffers(pd3dDevice, pd3dCommandList, pMeshInfo);
+}
+
+CMeshPackedFromFile::~CMeshPackedFromFile()
+{
+}
+
+void CMeshPackedFromFile::Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet, int nLod)
+{
+	//Root constants 32..39 of the GameObject parameter (gf4PositionScale, gf4PositionBias)
+	pd3dCommandList->SetGraphicsRoot32BitConstants(1, 4, &m_xmf4PositionScale, 32);
+	pd3dCommandList->SetGraphicsRoot32BitConstants(1, 4, &m_xmf4PositionBias, 36);
+
+	CMeshFromFile::Render(pd3dCommandList, nSubSet, nLod);
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // 
-CHeightMapImage::CHeightMapImage(LPCTSTR pFileName, int nWidth, int nLength, XMFLOAT3 xmf3Scale)
+CHeightMapImage::CHeightMapImage(LPCTSTR pFileName, int nWidth, int nLength, XMFLOAT3 xmf3Scale, bool bTiled)
 {
-	m_nWidth = nWidth;
-	m_nLength = nLength;
-	m_xmf3Scale = xmf3Scale;
-
-	BYTE* pHeightMapPixels = new BYTE[m_nWidth * m_nLength];
+	CreatePixels(nWidth, nLength, xmf3Scale, bTiled);
 
+	//One row at a time, flipped straight into place (the file has the top row first)
+	BYTE *pRow = new BYTE[m_nWidth];
 	HANDLE hFile = ::CreateFile(pFileName, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_ATTRIBUTE_READONLY, NULL);
 	DWORD dwBytesRead;
-	::ReadFile(hFile, pHeightMapPixels, (m_nWidth * m_nLength), &dwBytesRead, NULL);
+	for (int y = 0; y < m_nLength; y++)
+	{
+		::ReadFile(hFile, pRow, m_nWidth, &dwBytesRead, NULL);
+		SetPixelRow(m_nLength - 1 - y, pRow);
+	}
 	::CloseHandle(hFile);
+	delete[] pRow;
 
-	m_pHeightMapPixels = new BYTE[m_nWidth * m_nLength];
-	for (int y = 0; y < m_nLength; y++)
+	BuildPyramid();
+}
+
+CHeightMapImage::CHeightMapImage(BYTE *pPixels, int nWidth, int nLength, XMFLOAT3 xmf3Scale, bool bTiled)
+{
+	CreatePixels(nWidth, nLength, xmf3Scale, bTiled);
+	for (int y = 0; y < m_nLength; y++) SetPixelRow(m_nLength - 1 - y, &pPixels[y * m_nWidth]);
+
+	BuildPyramid();
+}
+
+void CHeightMapImage::CreatePixels(int nWidth, int nLength, XMFLOAT3 xmf3Scale, bool bTiled)
+{
+	m_nWidth = nWidth;
+	m_nLength = nLength;
+	m_xmf3Scale = xmf3Scale;
+	m_bTiled = bTiled;
+	if (m_bTiled)
 	{
-		for (int x = 0; x < m_nWidth; x++)
-		{
-			m_pHeightMapPixels[x + ((m_nLength - 1 - y) * m_nWidth)] = pHeightMapPixels[x + (y * m_nWidth)];
-		}
+		m_nTilesX = (m_nWidth >> HEIGHT_MAP_TILE_SHIFT) + 1;
+		m_nTilesZ = (m_nLength >> HEIGHT_MAP_TILE_SHIFT) + 1;
+		m_nPixels = (m_nTilesX * m_nTilesZ) << (2 * HEIGHT_MAP_TILE_SHIFT);
+	}
+	else
+	{
+		m_nPixels = m_nWidth * m_nLength;
+	}
+	m_pHeightMapPixels = new BYTE[m_nPixels];
+}
+
+void CHeightMapImage::SetPixelRow(int z, BYTE *pRow)
+{
+	if (!m_bTiled)
+	{
+		memcpy(&m_pHeightMapPixels[z * m_nWidth], pRow, m_nWidth);
+		return;
 	}
 
-	if (pHeightMapPixels) delete[] pHeightMapPixels;
+	int nPaddedWidth = m_nTilesX << HEIGHT_MAP_TILE_SHIFT, nPaddedLength = m_nTilesZ << HEIGHT_MAP_TILE_SHIFT;
+	for (int cz = z; cz < ((z == m_nLength - 1) ? nPaddedLength : z + 1); cz++)
+	{
+		for (int x = 0; x < nPaddedWidth; x++) m_pHeightMapPixels[GetPixelIndex(x, cz)] = pRow[min(x, m_nWidth - 1)];
+	}
 }
 
 CHeightMapImage::~CHeightMapImage()
 {
 	if (m_pHeightMapPixels) delete[] m_pHeightMapPixels;
 	m_pHeightMapPixels = NULL;
+
+	if (m_ppnPyramid)
+	{
+		for (int i = 0; i < m_nPyramidLevels; i++) delete[] m_ppnPyramid[i];
+		delete[] m_ppnPyramid;
+	}
+	if (m_pnPyramidWidths) delete[] m_pnPyramidWidths;
+}
+
+void CHeightMapImage::BuildPyramid()
+{
+	int nWidth = m_nWidth - 1, nLength = m_nLength - 1;
+	for (m_nPyramidLevels = 1; (nWidth > 1) || (nLength > 1); m_nPyramidLevels++)
+	{
+		nWidth = (nWidth + 1) / 2;
+		nLength = (nLength + 1) / 2;
+	}
+	m_ppnPyramid = new BYTE*[m_nPyramidLevels];
+	m_pnPyramidWidths = new int[m_nPyramidLevels];
+
+	//Level 0: the four corners of every quad
+	nWidth = m_nWidth - 1;
+	nLength = m_nLength - 1;
+	m_pnPyramidWidths[0] = nWidth;
+	m_ppnPyramid[0] = new BYTE[nWidth * nLength * 2];
+	for (int z = 0; z < nLength; z++)
+	{
+		for (int x = 0; x < nWidth; x++)
+		{
+			BYTE nBottomLeft = GetPixel(x, z), nBottomRight = GetPixel(x + 1, z), nTopLeft = GetPixel(x, z + 1), nTopRight = GetPixel(x + 1, z + 1);
+			BYTE nMin = min(min(nBottomLeft, nBottomRight), min(nTopLeft, nTopRight));
+			BYTE nMax = max(max(nBottomLeft, nBottomRight), max(nTopLeft, nTopRight));
+			m_ppnPyramid[0][(x + (z * nWidth)) * 2 + 0] = nMin;
+			m_ppnPyramid[0][(x + (z * nWidth)) * 2 + 1] = nMax;
+		}
+	}
+
+	for (int i = 1; i < m_nPyramidLevels; i++)
+	{
+		int nChildWidth = nWidth, nChildLength = nLength;
+		nWidth = (nWidth + 1) / 2;
+		nLength = (nLength + 1) / 2;
+		m_pnPyramidWidths[i] = nWidth;
+		m_ppnPyramid[i] = new BYTE[nWidth * nLength * 2];
+		for (int z = 0; z < nLength; z++)
+		{
+			for (int x = 0; x < nWidth; x++)
+			{
+				BYTE nMin = 255, nMax = 0;
+				for (int cz = z * 2; cz < min(z * 2 + 2, nChildLength); cz++)
+				{
+					for (int cx = x * 2; cx < min(x * 2 + 2, nChildWidth); cx++)
+					{
+						BYTE *pChild = &m_ppnPyramid[i - 1][(cx + (cz * nChildWidth)) * 2];
+						nMin = min(nMin, pChild[0]);
+						nMax = max(nMax, pChild[1]);
+					}
+				}
+				m_ppnPyramid[i][(x + (z * nWidth)) * 2 + 0] = nMin;
+				m_ppnPyramid[i][(x + (z * nWidth)) * 2 + 1] = nMax;
+			}
+		}
+	}
 }
 
 XMFLOAT3 CHeightMapImage::GetHeightMapNormal(int x, int z)
 {
 	if ((x < 0.0f) || (z < 0.0f) || (x >= m_nWidth) || (z >= m_nLength)) return(XMFLOAT3(0.0f, 1.0f, 0.0f));
 
-	int nHeightMapIndex = x + (z * m_nWidth);
-	int xHeightMapAdd = (x < (m_nWidth - 1)) ? 1 : -1;
-	int zHeightMapAdd = (z < (m_nLength - 1)) ? m_nWidth : -m_nWidth;
-	float y1 = (float)m_pHeightMapPixels[nHeightMapIndex] * m_xmf3Scale.y;
-	float y2 = (float)m_pHeightMapPixels[nHeightMapIndex + xHeightMapAdd] * m_xmf3Scale.y;
-	float y3 = (float)m_pHeightMapPixels[nHeightMapIndex + zHeightMapAdd] * m_xmf3Scale.y;
-	XMFLOAT3 xmf3Edge1 = XMFLOAT3(0.0f, y3 - y1, m_xmf3Scale.z);
-	XMFLOAT3 xmf3Edge2 = XMFLOAT3(m_xmf3Scale.x, y2 - y1, 0.0f);
-	XMFLOAT3 xmf3Normal = Vector3::CrossProduct(xmf3Edge1, xmf3Edge2, true);
-
-	return(xmf3Normal);
+	int xNext = (x < (m_nWidth - 1)) ? x + 1 : x - 1;
+	int zNext = (z < (m_nLength - 1)) ? z + 1 : z - 1;
+	float y1 = (float)GetPixel(x, z) * m_xmf3Scale.y;
+	float y2 = (float)GetPixel(xNext, z) * m_xmf3Scale.y;
+	float y3 = (float)GetPixel(x, zNext) * m_xmf3Scale.y;
+	//The cross product of the edges toward +z and +x, (0, y3 - y1, scale.z) x (scale.x, y2 - y1, 0), written out so
+	//GetHeightsAndNormals can repeat the same operations
+	float fNormalX = m_xmf3Scale.z * (y1 - y2);
+	float fNormalY = m_xmf3Scale.z * m_xmf3Scale.x;
+	float fNormalZ = m_xmf3Scale.x * (y1 - y3);
+	float fLength = sqrtf(fNormalX * fNormalX + fNormalY * fNormalY + fNormalZ * fNormalZ);
+
+	return(XMFLOAT3(fNormalX / fLength, fNormalY / fLength, fNormalZ / fLength));
 }
 
 #define _WITH_APPROXIMATE_OPPOSITE_CORNER
@@ -223,10 +517,10 @@ float CHeightMapImage::GetHeight(float fx, float fz, bool bReverseQuad)
 	float fxPercent = fx - x;
 	float fzPercent = fz - z;
 
-	float fBottomLeft = (float)m_pHeightMapPixels[x + (z * m_nWidth)];
-	float fBottomRight = (float)m_pHeightMapPixels[(x + 1) + (z * m_nWidth)];
-	float fTopLeft = (float)m_pHeightMapPixels[x + ((z + 1) * m_nWidth)];
-	float fTopRight = (float)m_pHeightMapPixels[(x + 1) + ((z + 1) * m_nWidth)];
+	float fBottomLeft = (float)GetPixel(x, z);
+	float fBottomRight = (float)GetPixel(x + 1, z);
+	float fTopLeft = (float)GetPixel(x, z + 1);
+	float fTopRight = (float)GetPixel(x + 1, z + 1);
 #ifdef _WITH_APPROXIMATE_OPPOSITE_CORNER
 	if (bReverseQuad)
 	{
@@ -250,170 +544,802 @@ float CHeightMapImage::GetHeight(float fx, float fz, bool bReverseQuad)
 	return(fHeight);
 }
 
-CHeightMapGridMesh::CHeightMapGridMesh(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, int xStart, int zStart, int nWidth, int nLength, XMFLOAT3 xmf3Scale, XMFLOAT4 xmf4Color, void* pContext)
+#if defined(__AVX2__)
+//The pixels at eight indices (0 or more; past the end reads 0), each in the low byte with the next pixel in the
+//second: the dword at min(index, last - 3) shifted down, so no gather reads past the height map
+static inline __m256i GatherHeightMapPixels(BYTE *pPixels, int nPixels, __m256i xmmnIndices)
+{
+	__m256i xmmnBases = _mm256_min_epi32(xmmnIndices, _mm256_set1_epi32(nPixels - 4));
+	__m256i xmmnDwords = _mm256_i32gather_epi32((const int *)pPixels, xmmnBases, 1);
+	return(_mm256_srlv_epi32(xmmnDwords, _mm256_slli_epi32(_mm256_sub_epi32(xmmnIndices, xmmnBases), 3)));
+}
+
+//CHeightMapImage::GetPixelIndex of a tiled map
+static inline __m256i GetTiledPixelIndices(__m256i xmmnx, __m256i xmmnz, int nTilesX)
+{
+	__m256i xmmnMask = _mm256_set1_epi32(HEIGHT_MAP_TILE_MASK);
+	__m256i xmmnTiles = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(xmmnz, HEIGHT_MAP_TILE_SHIFT), _mm256_set1_epi32(nTilesX)), _mm256_srli_epi32(xmmnx, HEIGHT_MAP_TILE_SHIFT));
+	__m256i xmmnInTile = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(xmmnz, xmmnMask), HEIGHT_MAP_TILE_SHIFT), _mm256_and_si256(xmmnx, xmmnMask));
+	return(_mm256_add_epi32(_mm256_slli_epi32(xmmnTiles, 2 * HEIGHT_MAP_TILE_SHIFT), xmmnInTile));
+}
+#endif
+
+void CHeightMapImage::GetHeightsAndNormals(float *pfx, float *pfz, int nPoints, float *pfHeights, XMFLOAT3 *pxmf3Normals, bool bReverseQuad)
+{
+	int i = 0;
+#if defined(__AVX2__)
+	//Every operation of GetHeight and GetHeightMapNormal in the same order: no reciprocals and no fused multiply-adds
+	//(bit-identical as long as the scalar functions are not contracted either, fp_contract above)
+	int nPixels = m_nPixels;
+	__m256 xmmScaleX = _mm256_set1_ps(m_xmf3Scale.x), xmmScaleY = _mm256_set1_ps(m_xmf3Scale.y), xmmScaleZ = _mm256_set1_ps(m_xmf3Scale.z);
+	__m256 xmmWidth = _mm256_set1_ps((float)m_nWidth), xmmLength = _mm256_set1_ps((float)m_nLength);
+	__m256 xmmZero = _mm256_setzero_ps(), xmmOne = _mm256_set1_ps(1.0f);
+	__m256 xmmNormalY = _mm256_set1_ps(m_xmf3Scale.z * m_xmf3Scale.x);
+	__m256i xmmnWidth = _mm256_set1_epi32(m_nWidth), xmmnLength = _mm256_set1_epi32(m_nLength);
+	__m256i xmmnLastX = _mm256_set1_epi32(m_nWidth - 1), xmmnLastZ = _mm256_set1_epi32(m_nLength - 1);
+	__m256i xmmnMinusOne = _mm256_set1_epi32(-1), xmmnPixel = _mm256_set1_epi32(0xFF);
+	float pfNormals[3][8];
+	for ( ; i + 8 <= nPoints; i += 8)
+	{
+		__m256 xmmx = _mm256_div_ps(_mm256_loadu_ps(&pfx[i]), xmmScaleX);
+		__m256 xmmz = _mm256_div_ps(_mm256_loadu_ps(&pfz[i]), xmmScaleZ);
+		__m256i xmmnx = _mm256_cvttps_epi32(xmmx), xmmnz = _mm256_cvttps_epi32(xmmz);
+
+		//Outside: GetHeight returns 0. The last row and column (GetHeight reads the pixels after them) and anything
+		//else not inside go to the scalar path.
+		__m256 xmmOutside = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(xmmx, xmmZero, _CMP_LT_OQ), _mm256_cmp_ps(xmmz, xmmZero, _CMP_LT_OQ)), _mm256_or_ps(_mm256_cmp_ps(xmmx, xmmWidth, _CMP_GE_OQ), _mm256_cmp_ps(xmmz, xmmLength, _CMP_GE_OQ)));
+		__m256i xmmnInside = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(xmmnx, xmmnMinusOne), _mm256_cmpgt_epi32(xmmnLastX, xmmnx)), _mm256_and_si256(_mm256_cmpgt_epi32(xmmnz, xmmnMinusOne), _mm256_cmpgt_epi32(xmmnLastZ, xmmnz)));
+		__m256i xmmnBottomLeft, xmmnBottomRight, xmmnTopLeft, xmmnTopRight;
+		if (m_bTiled)
+		{
+			//Four gathers; the corners of a quad are adjacent only inside a tile
+			__m256i xmmnx1 = _mm256_sub_epi32(xmmnx, xmmnMinusOne), xmmnz1 = _mm256_sub_epi32(xmmnz, xmmnMinusOne);
+			xmmnBottomLeft = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, _mm256_and_si256(GetTiledPixelIndices(xmmnx, xmmnz, m_nTilesX), xmmnInside));
+			xmmnBottomRight = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, _mm256_and_si256(GetTiledPixelIndices(xmmnx1, xmmnz, m_nTilesX), xmmnInside));
+			xmmnTopLeft = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, _mm256_and_si256(GetTiledPixelIndices(xmmnx, xmmnz1, m_nTilesX), xmmnInside));
+			xmmnTopRight = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, _mm256_and_si256(GetTiledPixelIndices(xmmnx1, xmmnz1, m_nTilesX), xmmnInside));
+		}
+		else
+		{
+			//Two gathers, the left pixel of each row with the right one in the next byte
+			__m256i xmmnBottom = _mm256_and_si256(_mm256_add_epi32(xmmnx, _mm256_mullo_epi32(xmmnz, xmmnWidth)), xmmnInside);
+			xmmnBottomLeft = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, xmmnBottom);
+			xmmnBottomRight = _mm256_srli_epi32(xmmnBottomLeft, 8);
+			xmmnTopLeft = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, _mm256_add_epi32(xmmnBottom, xmmnWidth));
+			xmmnTopRight = _mm256_srli_epi32(xmmnTopLeft, 8);
+		}
+		__m256 xmmBottomLeft = _mm256_cvtepi32_ps(_mm256_and_si256(xmmnBottomLeft, xmmnPixel));
+		__m256 xmmBottomRight = _mm256_cvtepi32_ps(_mm256_and_si256(xmmnBottomRight, xmmnPixel));
+		__m256 xmmTopLeft = _mm256_cvtepi32_ps(_mm256_and_si256(xmmnTopLeft, xmmnPixel));
+		__m256 xmmTopRight = _mm256_cvtepi32_ps(_mm256_and_si256(xmmnTopRight, xmmnPixel));
+		__m256 xmmxPercent = _mm256_sub_ps(xmmx, _mm256_cvtepi32_ps(xmmnx));
+		__m256 xmmzPercent = _mm256_sub_ps(xmmz, _mm256_cvtepi32_ps(xmmnz));
+#ifdef _WITH_APPROXIMATE_OPPOSITE_CORNER
+		if (bReverseQuad)
+		{
+			__m256 xmmUpper = _mm256_cmp_ps(xmmzPercent, xmmxPercent, _CMP_GE_OQ);
+			__m256 xmmNewBottomRight = _mm256_blendv_ps(xmmBottomRight, _mm256_add_ps(xmmBottomLeft, _mm256_sub_ps(xmmTopRight, xmmTopLeft)), xmmUpper);
+			xmmTopLeft = _mm256_blendv_ps(_mm256_add_ps(xmmTopRight, _mm256_sub_ps(xmmBottomLeft, xmmBottomRight)), xmmTopLeft, xmmUpper);
+			xmmBottomRight = xmmNewBottomRight;
+		}
+		else
+		{
+			__m256 xmmLower = _mm256_cmp_ps(xmmzPercent, _mm256_sub_ps(xmmOne, xmmxPercent), _CMP_LT_OQ);
+			__m256 xmmNewTopRight = _mm256_blendv_ps(xmmTopRight, _mm256_add_ps(xmmTopLeft, _mm256_sub_ps(xmmBottomRight, xmmBottomLeft)), xmmLower);
+			xmmBottomLeft = _mm256_blendv_ps(_mm256_add_ps(xmmTopLeft, _mm256_sub_ps(xmmBottomRight, xmmTopRight)), xmmBottomLeft, xmmLower);
+			xmmTopRight = xmmNewTopRight;
+		}
+#endif
+		__m256 xmmxRest = _mm256_sub_ps(xmmOne, xmmxPercent);
+		__m256 xmmTopHeight = _mm256_add_ps(_mm256_mul_ps(xmmTopLeft, xmmxRest), _mm256_mul_ps(xmmTopRight, xmmxPercent));
+		__m256 xmmBottomHeight = _mm256_add_ps(_mm256_mul_ps(xmmBottomLeft, xmmxRest), _mm256_mul_ps(xmmBottomRight, xmmxPercent));
+		__m256 xmmHeight = _mm256_add_ps(_mm256_mul_ps(xmmBottomHeight, _mm256_sub_ps(xmmOne, xmmzPercent)), _mm256_mul_ps(xmmTopHeight, xmmzPercent));
+		_mm256_storeu_ps(&pfHeights[i], _mm256_andnot_ps(xmmOutside, xmmHeight));
+
+		int nScalar = ~(_mm256_movemask_ps(_mm256_castsi256_ps(xmmnInside)) | _mm256_movemask_ps(xmmOutside)) & 0xFF;
+		for (int j = 0; j < 8; j++) if (nScalar & (1 << j)) pfHeights[i + j] = GetHeight(pfx[i + j], pfz[i + j], bReverseQuad);
+
+		if (pxmf3Normals)
+		{
+			//GetHeightMapNormal(x, z): the pixel, the one after it in x (before it on the last column) and in z (before it on the last row)
+			__m256i xmmnInMap = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(xmmnx, xmmnMinusOne), _mm256_cmpgt_epi32(xmmnWidth, xmmnx)), _mm256_and_si256(_mm256_cmpgt_epi32(xmmnz, xmmnMinusOne), _mm256_cmpgt_epi32(xmmnLength, xmmnz)));
+			__m256i xmmnNextX = _mm256_and_si256(_mm256_cmpgt_epi32(xmmnLastX, xmmnx), xmmnInMap);
+			__m256i xmmnNextZ = _mm256_cmpgt_epi32(xmmnLastZ, xmmnz);
+			__m256i xmmnFirst, xmmnSecond, xmmnThird;
+			if (m_bTiled)
+			{
+				//x + 1 or x - 1 (NextX is -1 or 0), z + 1 or z - 1
+				__m256i xmmnxNext = _mm256_sub_epi32(_mm256_add_epi32(xmmnx, xmmnMinusOne), _mm256_add_epi32(xmmnNextX, xmmnNextX));
+				__m256i xmmnzNext = _mm256_sub_epi32(_mm256_add_epi32(xmmnz, xmmnMinusOne), _mm256_add_epi32(xmmnNextZ, xmmnNextZ));
+				xmmnFirst = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, _mm256_and_si256(GetTiledPixelIndices(xmmnx, xmmnz, m_nTilesX), xmmnInMap));
+				xmmnSecond = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, _mm256_and_si256(GetTiledPixelIndices(xmmnxNext, xmmnz, m_nTilesX), xmmnInMap));
+				xmmnThird = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, _mm256_and_si256(GetTiledPixelIndices(xmmnx, xmmnzNext, m_nTilesX), xmmnInMap));
+			}
+			else
+			{
+				//(x, x + 1) or (x - 1, x) in the two low bytes
+				__m256i xmmnIndex = _mm256_and_si256(_mm256_add_epi32(xmmnx, _mm256_mullo_epi32(xmmnz, xmmnWidth)), xmmnInMap);
+				__m256i xmmnPair = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, _mm256_add_epi32(xmmnIndex, _mm256_andnot_si256(xmmnNextX, _mm256_and_si256(xmmnMinusOne, xmmnInMap))));
+				__m256i xmmnLower = _mm256_and_si256(xmmnPair, xmmnPixel), xmmnUpper = _mm256_and_si256(_mm256_srli_epi32(xmmnPair, 8), xmmnPixel);
+				xmmnFirst = _mm256_blendv_epi8(xmmnUpper, xmmnLower, xmmnNextX);
+				xmmnSecond = _mm256_blendv_epi8(xmmnLower, xmmnUpper, xmmnNextX);
+				__m256i xmmnzAdd = _mm256_blendv_epi8(_mm256_sub_epi32(_mm256_setzero_si256(), xmmnWidth), xmmnWidth, xmmnNextZ);
+				xmmnThird = GatherHeightMapPixels(m_pHeightMapPixels, nPixels, _mm256_and_si256(_mm256_add_epi32(xmmnIndex, xmmnzAdd), xmmnInMap));
+			}
+			__m256 y1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(xmmnFirst, xmmnPixel)), xmmScaleY);
+			__m256 y2 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(xmmnSecond, xmmnPixel)), xmmScaleY);
+			__m256 y3 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(xmmnThird, xmmnPixel)), xmmScaleY);
+
+			__m256 xmmNormalX = _mm256_mul_ps(xmmScaleZ, _mm256_sub_ps(y1, y2));
+			__m256 xmmNormalZ = _mm256_mul_ps(xmmScaleX, _mm256_sub_ps(y1, y3));
+			__m256 xmmLength = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xmmNormalX, xmmNormalX), _mm256_mul_ps(xmmNormalY, xmmNormalY)), _mm256_mul_ps(xmmNormalZ, xmmNormalZ)));
+			__m256 xmmInMap = _mm256_castsi256_ps(xmmnInMap);
+			_mm256_storeu_ps(pfNormals[0], _mm256_and_ps(_mm256_div_ps(xmmNormalX, xmmLength), xmmInMap));
+			_mm256_storeu_ps(pfNormals[1], _mm256_blendv_ps(xmmOne, _mm256_div_ps(xmmNormalY, xmmLength), xmmInMap));
+			_mm256_storeu_ps(pfNormals[2], _mm256_and_ps(_mm256_div_ps(xmmNormalZ, xmmLength), xmmInMap));
+			for (int j = 0; j < 8; j++) pxmf3Normals[i + j] = XMFLOAT3(pfNormals[0][j], pfNormals[1][j], pfNormals[2][j]);
+		}
+	}
+#endif
+	for ( ; i < nPoints; i++)
+	{
+		pfHeights[i] = GetHeight(pfx[i], pfz[i], bReverseQuad);
+		if (pxmf3Normals) pxmf3Normals[i] = GetHeightMapNormal(int(pfx[i] / m_xmf3Scale.x), int(pfz[i] / m_xmf3Scale.z));
+	}
+}
+
+static bool ClipSegmentSlab(float fStart, float fDelta, float fMin, float fMax, float *pt0, float *pt1)
+{
+	if (fDelta == 0.0f) return((fStart >= fMin) && (fStart <= fMax));
+
+	float ta = (fMin - fStart) / fDelta, tb = (fMax - fStart) / fDelta;
+	if (ta > tb) { float t = ta; ta = tb; tb = t; }
+	*pt0 = max(*pt0, ta);
+	*pt1 = min(*pt1, tb);
+	return(*pt0 <= *pt1);
+}
+
+bool CHeightMapImage::IntersectQuad(int x, int z, float x0, float y0, float z0, float dx, float dy, float dz, float ta, float tb, float *pfHit, XMFLOAT3 *pxmf3Normal)
+{
+	//The two triangles of GetHeight meet on u + v = 1; w(t) = u + v - 1 along the segment
+	float fBottomLeft = GetPixel(x, z), fBottomRight = GetPixel(x + 1, z), fTopLeft = GetPixel(x, z + 1), fTopRight = GetPixel(x + 1, z + 1);
+	float u0 = x0 - x, v0 = z0 - z, dw = dx + dz;
+	float wa = u0 + v0 - 1.0f + dw * ta, wb = u0 + v0 - 1.0f + dw * tb;
+	float ts = ((wa < 0.0f) != (wb < 0.0f)) ? (ta + (tb - ta) * wa / (wa - wb)) : tb;
+	float pfPieces[3] = { ta, ts, tb };
+	for (int i = 0; i < 2; i++)
+	{
+		float pa = pfPieces[i], pb = pfPieces[i + 1];
+		if ((i == 1) && (pb <= pa)) break;
+
+		//Height over the triangle as h0 + hu * u + hv * v, so f(t) = y(t) - h(t) is linear on the piece
+		float h0, hu, hv;
+		if ((u0 + v0 - 1.0f + dw * (pa + pb) * 0.5f) < 0.0f)
+		{
+			h0 = fBottomLeft; hu = fBottomRight - fBottomLeft; hv = fTopLeft - fBottomLeft;
+		}
+		else
+		{
+			h0 = fTopLeft + fBottomRight - fTopRight; hu = fTopRight - fTopLeft; hv = fTopRight - fBottomRight;
+		}
+		float fa = (y0 + dy * pa) - m_xmf3Scale.y * (h0 + hu * (u0 + dx * pa) + hv * (v0 + dz * pa));
+		float fb = (y0 + dy * pb) - m_xmf3Scale.y * (h0 + hu * (u0 + dx * pb) + hv * (v0 + dz * pb));
+		if (fa < 0.0f)
+			*pfHit = pa;
+		else if (fb < 0.0f)
+			*pfHit = pa + (pb - pa) * fa / (fa - fb);
+		else
+			continue;
+
+		if (pxmf3Normal)
+		{
+			XMFLOAT3 xmf3Normal(-m_xmf3Scale.y * hu / m_xmf3Scale.x, 1.0f, -m_xmf3Scale.y * hv / m_xmf3Scale.z);
+			*pxmf3Normal = Vector3::Normalize(xmf3Normal);
+		}
+		return(true);
+	}
+	return(false);
+}
+
+bool CHeightMapImage::IntersectSegmentQuads(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, float *pfHit)
+{
+	//Height map space: one unit per pixel in x and z, world heights in y
+	float x0 = xmf3Start.x / m_xmf3Scale.x, z0 = xmf3Start.z / m_xmf3Scale.z, y0 = xmf3Start.y;
+	float dx = xmf3End.x / m_xmf3Scale.x - x0, dz = xmf3End.z / m_xmf3Scale.z - z0, dy = xmf3End.y - y0;
+
+	float t0 = 0.0f, t1 = 1.0f;
+	if (!::ClipSegmentSlab(x0, dx, 0.0f, float(m_nWidth - 1), &t0, &t1) || !::ClipSegmentSlab(z0, dz, 0.0f, float(m_nLength - 1), &t0, &t1)) return(false);
+
+	//Walk the quads the segment crosses in order (2D DDA)
+	int x = int(floorf(x0 + dx * t0)), z = int(floorf(z0 + dz * t0));
+	x = (x < 0) ? 0 : ((x > m_nWidth - 2) ? (m_nWidth - 2) : x);
+	z = (z < 0) ? 0 : ((z > m_nLength - 2) ? (m_nLength - 2) : z);
+	int nStepX = (dx > 0.0f) ? 1 : -1, nStepZ = (dz > 0.0f) ? 1 : -1;
+	float tDeltaX = (dx != 0.0f) ? fabsf(1.0f / dx) : FLT_MAX, tDeltaZ = (dz != 0.0f) ? fabsf(1.0f / dz) : FLT_MAX;
+	float tNextX = (dx != 0.0f) ? ((x + ((dx > 0.0f) ? 1 : 0)) - x0) / dx : FLT_MAX;
+	float tNextZ = (dz != 0.0f) ? ((z + ((dz > 0.0f) ? 1 : 0)) - z0) / dz : FLT_MAX;
+
+	for (float ta = t0; ; )
+	{
+		float tb = min(min(tNextX, tNextZ), t1);
+		if (tb < ta) tb = ta;
+		if (IntersectQuad(x, z, x0, y0, z0, dx, dy, dz, ta, tb, pfHit, NULL)) return(true);
+
+		if (tb >= t1) break;
+		if (tNextX < tNextZ)
+		{
+			x += nStepX;
+			tNextX += tDeltaX;
+		}
+		else
+		{
+			z += nStepZ;
+			tNextZ += tDeltaZ;
+		}
+		if ((x < 0) || (x > m_nWidth - 2) || (z < 0) || (z > m_nLength - 2)) break;
+		ta = tb;
+	}
+	return(false);
+}
+
+bool CHeightMapImage::MarchPyramid(float x0, float y0, float z0, float dx, float dy, float dz, bool bAnyHit, float *pfHit, XMFLOAT3 *pxmf3Normal)
+{
+	float t0 = 0.0f, t1 = 1.0f;
+	if (!::ClipSegmentSlab(x0, dx, 0.0f, float(m_nWidth - 1), &t0, &t1) || !::ClipSegmentSlab(z0, dz, 0.0f, float(m_nLength - 1), &t0, &t1)) return(false);
+
+	//(x, z) is the quad the segment is in at ta; the block tested is the one containing it on level nLevel
+	int x = int(floorf(x0 + dx * t0)), z = int(floorf(z0 + dz * t0));
+	x = (x < 0) ? 0 : ((x > m_nWidth - 2) ? (m_nWidth - 2) : x);
+	z = (z < 0) ? 0 : ((z > m_nLength - 2) ? (m_nLength - 2) : z);
+	int nLevel = m_nPyramidLevels - 1;
+	for (float ta = t0; ; )
+	{
+		int nSize = 1 << nLevel, bx = x >> nLevel, bz = z >> nLevel;
+		float txExit = (dx > 0.0f) ? (((bx + 1) * nSize - x0) / dx) : ((dx < 0.0f) ? ((bx * nSize - x0) / dx) : FLT_MAX);
+		float tzExit = (dz > 0.0f) ? (((bz + 1) * nSize - z0) / dz) : ((dz < 0.0f) ? ((bz * nSize - z0) / dz) : FLT_MAX);
+		float tb = min(min(txExit, tzExit), t1);
+		if (tb < ta) tb = ta;
+
+		BYTE *pnBlock = &m_ppnPyramid[nLevel][(bx + (bz * m_pnPyramidWidths[nLevel])) * 2];
+		float ya = y0 + dy * ta, yb = y0 + dy * tb;
+		if (min(ya, yb) >= pnBlock[1] * m_xmf3Scale.y)
+		{
+			//Above the whole block: skip it, and the next one may be skipped on a coarser level
+			if (nLevel < m_nPyramidLevels - 1) nLevel++;
+		}
+		else if (bAnyHit && (min(ya, yb) < pnBlock[0] * m_xmf3Scale.y))
+		{
+			//Partly below the whole block: some point is below the surface, not necessarily the first
+			*pfHit = (ya < yb) ? ta : tb;
+			return(true);
+		}
+		else if (nLevel > 0)
+		{
+			nLevel--;
+			continue;
+		}
+		else if (IntersectQuad(x, z, x0, y0, z0, dx, dy, dz, ta, tb, pfHit, pxmf3Normal))
+		{
+			return(true);
+		}
+
+		if (tb >= t1) break;
+		//Into the next block across the side crossed first; the other coordinate stays inside the block
+		if (txExit <= tzExit)
+		{
+			x = (dx > 0.0f) ? ((bx + 1) * nSize) : (bx * nSize - 1);
+			z = int(floorf(z0 + dz * tb));
+			z = (z < bz * nSize) ? (bz * nSize) : ((z > (bz + 1) * nSize - 1) ? ((bz + 1) * nSize - 1) : z);
+		}
+		else
+		{
+			z = (dz > 0.0f) ? ((bz + 1) * nSize) : (bz * nSize - 1);
+			x = int(floorf(x0 + dx * tb));
+			x = (x < bx * nSize) ? (bx * nSize) : ((x > (bx + 1) * nSize - 1) ? ((bx + 1) * nSize - 1) : x);
+		}
+		if ((x < 0) || (x > m_nWidth - 2) || (z < 0) || (z > m_nLength - 2)) break;
+		ta = tb;
+	}
+	return(false);
+}
+
+bool CHeightMapImage::IntersectSegment(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, float *pfHit, XMFLOAT3 *pxmf3Normal)
+{
+	float x0 = xmf3Start.x / m_xmf3Scale.x, z0 = xmf3Start.z / m_xmf3Scale.z, y0 = xmf3Start.y;
+	return(MarchPyramid(x0, y0, z0, xmf3End.x / m_xmf3Scale.x - x0, xmf3End.y - y0, xmf3End.z / m_xmf3Scale.z - z0, false, pfHit, pxmf3Normal));
+}
+
+bool CHeightMapImage::IntersectRay(XMFLOAT3& xmf3Origin, XMFLOAT3& xmf3Direction, float fMaxDistance, float *pfDistance, XMFLOAT3 *pxmf3Normal)
+{
+	XMFLOAT3 xmf3End = Vector3::Add(xmf3Origin, xmf3Direction, fMaxDistance);
+	float fHit;
+	if (!IntersectSegment(xmf3Origin, xmf3End, &fHit, pxmf3Normal)) return(false);
+	*pfDistance = fHit * fMaxDistance;
+	return(true);
+}
+
+bool CHeightMapImage::IsVisible(XMFLOAT3& xmf3From, XMFLOAT3& xmf3To)
+{
+	float x0 = xmf3From.x / m_xmf3Scale.x, z0 = xmf3From.z / m_xmf3Scale.z, y0 = xmf3From.y, fHit;
+	return(!MarchPyramid(x0, y0, z0, xmf3To.x / m_xmf3Scale.x - x0, xmf3To.y - y0, xmf3To.z / m_xmf3Scale.z - z0, true, &fHit, NULL));
+}
+
+//World heights of whole rows of the height field from m_zFirst: the samples a job of BuildTerrainVertexRows reads
+struct TERRAINHEIGHTBAND
+{
+	float							*m_pfHeights;
+	int								m_zFirst;
+	int								m_cxHeightMap;
+	int								m_czHeightMap;
+	XMFLOAT3						m_xmf3Scale;
+};
+
+//The light a sample of the height map takes from the direction of the terrain's light, its normal as
+//CHeightField::GetNormal
+static float GetHeightMapTerrainLight(TERRAINHEIGHTBAND *pBand, int x, int z, XMFLOAT3& xmf3LightDirection)
+{
+	XMFLOAT3 xmf3Normal(0.0f, 1.0f, 0.0f);
+	if ((x >= 0) && (z >= 0) && (x < pBand->m_cxHeightMap) && (z < pBand->m_czHeightMap))
+	{
+		int xNext = (x < (pBand->m_cxHeightMap - 1)) ? x + 1 : x - 1;
+		int zNext = (z < (pBand->m_czHeightMap - 1)) ? z + 1 : z - 1;
+		float *pfRow = pBand->m_pfHeights + (z - pBand->m_zFirst) * pBand->m_cxHeightMap;
+		float *pfNextRow = pBand->m_pfHeights + (zNext - pBand->m_zFirst) * pBand->m_cxHeightMap;
+		xmf3Normal = ::GetHeightFieldNormal(pfRow[x], pfRow[xNext], pfNextRow[x], pBand->m_xmf3Scale);
+	}
+	return(Vector3::DotProduct(xmf3Normal, xmf3LightDirection));
+}
+
+//The color of a vertex from the light of the four samples of its quad: (x, z), (x + 1, z), (x + 1, z + 1), (x, z + 1)
+static XMFLOAT4 GetHeightMapTerrainColor(float fLight00, float fLight10, float fLight11, float fLight01)
+{
+	XMFLOAT4 xmf4IncidentLightColor(0.6f, 0.5f, 0.2f, 1.0f);
+	float fScale = fLight00;
+	fScale += fLight10;
+	fScale += fLight11;
+	fScale += fLight01;
+	fScale = (fScale / 4.0f) + 0.05f;
+	if (fScale > 1.0f) fScale = 1.0f;
+	if (fScale < 0.25f) fScale = 0.25f;
+	XMFLOAT4 xmf4Color = Vector4::Multiply(fScale, xmf4IncidentLightColor);
+	return(xmf4Color);
+}
+
+static XMFLOAT3 GetHeightMapTerrainLightDirection()
+{
+	XMFLOAT3 xmf3LightDirection = XMFLOAT3(-1.0f, 1.0f, 1.0f);
+	return(Vector3::Normalize(xmf3LightDirection));
+}
+
+//The color of the sample (x, z) on its own, four normals (CHeightMapGridMesh, whose vertices share none)
+static XMFLOAT4 GetHeightMapTerrainColor(TERRAINHEIGHTBAND *pBand, int x, int z)
+{
+	XMFLOAT3 xmf3LightDirection = ::GetHeightMapTerrainLightDirection();
+	return(::GetHeightMapTerrainColor(::GetHeightMapTerrainLight(pBand, x, z, xmf3LightDirection), ::GetHeightMapTerrainLight(pBand, x + 1, z, xmf3LightDirection), ::GetHeightMapTerrainLight(pBand, x + 1, z + 1, xmf3LightDirection), ::GetHeightMapTerrainLight(pBand, x, z + 1, xmf3LightDirection)));
+}
+
+//The vertices of CHeightMapTerrainMesh::BuildVertices
+struct TERRAINVERTEXJOB
+{
+	CHeightField					*m_pHeightField;
+	std::mutex						*m_pmtxHeightField; //The field maps and unmaps tiles: one job reads it at a time
+	int								m_cxHeightMap; //The mesh's; samples past an unopened field read as 0
+	int								m_czHeightMap;
+	int								m_cxVertices;
+	int								m_nStep;
+	XMFLOAT3						m_xmf3Scale;
+	XMFLOAT4						m_xmf4Color;
+	XMFLOAT3						*m_pxmf3Positions;
+	XMFLOAT4						*m_pxmf4Colors;
+	XMFLOAT2						*m_pxmf2TextureCoords0;
+	XMFLOAT2						*m_pxmf2TextureCoords1;
+};
+
+//Rows [zFirst, zLast) of the vertices, a job of ParallelFor. Every sample's light goes into four colors; with a step of
+//1 those are the vertices of the rows on either side of it, so a row of lights is computed once and kept for the next.
+static void BuildTerrainVertexRows(int zFirst, int zLast, void *pContext)
+{
+	TERRAINVERTEXJOB *pJob = (TERRAINVERTEXJOB *)pContext;
+	CHeightField *pHeightField = pJob->m_pHeightField;
+	int cxHeightMap = pJob->m_cxHeightMap, czHeightMap = pJob->m_czHeightMap;
+	XMFLOAT3 xmf3LightDirection = ::GetHeightMapTerrainLightDirection();
+
+	int cxVertices = pJob->m_cxVertices, nStep = pJob->m_nStep;
+
+	//Every height the rows and their lights read (a normal reads the next row, or the one before on the last), in one
+	//read of the field
+	TERRAINHEIGHTBAND xBand;
+	xBand.m_zFirst = max(zFirst * nStep - 1, 0);
+	xBand.m_cxHeightMap = cxHeightMap;
+	xBand.m_czHeightMap = czHeightMap;
+	xBand.m_xmf3Scale = pJob->m_xmf3Scale;
+	int czBand = (zLast - 1) * nStep + 3 - xBand.m_zFirst;
+	xBand.m_pfHeights = new float[czBand * cxHeightMap];
+	bool bRead;
+	{
+		std::lock_guard<std::mutex> lock(*pJob->m_pmtxHeightField);
+		bRead = pHeightField->GetHeights(0, xBand.m_zFirst, cxHeightMap, czBand, xBand.m_pfHeights);
+	}
+	if (!bRead) OutputDebugString(_T("Terrain: a tile of the height field could not be mapped, its vertices are flat\n"));
+	float *pfLightRows = NULL, *pfLights = NULL, *pfNextLights = NULL;
+	if (nStep == 1)
+	{
+		pfLightRows = new float[2 * (cxVertices + 1)];
+		pfLights = pfLightRows;
+		pfNextLights = pfLightRows + (cxVertices + 1);
+		for (int x = 0; x <= cxVertices; x++) pfLights[x] = ::GetHeightMapTerrainLight(&xBand, x, zFirst, xmf3LightDirection);
+	}
+
+	for (int k = zFirst; k < zLast; k++)
+	{
+		int z = k * nStep, i = k * cxVertices;
+		if (nStep == 1)
+		{
+			for (int x = 0; x <= cxVertices; x++) pfNextLights[x] = ::GetHeightMapTerrainLight(&xBand, x, z + 1, xmf3LightDirection);
+		}
+		float *pfHeights = xBand.m_pfHeights + (z - xBand.m_zFirst) * cxHeightMap;
+		for (int j = 0; j < cxVertices; j++, i++)
+		{
+			int x = j * nStep;
+			pJob->m_pxmf3Positions[i] = XMFLOAT3((x * pJob->m_xmf3Scale.x), pfHeights[x], (z * pJob->m_xmf3Scale.z));
+			XMFLOAT4 xmf4Color;
+			if (nStep == 1)
+				xmf4Color = ::GetHeightMapTerrainColor(pfLights[x], pfLights[x + 1], pfNextLights[x + 1], pfNextLights[x]);
+			else
+				xmf4Color = ::GetHeightMapTerrainColor(&xBand, x, z);
+			pJob->m_pxmf4Colors[i] = Vector4::Add(xmf4Color, pJob->m_xmf4Color);
+			pJob->m_pxmf2TextureCoords0[i] = XMFLOAT2(float(x) / float(cxHeightMap - 1), float(czHeightMap - 1 - z) / float(czHeightMap - 1));
+			pJob->m_pxmf2TextureCoords1[i] = XMFLOAT2(float(x) / float(pJob->m_xmf3Scale.x * 0.5f), float(z) / float(pJob->m_xmf3Scale.z * 0.5f));
+		}
+		if (nStep == 1)
+		{
+			float *pfTemp = pfLights;
+			pfLights = pfNextLights;
+			pfNextLights = pfTemp;
+		}
+	}
+
+	if (pfLightRows) delete[] pfLightRows;
+	delete[] xBand.m_pfHeights;
+}
+
+CHeightMapTerrainMesh::CHeightMapTerrainMesh(int nWidth, int nLength, XMFLOAT3 xmf3Scale)
+{
+	m_nWidth = nWidth;
+	m_nLength = nLength;
+	m_xmf3Scale = xmf3Scale;
+
+	::ZeroMemory(m_pd3dVertexBufferViews, sizeof(m_pd3dVertexBufferViews));
+	::ZeroMemory(&m_d3dIndexBufferView, sizeof(D3D12_INDEX_BUFFER_VIEW));
+}
+
+CHeightMapTerrainMesh::~CHeightMapTerrainMesh()
+{
+	ReleaseUploadBuffers();
+
+	if (m_pd3dPositionBuffer) m_pd3dPositionBuffer->Release();
+	if (m_pd3dColorBuffer) m_pd3dColorBuffer->Release();
+	if (m_pd3dTextureCoord0Buffer) m_pd3dTextureCoord0Buffer->Release();
+	if (m_pd3dTextureCoord1Buffer) m_pd3dTextureCoord1Buffer->Release();
+	if (m_pd3dIndexBuffer) m_pd3dIndexBuffer->Release();
+
+	if (m_pxmf3Positions) delete[] m_pxmf3Positions;
+	if (m_pxmf4Colors) delete[] m_pxmf4Colors;
+	if (m_pxmf2TextureCoords0) delete[] m_pxmf2TextureCoords0;
+	if (m_pxmf2TextureCoords1) delete[] m_pxmf2TextureCoords1;
+	if (m_pnIndices) delete[] m_pnIndices;
+	if (m_pPatchDraws) delete[] m_pPatchDraws;
+}
+
+void CHeightMapTerrainMesh::ReleaseUploadBuffers()
 {
-	m_nVertices = 25;
-	m_d3dPrimitiveTopology = D3D_PRIMITIVE_TOPOLOGY_25_CONTROL_POINT_PATCHLIST;
-
-	m_nWidth = nWidth;
-	m_nLength = nLength;
-	m_xmf3Scale = xmf3Scale;
+	if (m_pd3dUploadBuffer) m_pd3dUploadBuffer->Release();
+	m_pd3dUploadBuffer = NULL;
+}
 
+void CHeightMapTerrainMesh::BuildVertices(int cxVertices, int czVertices, int nStep, XMFLOAT4 xmf4Color, void* pContext, CThreadPool *pThreadPool)
+{
+	m_nVertices = cxVertices * czVertices;
 	m_pxmf3Positions = new XMFLOAT3[m_nVertices];
 	m_pxmf4Colors = new XMFLOAT4[m_nVertices];
 	m_pxmf2TextureCoords0 = new XMFLOAT2[m_nVertices];
 	m_pxmf2TextureCoords1 = new XMFLOAT2[m_nVertices];
 
-	CHeightMapImage* pHeightMapImage = (CHeightMapImage*)pContext;
-	int cxHeightMap = pHeightMapImage->GetHeightMapWidth();
-	int czHeightMap = pHeightMapImage->GetHeightMapLength();
+	std::mutex mtxHeightField;
+	TERRAINVERTEXJOB xJob = { (CHeightField*)pContext, &mtxHeightField, m_nWidth, m_nLength, cxVertices, nStep, m_xmf3Scale, xmf4Color, m_pxmf3Positions, m_pxmf4Colors, m_pxmf2TextureCoords0, m_pxmf2TextureCoords1 };
+	::ParallelFor(pThreadPool, czVertices, 16, ::BuildTerrainVertexRows, &xJob);
+}
 
-	float fHeight = 0.0f, fMinHeight = +FLT_MAX, fMaxHeight = -FLT_MAX;
-	for (int i = 0, z = (zStart + nLength - 1); z >= zStart; z -= 2)
+void CHeightMapTerrainMesh::CreateBuffers(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList)
+{
+	if (!pd3dDevice) return;
+
+	void *ppData[5] = { m_pxmf3Positions, m_pxmf4Colors, m_pxmf2TextureCoords0, m_pxmf2TextureCoords1, m_pnIndices };
+	UINT pnStrides[5] = { sizeof(XMFLOAT3), sizeof(XMFLOAT4), sizeof(XMFLOAT2), sizeof(XMFLOAT2), sizeof(UINT) };
+	UINT pnBytes[5];
+	for (int i = 0; i < 4; i++) pnBytes[i] = pnStrides[i] * m_nVertices;
+	pnBytes[4] = sizeof(UINT) * m_nIndices;
+	D3D12_RESOURCE_STATES pd3dResourceStates[5] = { D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, D3D12_RESOURCE_STATE_INDEX_BUFFER };
+	ID3D12Resource *ppd3dBuffers[5] = { NULL, NULL, NULL, NULL, NULL };
+	::CreateBufferResources(pd3dDevice, pd3dCommandList, 5, ppData, pnBytes, pd3dResourceStates, ppd3dBuffers, &m_pd3dUploadBuffer);
+	m_pd3dPositionBuffer = ppd3dBuffers[0];
+	m_pd3dColorBuffer = ppd3dBuffers[1];
+	m_pd3dTextureCoord0Buffer = ppd3dBuffers[2];
+	m_pd3dTextureCoord1Buffer = ppd3dBuffers[3];
+	m_pd3dIndexBuffer = ppd3dBuffers[4];
+
+	for (int i = 0; i < 4; i++)
 	{
-		for (int x = xStart; x < (xStart + nWidth); x += 2, i++)
-		{
-			fHeight = OnGetHeight(x, z, pContext);
-			m_pxmf3Positions[i] = XMFLOAT3((x * m_xmf3Scale.x), fHeight, (z * m_xmf3Scale.z));
-			m_pxmf4Colors[i] = Vector4::Add(OnGetColor(x, z, pContext), xmf4Color);
-			m_pxmf2TextureCoords0[i] = XMFLOAT2(float(x) / float(cxHeightMap - 1), float(czHeightMap - 1 - z) / float(czHeightMap - 1));
-			m_pxmf2TextureCoords1[i] = XMFLOAT2(float(x) / float(m_xmf3Scale.x * 0.5f), float(z) / float(m_xmf3Scale.z * 0.5f));
-
-			if (fHeight < fMinHeight) fMinHeight = fHeight;
-			if (fHeight > fMaxHeight) fMaxHeight = fHeight;
-		}
+		m_pd3dVertexBufferViews[i].BufferLocation = ppd3dBuffers[i]->GetGPUVirtualAddress();
+		m_pd3dVertexBufferViews[i].StrideInBytes = pnStrides[i];
+		m_pd3dVertexBufferViews[i].SizeInBytes = pnBytes[i];
 	}
 
-	m_pd3dPositionBuffer = ::CreateBufferResource(pd3dDevice, pd3dCommandList, m_pxmf3Positions, sizeof(XMFLOAT3) * m_nVertices, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, &m_pd3dPositionUploadBuffer);
-
-	m_d3dPositionBufferView.BufferLocation = m_pd3dPositionBuffer->GetGPUVirtualAddress();
-	m_d3dPositionBufferView.StrideInBytes = sizeof(XMFLOAT3);
-	m_d3dPositionBufferView.SizeInBytes = sizeof(XMFLOAT3) * m_nVertices;
-
-	m_pd3dColorBuffer = ::CreateBufferResource(pd3dDevice, pd3dCommandList, m_pxmf4Colors, sizeof(XMFLOAT4) * m_nVertices, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, &m_pd3dColorUploadBuffer);
-
-	m_d3dColorBufferView.BufferLocation = m_pd3dColorBuffer->GetGPUVirtualAddress();
-	m_d3dColorBufferView.StrideInBytes = sizeof(XMFLOAT4);
-	m_d3dColorBufferView.SizeInBytes = sizeof(XMFLOAT4) * m_nVertices;
-
-
-	m_pd3dTextureCoord0Buffer = ::CreateBufferResource(pd3dDevice, pd3dCommandList, m_pxmf2TextureCoords0, sizeof(XMFLOAT2) * m_nVertices, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, &m_pd3dTextureCoord0UploadBuffer);
-
-	m_d3dTextureCoord0BufferView.BufferLocation = m_pd3dTextureCoord0Buffer->GetGPUVirtualAddress();
-	m_d3dTextureCoord0BufferView.StrideInBytes = sizeof(XMFLOAT2);
-	m_d3dTextureCoord0BufferView.SizeInBytes = sizeof(XMFLOAT2) * m_nVertices;
+	m_d3dIndexBufferView.BufferLocation = m_pd3dIndexBuffer->GetGPUVirtualAddress();
+	m_d3dIndexBufferView.Format = DXGI_FORMAT_R32_UINT;
+	m_d3dIndexBufferView.SizeInBytes = pnBytes[4];
+
+	//The upload buffer holds their copy until ReleaseUploadBuffers
+	delete[] m_pxmf4Colors;
+	delete[] m_pxmf2TextureCoords0;
+	delete[] m_pxmf2TextureCoords1;
+	m_pxmf4Colors = NULL;
+	m_pxmf2TextureCoords0 = m_pxmf2TextureCoords1 = NULL;
+}
 
-	m_pd3dTextureCoord1Buffer = ::CreateBufferResource(pd3dDevice, pd3dCommandList, m_pxmf2TextureCoords1, sizeof(XMFLOAT2) * m_nVertices, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, &m_pd3dTextureCoord1UploadBuffer);
+CHeightMapGridMesh::CHeightMapGridMesh(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, XMFLOAT4 xmf4Color, void* pContext, CThreadPool *pThreadPool) : CHeightMapTerrainMesh(nWidth, nLength, xmf3Scale)
+{
+	m_d3dPrimitiveTopology = D3D_PRIMITIVE_TOPOLOGY_25_CONTROL_POINT_PATCHLIST;
 
-	m_d3dTextureCoord1BufferView.BufferLocation = m_pd3dTextureCoord1Buffer->GetGPUVirtualAddress();
-	m_d3dTextureCoord1BufferView.StrideInBytes = sizeof(XMFLOAT2);
-	m_d3dTextureCoord1BufferView.SizeInBytes = sizeof(XMFLOAT2) * m_nVertices;
+	m_cxPatches = (nWidth - 1) / (nBlockWidth - 1);
+	m_czPatches = (nLength - 1) / (nBlockLength - 1);
+	m_cxPatchControlPoints = (nBlockWidth - 1) / 2 + 1;
+	m_czPatchControlPoints = (nBlockLength - 1) / 2 + 1;
+	m_cxControlPoints = m_cxPatches * (m_cxPatchControlPoints - 1) + 1;
+	m_czControlPoints = m_czPatches * (m_czPatchControlPoints - 1) + 1;
+
+	//The control points are every other sample
+	BuildVertices(m_cxControlPoints, m_czControlPoints, 2, xmf4Color, pContext, pThreadPool);
+
+	int nPatches = m_cxPatches * m_czPatches;
+	m_pxmf3PatchCenters = new XMFLOAT3[nPatches];
+	m_pxmf3PatchExtents = new XMFLOAT3[nPatches];
+	m_pfPatchErrors = new float[nPatches];
+	::ParallelFor(pThreadPool, m_czPatches, 1, CHeightMapGridMesh::BuildPatchBounds, this);
+
+	//The first row of patches; the first control point of a patch is its top left corner (least x, greatest z)
+	int nPatchIndices = m_cxPatchControlPoints * m_czPatchControlPoints;
+	m_nIndices = m_cxPatches * nPatchIndices;
+	m_pnIndices = new UINT[m_nIndices];
+	for (int i = 0, px = 0; px < m_cxPatches; px++)
+	{
+		for (int k = m_czPatchControlPoints - 1; k >= 0; k--)
+		{
+			for (int j = 0; j < m_cxPatchControlPoints; j++) m_pnIndices[i++] = (UINT)(px * (m_cxPatchControlPoints - 1) + j + k * m_cxControlPoints);
+		}
+	}
 
-	m_nSubMeshes = 1;
-	m_pnSubSetIndices = new int[m_nSubMeshes];
-	m_ppnSubSetIndices = new UINT * [m_nSubMeshes];
+	m_pnPatchMarks = new BYTE[nPatches];
+	m_pPatchDraws = new TERRAINPATCHDRAW[nPatches];
 
-	m_ppd3dSubSetIndexBuffers = new ID3D12Resource * [m_nSubMeshes];
-	m_ppd3dSubSetIndexUploadBuffers = new ID3D12Resource * [m_nSubMeshes];
-	m_pd3dSubSetIndexBufferViews = new D3D12_INDEX_BUFFER_VIEW[m_nSubMeshes];
+	CreateBuffers(pd3dDevice, pd3dCommandList);
+}
 
-	m_pnSubSetIndices[0] = ((nWidth * 2) * (nLength - 1)) + ((nLength - 1) - 1);
-	m_ppnSubSetIndices[0] = new UINT[m_pnSubSetIndices[0]];
+CHeightMapGridMesh::~CHeightMapGridMesh()
+{
+	if (m_pxmf3PatchCenters) delete[] m_pxmf3PatchCenters;
+	if (m_pxmf3PatchExtents) delete[] m_pxmf3PatchExtents;
+	if (m_pfPatchErrors) delete[] m_pfPatchErrors;
+	if (m_pnPatchMarks) delete[] m_pnPatchMarks;
+}
 
-	for (int j = 0, z = 0; z < nLength - 1; z++)
+void CHeightMapGridMesh::BuildPatchBounds(int zFirst, int zLast, void *pContext)
+{
+	CHeightMapGridMesh *pMesh = (CHeightMapGridMesh *)pContext;
+	int cxControlPoints = pMesh->m_cxControlPoints, cxPatchControlPoints = pMesh->m_cxPatchControlPoints, czPatchControlPoints = pMesh->m_czPatchControlPoints;
+	for (int pz = zFirst; pz < zLast; pz++)
 	{
-		if ((z % 2) == 0)
+		for (int px = 0; px < pMesh->m_cxPatches; px++)
 		{
-			for (int x = 0; x < nWidth; x++)
+			XMFLOAT3 *pxmf3First = &pMesh->m_pxmf3Positions[px * (cxPatchControlPoints - 1) + pz * (czPatchControlPoints - 1) * cxControlPoints];
+			XMFLOAT3 *pxmf3Last = pxmf3First + (cxPatchControlPoints - 1) + (czPatchControlPoints - 1) * cxControlPoints;
+			float fMinHeight = +FLT_MAX, fMaxHeight = -FLT_MAX;
+			for (int k = 0; k < czPatchControlPoints; k++)
 			{
-				if ((x == 0) && (z > 0)) m_ppnSubSetIndices[0][j++] = (UINT)(x + (z * nWidth));
-				m_ppnSubSetIndices[0][j++] = (UINT)(x + (z * nWidth));
-				m_ppnSubSetIndices[0][j++] = (UINT)((x + (z * nWidth)) + nWidth);
+				for (int j = 0; j < cxPatchControlPoints; j++)
+				{
+					float fHeight = pxmf3First[j + k * cxControlPoints].y;
+					if (fHeight < fMinHeight) fMinHeight = fHeight;
+					if (fHeight > fMaxHeight) fMaxHeight = fHeight;
+				}
 			}
-		}
-		else
-		{
-			for (int x = nWidth - 1; x >= 0; x--)
+			XMFLOAT3 xmf3Min(pxmf3First->x, fMinHeight, pxmf3First->z), xmf3Max(pxmf3Last->x, fMaxHeight, pxmf3Last->z);
+
+			//x and z are linear in the control points, so only the height bends. Over a triangle of side h in (u, v)
+			//linear interpolation is off by at most h^2 / 8 (|Suu| + 2|Suv| + |Svv|), and for a degree 4 Bezier
+			//|Suu| <= 12 max|second differences along u|, |Suv| <= 16 max|mixed differences|
+			float fUU = 0.0f, fVV = 0.0f, fUV = 0.0f;
+			for (int k = 0; k < czPatchControlPoints; k++)
 			{
-				if (x == (nWidth - 1)) m_ppnSubSetIndices[0][j++] = (UINT)(x + (z * nWidth));
-				m_ppnSubSetIndices[0][j++] = (UINT)(x + (z * nWidth));
-				m_ppnSubSetIndices[0][j++] = (UINT)((x + (z * nWidth)) + nWidth);
+				for (int j = 0; j < cxPatchControlPoints; j++)
+				{
+					XMFLOAT3 *p = &pxmf3First[j + k * cxControlPoints];
+					if ((j > 0) && (j < cxPatchControlPoints - 1)) fUU = max(fUU, fabsf(p[-1].y - 2.0f * p[0].y + p[1].y));
+					if ((k > 0) && (k < czPatchControlPoints - 1)) fVV = max(fVV, fabsf(p[-cxControlPoints].y - 2.0f * p[0].y + p[cxControlPoints].y));
+					if ((j < cxPatchControlPoints - 1) && (k < czPatchControlPoints - 1)) fUV = max(fUV, fabsf(p[cxControlPoints + 1].y - p[cxControlPoints].y - p[1].y + p[0].y));
+				}
 			}
+			int nPatch = px + pz * pMesh->m_cxPatches;
+			pMesh->m_pfPatchErrors[nPatch] = 1.5f * fUU + 4.0f * fUV + 1.5f * fVV;
+
+			pMesh->m_pxmf3PatchCenters[nPatch] = XMFLOAT3((xmf3Min.x + xmf3Max.x) * 0.5f, (xmf3Min.y + xmf3Max.y) * 0.5f, (xmf3Min.z + xmf3Max.z) * 0.5f);
+			pMesh->m_pxmf3PatchExtents[nPatch] = XMFLOAT3((xmf3Max.x - xmf3Min.x) * 0.5f, (xmf3Max.y - xmf3Min.y) * 0.5f, (xmf3Max.z - xmf3Min.z) * 0.5f);
 		}
 	}
+}
 
-	m_ppd3dSubSetIndexBuffers[0] = ::CreateBufferResource(pd3dDevice, pd3dCommandList, m_ppnSubSetIndices[0], sizeof(UINT) * m_pnSubSetIndices[0], D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_INDEX_BUFFER, &m_ppd3dSubSetIndexUploadBuffers[0]);
-
-	m_pd3dSubSetIndexBufferViews[0].BufferLocation = m_ppd3dSubSetIndexBuffers[0]->GetGPUVirtualAddress();
-	m_pd3dSubSetIndexBufferViews[0].Format = DXGI_FORMAT_R32_UINT;
-	m_pd3dSubSetIndexBufferViews[0].SizeInBytes = sizeof(UINT) * m_pnSubSetIndices[0];
+int CHeightMapGridMesh::BuildPatchDraws(int *pnPatches, int nPatches, TERRAINPATCHDRAW *pDraws)
+{
+	//Marking the patches and scanning the rows keeps the runs without sorting the patches (CTerrainQuadtree::Cull gives them in quadtree order)
+	::memset(m_pnPatchMarks, (pnPatches) ? 0 : 1, m_cxPatches * m_czPatches);
+	if (pnPatches)
+	{
+		for (int i = 0; i < nPatches; i++) m_pnPatchMarks[pnPatches[i]] = 1;
+	}
 
+	int nDraws = 0, nPatchIndices = m_cxPatchControlPoints * m_czPatchControlPoints;
+	for (int z = 0; z < m_czPatches; z++)
+	{
+		BYTE *pnMarks = &m_pnPatchMarks[z * m_cxPatches];
+		for (int x = 0; x < m_cxPatches; )
+		{
+			if (!pnMarks[x])
+			{
+				x++;
+				continue;
+			}
+			int x0 = x;
+			while ((x < m_cxPatches) && pnMarks[x]) x++;
+			pDraws[nDraws].m_nIndices = (x - x0) * nPatchIndices;
+			pDraws[nDraws].m_nStartIndex = x0 * nPatchIndices;
+			pDraws[nDraws].m_nBaseVertex = z * (m_czPatchControlPoints - 1) * m_cxControlPoints;
+			nDraws++;
+		}
+	}
+	return(nDraws);
 }
 
-CHeightMapGridMesh::~CHeightMapGridMesh()
+void CHeightMapGridMesh::Render(ID3D12GraphicsCommandList* pd3dCommandList, int *pnPatches, int nPatches)
 {
-	if (m_pd3dColorBuffer) m_pd3dColorBuffer->Release();
-	if (m_pd3dTextureCoord0Buffer) m_pd3dTextureCoord0Buffer->Release();
-	if (m_pd3dTextureCoord1Buffer) m_pd3dTextureCoord1Buffer->Release();
+	m_nPatchDraws = BuildPatchDraws(pnPatches, nPatches, m_pPatchDraws);
+	::SubmitTerrainPatchDraws(pd3dCommandList, m_d3dPrimitiveTopology, m_pd3dVertexBufferViews, &m_d3dIndexBufferView, m_pPatchDraws, m_nPatchDraws);
+}
 
-	if (m_pxmf4Colors) delete[] m_pxmf4Colors;
-	if (m_pxmf2TextureCoords0) delete[] m_pxmf2TextureCoords0;
-	if (m_pxmf2TextureCoords1) delete[] m_pxmf2TextureCoords1;
+CHeightMapGeomipMesh::CHeightMapGeomipMesh(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, int nWidth, int nLength, int nPatchQuads, XMFLOAT3 xmf3Scale, XMFLOAT4 xmf4Color, void* pContext, CThreadPool *pThreadPool) : CHeightMapTerrainMesh(nWidth, nLength, xmf3Scale)
+{
+	m_d3dPrimitiveTopology = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 
-	if (m_pd3dColorUploadBuffer) m_pd3dColorUploadBuffer->Release();
-	m_pd3dColorUploadBuffer = NULL;
+	m_nPatchQuads = nPatchQuads;
+	m_cxPatches = (nWidth - 1) / nPatchQuads;
+	m_czPatches = (nLength - 1) / nPatchQuads;
+	for (m_nLevels = 1; (1 << (m_nLevels - 1)) < nPatchQuads; m_nLevels++);
+
+	//The vertices of CHeightMapGridMesh, at every sample instead of every other one
+	BuildVertices(nWidth, nLength, 1, xmf4Color, pContext, pThreadPool);
+
+	int nPatches = m_cxPatches * m_czPatches;
+	m_pxmf3PatchCenters = new XMFLOAT3[nPatches];
+	m_pxmf3PatchExtents = new XMFLOAT3[nPatches];
+	::ParallelFor(pThreadPool, m_czPatches, 1, CHeightMapGeomipMesh::BuildPatchBounds, this);
+
+	//Every level but the last in all 16 combinations of stitched edges, then the single quad of the last
+	int nMaxIndices = 6;
+	for (int l = 0; l < m_nLevels - 1; l++) nMaxIndices += GEOMIPMAP_EDGE_MASKS * 6 * (nPatchQuads >> l) * (nPatchQuads >> l);
+	m_pnIndices = new UINT[nMaxIndices];
+	m_pIndexSets = new TERRAINPATCHDRAW[m_nLevels * GEOMIPMAP_EDGE_MASKS];
+	for (int l = 0; l < m_nLevels; l++)
+	{
+		for (int m = 0; m < GEOMIPMAP_EDGE_MASKS; m++)
+		{
+			TERRAINPATCHDRAW *pIndexSet = &m_pIndexSets[l * GEOMIPMAP_EDGE_MASKS + m];
+			if ((l == m_nLevels - 1) && (m > 0))
+			{
+				*pIndexSet = m_pIndexSets[l * GEOMIPMAP_EDGE_MASKS];
+				continue;
+			}
+			pIndexSet->m_nStartIndex = m_nIndices;
+			pIndexSet->m_nIndices = BuildIndexSet(l, m, &m_pnIndices[m_nIndices]);
+			pIndexSet->m_nBaseVertex = 0;
+			m_nIndices += pIndexSet->m_nIndices;
+		}
+	}
 
-	if (m_pd3dTextureCoord0UploadBuffer) m_pd3dTextureCoord0UploadBuffer->Release();
-	m_pd3dTextureCoord0UploadBuffer = NULL;
+	m_pPatchDraws = new TERRAINPATCHDRAW[nPatches];
 
-	if (m_pd3dTextureCoord1UploadBuffer) m_pd3dTextureCoord1UploadBuffer->Release();
-	m_pd3dTextureCoord1UploadBuffer = NULL;
+	CreateBuffers(pd3dDevice, pd3dCommandList);
 }
 
-float CHeightMapGridMesh::OnGetHeight(int x, int z, void* pContext)
+CHeightMapGeomipMesh::~CHeightMapGeomipMesh()
 {
-	CHeightMapImage* pHeightMapImage = (CHeightMapImage*)pContext;
-	BYTE* pHeightMapPixels = pHeightMapImage->GetHeightMapPixels();
-	XMFLOAT3 xmf3Scale = pHeightMapImage->GetScale();
-	int nWidth = pHeightMapImage->GetHeightMapWidth();
-	float fHeight = pHeightMapPixels[x + (z * nWidth)] * xmf3Scale.y;
-	return(fHeight);
+	if (m_pIndexSets) delete[] m_pIndexSets;
+	if (m_pxmf3PatchCenters) delete[] m_pxmf3PatchCenters;
+	if (m_pxmf3PatchExtents) delete[] m_pxmf3PatchExtents;
 }
 
-XMFLOAT4 CHeightMapGridMesh::OnGetColor(int x, int z, void* pContext)
+void CHeightMapGeomipMesh::BuildPatchBounds(int zFirst, int zLast, void *pContext)
 {
-	XMFLOAT3 xmf3LightDirection = XMFLOAT3(-1.0f, 1.0f, 1.0f);
-	xmf3LightDirection = Vector3::Normalize(xmf3LightDirection);
-	CHeightMapImage* pHeightMapImage = (CHeightMapImage*)pContext;
-	XMFLOAT3 xmf3Scale = pHeightMapImage->GetScale();
-	XMFLOAT4 xmf4IncidentLightColor(0.6f, 0.5f, 0.2f, 1.0f);
-	float fScale = Vector3::DotProduct(pHeightMapImage->GetHeightMapNormal(x, z), xmf3LightDirection);
-	fScale += Vector3::DotProduct(pHeightMapImage->GetHeightMapNormal(x + 1, z), xmf3LightDirection);
-	fScale += Vector3::DotProduct(pHeightMapImage->GetHeightMapNormal(x + 1, z + 1), xmf3LightDirection);
-	fScale += Vector3::DotProduct(pHeightMapImage->GetHeightMapNormal(x, z + 1), xmf3LightDirection);
-	fScale = (fScale / 4.0f) + 0.05f;
-	if (fScale > 1.0f) fScale = 1.0f;
-	if (fScale < 0.25f) fScale = 0.25f;
-	XMFLOAT4 xmf4Color = Vector4::Multiply(fScale, xmf4IncidentLightColor);
-	return(xmf4Color);
+	CHeightMapGeomipMesh *pMesh = (CHeightMapGeomipMesh *)pContext;
+	int nPatchQuads = pMesh->m_nPatchQuads, nWidth = pMesh->m_nWidth;
+	for (int i = zFirst * pMesh->m_cxPatches; i < zLast * pMesh->m_cxPatches; i++)
+	{
+		XMFLOAT3 *pxmf3First = &pMesh->m_pxmf3Positions[pMesh->GetPatchBaseVertex(i)];
+		XMFLOAT3 *pxmf3Last = pxmf3First + nPatchQuads + nPatchQuads * nWidth;
+		float fMinHeight = +FLT_MAX, fMaxHeight = -FLT_MAX;
+		for (int z = 0; z <= nPatchQuads; z++)
+		{
+			for (int x = 0; x <= nPatchQuads; x++)
+			{
+				float fHeight = pxmf3First[x + z * nWidth].y;
+				if (fHeight < fMinHeight) fMinHeight = fHeight;
+				if (fHeight > fMaxHeight) fMaxHeight = fHeight;
+			}
+		}
+		pMesh->m_pxmf3PatchCenters[i] = XMFLOAT3((pxmf3First->x + pxmf3Last->x) * 0.5f, (fMinHeight + fMaxHeight) * 0.5f, (pxmf3First->z + pxmf3Last->z) * 0.5f);
+		pMesh->m_pxmf3PatchExtents[i] = XMFLOAT3((pxmf3Last->x - pxmf3First->x) * 0.5f, (fMaxHeight - fMinHeight) * 0.5f, (pxmf3Last->z - pxmf3First->z) * 0.5f);
+	}
 }
 
-void CHeightMapGridMesh::Render(ID3D12GraphicsCommandList* pd3dCommandList, int nSubSet)
+int CHeightMapGeomipMesh::BuildIndexSet(int nLevel, int nEdgeMask, UINT *pnIndices)
 {
-	pd3dCommandList->IASetPrimitiveTopology(m_d3dPrimitiveTopology);
+	//Clockwise seen from above: (x, z), (x, z + s), (x + s, z + s) and (x, z), (x + s, z + s), (x + s, z)
+	static const int pnTriangles[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
 
-	D3D12_VERTEX_BUFFER_VIEW pVertexBufferViews[4] = { m_d3dPositionBufferView,  m_d3dColorBufferView, m_d3dTextureCoord0BufferView, m_d3dTextureCoord1BufferView};
-	pd3dCommandList->IASetVertexBuffers(m_nSlot, 4, pVertexBufferViews);
-
-	if ((m_nSubMeshes > 0) && (nSubSet < m_nSubMeshes))
+	int s = 1 << nLevel, nIndices = 0;
+	for (int z = 0; z < m_nPatchQuads; z += s)
 	{
-		pd3dCommandList->IASetIndexBuffer(&(m_pd3dSubSetIndexBufferViews[nSubSet]));
-		pd3dCommandList->DrawIndexedInstanced(m_pnSubSetIndices[nSubSet], 1, 0, 0, 0);
+		for (int x = 0; x < m_nPatchQuads; x += s)
+		{
+			int pxCorners[4] = { x, x, x + s, x + s }, pzCorners[4] = { z, z + s, z + s, z };
+			UINT pnCorners[4];
+			for (int i = 0; i < 4; i++)
+			{
+				//An odd vertex of a stitched edge drops onto the even one below it (the corners are all even)
+				int cx = pxCorners[i], cz = pzCorners[i];
+				if ((nEdgeMask & GEOMIPMAP_EDGE_LEFT) && (cx == 0) && ((cz / s) & 1)) cz -= s;
+				else if ((nEdgeMask & GEOMIPMAP_EDGE_RIGHT) && (cx == m_nPatchQuads) && ((cz / s) & 1)) cz -= s;
+				else if ((nEdgeMask & GEOMIPMAP_EDGE_TOP) && (cz == m_nPatchQuads) && ((cx / s) & 1)) cx -= s;
+				else if ((nEdgeMask & GEOMIPMAP_EDGE_BOTTOM) && (cz == 0) && ((cx / s) & 1)) cx -= s;
+				pnCorners[i] = UINT(cx + cz * m_nWidth);
+			}
+			for (int t = 0; t < 2; t++)
+			{
+				UINT a = pnCorners[pnTriangles[t][0]], b = pnCorners[pnTriangles[t][1]], c = pnCorners[pnTriangles[t][2]];
+				if ((a == b) || (b == c) || (c == a)) continue;
+				pnIndices[nIndices++] = a;
+				pnIndices[nIndices++] = b;
+				pnIndices[nIndices++] = c;
+			}
+		}
 	}
-	else
+	return(nIndices);
+}
+
+int CHeightMapGeomipMesh::BuildPatchDraws(int *pnPatches, int nPatches, int *pnLevels, BYTE *pnEdgeMasks, TERRAINPATCHDRAW *pDraws)
+{
+	if (!pnPatches) nPatches = m_cxPatches * m_czPatches;
+	for (int i = 0; i < nPatches; i++)
 	{
-		pd3dCommandList->DrawInstanced(m_nVertices, 1, m_nOffset, 0);
+		int nPatch = (pnPatches) ? pnPatches[i] : i;
+		pDraws[i] = *GetIndexSet(pnLevels[nPatch], pnEdgeMasks[nPatch]);
+		pDraws[i].m_nBaseVertex = GetPatchBaseVertex(nPatch);
 	}
+	return(nPatches);
+}
+
+void CHeightMapGeomipMesh::Render(ID3D12GraphicsCommandList* pd3dCommandList, int *pnPatches, int nPatches, int *pnLevels, BYTE *pnEdgeMasks)
+{
+	m_nPatchDraws = BuildPatchDraws(pnPatches, nPatches, pnLevels, pnEdgeMasks, m_pPatchDraws);
+	::SubmitTerrainPatchDraws(pd3dCommandList, m_d3dPrimitiveTopology, m_pd3dVertexBufferViews, &m_d3dIndexBufferView, m_pPatchDraws, m_nPatchDraws);
 }
 
 CWaterMesh::CWaterMesh(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, int xStart, int zStart, int nWidth, int nLength, XMFLOAT3 xmf3Scale, void* pContext)
@@ -782,3 +1708,445 @@ CSkyBoxMesh::CSkyBoxMesh(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd
 CSkyBoxMesh::~CSkyBoxMesh()
 {
 }
+
+#if defined(_WITH_TERRAIN_RAYCAST_BENCHMARK) || defined(_WITH_HEIGHT_QUERY_BENCHMARK) || defined(_WITH_HEIGHT_MAP_LAYOUT_BENCHMARK) || defined(_WITH_TERRAIN_CONSTRUCTION_BENCHMARK)
+static float RandomBenchmarkValue(UINT *pnRandom, float fMin, float fMax)
+{
+	*pnRandom = *pnRandom * 1664525 + 1013904223;
+	return(fMin + (fMax - fMin) * ((*pnRandom >> 8) / float(1 << 24)));
+}
+
+int BenchmarkTerrainRayCast(LPCTSTR pstrFileName, int nWidth, int nLength, XMFLOAT3 xmf3Scale, int nRays)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	CHeightMapImage *pHeightMapImage = new CHeightMapImage(pstrFileName, nWidth, nLength, xmf3Scale);
+	float fWidth = (nWidth - 1) * xmf3Scale.x, fLength = (nLength - 1) * xmf3Scale.z, fTop = 255.0f * xmf3Scale.y;
+	XMFLOAT3 *pxmf3Starts = new XMFLOAT3[nRays], *pxmf3Ends = new XMFLOAT3[nRays];
+	float *pfHits = new float[nRays];
+	bool *pbHits = new bool[nRays];
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Terrain ray cast: %d x %d height map, %d pyramid levels, %d rays\n"), nWidth, nLength, pHeightMapImage->GetPyramidLevels(), nRays);
+	OutputDebugString(pstrDebug);
+
+	int nFailures = 0;
+
+	//Sight lines between two points anywhere over the terrain (AI visibility, camera), then bullet steps of 10 units
+	for (int k = 0; k < 2; k++)
+	{
+		UINT nRandom = 1;
+		for (int i = 0; i < nRays; i++)
+		{
+			pxmf3Starts[i] = XMFLOAT3(::RandomBenchmarkValue(&nRandom, 0.0f, fWidth), ::RandomBenchmarkValue(&nRandom, 0.0f, fTop), ::RandomBenchmarkValue(&nRandom, 0.0f, fLength));
+			if (k == 0)
+			{
+				pxmf3Ends[i] = XMFLOAT3(::RandomBenchmarkValue(&nRandom, 0.0f, fWidth), ::RandomBenchmarkValue(&nRandom, 0.0f, fTop), ::RandomBenchmarkValue(&nRandom, 0.0f, fLength));
+			}
+			else
+			{
+				XMFLOAT3 xmf3Direction(::RandomBenchmarkValue(&nRandom, -1.0f, 1.0f), ::RandomBenchmarkValue(&nRandom, -1.0f, 1.0f), ::RandomBenchmarkValue(&nRandom, -1.0f, 1.0f));
+				xmf3Direction = Vector3::Normalize(xmf3Direction);
+				pxmf3Ends[i] = Vector3::Add(pxmf3Starts[i], xmf3Direction, 10.0f);
+			}
+		}
+
+		int nHits = 0;
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nRays; i++)
+		{
+			pbHits[i] = pHeightMapImage->IntersectSegment(pxmf3Starts[i], pxmf3Ends[i], &pfHits[i]);
+			if (pbHits[i]) nHits++;
+		}
+		::QueryPerformanceCounter(&nEnd);
+		double fPyramidSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		//The first hits may differ by rounding where the segment only grazes the surface
+		int nMismatches = 0;
+		float fHit;
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nRays; i++)
+		{
+			bool bHit = pHeightMapImage->IntersectSegmentQuads(pxmf3Starts[i], pxmf3Ends[i], &fHit);
+			if ((bHit != pbHits[i]) || (bHit && (fabsf(fHit - pfHits[i]) > 1.0e-4f))) nMismatches++;
+		}
+		::QueryPerformanceCounter(&nEnd);
+		double fQuadSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		int nVisibilityMismatches = 0;
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nRays; i++)
+		{
+			if (pHeightMapImage->IsVisible(pxmf3Starts[i], pxmf3Ends[i]) == pbHits[i]) nVisibilityMismatches++;
+		}
+		::QueryPerformanceCounter(&nEnd);
+		double fVisibilitySeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		_stprintf_s(pstrDebug, 256, _T("    %s: pyramid %.2f M rays/s, quad walk %.2f M rays/s, line of sight %.2f M rays/s; %d hits, %d mismatches (%d line of sight)\n"), (k == 0) ? _T("sight lines") : _T("bullet steps"), nRays / fPyramidSeconds * 1.0e-6, nRays / fQuadSeconds * 1.0e-6, nRays / fVisibilitySeconds * 1.0e-6, nHits, nMismatches, nVisibilityMismatches);
+		OutputDebugString(pstrDebug);
+		nFailures += nMismatches + nVisibilityMismatches;
+	}
+
+	delete pHeightMapImage;
+	delete[] pxmf3Starts;
+	delete[] pxmf3Ends;
+	delete[] pfHits;
+	delete[] pbHits;
+
+	return(nFailures);
+}
+#endif
+
+#ifdef _WITH_HEIGHT_QUERY_BENCHMARK
+int BenchmarkHeightQueries(LPCTSTR pstrFileName, int nWidth, int nLength, XMFLOAT3 xmf3Scale, int nQueries)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	CHeightMapImage *pHeightMapImage = new CHeightMapImage(pstrFileName, nWidth, nLength, xmf3Scale);
+	float *pfx = new float[nQueries], *pfz = new float[nQueries];
+	float *pfHeights = new float[nQueries], *pfReferenceHeights = new float[nQueries];
+	XMFLOAT3 *pxmf3Normals = new XMFLOAT3[nQueries], *pxmf3ReferenceNormals = new XMFLOAT3[nQueries];
+
+	//Mostly over the height map, some around it (outside and the last row and column take the other paths)
+	UINT nRandom = 1;
+	float fWidth = nWidth * xmf3Scale.x, fLength = nLength * xmf3Scale.z;
+	for (int i = 0; i < nQueries; i++)
+	{
+		pfx[i] = ::RandomBenchmarkValue(&nRandom, -0.02f * fWidth, 1.02f * fWidth);
+		pfz[i] = ::RandomBenchmarkValue(&nRandom, -0.02f * fLength, 1.02f * fLength);
+	}
+
+	TCHAR pstrDebug[256] = { 0 };
+#if defined(__AVX2__)
+	_stprintf_s(pstrDebug, 256, _T("Height queries (AVX2, 8 lanes): %d x %d height map, %d queries\n"), nWidth, nLength, nQueries);
+#else
+	_stprintf_s(pstrDebug, 256, _T("Height queries (no AVX2, scalar batch): %d x %d height map, %d queries\n"), nWidth, nLength, nQueries);
+#endif
+	OutputDebugString(pstrDebug);
+
+	int nFailures = 0;
+	for (int k = 0; k < 2; k++)
+	{
+		bool bReverseQuad = (k == 1);
+
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nQueries; i++) pfReferenceHeights[i] = pHeightMapImage->GetHeight(pfx[i], pfz[i], bReverseQuad);
+		::QueryPerformanceCounter(&nEnd);
+		double fScalarHeightSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nQueries; i++) pxmf3ReferenceNormals[i] = pHeightMapImage->GetHeightMapNormal(int(pfx[i] / xmf3Scale.x), int(pfz[i] / xmf3Scale.z));
+		::QueryPerformanceCounter(&nEnd);
+		double fScalarSeconds = fScalarHeightSeconds + double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		::QueryPerformanceCounter(&nBegin);
+		pHeightMapImage->GetHeightsAndNormals(pfx, pfz, nQueries, pfHeights, NULL, bReverseQuad);
+		::QueryPerformanceCounter(&nEnd);
+		double fBatchHeightSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		int nMismatches = 0;
+		for (int i = 0; i < nQueries; i++) if (memcmp(&pfHeights[i], &pfReferenceHeights[i], sizeof(float))) nMismatches++;
+
+		::QueryPerformanceCounter(&nBegin);
+		pHeightMapImage->GetHeightsAndNormals(pfx, pfz, nQueries, pfHeights, pxmf3Normals, bReverseQuad);
+		::QueryPerformanceCounter(&nEnd);
+		double fBatchSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		for (int i = 0; i < nQueries; i++)
+		{
+			if (memcmp(&pfHeights[i], &pfReferenceHeights[i], sizeof(float)) || memcmp(&pxmf3Normals[i], &pxmf3ReferenceNormals[i], sizeof(XMFLOAT3))) nMismatches++;
+		}
+
+		_stprintf_s(pstrDebug, 256, _T("    %s: heights %.1f M/s batched, %.1f M/s scalar; heights and normals %.1f M/s batched, %.1f M/s scalar; %d mismatches\n"), (bReverseQuad) ? _T("reversed quads") : _T("quads"), nQueries / fBatchHeightSeconds * 1.0e-6, nQueries / fScalarHeightSeconds * 1.0e-6, nQueries / fBatchSeconds * 1.0e-6, nQueries / fScalarSeconds * 1.0e-6, nMismatches);
+		OutputDebugString(pstrDebug);
+		nFailures += nMismatches;
+	}
+
+	delete pHeightMapImage;
+	delete[] pfx;
+	delete[] pfz;
+	delete[] pfHeights;
+	delete[] pfReferenceHeights;
+	delete[] pxmf3Normals;
+	delete[] pxmf3ReferenceNormals;
+
+	return(nFailures);
+}
+#endif
+
+#ifdef _WITH_HEIGHT_MAP_LAYOUT_BENCHMARK
+int BenchmarkHeightMapLayouts(int nSize, int nQueries)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	//Rolling hills with some noise
+	BYTE *pPixels = new BYTE[nSize * nSize];
+	UINT nRandom = 1;
+	for (int z = 0; z < nSize; z++)
+	{
+		for (int x = 0; x < nSize; x++)
+		{
+			float fHeight = 128.0f + 80.0f * sinf(x * 0.011f) * cosf(z * 0.007f) + 30.0f * sinf((x + z) * 0.031f);
+			pPixels[x + (z * nSize)] = (BYTE)(max(0.0f, min(255.0f, fHeight + ::RandomBenchmarkValue(&nRandom, -8.0f, 8.0f))));
+		}
+	}
+	XMFLOAT3 xmf3Scale(4.0f, 1.0f, 4.0f);
+	CHeightMapImage *ppHeightMapImages[2];
+	ppHeightMapImages[0] = new CHeightMapImage(pPixels, nSize, nSize, xmf3Scale, false);
+	ppHeightMapImages[1] = new CHeightMapImage(pPixels, nSize, nSize, xmf3Scale, true);
+	delete[] pPixels;
+
+	float *pfx = new float[nQueries], *pfz = new float[nQueries];
+	float *ppfHeights[2] = { new float[nQueries], new float[nQueries] };
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Height map layouts: %d x %d, %d queries, row-major / tiled (%d x %d)\n"), nSize, nSize, nQueries, 1 << HEIGHT_MAP_TILE_SHIFT, 1 << HEIGHT_MAP_TILE_SHIFT);
+	OutputDebugString(pstrDebug);
+
+	//Inside the last row and column, where the layouts agree
+	float fSize = (nSize - 1) * xmf3Scale.x;
+	int nFailures = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		nRandom = 1;
+		if (k == 0)
+		{
+			//Random points anywhere
+			for (int i = 0; i < nQueries; i++)
+			{
+				pfx[i] = ::RandomBenchmarkValue(&nRandom, 0.0f, fSize);
+				pfz[i] = ::RandomBenchmarkValue(&nRandom, 0.0f, fSize);
+			}
+		}
+		else if (k == 1)
+		{
+			//Walks: 256 objects taking steps of up to a pixel, one query each per step
+			int nWalkers = 256;
+			for (int i = 0; i < nQueries; i++)
+			{
+				if (i < nWalkers)
+				{
+					pfx[i] = ::RandomBenchmarkValue(&nRandom, 0.0f, fSize);
+					pfz[i] = ::RandomBenchmarkValue(&nRandom, 0.0f, fSize);
+				}
+				else
+				{
+					pfx[i] = min(fSize - 0.01f, max(0.0f, pfx[i - nWalkers] + ::RandomBenchmarkValue(&nRandom, -xmf3Scale.x, xmf3Scale.x)));
+					pfz[i] = min(fSize - 0.01f, max(0.0f, pfz[i - nWalkers] + ::RandomBenchmarkValue(&nRandom, -xmf3Scale.z, xmf3Scale.z)));
+				}
+			}
+		}
+		else
+		{
+			//Down the columns, one pixel at a time (across the rows of a row-major map)
+			for (int i = 0; i < nQueries; i++)
+			{
+				pfx[i] = (((i / (nSize - 1)) % (nSize - 1)) + 0.5f) * xmf3Scale.x;
+				pfz[i] = ((i % (nSize - 1)) + 0.5f) * xmf3Scale.z;
+			}
+		}
+
+		double pfScalarSeconds[2], pfBatchSeconds[2];
+		for (int j = 0; j < 2; j++)
+		{
+			::QueryPerformanceCounter(&nBegin);
+			for (int i = 0; i < nQueries; i++) ppfHeights[j][i] = ppHeightMapImages[j]->GetHeight(pfx[i], pfz[i]);
+			::QueryPerformanceCounter(&nEnd);
+			pfScalarSeconds[j] = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+			::QueryPerformanceCounter(&nBegin);
+			ppHeightMapImages[j]->GetHeightsAndNormals(pfx, pfz, nQueries, ppfHeights[j]);
+			::QueryPerformanceCounter(&nEnd);
+			pfBatchSeconds[j] = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+		}
+
+		int nMismatches = 0;
+		for (int i = 0; i < nQueries; i++) if (memcmp(&ppfHeights[0][i], &ppfHeights[1][i], sizeof(float))) nMismatches++;
+
+		_stprintf_s(pstrDebug, 256, _T("    %s: GetHeight %.1f / %.1f M/s, batched %.1f / %.1f M/s; %d mismatches\n"), (k == 0) ? _T("random") : ((k == 1) ? _T("walks") : _T("columns")), nQueries / pfScalarSeconds[0] * 1.0e-6, nQueries / pfScalarSeconds[1] * 1.0e-6, nQueries / pfBatchSeconds[0] * 1.0e-6, nQueries / pfBatchSeconds[1] * 1.0e-6, nMismatches);
+		OutputDebugString(pstrDebug);
+		nFailures += nMismatches;
+	}
+
+	delete ppHeightMapImages[0];
+	delete ppHeightMapImages[1];
+	delete[] pfx;
+	delete[] pfz;
+	delete[] ppfHeights[0];
+	delete[] ppfHeights[1];
+
+	return(nFailures);
+}
+#endif
+
+#ifdef _WITH_TERRAIN_CONSTRUCTION_BENCHMARK
+static UINT64 HashBenchmarkData(UINT64 nHash, void *pData, size_t nBytes)
+{
+	//FNV-1a over 32 bit words (every array hashed is made of them)
+	UINT *pnWords = (UINT *)pData;
+	for (size_t i = 0; i < nBytes / sizeof(UINT); i++) nHash = (nHash ^ pnWords[i]) * 0x100000001b3ULL;
+	return(nHash);
+}
+
+static UINT64 HashTerrainMesh(CHeightMapTerrainMesh *pMesh)
+{
+	UINT64 nHash = 0xcbf29ce484222325ULL;
+	UINT nVertices = pMesh->GetVertexCount();
+	nHash = ::HashBenchmarkData(nHash, pMesh->GetPositions(), sizeof(XMFLOAT3) * nVertices);
+	nHash = ::HashBenchmarkData(nHash, pMesh->GetColors(), sizeof(XMFLOAT4) * nVertices);
+	nHash = ::HashBenchmarkData(nHash, pMesh->GetTextureCoords0(), sizeof(XMFLOAT2) * nVertices);
+	nHash = ::HashBenchmarkData(nHash, pMesh->GetTextureCoords1(), sizeof(XMFLOAT2) * nVertices);
+	nHash = ::HashBenchmarkData(nHash, pMesh->GetIndices(), sizeof(UINT) * pMesh->GetIndexCount());
+	return(nHash);
+}
+
+//The color of GetHeightMapTerrainColor from the normals of CHeightField::GetNormal
+static XMFLOAT4 GetHeightFieldTerrainColor(CHeightField *pHeightField, int x, int z)
+{
+	XMFLOAT3 xmf3LightDirection = ::GetHeightMapTerrainLightDirection();
+	float pfLights[4];
+	int pnCorners[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+	for (int i = 0; i < 4; i++)
+	{
+		XMFLOAT3 xmf3Normal = pHeightField->GetNormal(x + pnCorners[i][0], z + pnCorners[i][1]);
+		pfLights[i] = Vector3::DotProduct(xmf3Normal, xmf3LightDirection);
+	}
+	return(::GetHeightMapTerrainColor(pfLights[0], pfLights[1], pfLights[2], pfLights[3]));
+}
+
+//The colors of a mesh of every nStep-th sample against the four normals per vertex of GetHeightFieldTerrainColor
+static int CheckTerrainMeshColors(CHeightMapTerrainMesh *pMesh, CHeightField *pHeightField, int cxVertices, int nStep, XMFLOAT4 xmf4Color, double *pfSeconds)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	int nMismatches = 0;
+	XMFLOAT4 *pxmf4Colors = pMesh->GetColors();
+	::QueryPerformanceCounter(&nBegin);
+	for (int i = 0; i < int(pMesh->GetVertexCount()); i++)
+	{
+		XMFLOAT4 xmf4Reference = Vector4::Add(::GetHeightFieldTerrainColor(pHeightField, (i % cxVertices) * nStep, (i / cxVertices) * nStep), xmf4Color);
+		if (memcmp(&xmf4Reference, &pxmf4Colors[i], sizeof(XMFLOAT4))) nMismatches++;
+	}
+	::QueryPerformanceCounter(&nEnd);
+	*pfSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+	return(nMismatches);
+}
+
+int BenchmarkTerrainConstruction(int *pnSizes, int nSizes, int nBlockWidth, int nBlockLength, int nPatchQuads, XMFLOAT3 xmf3Scale)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	int nFailures = 0;
+	CThreadPool *pThreadPool = new CThreadPool();
+	XMFLOAT4 xmf4Color(0.0f, 0.5f, 0.0f, 0.0f);
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Terrain construction: %d threads, grid mesh of %d x %d blocks, geomip mesh of %d quad patches\n"), pThreadPool->GetThreads(), nBlockWidth, nBlockLength, nPatchQuads);
+	OutputDebugString(pstrDebug);
+
+	for (int s = 0; s < nSizes; s++)
+	{
+		//The rolling hills of BenchmarkHeightMapLayouts
+		int nSize = pnSizes[s];
+		BYTE *pPixels = new BYTE[nSize * nSize];
+		UINT nRandom = 1;
+		for (int z = 0; z < nSize; z++)
+		{
+			for (int x = 0; x < nSize; x++)
+			{
+				float fHeight = 128.0f + 80.0f * sinf(x * 0.011f) * cosf(z * 0.007f) + 30.0f * sinf((x + z) * 0.031f);
+				pPixels[x + (z * nSize)] = (BYTE)(max(0.0f, min(255.0f, fHeight + ::RandomBenchmarkValue(&nRandom, -8.0f, 8.0f))));
+			}
+		}
+		//Through a raw file in the temporary directory, as the terrain reads its height map
+		TCHAR pstrTempPath[MAX_PATH], pstrRawFileName[MAX_PATH], pstrFileName[MAX_PATH];
+		::GetTempPath(MAX_PATH, pstrTempPath);
+		_stprintf_s(pstrRawFileName, MAX_PATH, _T("%sTerrainConstruction%d.raw"), pstrTempPath, nSize);
+		_stprintf_s(pstrFileName, MAX_PATH, _T("%sTerrainConstruction%d.hfld"), pstrTempPath, nSize);
+		HANDLE hRawFile = ::CreateFile(pstrRawFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		DWORD nBytes = 0;
+		bool bWritten = (hRawFile != INVALID_HANDLE_VALUE) && ::WriteFile(hRawFile, pPixels, nSize * nSize, &nBytes, NULL) && (nBytes == DWORD(nSize * nSize));
+		if (hRawFile != INVALID_HANDLE_VALUE) ::CloseHandle(hRawFile);
+		delete[] pPixels;
+		CHeightField *pHeightField = new CHeightField(256);
+		if (!bWritten || !pHeightField->OpenRaw(pstrRawFileName, nSize, nSize, HEIGHT_FIELD_FORMAT_R8, xmf3Scale))
+		{
+			OutputDebugString(_T("  the height map could not be written or cooked\n"));
+			nFailures++;
+			delete pHeightField;
+			::DeleteFile(pstrRawFileName);
+			continue;
+		}
+
+		//Each mesh built on the calling thread alone, then on the pool; both must give the same bits. One mesh at a time,
+		//the vertices of a 4097 x 4097 geomip mesh take 700 MB
+		for (int k = 0; k < 2; k++)
+		{
+			double pfSeconds[2], fReferenceSeconds = 0.0;
+			UINT64 pnHashes[2], pnBoundsHashes[2];
+			int nColorMismatches = 0, nPatches = 0;
+			UINT nVertices = 0, nIndices = 0;
+			for (int j = 0; j < 2; j++)
+			{
+				CThreadPool *pMeshThreadPool = (j == 0) ? NULL : pThreadPool;
+				CHeightMapTerrainMesh *pMesh = NULL;
+				UINT64 nBoundsHash = 0xcbf29ce484222325ULL;
+				::QueryPerformanceCounter(&nBegin);
+				if (k == 0)
+				{
+					CHeightMapGridMesh *pGridMesh = new CHeightMapGridMesh(NULL, NULL, nSize, nSize, nBlockWidth, nBlockLength, xmf3Scale, xmf4Color, pHeightField, pMeshThreadPool);
+					::QueryPerformanceCounter(&nEnd);
+					nPatches = pGridMesh->GetPatches();
+					nBoundsHash = ::HashBenchmarkData(nBoundsHash, pGridMesh->GetPatchAABBCenters(), sizeof(XMFLOAT3) * nPatches);
+					nBoundsHash = ::HashBenchmarkData(nBoundsHash, pGridMesh->GetPatchAABBExtents(), sizeof(XMFLOAT3) * nPatches);
+					nBoundsHash = ::HashBenchmarkData(nBoundsHash, pGridMesh->GetPatchErrors(), sizeof(float) * nPatches);
+					pMesh = pGridMesh;
+				}
+				else
+				{
+					CHeightMapGeomipMesh *pGeomipMesh = new CHeightMapGeomipMesh(NULL, NULL, nSize, nSize, nPatchQuads, xmf3Scale, xmf4Color, pHeightField, pMeshThreadPool);
+					::QueryPerformanceCounter(&nEnd);
+					nPatches = pGeomipMesh->GetPatches();
+					nBoundsHash = ::HashBenchmarkData(nBoundsHash, pGeomipMesh->GetPatchAABBCenters(), sizeof(XMFLOAT3) * nPatches);
+					nBoundsHash = ::HashBenchmarkData(nBoundsHash, pGeomipMesh->GetPatchAABBExtents(), sizeof(XMFLOAT3) * nPatches);
+					pMesh = pGeomipMesh;
+				}
+				pfSeconds[j] = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+				pnHashes[j] = ::HashTerrainMesh(pMesh);
+				pnBoundsHashes[j] = nBoundsHash;
+				nVertices = pMesh->GetVertexCount();
+				nIndices = pMesh->GetIndexCount();
+				if (j == 1)
+				{
+					if (k == 0)
+						nColorMismatches = ::CheckTerrainMeshColors(pMesh, pHeightField, ((nSize - 1) / (nBlockWidth - 1)) * ((nBlockWidth - 1) / 2) + 1, 2, xmf4Color, &fReferenceSeconds);
+					else
+						nColorMismatches = ::CheckTerrainMeshColors(pMesh, pHeightField, nSize, 1, xmf4Color, &fReferenceSeconds);
+				}
+				delete pMesh;
+			}
+
+			//What CreateBuffers would upload, 256 byte aligned in one upload buffer
+			UINT64 nUploadBytes = ((UINT64(sizeof(XMFLOAT3) + sizeof(XMFLOAT4) + 2 * sizeof(XMFLOAT2)) * nVertices) + (UINT64(sizeof(UINT)) * nIndices));
+			_stprintf_s(pstrDebug, 256, _T("  %4d x %4d %s: %d patches, %u vertices, %u indices, %.1f MB to upload; serial %.2f ms, pool %.2f ms (x%.2f)\n"), nSize, nSize, (k == 0) ? _T("grid  ") : _T("geomip"), nPatches, nVertices, nIndices, nUploadBytes / (1024.0 * 1024.0), pfSeconds[0] * 1000.0, pfSeconds[1] * 1000.0, pfSeconds[0] / pfSeconds[1]);
+			OutputDebugString(pstrDebug);
+			_stprintf_s(pstrDebug, 256, _T("    serial/pool: geometry %s, bounds %s; colors against 4 normals per vertex (%.2f ms): %d mismatches\n"), (pnHashes[0] == pnHashes[1]) ? _T("identical") : _T("DIFFERENT"), (pnBoundsHashes[0] == pnBoundsHashes[1]) ? _T("identical") : _T("DIFFERENT"), fReferenceSeconds * 1000.0, nColorMismatches);
+			OutputDebugString(pstrDebug);
+			nFailures += ((pnHashes[0] != pnHashes[1]) ? 1 : 0) + ((pnBoundsHashes[0] != pnBoundsHashes[1]) ? 1 : 0) + nColorMismatches;
+		}
+
+		delete pHeightField;
+		::DeleteFile(pstrRawFileName);
+		::DeleteFile(pstrFileName);
+	}
+
+	delete pThreadPool;
+
+	return(nFailures);
+}
+#endif
@@ -4,6 +4,11 @@
 
 #pragma once
 
+class CCamera;
+class CThreadPool;
+struct MESHCLUSTER;
+struct MESHCLUSTERBLOCK;
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
 class CMesh
@@ -33,6 +38,11 @@ public:
 	UINT GetType() { return(m_nType); }
 	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList) { }
 	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet) { }
+	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet, int nLod) { Render(pd3dCommandList, nSubSet); }
+
+	virtual int SelectLod(CCamera *pCamera, XMFLOAT4X4 *pxmf4x4World) { return(0); }
+	//Prepares the subsets of level nLod for the next Render calls; false when nothing of the mesh is visible
+	virtual bool CullClusters(CCamera *pCamera, XMFLOAT4X4 *pxmf4x4World, int nLod) { return(true); }
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -42,6 +52,8 @@ public:
 #define VERTEXT_NORMAL				0x04
 #define VERTEXT_UV					0x08
 
+#define MESH_MAX_LODS				4 //Level 0 plus up to three simplified index sets (MeshSimplifier.h)
+
 class CMeshLoadInfo
 {
 public:
@@ -53,6 +65,9 @@ public:
 
 	UINT							m_nType = 0x00;
 
+	//Vertex/index arrays point into a mapped model file and are not owned (CModelStreamReader)
+	bool							m_bMappedArrays = false;
+
 	XMFLOAT3						m_xmf3AABBCenter = XMFLOAT3(0.0f, 0.0f, 0.0f);
 	XMFLOAT3						m_xmf3AABBExtents = XMFLOAT3(0.0f, 0.0f, 0.0f);
 
@@ -68,6 +83,18 @@ public:
 	int								m_nSubMeshes = 0;
 	int								*m_pnSubSetIndices = NULL;
 	UINT							**m_ppnSubSetIndices = NULL;
+
+	//Level 0 is m_ppnSubSetIndices; level l > 0 of submesh i is at [(l - 1) * m_nSubMeshes + i].
+	//m_pfLodErrors are in model units (0 for level 0).
+	int								m_nLods = 1;
+	float							m_pfLodErrors[MESH_MAX_LODS] = { 0.0f };
+	int								*m_pnLodSubSetIndices = NULL;
+	UINT							**m_ppnLodSubSetIndices = NULL;
+
+	//Clusters of level l, submesh i at [l * m_nSubMeshes + i], level 0 included (MeshCluster.h);
+	//the index sets above are stored cluster by cluster
+	int								*m_pnSubSetClusters = NULL;
+	MESHCLUSTER						**m_ppSubSetClusters = NULL;
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -78,6 +105,11 @@ public:
 	CMeshFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, CMeshLoadInfo *pMeshInfo);
 	virtual ~CMeshFromFile();
 
+protected:
+	CMeshFromFile() { }
+
+	void CreateSubSetIndexBuffers(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, CMeshLoadInfo *pMeshInfo);
+
 public:
 	virtual void ReleaseUploadBuffers();
 
@@ -93,8 +125,37 @@ protected:
 	ID3D12Resource					**m_ppd3dSubSetIndexUploadBuffers = NULL;
 	D3D12_INDEX_BUFFER_VIEW			*m_pd3dSubSetIndexBufferViews = NULL;
 
+	//All levels of a submesh share its index buffer: level l is [m_pnLodSubSetStarts, +m_pnLodSubSetIndices) at [l * m_nSubMeshes + i]
+	int								m_nLods = 1;
+	float							m_pfLodErrors[MESH_MAX_LODS] = { 0.0f };
+	int								*m_pnLodSubSetStarts = NULL;
+	int								*m_pnLodSubSetIndices = NULL;
+
+	XMFLOAT3						m_xmf3AABBCenter = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	XMFLOAT3						m_xmf3AABBExtents = XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+	//Clusters of range [l * m_nSubMeshes + i] start at block m_pnLodSubSetFirstBlocks; the per-cluster arrays have 4 entries per block
+	MESHCLUSTERBLOCK				*m_pClusterBlocks = NULL;
+	UINT							*m_pnClusterIndexStarts = NULL; //In the submesh index buffer
+	UINT							*m_pnClusterIndices = NULL;
+	int								*m_pnLodSubSetFirstBlocks = NULL;
+	int								*m_pnLodSubSetClusters = NULL;
+
+	//Written by CullClusters, consumed by the next DrawSubSet of each subset (-1: draw the whole level)
+	int								m_nCulledLod = 0;
+	int								*m_pnVisibleRanges = NULL;
+	UINT							*m_pnVisibleRangeStarts = NULL;
+	UINT							*m_pnVisibleRangeIndices = NULL;
+
+	void CreateClusterBlocks(CMeshLoadInfo *pMeshInfo);
+	void DrawSubSet(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet, int nLod);
+
 public:
-	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet);
+	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet) { Render(pd3dCommandList, nSubSet, 0); }
+	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet, int nLod);
+
+	virtual int SelectLod(CCamera *pCamera, XMFLOAT4X4 *pxmf4x4World);
+	virtual bool CullClusters(CCamera *pCamera, XMFLOAT4X4 *pxmf4x4World, int nLod);
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -117,7 +178,27 @@ protected:
 	D3D12_VERTEX_BUFFER_VIEW		m_d3dNormalBufferView;
 
 public:
-	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet);
+	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet, int nLod);
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+#define VERTEXT_PACKED				0x10 //Set by CMeshPackedFromFile; selects CPackedIlluminatedShader
+
+//Position, normal and uv interleaved in the single slot 0 buffer of CMeshFromFile (PACKED_VERTEX_FLAGS layout)
+class CMeshPackedFromFile : public CMeshFromFile
+{
+public:
+	CMeshPackedFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, CMeshLoadInfo *pMeshInfo);
+	virtual ~CMeshPackedFromFile();
+
+protected:
+	//Dequantization for VSPackedLighting: position = input * scale + bias
+	XMFLOAT4						m_xmf4PositionScale;
+	XMFLOAT4						m_xmf4PositionBias;
+
+public:
+	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList, int nSubSet, int nLod);
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -184,81 +265,294 @@ public:
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
+#define HEIGHT_MAP_TILE_SHIFT			3 //Tiles of 8 x 8 pixels, 64 bytes (a cache line)
+#define HEIGHT_MAP_TILE_MASK			((1 << HEIGHT_MAP_TILE_SHIFT) - 1)
+
 class CHeightMapImage
 {
 private:
 	BYTE* m_pHeightMapPixels;
+	int							m_nPixels = 0; //Allocated, padding included
 
 	int							m_nWidth;
 	int							m_nLength;
 	XMFLOAT3					m_xmf3Scale;
 
+	//Row-major: rows of m_nWidth pixels, so the rows z and z + 1 of a quad are m_nWidth bytes apart. Tiled: rows of
+	//m_nTilesX tiles, each 8 x 8 pixels row-major, so a quad is in one cache line unless it straddles a tile edge.
+	//The tiles cover at least one more row and column than the map; they repeat the last row and column.
+	bool						m_bTiled = false;
+	int							m_nTilesX = 0;
+	int							m_nTilesZ = 0;
+
+	void CreatePixels(int nWidth, int nLength, XMFLOAT3 xmf3Scale, bool bTiled);
+	//Row z of the map; the last one (z = m_nLength - 1) also fills the padding rows of a tiled map
+	void SetPixelRow(int z, BYTE *pRow);
+
+	//Min/max pyramid: level 0 has one block per quad, every level above halves both counts (rounding up) up to a
+	//single block. Each block is the lowest and the highest pixel under it (two BYTEs), rows of m_pnPyramidWidths[level].
+	int							m_nPyramidLevels = 0;
+	BYTE						**m_ppnPyramid = NULL;
+	int							*m_pnPyramidWidths = NULL;
+
+	void BuildPyramid();
+	//Height map space: x and z in pixels, y in world units; t along start + t * delta
+	bool IntersectQuad(int x, int z, float x0, float y0, float z0, float dx, float dy, float dz, float ta, float tb, float *pfHit, XMFLOAT3 *pxmf3Normal);
+	bool MarchPyramid(float x0, float y0, float z0, float dx, float dy, float dz, bool bAnyHit, float *pfHit, XMFLOAT3 *pxmf3Normal);
+
 public:
-	CHeightMapImage(LPCTSTR pFileName, int nWidth, int nLength, XMFLOAT3 xmf3Scale);
+	CHeightMapImage(LPCTSTR pFileName, int nWidth, int nLength, XMFLOAT3 xmf3Scale, bool bTiled = false);
+	//pPixels: in the order of a height map file, the top row (z = nLength - 1) first
+	CHeightMapImage(BYTE *pPixels, int nWidth, int nLength, XMFLOAT3 xmf3Scale, bool bTiled = false);
 	~CHeightMapImage(void);
 
+	int GetPixelIndex(int x, int z)
+	{
+		if (!m_bTiled) return(x + (z * m_nWidth));
+		int nTile = ((z >> HEIGHT_MAP_TILE_SHIFT) * m_nTilesX) + (x >> HEIGHT_MAP_TILE_SHIFT);
+		return((nTile << (2 * HEIGHT_MAP_TILE_SHIFT)) + ((z & HEIGHT_MAP_TILE_MASK) << HEIGHT_MAP_TILE_SHIFT) + (x & HEIGHT_MAP_TILE_MASK));
+	}
+	BYTE GetPixel(int x, int z) { return(m_pHeightMapPixels[GetPixelIndex(x, z)]); }
+	bool IsTiled() { return(m_bTiled); }
+
 	float GetHeight(float x, float z, bool bReverseQuad = false);
 	XMFLOAT3 GetHeightMapNormal(int x, int z);
+	//GetHeight of nPoints points (world x and z) and, if pxmf3Normals, the normal of the pixel each is in (as
+	//CHeightMapTerrain::GetNormal). Eight points per instruction with AVX2 (/arch:AVX2, every configuration of the
+	//project); bit-identical to the scalar functions.
+	void GetHeightsAndNormals(float *pfx, float *pfz, int nPoints, float *pfHeights, XMFLOAT3 *pxmf3Normals = NULL, bool bReverseQuad = false);
+	//First point of the segment (world x and z, heights scaled by m_xmf3Scale.y) below the surface of GetHeight, as a
+	//fraction of the segment in *pfHit. Exact for the two planar triangles of every quad; the part of the segment
+	//outside the height map is not tested. Skips the blocks of the pyramid the segment passes above.
+	bool IntersectSegment(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, float *pfHit, XMFLOAT3 *pxmf3Normal = NULL);
+	//The same test visiting every quad the segment crosses (the reference of the pyramid march)
+	bool IntersectSegmentQuads(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, float *pfHit);
+	//First hit within fMaxDistance along the (normalized) direction: distance and the normal of the triangle hit
+	bool IntersectRay(XMFLOAT3& xmf3Origin, XMFLOAT3& xmf3Direction, float fMaxDistance, float *pfDistance, XMFLOAT3 *pxmf3Normal = NULL);
+	//No point of the segment below the surface; stops at the first block the segment passes completely below
+	bool IsVisible(XMFLOAT3& xmf3From, XMFLOAT3& xmf3To);
 	XMFLOAT3 GetScale() { return(m_xmf3Scale); }
 
-	BYTE* GetHeightMapPixels() { return(m_pHeightMapPixels); }
+	BYTE* GetHeightMapPixels() { return(m_pHeightMapPixels); } //In the layout of GetPixelIndex
 	int GetHeightMapWidth() { return(m_nWidth); }
 	int GetHeightMapLength() { return(m_nLength); }
+	int GetPyramidLevels() { return(m_nPyramidLevels); }
 };
 
-class CHeightMapGridMesh : public CMesh
+#ifdef _WITH_TERRAIN_RAYCAST_BENCHMARK
+//nRays random rays (long sight lines and short bullet steps) against the height map: the pyramid march against the
+//quad walk (mismatches), and the rays per second of IntersectSegment, IntersectSegmentQuads and IsVisible; returns
+//the mismatches
+int BenchmarkTerrainRayCast(LPCTSTR pstrFileName, int nWidth, int nLength, XMFLOAT3 xmf3Scale, int nRays);
+#endif
+
+#ifdef _WITH_HEIGHT_QUERY_BENCHMARK
+//nQueries random points over (and around) the height map: GetHeightsAndNormals against GetHeight and
+//GetHeightMapNormal one point at a time (results that differ in any bit), and the queries per second of each;
+//returns the results that differ
+int BenchmarkHeightQueries(LPCTSTR pstrFileName, int nWidth, int nLength, XMFLOAT3 xmf3Scale, int nQueries);
+#endif
+
+#ifdef _WITH_HEIGHT_MAP_LAYOUT_BENCHMARK
+//A synthetic nSize x nSize height map, row-major and tiled: nQueries GetHeight (one at a time and batched) at random
+//points, along walks and down columns; the queries per second of each layout and the results that differ (returned)
+int BenchmarkHeightMapLayouts(int nSize, int nQueries);
+#endif
+
+//A run of visible patches in one row of the terrain: DrawIndexedInstanced(m_nIndices, 1, m_nStartIndex, m_nBaseVertex, 0)
+struct TERRAINPATCHDRAW
+{
+	UINT							m_nIndices;
+	UINT							m_nStartIndex;
+	INT								m_nBaseVertex;
+};
+
+//The vertex buffers of a terrain mesh from the height map (position, color, texture coordinates 0 and 1: the layout
+//of CTerrainShader) and its index buffer. The geometry is built first, on the CPU (in parallel over rows of vertices
+//with a thread pool); CreateBuffers then uploads all of it from the calling thread through one upload buffer.
+class CHeightMapTerrainMesh : public CMesh
 {
 protected:
 	int							m_nWidth;
 	int							m_nLength;
 	XMFLOAT3					m_xmf3Scale;
-	UINT							m_nIndices = 0;
 
-	XMFLOAT4* m_pxmf4Colors = NULL;
-	XMFLOAT2* m_pxmf2TextureCoords0 = NULL;
-	XMFLOAT2* m_pxmf2TextureCoords1 = NULL;
+	XMFLOAT3						*m_pxmf3Positions = NULL; //Row by row from z = 0
+	//Until CreateBuffers uploads them; kept without a device
+	XMFLOAT4						*m_pxmf4Colors = NULL;
+	XMFLOAT2						*m_pxmf2TextureCoords0 = NULL;
+	XMFLOAT2						*m_pxmf2TextureCoords1 = NULL;
 
-	XMFLOAT3* m_pxmf3Positions = NULL;
+	UINT							m_nIndices = 0;
+	UINT							*m_pnIndices = NULL;
 
 	ID3D12Resource* m_pd3dPositionBuffer = NULL;
-	ID3D12Resource* m_pd3dPositionUploadBuffer = NULL;
-	D3D12_VERTEX_BUFFER_VIEW		m_d3dPositionBufferView;
-
-
 	ID3D12Resource* m_pd3dColorBuffer = NULL;
-	ID3D12Resource* m_pd3dColorUploadBuffer = NULL;
-	D3D12_VERTEX_BUFFER_VIEW		m_d3dColorBufferView;
+	ID3D12Resource* m_pd3dTextureCoord0Buffer = NULL;
+	ID3D12Resource* m_pd3dTextureCoord1Buffer = NULL;
+	ID3D12Resource* m_pd3dIndexBuffer = NULL;
+	ID3D12Resource* m_pd3dUploadBuffer = NULL; //Of all five
 
+	//Position, color, texture coordinates 0 and 1
+	D3D12_VERTEX_BUFFER_VIEW		m_pd3dVertexBufferViews[4];
+	D3D12_INDEX_BUFFER_VIEW			m_d3dIndexBufferView;
 
-	ID3D12Resource* m_pd3dTextureCoord0Buffer = NULL;
-	ID3D12Resource* m_pd3dTextureCoord0UploadBuffer = NULL;
-	D3D12_VERTEX_BUFFER_VIEW		m_d3dTextureCoord0BufferView;
+	TERRAINPATCHDRAW				*m_pPatchDraws = NULL;
+	int								m_nPatchDraws = 0;
 
-	ID3D12Resource* m_pd3dTextureCoord1Buffer = NULL;
-	ID3D12Resource* m_pd3dTextureCoord1UploadBuffer = NULL;
-	D3D12_VERTEX_BUFFER_VIEW		m_d3dTextureCoord1BufferView;
+	//cxVertices x czVertices vertices at every nStep-th sample of the height field (pContext, a CHeightField of the
+	//mesh's size and scale); each job of pThreadPool reads the rows it needs in one GetHeights
+	void BuildVertices(int cxVertices, int czVertices, int nStep, XMFLOAT4 xmf4Color, void* pContext, CThreadPool *pThreadPool);
+	//The buffers of the vertices and m_pnIndices; without a device the views are left empty
+	void CreateBuffers(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList);
 
-	int								m_nSubMeshes = 0;
-	int* m_pnSubSetIndices = NULL;
-	UINT** m_ppnSubSetIndices = NULL;
-	ID3D12Resource** m_ppd3dSubSetIndexBuffers = NULL;
-	ID3D12Resource** m_ppd3dSubSetIndexUploadBuffers = NULL;
-	D3D12_INDEX_BUFFER_VIEW* m_pd3dSubSetIndexBufferViews = NULL;
 public:
-	CHeightMapGridMesh(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, int xStart, int zStart, int nWidth, int nLength, XMFLOAT3 xmf3Scale = XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT4 xmf4Color = XMFLOAT4(1.0f, 1.0f, 0.0f, 0.0f), void* pContext = NULL);
-	virtual ~CHeightMapGridMesh();
+	CHeightMapTerrainMesh(int nWidth, int nLength, XMFLOAT3 xmf3Scale);
+	virtual ~CHeightMapTerrainMesh();
+
+	virtual void ReleaseUploadBuffers();
 
 	XMFLOAT3 GetScale() { return(m_xmf3Scale); }
 	int GetWidth() { return(m_nWidth); }
 	int GetLength() { return(m_nLength); }
+	UINT GetVertexCount() { return(m_nVertices); }
+	UINT GetIndexCount() { return(m_nIndices); }
+	XMFLOAT3 *GetPositions() { return(m_pxmf3Positions); }
+	XMFLOAT4 *GetColors() { return(m_pxmf4Colors); }
+	XMFLOAT2 *GetTextureCoords0() { return(m_pxmf2TextureCoords0); }
+	XMFLOAT2 *GetTextureCoords1() { return(m_pxmf2TextureCoords1); }
+	UINT *GetIndices() { return(m_pnIndices); }
+	int GetPatchDraws() { return(m_nPatchDraws); } //Of the last Render
+	D3D12_VERTEX_BUFFER_VIEW *GetVertexBufferViews() { return(m_pd3dVertexBufferViews); }
+	D3D12_INDEX_BUFFER_VIEW *GetIndexBufferView() { return(&m_d3dIndexBufferView); }
+	D3D12_PRIMITIVE_TOPOLOGY GetPrimitiveTopology() { return(m_d3dPrimitiveTopology); }
+};
+
+//All the patches of the terrain in one set of vertex buffers and one index buffer. The control points (every other
+//height map sample) form one grid, shared by neighbouring patches along their edges; the index buffer holds the 25
+//control points of every patch of the first row, in the order the hull shader takes them (rows from the greatest z,
+//x ascending), and a row of patches is the same indices at the base vertex of the row. Visible patches that follow each
+//other in a row are one draw.
+class CHeightMapGridMesh : public CHeightMapTerrainMesh
+{
+protected:
+	int								m_cxControlPoints = 0; //Of the grid; a row of the vertex buffers
+	int								m_czControlPoints = 0;
+	int								m_cxPatches = 0;
+	int								m_czPatches = 0;
+	int								m_cxPatchControlPoints = 0; //(nBlockWidth - 1) / 2 + 1
+	int								m_czPatchControlPoints = 0;
+
+	//Per patch, of its control points, which also bound the tessellated patch (CTerrainQuadtree)
+	XMFLOAT3						*m_pxmf3PatchCenters = NULL;
+	XMFLOAT3						*m_pxmf3PatchExtents = NULL;
+	//Per patch, the most a tessellation with a factor of 1 departs from the surface in height (CTerrainTessellation)
+	float							*m_pfPatchErrors = NULL;
+
+	BYTE							*m_pnPatchMarks = NULL; //Scratch of BuildPatchDraws
+
+	//The bounds and errors of the patches of rows [zFirst, zLast), a job of ParallelFor (pContext: the mesh)
+	static void BuildPatchBounds(int zFirst, int zLast, void *pContext);
 
-	virtual float OnGetHeight(int x, int z, void* pContext);
-	virtual XMFLOAT4 OnGetColor(int x, int z, void* pContext);
 public:
-	virtual void Render(ID3D12GraphicsCommandList* pd3dCommandList, int nSubSet);
+	//The whole nWidth x nLength height map in patches of nBlockWidth x nBlockLength samples, the geometry built on
+	//pThreadPool when there is one. Without a device only the CPU side is built (vertices, bounds, indices and draws),
+	//for headless benchmarks.
+	CHeightMapGridMesh(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale = XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT4 xmf4Color = XMFLOAT4(1.0f, 1.0f, 0.0f, 0.0f), void* pContext = NULL, CThreadPool *pThreadPool = NULL);
+	virtual ~CHeightMapGridMesh();
 
+	//Patch (x, z) is patch x + z * GetPatchesX(), its first sample at (x * (nBlockWidth - 1), z * (nBlockLength - 1))
+	int GetPatchesX() { return(m_cxPatches); }
+	int GetPatchesZ() { return(m_czPatches); }
+	int GetPatches() { return(m_cxPatches * m_czPatches); }
+	XMFLOAT3 *GetPatchAABBCenters() { return(m_pxmf3PatchCenters); }
+	XMFLOAT3 *GetPatchAABBExtents() { return(m_pxmf3PatchExtents); }
+	float *GetPatchErrors() { return(m_pfPatchErrors); }
+
+	//The runs of the nPatches patches in pnPatches (any order, no repeats; every patch when NULL) into pDraws (room for
+	//nPatches, or GetPatchesZ() for every patch), row by row; returns their number
+	int BuildPatchDraws(int *pnPatches, int nPatches, TERRAINPATCHDRAW *pDraws);
+public:
+	//The patches pnPatches; every patch when pnPatches is NULL
+	void Render(ID3D12GraphicsCommandList* pd3dCommandList, int *pnPatches, int nPatches);
 };
 
+//Binds the vertex and index buffers of a terrain once and issues the draws. T is ID3D12GraphicsCommandList, or a
+//stand-in with the same methods that records the calls (the submission benchmark)
+template <class T> void SubmitTerrainPatchDraws(T *pCommandList, D3D12_PRIMITIVE_TOPOLOGY d3dPrimitiveTopology, D3D12_VERTEX_BUFFER_VIEW *pd3dVertexBufferViews, D3D12_INDEX_BUFFER_VIEW *pd3dIndexBufferView, TERRAINPATCHDRAW *pDraws, int nDraws)
+{
+	pCommandList->IASetPrimitiveTopology(d3dPrimitiveTopology);
+	pCommandList->IASetVertexBuffers(0, 4, pd3dVertexBufferViews);
+	pCommandList->IASetIndexBuffer(pd3dIndexBufferView);
+	for (int i = 0; i < nDraws; i++) pCommandList->DrawIndexedInstanced(pDraws[i].m_nIndices, 1, pDraws[i].m_nStartIndex, pDraws[i].m_nBaseVertex, 0);
+}
+
+//Edges of a geomipmap patch whose neighbour is one level coarser (CHeightMapGeomipMesh index sets)
+#define GEOMIPMAP_EDGE_LEFT				0x01 //Least x
+#define GEOMIPMAP_EDGE_TOP				0x02 //Greatest z
+#define GEOMIPMAP_EDGE_RIGHT			0x04 //Greatest x
+#define GEOMIPMAP_EDGE_BOTTOM			0x08 //Least z
+#define GEOMIPMAP_EDGE_MASKS			16
+
+//The terrain as triangles of the height map samples themselves, for geomipmapping (CTerrainGeomipmap) instead of
+//tessellation. Every sample is a vertex of one set of vertex buffers; a patch of nPatchQuads x nPatchQuads quads
+//(a power of two) draws at a level l with every 2^l-th sample. The index buffer holds one index set per level and
+//combination of edges stitched to a coarser neighbour, relative to the first sample of a patch, so a patch is one
+//draw of its set at the base vertex of the patch. A stitched edge drops its odd vertices onto the even ones below
+//them, which leaves it the vertices of the coarser level and no cracks.
+class CHeightMapGeomipMesh : public CHeightMapTerrainMesh
+{
+protected:
+	int								m_nPatchQuads = 0;
+	int								m_cxPatches = 0;
+	int								m_czPatches = 0;
+	int								m_nLevels = 0; //Level m_nLevels - 1 is a single quad per patch
+
+	//Per patch, of its samples (CTerrainQuadtree)
+	XMFLOAT3						*m_pxmf3PatchCenters = NULL;
+	XMFLOAT3						*m_pxmf3PatchExtents = NULL;
+
+	//Index set (level, edge mask) is m_pIndexSets[level * GEOMIPMAP_EDGE_MASKS + mask], with a base vertex of 0; the
+	//last level has no coarser neighbours and all its masks are its unstitched set
+	TERRAINPATCHDRAW				*m_pIndexSets = NULL;
+
+	//The triangles of a level with the edges of nEdgeMask stitched into pnIndices; returns the indices
+	int BuildIndexSet(int nLevel, int nEdgeMask, UINT *pnIndices);
+	//The bounds of the patches of rows [zFirst, zLast), a job of ParallelFor (pContext: the mesh)
+	static void BuildPatchBounds(int zFirst, int zLast, void *pContext);
+
+public:
+	//The nWidth x nLength height map in patches of nPatchQuads x nPatchQuads quads, the geometry built on pThreadPool
+	//when there is one; samples past the last whole patch are left out. Without a device only the CPU side is built,
+	//for headless benchmarks.
+	CHeightMapGeomipMesh(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, int nWidth, int nLength, int nPatchQuads, XMFLOAT3 xmf3Scale = XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT4 xmf4Color = XMFLOAT4(1.0f, 1.0f, 0.0f, 0.0f), void* pContext = NULL, CThreadPool *pThreadPool = NULL);
+	virtual ~CHeightMapGeomipMesh();
+
+	int GetPatchQuads() { return(m_nPatchQuads); }
+	//Patch (x, z) is patch x + z * GetPatchesX(), its first sample at (x * nPatchQuads, z * nPatchQuads)
+	int GetPatchesX() { return(m_cxPatches); }
+	int GetPatchesZ() { return(m_czPatches); }
+	int GetPatches() { return(m_cxPatches * m_czPatches); }
+	int GetLevels() { return(m_nLevels); }
+	XMFLOAT3 *GetPatchAABBCenters() { return(m_pxmf3PatchCenters); }
+	XMFLOAT3 *GetPatchAABBExtents() { return(m_pxmf3PatchExtents); }
+	TERRAINPATCHDRAW *GetIndexSet(int nLevel, int nEdgeMask) { return(&m_pIndexSets[nLevel * GEOMIPMAP_EDGE_MASKS + nEdgeMask]); }
+	INT GetPatchBaseVertex(int nPatch) { return(INT(((nPatch % m_cxPatches) + (nPatch / m_cxPatches) * m_nWidth) * m_nPatchQuads)); }
+
+	//A draw per patch of pnPatches (every patch when NULL) at its level of pnLevels with the edges of pnEdgeMasks
+	//(both indexed by patch) into pDraws; returns their number
+	int BuildPatchDraws(int *pnPatches, int nPatches, int *pnLevels, BYTE *pnEdgeMasks, TERRAINPATCHDRAW *pDraws);
+	void Render(ID3D12GraphicsCommandList* pd3dCommandList, int *pnPatches, int nPatches, int *pnLevels, BYTE *pnEdgeMasks);
+};
+
+#ifdef _WITH_TERRAIN_CONSTRUCTION_BENCHMARK
+//Headless: both terrain meshes of synthetic nSize x nSize height maps (pnSizes) built without a device, on the calling
+//thread and on a CThreadPool; the time of each, that both give the same bits, and the colors against four normals per
+//vertex of every sample. Returns the maps that cannot be cooked, the meshes whose bits differ and the colors that do.
+int BenchmarkTerrainConstruction(
+int *pnSizes, int nSizes, int nBlockWidth, int nBlockLength, int nPatchQuads, XMFLOAT3 xmf3Scale);
+#endif
+
 
 
 class CWaterMesh : public CMesh
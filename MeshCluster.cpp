@@ -0,0 +1,598 @@
+//-----------------------------------------------------------------------------
+// File: MeshCluster.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "MeshCluster.h"
+#include "MeshOptimizer.h"
+#include <cfloat>
+#include <climits>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//Level 0 only: that is the level drawn up close, where the culling matters
+void MESHCLUSTERSTATS::Add(CMeshLoadInfo *pMeshInfo)
+{
+	if (!pMeshInfo->m_ppSubSetClusters) return;
+
+	m_nMeshes++;
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++)
+	{
+		for (int j = 0; j < pMeshInfo->m_pnSubSetClusters[i]; j++)
+		{
+			MESHCLUSTER *pCluster = &pMeshInfo->m_ppSubSetClusters[i][j];
+			m_nClusters++;
+			m_nTriangles += pCluster->m_nIndices / 3;
+			m_nClusterVertices += pCluster->m_nVertices;
+			if (pCluster->m_fConeCutoff <= 1.0f) m_nConeClusters++;
+		}
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+static XMFLOAT3 TriangleNormal(XMFLOAT3& p0, XMFLOAT3& p1, XMFLOAT3& p2)
+{
+	float e1x = p1.x - p0.x, e1y = p1.y - p0.y, e1z = p1.z - p0.z;
+	float e2x = p2.x - p0.x, e2y = p2.y - p0.y, e2z = p2.z - p0.z;
+	return(XMFLOAT3(e1y * e2z - e1z * e2y, e1z * e2x - e1x * e2z, e1x * e2y - e1y * e2x));
+}
+
+//Front faces are clockwise on screen (D3D12 default), so cross(p1 - p0, p2 - p0) points out of the visible side
+void ComputeMeshClusterBounds(MESHCLUSTER *pCluster, UINT *pnIndices, XMFLOAT3 *pxmf3Positions)
+{
+	int nIndices = (int)pCluster->m_nIndices;
+
+	XMFLOAT3 xmf3Min(+FLT_MAX, +FLT_MAX, +FLT_MAX), xmf3Max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < nIndices; i++)
+	{
+		XMFLOAT3& p = pxmf3Positions[pnIndices[i]];
+		xmf3Min = XMFLOAT3(min(xmf3Min.x, p.x), min(xmf3Min.y, p.y), min(xmf3Min.z, p.z));
+		xmf3Max = XMFLOAT3(max(xmf3Max.x, p.x), max(xmf3Max.y, p.y), max(xmf3Max.z, p.z));
+	}
+	XMFLOAT3 c((xmf3Min.x + xmf3Max.x) * 0.5f, (xmf3Min.y + xmf3Max.y) * 0.5f, (xmf3Min.z + xmf3Max.z) * 0.5f);
+	float fRadiusSq = 0.0f;
+	for (int i = 0; i < nIndices; i++)
+	{
+		XMFLOAT3& p = pxmf3Positions[pnIndices[i]];
+		fRadiusSq = max(fRadiusSq, (p.x - c.x) * (p.x - c.x) + (p.y - c.y) * (p.y - c.y) + (p.z - c.z) * (p.z - c.z));
+	}
+	pCluster->m_xmf3Center = c;
+	pCluster->m_fRadius = sqrtf(fRadiusSq);
+
+	//Normal cone: the axis is the mean triangle normal, the half angle the widest normal around it
+	vector<XMFLOAT3> vxmf3Normals(nIndices / 3);
+	XMFLOAT3 xmf3Axis(0.0f, 0.0f, 0.0f);
+	for (int i = 0; i < nIndices / 3; i++)
+	{
+		XMFLOAT3 n = ::TriangleNormal(pxmf3Positions[pnIndices[i * 3 + 0]], pxmf3Positions[pnIndices[i * 3 + 1]], pxmf3Positions[pnIndices[i * 3 + 2]]);
+		float fLength = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+		vxmf3Normals[i] = (fLength > 0.0f) ? XMFLOAT3(n.x / fLength, n.y / fLength, n.z / fLength) : XMFLOAT3(0.0f, 0.0f, 0.0f);
+		xmf3Axis = XMFLOAT3(xmf3Axis.x + vxmf3Normals[i].x, xmf3Axis.y + vxmf3Normals[i].y, xmf3Axis.z + vxmf3Normals[i].z);
+	}
+
+	pCluster->m_xmf3ConeAxis = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	pCluster->m_xmf3ConeApex = c;
+	pCluster->m_fConeCutoff = 2.0f;
+
+	float fAxisLength = sqrtf(xmf3Axis.x * xmf3Axis.x + xmf3Axis.y * xmf3Axis.y + xmf3Axis.z * xmf3Axis.z);
+	if (fAxisLength <= 0.0f) return;
+	xmf3Axis = XMFLOAT3(xmf3Axis.x / fAxisLength, xmf3Axis.y / fAxisLength, xmf3Axis.z / fAxisLength);
+
+	float fMinDot = 1.0f;
+	for (int i = 0; i < nIndices / 3; i++)
+	{
+		XMFLOAT3& n = vxmf3Normals[i];
+		if ((n.x != 0.0f) || (n.y != 0.0f) || (n.z != 0.0f)) fMinDot = min(fMinDot, n.x * xmf3Axis.x + n.y * xmf3Axis.y + n.z * xmf3Axis.z);
+	}
+	if (fMinDot <= 0.0f) return;
+
+	//Apex: the point on (center - t * axis) that lies behind every triangle plane, so the cone test from it covers the whole cluster
+	float fMaxT = 0.0f;
+	for (int i = 0; i < nIndices / 3; i++)
+	{
+		XMFLOAT3& n = vxmf3Normals[i];
+		float fDotAxis = n.x * xmf3Axis.x + n.y * xmf3Axis.y + n.z * xmf3Axis.z;
+		if (fDotAxis <= 0.0f) continue;
+		XMFLOAT3& p = pxmf3Positions[pnIndices[i * 3]];
+		float fDotCenter = (c.x - p.x) * n.x + (c.y - p.y) * n.y + (c.z - p.z) * n.z;
+		fMaxT = max(fMaxT, fDotCenter / fDotAxis);
+	}
+
+	pCluster->m_xmf3ConeAxis = xmf3Axis;
+	pCluster->m_xmf3ConeApex = XMFLOAT3(c.x - xmf3Axis.x * fMaxT, c.y - xmf3Axis.y * fMaxT, c.z - xmf3Axis.z * fMaxT);
+	pCluster->m_fConeCutoff = sqrtf(1.0f - fMinDot * fMinDot);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//Greedy growth over shared positions (hard edges split the vertices but not the surface): the next triangle adds the fewest new
+//vertices, ties go to the triangle whose normal and position keep the cone and the sphere tight, and triangles beyond
+//MESH_CLUSTER_CONE_LIMIT are left for another cluster. A cluster that runs out of neighbours takes the next unused triangle in
+//index order (the ranges are already in vertex cache order, so that triangle is usually close) and a new cluster starts from
+//the unused neighbour of the previous one that has the fewest unused triangles left around it.
+MESHCLUSTER *BuildMeshClusters(UINT *pnIndices, int nIndices, XMFLOAT3 *pxmf3Positions, int nVertices, int *pnClusters)
+{
+	int nTriangles = nIndices / 3;
+	*pnClusters = 0;
+	if (nTriangles <= 0) return(NULL);
+
+	vector<UINT> vnPositionIds(nVertices);
+	::BuildPositionIds(pxmf3Positions, nVertices, &vnPositionIds[0]);
+
+	//Triangles around every position id
+	vector<int> vnPositionOffsets(nVertices + 1, 0);
+	for (int i = 0; i < nTriangles * 3; i++) vnPositionOffsets[vnPositionIds[pnIndices[i]] + 1]++;
+	for (int i = 0; i < nVertices; i++) vnPositionOffsets[i + 1] += vnPositionOffsets[i];
+	vector<int> vnPositionTriangles(nTriangles * 3);
+	vector<int> vnLiveTriangles(nVertices, 0);
+	for (int i = 0; i < nTriangles * 3; i++)
+	{
+		UINT nPosition = vnPositionIds[pnIndices[i]];
+		vnPositionTriangles[vnPositionOffsets[nPosition] + vnLiveTriangles[nPosition]++] = i / 3;
+	}
+
+	vector<XMFLOAT3> vxmf3Centroids(nTriangles), vxmf3Normals(nTriangles);
+	for (int i = 0; i < nTriangles; i++)
+	{
+		XMFLOAT3& p0 = pxmf3Positions[pnIndices[i * 3 + 0]];
+		XMFLOAT3& p1 = pxmf3Positions[pnIndices[i * 3 + 1]];
+		XMFLOAT3& p2 = pxmf3Positions[pnIndices[i * 3 + 2]];
+		vxmf3Centroids[i] = XMFLOAT3((p0.x + p1.x + p2.x) / 3.0f, (p0.y + p1.y + p2.y) / 3.0f, (p0.z + p1.z + p2.z) / 3.0f);
+		XMFLOAT3 n = ::TriangleNormal(p0, p1, p2);
+		float fLength = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+		vxmf3Normals[i] = (fLength > 0.0f) ? XMFLOAT3(n.x / fLength, n.y / fLength, n.z / fLength) : XMFLOAT3(0.0f, 0.0f, 0.0f);
+	}
+
+	vector<bool> vbEmitted(nTriangles, false);
+	vector<int> vnVertexStamps(nVertices, -1), vnPositionStamps(nVertices, -1), vnCandidateStamps(nTriangles, -1);
+	vector<int> vnCandidates;
+	vector<UINT> vnResult;
+	vnResult.reserve(nTriangles * 3);
+	vector<MESHCLUSTER> vClusters;
+
+	int nEmitted = 0, nCursor = 0;
+	while (nEmitted < nTriangles)
+	{
+		int nCluster = (int)vClusters.size();
+		MESHCLUSTER xCluster;
+		memset(&xCluster, 0, sizeof(MESHCLUSTER));
+		xCluster.m_nIndexStart = (UINT)vnResult.size();
+
+		XMFLOAT3 xmf3Center(0.0f, 0.0f, 0.0f), xmf3NormalSum(0.0f, 0.0f, 0.0f), xmf3Axis(0.0f, 0.0f, 0.0f);
+		float fRadius = 0.0f;
+
+		int nSeed = -1, nSeedLive = INT_MAX;
+		for (int i = 0; i < (int)vnCandidates.size(); i++)
+		{
+			int t = vnCandidates[i];
+			if (vbEmitted[t]) continue;
+			int nLive = vnLiveTriangles[vnPositionIds[pnIndices[t * 3 + 0]]] + vnLiveTriangles[vnPositionIds[pnIndices[t * 3 + 1]]] + vnLiveTriangles[vnPositionIds[pnIndices[t * 3 + 2]]];
+			if (nLive < nSeedLive) { nSeed = t; nSeedLive = nLive; }
+		}
+		vnCandidates.clear();
+		if (nSeed < 0)
+		{
+			while (vbEmitted[nCursor]) nCursor++;
+			nSeed = nCursor;
+		}
+
+		for (int nNext = nSeed; nNext >= 0; )
+		{
+			vbEmitted[nNext] = true;
+			nEmitted++;
+			for (int k = 0; k < 3; k++)
+			{
+				UINT v = pnIndices[nNext * 3 + k], nPosition = vnPositionIds[v];
+				vnResult.push_back(v);
+				vnLiveTriangles[nPosition]--;
+				if (vnVertexStamps[v] != nCluster)
+				{
+					vnVertexStamps[v] = nCluster;
+					xCluster.m_nVertices++;
+				}
+				if (vnPositionStamps[nPosition] == nCluster) continue;
+				vnPositionStamps[nPosition] = nCluster;
+				for (int j = vnPositionOffsets[nPosition]; j < vnPositionOffsets[nPosition + 1]; j++)
+				{
+					int t = vnPositionTriangles[j];
+					if (!vbEmitted[t] && (vnCandidateStamps[t] != nCluster))
+					{
+						vnCandidateStamps[t] = nCluster;
+						vnCandidates.push_back(t);
+					}
+				}
+			}
+
+			int nClusterTriangles = (int)(vnResult.size() - xCluster.m_nIndexStart) / 3;
+			XMFLOAT3& xmf3Centroid = vxmf3Centroids[nNext];
+			float fWeight = 1.0f / float(nClusterTriangles);
+			xmf3Center = XMFLOAT3(xmf3Center.x + (xmf3Centroid.x - xmf3Center.x) * fWeight, xmf3Center.y + (xmf3Centroid.y - xmf3Center.y) * fWeight, xmf3Center.z + (xmf3Centroid.z - xmf3Center.z) * fWeight);
+			float dx = xmf3Centroid.x - xmf3Center.x, dy = xmf3Centroid.y - xmf3Center.y, dz = xmf3Centroid.z - xmf3Center.z;
+			fRadius = max(fRadius, sqrtf(dx * dx + dy * dy + dz * dz));
+			xmf3NormalSum = XMFLOAT3(xmf3NormalSum.x + vxmf3Normals[nNext].x, xmf3NormalSum.y + vxmf3Normals[nNext].y, xmf3NormalSum.z + vxmf3Normals[nNext].z);
+			float fAxisLength = sqrtf(xmf3NormalSum.x * xmf3NormalSum.x + xmf3NormalSum.y * xmf3NormalSum.y + xmf3NormalSum.z * xmf3NormalSum.z);
+			xmf3Axis = (fAxisLength > 0.0f) ? XMFLOAT3(xmf3NormalSum.x / fAxisLength, xmf3NormalSum.y / fAxisLength, xmf3NormalSum.z / fAxisLength) : XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+			nNext = -1;
+			if (nClusterTriangles >= MESH_CLUSTER_MAX_TRIANGLES) break;
+
+			int nBestNew = 4, nLive = 0;
+			float fBestScore = FLT_MAX;
+			for (int i = 0; i < (int)vnCandidates.size(); i++)
+			{
+				int t = vnCandidates[i];
+				if (vbEmitted[t]) continue;
+				vnCandidates[nLive++] = t;
+
+				UINT a = pnIndices[t * 3 + 0], b = pnIndices[t * 3 + 1], c = pnIndices[t * 3 + 2];
+				int nNew = (vnVertexStamps[a] != nCluster) + ((vnVertexStamps[b] != nCluster) && (b != a)) + ((vnVertexStamps[c] != nCluster) && (c != a) && (c != b));
+				if ((int)xCluster.m_nVertices + nNew > MESH_CLUSTER_MAX_VERTICES) continue;
+
+				XMFLOAT3& n = vxmf3Normals[t];
+				if ((nClusterTriangles >= 4) && (n.x * xmf3Axis.x + n.y * xmf3Axis.y + n.z * xmf3Axis.z < MESH_CLUSTER_CONE_LIMIT)) continue;
+				XMFLOAT3& p = vxmf3Centroids[t];
+				float fDistance = sqrtf((p.x - xmf3Center.x) * (p.x - xmf3Center.x) + (p.y - xmf3Center.y) * (p.y - xmf3Center.y) + (p.z - xmf3Center.z) * (p.z - xmf3Center.z));
+				float fScore = (1.0f - (n.x * xmf3Axis.x + n.y * xmf3Axis.y + n.z * xmf3Axis.z)) * MESH_CLUSTER_CONE_WEIGHT + (fDistance / (fRadius + FLT_EPSILON)) * (1.0f - MESH_CLUSTER_CONE_WEIGHT);
+				if ((nNew < nBestNew) || ((nNew == nBestNew) && (fScore < fBestScore)))
+				{
+					nNext = t;
+					nBestNew = nNew;
+					fBestScore = fScore;
+				}
+			}
+			vnCandidates.resize(nLive);
+
+			if ((nNext < 0) && (nLive == 0) && (nEmitted < nTriangles))
+			{
+				while (vbEmitted[nCursor]) nCursor++;
+				XMFLOAT3& p = vxmf3Centroids[nCursor];
+				float fDistance = sqrtf((p.x - xmf3Center.x) * (p.x - xmf3Center.x) + (p.y - xmf3Center.y) * (p.y - xmf3Center.y) + (p.z - xmf3Center.z) * (p.z - xmf3Center.z));
+				if ((xCluster.m_nVertices + 3 <= MESH_CLUSTER_MAX_VERTICES) && (fDistance <= 2.0f * fRadius)) nNext = nCursor;
+			}
+		}
+
+		xCluster.m_nIndices = (UINT)vnResult.size() - xCluster.m_nIndexStart;
+		vClusters.push_back(xCluster);
+	}
+
+	memcpy(pnIndices, &vnResult[0], sizeof(UINT) * nTriangles * 3);
+
+	MESHCLUSTER *pClusters = new MESHCLUSTER[vClusters.size()];
+	for (int i = 0; i < (int)vClusters.size(); i++)
+	{
+		pClusters[i] = vClusters[i];
+		::ComputeMeshClusterBounds(&pClusters[i], &pnIndices[pClusters[i].m_nIndexStart], pxmf3Positions);
+	}
+	*pnClusters = (int)vClusters.size();
+
+	return(pClusters);
+}
+
+void GenerateMeshClusters(CMeshLoadInfo *pMeshInfo, MESHCLUSTERSTATS *pStats)
+{
+	if (pMeshInfo->m_bMappedArrays || !pMeshInfo->m_pxmf3Positions || (pMeshInfo->m_nSubMeshes <= 0)) return;
+
+	int nSubMeshes = pMeshInfo->m_nSubMeshes;
+	int nRanges = pMeshInfo->m_nLods * nSubMeshes;
+	pMeshInfo->m_pnSubSetClusters = new int[nRanges];
+	pMeshInfo->m_ppSubSetClusters = new MESHCLUSTER*[nRanges];
+	for (int l = 0; l < pMeshInfo->m_nLods; l++)
+	{
+		for (int i = 0; i < nSubMeshes; i++)
+		{
+			int nIndices = (l > 0) ? pMeshInfo->m_pnLodSubSetIndices[(l - 1) * nSubMeshes + i] : pMeshInfo->m_pnSubSetIndices[i];
+			UINT *pnIndices = (l > 0) ? pMeshInfo->m_ppnLodSubSetIndices[(l - 1) * nSubMeshes + i] : pMeshInfo->m_ppnSubSetIndices[i];
+			pMeshInfo->m_ppSubSetClusters[l * nSubMeshes + i] = ::BuildMeshClusters(pnIndices, nIndices, pMeshInfo->m_pxmf3Positions, pMeshInfo->m_nVertices, &pMeshInfo->m_pnSubSetClusters[l * nSubMeshes + i]);
+		}
+	}
+
+	if (pStats) pStats->Add(pMeshInfo);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+void CreateMeshClusterBlocks(MESHCLUSTER *pClusters, int nClusters, MESHCLUSTERBLOCK *pBlocks)
+{
+	for (int b = 0; b < (nClusters + 3) / 4; b++)
+	{
+		float *pfBlock = (float *)&pBlocks[b];
+		for (int j = 0; j < 4; j++)
+		{
+			MESHCLUSTER *pCluster = (b * 4 + j < nClusters) ? &pClusters[b * 4 + j] : NULL;
+			//Member order of MESHCLUSTERBLOCK, one XMFLOAT4 per field
+			float pfLane[11] = { 0.0f, 0.0f, 0.0f, -FLT_MAX, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 2.0f };
+			if (pCluster)
+			{
+				pfLane[0] = pCluster->m_xmf3Center.x; pfLane[1] = pCluster->m_xmf3Center.y; pfLane[2] = pCluster->m_xmf3Center.z; pfLane[3] = pCluster->m_fRadius;
+				pfLane[4] = pCluster->m_xmf3ConeApex.x; pfLane[5] = pCluster->m_xmf3ConeApex.y; pfLane[6] = pCluster->m_xmf3ConeApex.z;
+				pfLane[7] = pCluster->m_xmf3ConeAxis.x; pfLane[8] = pCluster->m_xmf3ConeAxis.y; pfLane[9] = pCluster->m_xmf3ConeAxis.z;
+				pfLane[10] = pCluster->m_fConeCutoff;
+			}
+			for (int k = 0; k < 11; k++) pfBlock[k * 4 + j] = pfLane[k];
+		}
+	}
+}
+
+//Planes of the combined world-view-projection (Gribb/Hartmann) come out directly in model space; z is [0, 1] in D3D
+void GetMeshClusterCullInfo(XMFLOAT4X4 *pxmf4x4World, XMFLOAT4X4 *pxmf4x4View, XMFLOAT4X4 *pxmf4x4Projection, MESHCLUSTERCULLINFO *pCullInfo)
+{
+	XMFLOAT4X4 xmf4x4WorldView = Matrix4x4::Multiply(*pxmf4x4World, *pxmf4x4View);
+	XMFLOAT4X4 m = Matrix4x4::Multiply(xmf4x4WorldView, *pxmf4x4Projection);
+
+	XMFLOAT4 pxmf4Planes[6] = {
+		XMFLOAT4(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41), //Left
+		XMFLOAT4(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41), //Right
+		XMFLOAT4(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42), //Bottom
+		XMFLOAT4(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42), //Top
+		XMFLOAT4(m._13, m._23, m._33, m._43), //Near
+		XMFLOAT4(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43) //Far
+	};
+	for (int i = 0; i < 6; i++) pCullInfo->m_pxmf4FrustumPlanes[i] = Plane::Normalize(pxmf4Planes[i]);
+
+	XMFLOAT4X4 xmf4x4InverseWorldView = Matrix4x4::Inverse(xmf4x4WorldView);
+	pCullInfo->m_xmf3CameraPosition = XMFLOAT3(xmf4x4InverseWorldView._41, xmf4x4InverseWorldView._42, xmf4x4InverseWorldView._43);
+
+	//A mirroring world matrix flips the winding the rasterizer sees, so the model space cones no longer match it
+	XMFLOAT4X4& w = *pxmf4x4World;
+	float fDeterminant = w._11 * (w._22 * w._33 - w._23 * w._32) - w._12 * (w._21 * w._33 - w._23 * w._31) + w._13 * (w._21 * w._32 - w._22 * w._31);
+	pCullInfo->m_bBackfaceCulling = (fDeterminant > 0.0f);
+}
+
+//Scalar reference of one lane of CullMeshClusters
+bool IsMeshClusterVisible(MESHCLUSTER *pCluster, MESHCLUSTERCULLINFO *pCullInfo)
+{
+	XMFLOAT3& c = pCluster->m_xmf3Center;
+	for (int i = 0; i < 6; i++)
+	{
+		XMFLOAT4& p = pCullInfo->m_pxmf4FrustumPlanes[i];
+		if (!(c.x * p.x + c.y * p.y + c.z * p.z + p.w > -pCluster->m_fRadius)) return(false);
+	}
+
+	if (pCullInfo->m_bBackfaceCulling)
+	{
+		XMFLOAT3& e = pCullInfo->m_xmf3CameraPosition;
+		float dx = pCluster->m_xmf3ConeApex.x - e.x, dy = pCluster->m_xmf3ConeApex.y - e.y, dz = pCluster->m_xmf3ConeApex.z - e.z;
+		float fDot = dx * pCluster->m_xmf3ConeAxis.x + dy * pCluster->m_xmf3ConeAxis.y + dz * pCluster->m_xmf3ConeAxis.z;
+		if (fDot > pCluster->m_fConeCutoff * sqrtf(dx * dx + dy * dy + dz * dz)) return(false);
+	}
+
+	return(true);
+}
+
+int CullMeshClusters(MESHCLUSTERBLOCK *pBlocks, UINT *pnIndexStarts, UINT *pnIndices, int nClusters, MESHCLUSTERCULLINFO *pCullInfo, UINT *pnRangeStarts, UINT *pnRangeIndices)
+{
+	XMVECTOR pxmvPlaneX[6], pxmvPlaneY[6], pxmvPlaneZ[6], pxmvPlaneW[6];
+	for (int i = 0; i < 6; i++)
+	{
+		XMFLOAT4& p = pCullInfo->m_pxmf4FrustumPlanes[i];
+		pxmvPlaneX[i] = XMVectorReplicate(p.x);
+		pxmvPlaneY[i] = XMVectorReplicate(p.y);
+		pxmvPlaneZ[i] = XMVectorReplicate(p.z);
+		pxmvPlaneW[i] = XMVectorReplicate(p.w);
+	}
+	XMVECTOR xmvCameraX = XMVectorReplicate(pCullInfo->m_xmf3CameraPosition.x);
+	XMVECTOR xmvCameraY = XMVectorReplicate(pCullInfo->m_xmf3CameraPosition.y);
+	XMVECTOR xmvCameraZ = XMVectorReplicate(pCullInfo->m_xmf3CameraPosition.z);
+
+	int nRanges = 0;
+	for (int b = 0; b < (nClusters + 3) / 4; b++)
+	{
+		MESHCLUSTERBLOCK *pBlock = &pBlocks[b];
+		XMVECTOR xmvCenterX = XMLoadFloat4(&pBlock->m_xmf4CenterX);
+		XMVECTOR xmvCenterY = XMLoadFloat4(&pBlock->m_xmf4CenterY);
+		XMVECTOR xmvCenterZ = XMLoadFloat4(&pBlock->m_xmf4CenterZ);
+		XMVECTOR xmvNegativeRadius = XMVectorNegate(XMLoadFloat4(&pBlock->m_xmf4Radius));
+
+		XMVECTOR xmvVisible = XMVectorTrueInt();
+		for (int i = 0; i < 6; i++)
+		{
+			XMVECTOR xmvDistance = XMVectorMultiplyAdd(xmvCenterX, pxmvPlaneX[i], XMVectorMultiplyAdd(xmvCenterY, pxmvPlaneY[i], XMVectorMultiplyAdd(xmvCenterZ, pxmvPlaneZ[i], pxmvPlaneW[i])));
+			xmvVisible = XMVectorAndInt(xmvVisible, XMVectorGreater(xmvDistance, xmvNegativeRadius));
+		}
+
+		if (pCullInfo->m_bBackfaceCulling)
+		{
+			XMVECTOR xmvDeltaX = XMVectorSubtract(XMLoadFloat4(&pBlock->m_xmf4ApexX), xmvCameraX);
+			XMVECTOR xmvDeltaY = XMVectorSubtract(XMLoadFloat4(&pBlock->m_xmf4ApexY), xmvCameraY);
+			XMVECTOR xmvDeltaZ = XMVectorSubtract(XMLoadFloat4(&pBlock->m_xmf4ApexZ), xmvCameraZ);
+			XMVECTOR xmvDot = XMVectorMultiplyAdd(xmvDeltaX, XMLoadFloat4(&pBlock->m_xmf4AxisX), XMVectorMultiplyAdd(xmvDeltaY, XMLoadFloat4(&pBlock->m_xmf4AxisY), XMVectorMultiply(xmvDeltaZ, XMLoadFloat4(&pBlock->m_xmf4AxisZ))));
+			XMVECTOR xmvLength = XMVectorSqrt(XMVectorMultiplyAdd(xmvDeltaX, xmvDeltaX, XMVectorMultiplyAdd(xmvDeltaY, xmvDeltaY, XMVectorMultiply(xmvDeltaZ, xmvDeltaZ))));
+			xmvVisible = XMVectorAndInt(xmvVisible, XMVectorLessOrEqual(xmvDot, XMVectorMultiply(XMLoadFloat4(&pBlock->m_xmf4Cutoff), xmvLength)));
+		}
+
+#if defined(_XM_SSE_INTRINSICS_)
+		int nMask = _mm_movemask_ps(xmvVisible);
+#else
+		XMUINT4 xmu4Visible;
+		XMStoreUInt4(&xmu4Visible, xmvVisible);
+		int nMask = (xmu4Visible.x & 1) | ((xmu4Visible.y & 1) << 1) | ((xmu4Visible.z & 1) << 2) | ((xmu4Visible.w & 1) << 3);
+#endif
+		for (int j = 0; nMask; j++, nMask >>= 1)
+		{
+			if (!(nMask & 1)) continue;
+			int k = b * 4 + j;
+			if ((nRanges > 0) && (pnRangeStarts[nRanges - 1] + pnRangeIndices[nRanges - 1] + MESH_CLUSTER_MERGE_GAP * 3 >= pnIndexStarts[k]))
+			{
+				pnRangeIndices[nRanges - 1] = pnIndexStarts[k] + pnIndices[k] - pnRangeStarts[nRanges - 1];
+			}
+			else
+			{
+				pnRangeStarts[nRanges] = pnIndexStarts[k];
+				pnRangeIndices[nRanges] = pnIndices[k];
+				nRanges++;
+			}
+		}
+	}
+
+	return(nRanges);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+#ifdef _WITH_MESH_CLUSTER_BENCHMARK
+#include "ModelFile.h"
+#include "MeshOptimizer.h"
+
+struct MESHCLUSTERCULLREPORT
+{
+	int								m_nPoses = 0;
+	MESHCLUSTERSTATS				m_Stats;
+
+	UINT64							m_nTriangles = 0; //Summed over all poses
+	UINT64							m_nDrawnTriangles = 0; //Including the culled clusters bridged by MESH_CLUSTER_MERGE_GAP
+	UINT64							m_nFrustumRejected = 0;
+	UINT64							m_nBackfaceRejected = 0;
+	UINT64							m_nRanges = 0;
+	UINT64							m_nMismatches = 0; //A cluster the scalar test keeps is not covered by the SIMD ranges
+	UINT64							m_nFalseRejects = 0; //Front facing triangles inside the frustum in a rejected cluster
+
+	double							m_fSimdSeconds = 0.0;
+	double							m_fScalarSeconds = 0.0;
+};
+
+static bool IsTriangleCullable(XMFLOAT3& p0, XMFLOAT3& p1, XMFLOAT3& p2, MESHCLUSTERCULLINFO *pCullInfo)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		XMFLOAT4& p = pCullInfo->m_pxmf4FrustumPlanes[i];
+		if ((p0.x * p.x + p0.y * p.y + p0.z * p.z + p.w < 0.0f) && (p1.x * p.x + p1.y * p.y + p1.z * p.z + p.w < 0.0f) && (p2.x * p.x + p2.y * p.y + p2.z * p.z + p.w < 0.0f)) return(true);
+	}
+	//Edge-on within rounding (about 0.06 degrees) counts as back facing
+	XMFLOAT3 n = ::TriangleNormal(p0, p1, p2);
+	XMFLOAT3& e = pCullInfo->m_xmf3CameraPosition;
+	float dx = p0.x - e.x, dy = p0.y - e.y, dz = p0.z - e.z;
+	float fLength = sqrtf((n.x * n.x + n.y * n.y + n.z * n.z) * (dx * dx + dy * dy + dz * dz));
+	return(dx * n.x + dy * n.y + dz * n.z >= -1.0e-3f * fLength);
+}
+
+//Poses on a sphere around each mesh: even poses see the whole mesh from 3 radii, odd poses stand at 1.2 radii and look past the center
+static void MeasureClusterCulling(CMeshLoadInfo *pMeshInfo, void *pContext)
+{
+	MESHCLUSTERCULLREPORT *pReport = (MESHCLUSTERCULLREPORT *)pContext;
+
+	::OptimizeMeshLoadInfo(pMeshInfo);
+	::GenerateMeshClusters(pMeshInfo, &pReport->m_Stats);
+	if (!pMeshInfo->m_ppSubSetClusters) return;
+
+	int nClusters = 0;
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++) nClusters += pMeshInfo->m_pnSubSetClusters[i];
+	if (nClusters == 0) return;
+
+	//All submeshes back to back, as if they shared one index buffer
+	vector<MESHCLUSTER> vClusters;
+	vector<UINT> vnIndexStarts, vnIndices;
+	for (int i = 0, nBase = 0; i < pMeshInfo->m_nSubMeshes; nBase += pMeshInfo->m_pnSubSetIndices[i++])
+	{
+		for (int j = 0; j < pMeshInfo->m_pnSubSetClusters[i]; j++)
+		{
+			vClusters.push_back(pMeshInfo->m_ppSubSetClusters[i][j]);
+			vnIndexStarts.push_back(nBase + pMeshInfo->m_ppSubSetClusters[i][j].m_nIndexStart);
+			vnIndices.push_back(pMeshInfo->m_ppSubSetClusters[i][j].m_nIndices);
+		}
+	}
+	vector<MESHCLUSTERBLOCK> vBlocks((nClusters + 3) / 4);
+	::CreateMeshClusterBlocks(&vClusters[0], nClusters, &vBlocks[0]);
+	vector<UINT> vnRangeStarts(nClusters), vnRangeIndices(nClusters);
+
+	XMFLOAT3& c = pMeshInfo->m_xmf3AABBCenter;
+	XMFLOAT3& x = pMeshInfo->m_xmf3AABBExtents;
+	float fRadius = max(sqrtf(x.x * x.x + x.y * x.y + x.z * x.z), 1.0e-3f);
+	XMFLOAT4X4 xmf4x4World = Matrix4x4::Identity();
+	XMFLOAT4X4 xmf4x4Projection = Matrix4x4::PerspectiveFovLH(XMConvertToRadians(60.0f), 16.0f / 9.0f, fRadius * 0.01f, fRadius * 10.0f);
+
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	int nPoses = pReport->m_nPoses;
+	for (int k = 0; k < nPoses; k++)
+	{
+		//Fibonacci sphere
+		float fY = 1.0f - 2.0f * (k + 0.5f) / nPoses, fRing = sqrtf(max(0.0f, 1.0f - fY * fY)), fPhi = 2.39996323f * k;
+		XMFLOAT3 xmf3Direction(cosf(fPhi) * fRing, fY, sinf(fPhi) * fRing);
+		bool bNear = (k & 1) != 0;
+		float fDistance = (bNear) ? (fRadius * 1.2f) : (fRadius * 3.0f);
+		XMFLOAT3 xmf3Eye(c.x + xmf3Direction.x * fDistance, c.y + xmf3Direction.y * fDistance, c.z + xmf3Direction.z * fDistance);
+		XMFLOAT3 xmf3Up = (fabsf(fY) > 0.9f) ? XMFLOAT3(1.0f, 0.0f, 0.0f) : XMFLOAT3(0.0f, 1.0f, 0.0f);
+		XMFLOAT3 xmf3Side = Vector3::CrossProduct(xmf3Direction, xmf3Up);
+		XMFLOAT3 xmf3Target = (bNear) ? XMFLOAT3(c.x + xmf3Side.x * fRadius * 0.8f, c.y + xmf3Side.y * fRadius * 0.8f, c.z + xmf3Side.z * fRadius * 0.8f) : c;
+		XMFLOAT4X4 xmf4x4View = Matrix4x4::LookAtLH(xmf3Eye, xmf3Target, xmf3Up);
+
+		MESHCLUSTERCULLINFO xCullInfo;
+		::GetMeshClusterCullInfo(&xmf4x4World, &xmf4x4View, &xmf4x4Projection, &xCullInfo);
+
+		::QueryPerformanceCounter(&nBegin);
+		int nRanges = ::CullMeshClusters(&vBlocks[0], &vnIndexStarts[0], &vnIndices[0], nClusters, &xCullInfo, &vnRangeStarts[0], &vnRangeIndices[0]);
+		::QueryPerformanceCounter(&nEnd);
+		pReport->m_fSimdSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+		pReport->m_nRanges += nRanges;
+
+		int nScalarVisible = 0;
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nClusters; i++) nScalarVisible += ::IsMeshClusterVisible(&vClusters[i], &xCullInfo) ? 1 : 0;
+		::QueryPerformanceCounter(&nEnd);
+		pReport->m_fScalarSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		for (int i = 0; i < nRanges; i++) pReport->m_nDrawnTriangles += vnRangeIndices[i] / 3;
+
+		for (int i = 0, nCluster = 0, nRange = 0; i < pMeshInfo->m_nSubMeshes; i++)
+		{
+			for (int j = 0; j < pMeshInfo->m_pnSubSetClusters[i]; j++, nCluster++)
+			{
+				MESHCLUSTER *pCluster = &vClusters[nCluster];
+				pReport->m_nTriangles += pCluster->m_nIndices / 3;
+				if (::IsMeshClusterVisible(pCluster, &xCullInfo))
+				{
+					while ((nRange < nRanges) && (vnRangeStarts[nRange] + vnRangeIndices[nRange] <= vnIndexStarts[nCluster])) nRange++;
+					if ((nRange == nRanges) || (vnRangeStarts[nRange] > vnIndexStarts[nCluster]) || (vnRangeStarts[nRange] + vnRangeIndices[nRange] < vnIndexStarts[nCluster] + vnIndices[nCluster])) pReport->m_nMismatches++;
+					continue;
+				}
+
+				MESHCLUSTERCULLINFO xFrustumOnly = xCullInfo;
+				xFrustumOnly.m_bBackfaceCulling = false;
+				if (::IsMeshClusterVisible(pCluster, &xFrustumOnly))
+					pReport->m_nBackfaceRejected += pCluster->m_nIndices / 3;
+				else
+					pReport->m_nFrustumRejected += pCluster->m_nIndices / 3;
+
+				UINT *pnIndices = &pMeshInfo->m_ppnSubSetIndices[i][pCluster->m_nIndexStart];
+				for (UINT t = 0; t < pCluster->m_nIndices; t += 3)
+				{
+					XMFLOAT3 *p = pMeshInfo->m_pxmf3Positions;
+					if (!::IsTriangleCullable(p[pnIndices[t]], p[pnIndices[t + 1]], p[pnIndices[t + 2]], &xCullInfo)) pReport->m_nFalseRejects++;
+				}
+			}
+		}
+	}
+}
+
+int BenchmarkMeshClusterCulling(char **ppstrFileNames, int nFiles, int nPoses)
+{
+	int nFailures = 0;
+	TCHAR pstrDebug[512] = { 0 };
+	for (int i = 0; i < nFiles; i++)
+	{
+		MESHCLUSTERCULLREPORT xReport;
+		xReport.m_nPoses = nPoses;
+		if (!::EnumerateModelMeshes(ppstrFileNames[i], ::MeasureClusterCulling, &xReport))
+		{
+			nFailures++;
+			continue;
+		}
+
+		MESHCLUSTERSTATS *pStats = &xReport.m_Stats;
+		_stprintf_s(pstrDebug, 512, _T("%hs: %d meshes, %d clusters, %.1f triangles and %.1f vertices per cluster, %d clusters with a usable cone\n"), ppstrFileNames[i], pStats->m_nMeshes, pStats->m_nClusters, pStats->GetAverageTriangles(), pStats->GetAverageVertices(), pStats->m_nConeClusters);
+		OutputDebugString(pstrDebug);
+
+		double fTriangles = (xReport.m_nTriangles > 0) ? double(xReport.m_nTriangles) : 1.0, fMeshPoses = double(max(pStats->m_nMeshes, 1)) * nPoses;
+		_stprintf_s(pstrDebug, 512, _T("    %d poses: %.1f%% of triangles rejected (frustum %.1f%%, backface cone %.1f%%), %.1f%% not drawn after merging, %.1f draws per mesh and pose\n"), nPoses, 100.0 * (xReport.m_nFrustumRejected + xReport.m_nBackfaceRejected) / fTriangles, 100.0 * xReport.m_nFrustumRejected / fTriangles, 100.0 * xReport.m_nBackfaceRejected / fTriangles, 100.0 * (1.0 - xReport.m_nDrawnTriangles / fTriangles), xReport.m_nRanges / fMeshPoses);
+		OutputDebugString(pstrDebug);
+		_stprintf_s(pstrDebug, 512, _T("    cull %.2f us per mesh and pose (scalar loop %.2f us), %llu mismatches, %llu false rejects\n"), xReport.m_fSimdSeconds * 1.0e6 / fMeshPoses, xReport.m_fScalarSeconds * 1.0e6 / fMeshPoses, xReport.m_nMismatches, xReport.m_nFalseRejects);
+		OutputDebugString(pstrDebug);
+		nFailures += int(xReport.m_nMismatches + xReport.m_nFalseRejects);
+	}
+
+	return(nFailures);
+}
+#endif
+
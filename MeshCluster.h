@@ -0,0 +1,96 @@
+//-----------------------------------------------------------------------------
+// File: MeshCluster.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Mesh.h"
+
+//Import-time clustering of every (level, submesh) index range into clusters of at most 64 vertices and
+//124 triangles, each with a bounding sphere and a backface cone, plus the per-frame CPU culler that turns
+//the surviving clusters into merged index ranges. Building only reorders triangles inside a range, so the
+//vertex buffer and the LOD ranges of MeshSimplifier are unchanged.
+
+#define MESH_CLUSTER_MAX_VERTICES		64
+#define MESH_CLUSTER_MAX_TRIANGLES		124
+#define MESH_CLUSTER_CONE_WEIGHT		0.5f //Growth score: normal deviation against distance from the cluster center
+#define MESH_CLUSTER_CONE_LIMIT			0.5f //Growth skips triangles more than 60 degrees off the cluster normal (keeps the cones usable)
+#define MESH_CLUSTER_MERGE_GAP			32 //Culled triangles a visible range may run over to save a draw call
+
+//Loaded meshes keep their clusters and CGameObject::Render culls them against the camera every frame
+#define _WITH_MESH_CLUSTER_CULLING
+
+//Stored as-is in the cooked file (64 bytes)
+struct MESHCLUSTER
+{
+	UINT							m_nIndexStart; //Relative to the start of its (level, submesh) index range
+	UINT							m_nIndices;
+	UINT							m_nVertices;
+	float							m_fConeCutoff; //Sine of the normal cone half angle; 2 when the cone is too wide to cull
+	XMFLOAT3						m_xmf3Center;
+	float							m_fRadius;
+	XMFLOAT3						m_xmf3ConeApex;
+	XMFLOAT3						m_xmf3ConeAxis;
+	UINT							m_pnReserved[2];
+};
+
+//Four clusters in SoA form for the culler; unused lanes have a radius of -FLT_MAX and never pass the planes
+struct MESHCLUSTERBLOCK
+{
+	XMFLOAT4						m_xmf4CenterX;
+	XMFLOAT4						m_xmf4CenterY;
+	XMFLOAT4						m_xmf4CenterZ;
+	XMFLOAT4						m_xmf4Radius;
+	XMFLOAT4						m_xmf4ApexX;
+	XMFLOAT4						m_xmf4ApexY;
+	XMFLOAT4						m_xmf4ApexZ;
+	XMFLOAT4						m_xmf4AxisX;
+	XMFLOAT4						m_xmf4AxisY;
+	XMFLOAT4						m_xmf4AxisZ;
+	XMFLOAT4						m_xmf4Cutoff;
+};
+
+//Frustum planes (normalized, pointing inwards) and eye position in the model space of one object
+struct MESHCLUSTERCULLINFO
+{
+	XMFLOAT4						m_pxmf4FrustumPlanes[6];
+	XMFLOAT3						m_xmf3CameraPosition;
+	bool							m_bBackfaceCulling = true; //Off for mirroring world matrices
+};
+
+struct MESHCLUSTERSTATS
+{
+	int								m_nMeshes = 0;
+	int								m_nClusters = 0;
+	int								m_nTriangles = 0;
+	int								m_nClusterVertices = 0;
+	int								m_nConeClusters = 0; //Clusters whose cone can reject them
+
+	float GetAverageTriangles() { return((m_nClusters > 0) ? float(m_nTriangles) / float(m_nClusters) : 0.0f); }
+	float GetAverageVertices() { return((m_nClusters > 0) ? float(m_nClusterVertices) / float(m_nClusters) : 0.0f); }
+
+	void Add(CMeshLoadInfo *pMeshInfo);
+};
+
+//Reorders pnIndices in place so that every cluster is one contiguous run; returns a new[] array of *pnClusters clusters
+MESHCLUSTER *BuildMeshClusters(UINT *pnIndices, int nIndices, XMFLOAT3 *pxmf3Positions, int nVertices, int *pnClusters);
+void ComputeMeshClusterBounds(MESHCLUSTER *pCluster, UINT *pnIndices, XMFLOAT3 *pxmf3Positions);
+
+//Fills m_pnSubSetClusters/m_ppSubSetClusters of pMeshInfo for every level (owned arrays); needs owned index sets
+void GenerateMeshClusters(CMeshLoadInfo *pMeshInfo, MESHCLUSTERSTATS *pStats = NULL);
+
+//Fills (nClusters + 3) / 4 blocks
+void CreateMeshClusterBlocks(MESHCLUSTER *pClusters, int nClusters, MESHCLUSTERBLOCK *pBlocks);
+
+void GetMeshClusterCullInfo(XMFLOAT4X4 *pxmf4x4World, XMFLOAT4X4 *pxmf4x4View, XMFLOAT4X4 *pxmf4x4Projection, MESHCLUSTERCULLINFO *pCullInfo);
+bool IsMeshClusterVisible(MESHCLUSTER *pCluster, MESHCLUSTERCULLINFO *pCullInfo);
+
+//Culls four clusters per step and writes the visible ones as merged ranges (clusters at most MESH_CLUSTER_MERGE_GAP
+//triangles apart become one draw); the starts must be increasing.
+//pnIndexStarts/pnIndices hold one entry per cluster; the range arrays need room for nClusters entries.
+int CullMeshClusters(MESHCLUSTERBLOCK *pBlocks, UINT *pnIndexStarts, UINT *pnIndices, int nClusters, MESHCLUSTERCULLINFO *pCullInfo, UINT *pnRangeStarts, UINT *pnRangeIndices);
+
+#ifdef _WITH_MESH_CLUSTER_BENCHMARK
+//Returns the files that fail to load plus the mismatches and false rejects of the culling
+int BenchmarkMeshClusterCulling(char **ppstrFileNames, int nFiles, int nPoses);
+#endif
@@ -0,0 +1,484 @@
+//-----------------------------------------------------------------------------
+// File: MeshOptimizer.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+void MESHOPTIMIZESTATS::Add(MESHOPTIMIZESTATS *pStats)
+{
+	m_nMeshes += pStats->m_nMeshes;
+	m_nTriangles += pStats->m_nTriangles;
+	m_nVerticesBefore += pStats->m_nVerticesBefore;
+	m_nVerticesAfter += pStats->m_nVerticesAfter;
+	m_nCacheMissesBefore += pStats->m_nCacheMissesBefore;
+	m_nCacheMissesAfter += pStats->m_nCacheMissesAfter;
+	m_nUsedVerticesBefore += pStats->m_nUsedVerticesBefore;
+	m_nUsedVerticesAfter += pStats->m_nUsedVerticesAfter;
+}
+
+//FIFO post-transform cache; returns the number of vertex shader invocations
+int SimulateVertexCache(UINT *pnIndices, int nIndices, int nVertices, int nCacheSize, int *pnUsedVertices)
+{
+	vector<int> vnCacheTimes(nVertices, -(nCacheSize + 1));
+	vector<bool> vbUsed(nVertices, false);
+
+	int nTime = 0, nMisses = 0, nUsedVertices = 0;
+	for (int i = 0; i < nIndices; i++)
+	{
+		UINT v = pnIndices[i];
+		if (nTime - vnCacheTimes[v] > nCacheSize)
+		{
+			vnCacheTimes[v] = ++nTime;
+			nMisses++;
+		}
+		if (!vbUsed[v])
+		{
+			vbUsed[v] = true;
+			nUsedVertices++;
+		}
+	}
+	if (pnUsedVertices) *pnUsedVertices = nUsedVertices;
+
+	return(nMisses);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+template <class T> static T *CopyArray(T *pArray, int nElements)
+{
+	if (!pArray || (nElements <= 0)) return(NULL);
+	T *pCopy = new T[nElements];
+	memcpy(pCopy, pArray, sizeof(T) * nElements);
+	return(pCopy);
+}
+
+//Mapped arrays are read-only views of the model file; the optimizer needs its own copies
+static void TakeMeshArrays(CMeshLoadInfo *pMeshInfo)
+{
+	if (!pMeshInfo->m_bMappedArrays) return;
+
+	pMeshInfo->m_pxmf3Positions = ::CopyArray(pMeshInfo->m_pxmf3Positions, pMeshInfo->m_nVertices);
+	pMeshInfo->m_pxmf4Colors = ::CopyArray(pMeshInfo->m_pxmf4Colors, pMeshInfo->m_nVertices);
+	pMeshInfo->m_pxmf3Normals = ::CopyArray(pMeshInfo->m_pxmf3Normals, pMeshInfo->m_nVertices);
+	pMeshInfo->m_pxmf2TexCoords = ::CopyArray(pMeshInfo->m_pxmf2TexCoords, pMeshInfo->m_nVertices);
+	pMeshInfo->m_pnIndices = ::CopyArray(pMeshInfo->m_pnIndices, pMeshInfo->m_nIndices);
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++) pMeshInfo->m_ppnSubSetIndices[i] = ::CopyArray(pMeshInfo->m_ppnSubSetIndices[i], pMeshInfo->m_pnSubSetIndices[i]);
+	for (int i = 0; i < (pMeshInfo->m_nLods - 1) * pMeshInfo->m_nSubMeshes; i++) pMeshInfo->m_ppnLodSubSetIndices[i] = ::CopyArray(pMeshInfo->m_ppnLodSubSetIndices[i], pMeshInfo->m_pnLodSubSetIndices[i]);
+
+	pMeshInfo->m_bMappedArrays = false;
+}
+
+template <class T> static void PermuteArray(T **ppArray, UINT *pnSources, int nElements)
+{
+	if (!*ppArray) return;
+	T *pPermuted = new T[(nElements > 0) ? nElements : 1];
+	for (int i = 0; i < nElements; i++) pPermuted[i] = (*ppArray)[pnSources[i]];
+	delete[] *ppArray;
+	*ppArray = pPermuted;
+}
+
+//pnSources[new] = old, pnRemap[old] = new
+static void RemapMeshVertices(CMeshLoadInfo *pMeshInfo, UINT *pnSources, int nNewVertices, UINT *pnRemap)
+{
+	::PermuteArray(&pMeshInfo->m_pxmf3Positions, pnSources, nNewVertices);
+	::PermuteArray(&pMeshInfo->m_pxmf4Colors, pnSources, nNewVertices);
+	::PermuteArray(&pMeshInfo->m_pxmf3Normals, pnSources, nNewVertices);
+	::PermuteArray(&pMeshInfo->m_pxmf2TexCoords, pnSources, nNewVertices);
+
+	for (int i = 0; i < pMeshInfo->m_nIndices; i++) pMeshInfo->m_pnIndices[i] = pnRemap[pMeshInfo->m_pnIndices[i]];
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++)
+	{
+		for (int j = 0; j < pMeshInfo->m_pnSubSetIndices[i]; j++) pMeshInfo->m_ppnSubSetIndices[i][j] = pnRemap[pMeshInfo->m_ppnSubSetIndices[i][j]];
+	}
+	for (int i = 0; i < (pMeshInfo->m_nLods - 1) * pMeshInfo->m_nSubMeshes; i++)
+	{
+		for (int j = 0; j < pMeshInfo->m_pnLodSubSetIndices[i]; j++) pMeshInfo->m_ppnLodSubSetIndices[i][j] = pnRemap[pMeshInfo->m_ppnLodSubSetIndices[i][j]];
+	}
+	pMeshInfo->m_nVertices = nNewVertices;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+static UINT64 HashBytes(UINT64 nHash, void *pData, int nBytes)
+{
+	BYTE *pBytes = (BYTE *)pData;
+	for (int i = 0; i < nBytes; i++)
+	{
+		nHash ^= pBytes[i];
+		nHash *= 0x100000001b3ULL;
+	}
+	return(nHash);
+}
+
+static UINT64 HashVertex(CMeshLoadInfo *pMeshInfo, UINT v)
+{
+	UINT64 nHash = 0xcbf29ce484222325ULL;
+	if (pMeshInfo->m_pxmf3Positions) nHash = ::HashBytes(nHash, &pMeshInfo->m_pxmf3Positions[v], sizeof(XMFLOAT3));
+	if (pMeshInfo->m_pxmf4Colors) nHash = ::HashBytes(nHash, &pMeshInfo->m_pxmf4Colors[v], sizeof(XMFLOAT4));
+	if (pMeshInfo->m_pxmf3Normals) nHash = ::HashBytes(nHash, &pMeshInfo->m_pxmf3Normals[v], sizeof(XMFLOAT3));
+	if (pMeshInfo->m_pxmf2TexCoords) nHash = ::HashBytes(nHash, &pMeshInfo->m_pxmf2TexCoords[v], sizeof(XMFLOAT2));
+	return(nHash);
+}
+
+static bool IsSameVertex(CMeshLoadInfo *pMeshInfo, UINT a, UINT b)
+{
+	if (pMeshInfo->m_pxmf3Positions && memcmp(&pMeshInfo->m_pxmf3Positions[a], &pMeshInfo->m_pxmf3Positions[b], sizeof(XMFLOAT3))) return(false);
+	if (pMeshInfo->m_pxmf4Colors && memcmp(&pMeshInfo->m_pxmf4Colors[a], &pMeshInfo->m_pxmf4Colors[b], sizeof(XMFLOAT4))) return(false);
+	if (pMeshInfo->m_pxmf3Normals && memcmp(&pMeshInfo->m_pxmf3Normals[a], &pMeshInfo->m_pxmf3Normals[b], sizeof(XMFLOAT3))) return(false);
+	if (pMeshInfo->m_pxmf2TexCoords && memcmp(&pMeshInfo->m_pxmf2TexCoords[a], &pMeshInfo->m_pxmf2TexCoords[b], sizeof(XMFLOAT2))) return(false);
+	return(true);
+}
+
+//Every vertex maps to the lowest-numbered vertex with a bitwise identical position; topology is built on these ids
+void BuildPositionIds(XMFLOAT3 *pxmf3Positions, int nVertices, UINT *pnPositionIds)
+{
+	vector<UINT> vnOrder(nVertices);
+	for (int i = 0; i < nVertices; i++) vnOrder[i] = i;
+	std::sort(vnOrder.begin(), vnOrder.end(), [pxmf3Positions](UINT a, UINT b) {
+		int nCompare = memcmp(&pxmf3Positions[a], &pxmf3Positions[b], sizeof(XMFLOAT3));
+		return((nCompare < 0) || ((nCompare == 0) && (a < b)));
+	});
+	for (int i = 0; i < nVertices; i++)
+	{
+		UINT v = vnOrder[i];
+		bool bSame = (i > 0) && !memcmp(&pxmf3Positions[v], &pxmf3Positions[vnOrder[i - 1]], sizeof(XMFLOAT3));
+		pnPositionIds[v] = (bSame) ? pnPositionIds[vnOrder[i - 1]] : v;
+	}
+}
+
+//Merges bitwise identical vertices (all streams); returns the new vertex count
+int WeldVertices(CMeshLoadInfo *pMeshInfo, UINT *pnRemap)
+{
+	int nVertices = pMeshInfo->m_nVertices;
+
+	int nTableSize = 1;
+	while (nTableSize < nVertices * 2) nTableSize <<= 1;
+	vector<int> vnTable(nTableSize, -1);
+	vector<UINT> vnSources;
+	vnSources.reserve(nVertices);
+
+	for (int v = 0; v < nVertices; v++)
+	{
+		UINT nSlot = UINT(::HashVertex(pMeshInfo, v)) & (nTableSize - 1);
+		for ( ; ; nSlot = (nSlot + 1) & (nTableSize - 1))
+		{
+			if (vnTable[nSlot] < 0)
+			{
+				vnTable[nSlot] = v;
+				pnRemap[v] = (UINT)vnSources.size();
+				vnSources.push_back(v);
+				break;
+			}
+			if (::IsSameVertex(pMeshInfo, vnTable[nSlot], v))
+			{
+				pnRemap[v] = pnRemap[vnTable[nSlot]];
+				break;
+			}
+		}
+	}
+
+	int nWelded = (int)vnSources.size();
+	if (nWelded < nVertices) ::RemapMeshVertices(pMeshInfo, vnSources.data(), nWelded, pnRemap);
+
+	return(nWelded);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//Tom Forsyth, "Linear-Speed Vertex Cache Optimisation"
+static float ForsythVertexScore(int nCachePosition, int nRemainingTriangles)
+{
+	if (nRemainingTriangles <= 0) return(-1.0f);
+
+	float fScore = 0.0f;
+	if (nCachePosition >= 0)
+	{
+		if (nCachePosition < 3)
+			fScore = 0.75f;
+		else
+			fScore = powf(1.0f - float(nCachePosition - 3) / float(MESH_OPTIMIZE_CACHE_SIZE - 3), 1.5f);
+	}
+	fScore += 2.0f / sqrtf(float(nRemainingTriangles));
+
+	return(fScore);
+}
+
+void OptimizeVertexCache(UINT *pnIndices, int nIndices, int nVertices)
+{
+	int nTriangles = nIndices / 3;
+	if (nTriangles <= 1) return;
+
+	vector<int> vnOffsets(nVertices + 1, 0), vnRemaining(nVertices, 0), vnCachePositions(nVertices, -1);
+	vector<float> vfVertexScores(nVertices, 0.0f);
+	for (int i = 0; i < nTriangles * 3; i++) vnRemaining[pnIndices[i]]++;
+	for (int v = 0; v < nVertices; v++) vnOffsets[v + 1] = vnOffsets[v] + vnRemaining[v];
+
+	vector<int> vnAdjacency(nTriangles * 3), vnFill(vnOffsets.begin(), vnOffsets.end() - 1);
+	for (int t = 0; t < nTriangles; t++)
+	{
+		for (int k = 0; k < 3; k++) vnAdjacency[vnFill[pnIndices[t * 3 + k]]++] = t;
+	}
+	for (int v = 0; v < nVertices; v++) vfVertexScores[v] = ::ForsythVertexScore(-1, vnRemaining[v]);
+
+	vector<float> vfTriangleScores(nTriangles);
+	vector<bool> vbEmitted(nTriangles, false);
+	for (int t = 0; t < nTriangles; t++) vfTriangleScores[t] = vfVertexScores[pnIndices[t * 3]] + vfVertexScores[pnIndices[t * 3 + 1]] + vfVertexScores[pnIndices[t * 3 + 2]];
+
+	vector<UINT> vnOutput(nTriangles * 3);
+	UINT pnCache[MESH_OPTIMIZE_CACHE_SIZE + 3], pnNewCache[MESH_OPTIMIZE_CACHE_SIZE + 3];
+	int nCache = 0;
+
+	int nBest = 0, nCursor = 0;
+	for (int i = 1; i < nTriangles; i++) if (vfTriangleScores[i] > vfTriangleScores[nBest]) nBest = i;
+
+	for (int nEmitted = 0; nEmitted < nTriangles; nEmitted++)
+	{
+		if (nBest < 0)
+		{
+			while (vbEmitted[nCursor]) nCursor++;
+			nBest = nCursor;
+		}
+
+		UINT *pnTriangle = &pnIndices[nBest * 3];
+		vnOutput[nEmitted * 3 + 0] = pnTriangle[0];
+		vnOutput[nEmitted * 3 + 1] = pnTriangle[1];
+		vnOutput[nEmitted * 3 + 2] = pnTriangle[2];
+		vbEmitted[nBest] = true;
+
+		int nNewCache = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			UINT v = pnTriangle[k];
+			pnNewCache[nNewCache++] = v;
+
+			int *pnBegin = &vnAdjacency[vnOffsets[v]], *pnEnd = pnBegin + vnRemaining[v];
+			int *pnFound = std::find(pnBegin, pnEnd, nBest);
+			if (pnFound != pnEnd)
+			{
+				*pnFound = *(pnEnd - 1);
+				vnRemaining[v]--;
+			}
+		}
+		for (int i = 0; i < nCache; i++)
+		{
+			UINT v = pnCache[i];
+			if ((v != pnTriangle[0]) && (v != pnTriangle[1]) && (v != pnTriangle[2])) pnNewCache[nNewCache++] = v;
+		}
+		for (int i = MESH_OPTIMIZE_CACHE_SIZE; i < nNewCache; i++) vnCachePositions[pnNewCache[i]] = -1;
+		nCache = (nNewCache < MESH_OPTIMIZE_CACHE_SIZE) ? nNewCache : MESH_OPTIMIZE_CACHE_SIZE;
+		memcpy(pnCache, pnNewCache, sizeof(int) * nCache);
+
+		for (int i = 0; i < nNewCache; i++)
+		{
+			int v = pnNewCache[i];
+			if (i < nCache) vnCachePositions[v] = i;
+			vfVertexScores[v] = ::ForsythVertexScore(vnCachePositions[v], vnRemaining[v]);
+		}
+
+		nBest = -1;
+		float fBestScore = -1.0f;
+		for (int i = 0; i < nNewCache; i++)
+		{
+			int v = pnNewCache[i];
+			for (int j = 0; j < vnRemaining[v]; j++)
+			{
+				int t = vnAdjacency[vnOffsets[v] + j];
+				float fScore = vfVertexScores[pnIndices[t * 3]] + vfVertexScores[pnIndices[t * 3 + 1]] + vfVertexScores[pnIndices[t * 3 + 2]];
+				vfTriangleScores[t] = fScore;
+				if ((i < nCache) && (fScore > fBestScore))
+				{
+					fBestScore = fScore;
+					nBest = t;
+				}
+			}
+		}
+	}
+
+	memcpy(pnIndices, vnOutput.data(), sizeof(UINT) * nTriangles * 3);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw": the cache-ordered
+//list is cut where a triangle misses on all three vertices, and the clusters are sorted so the ones
+//facing away from the mesh center (likely occluders) are drawn first.
+struct OVERDRAWCLUSTER
+{
+	int								m_nFirstTriangle;
+	int								m_nTriangles;
+	float							m_fSortKey;
+};
+
+void OptimizeOverdraw(UINT *pnIndices, int nIndices, XMFLOAT3 *pxmf3Positions, int nVertices, float fThreshold)
+{
+	int nTriangles = nIndices / 3;
+	if (!pxmf3Positions || (nTriangles <= 1)) return;
+
+	vector<OVERDRAWCLUSTER> vClusters;
+	vector<int> vnCacheTimes(nVertices, -(MESH_SIMULATE_CACHE_SIZE + 1));
+	int nTime = 0;
+	for (int t = 0; t < nTriangles; t++)
+	{
+		int nMisses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			UINT v = pnIndices[t * 3 + k];
+			if (nTime - vnCacheTimes[v] > MESH_SIMULATE_CACHE_SIZE)
+			{
+				vnCacheTimes[v] = ++nTime;
+				nMisses++;
+			}
+		}
+		if ((t == 0) || (nMisses == 3))
+		{
+			OVERDRAWCLUSTER xCluster = { t, 0, 0.0f };
+			vClusters.push_back(xCluster);
+		}
+		vClusters.back().m_nTriangles++;
+	}
+	if (vClusters.size() <= 1) return;
+
+	XMFLOAT3 xmf3MeshCenter(0.0f, 0.0f, 0.0f);
+	float fMeshArea = 0.0f;
+	vector<XMFLOAT3> vxmf3Centroids(vClusters.size()), vxmf3Normals(vClusters.size());
+	for (size_t c = 0; c < vClusters.size(); c++)
+	{
+		XMFLOAT3 xmf3Centroid(0.0f, 0.0f, 0.0f), xmf3Normal(0.0f, 0.0f, 0.0f);
+		float fClusterArea = 0.0f;
+		for (int t = vClusters[c].m_nFirstTriangle; t < vClusters[c].m_nFirstTriangle + vClusters[c].m_nTriangles; t++)
+		{
+			XMFLOAT3 &p0 = pxmf3Positions[pnIndices[t * 3]], &p1 = pxmf3Positions[pnIndices[t * 3 + 1]], &p2 = pxmf3Positions[pnIndices[t * 3 + 2]];
+			XMFLOAT3 e1(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z), e2(p2.x - p0.x, p2.y - p0.y, p2.z - p0.z);
+			XMFLOAT3 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+			float fArea = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+
+			xmf3Centroid.x += (p0.x + p1.x + p2.x) * fArea / 3.0f;
+			xmf3Centroid.y += (p0.y + p1.y + p2.y) * fArea / 3.0f;
+			xmf3Centroid.z += (p0.z + p1.z + p2.z) * fArea / 3.0f;
+			xmf3Normal.x += n.x; xmf3Normal.y += n.y; xmf3Normal.z += n.z;
+			fClusterArea += fArea;
+		}
+		float fInverseArea = (fClusterArea > 0.0f) ? (1.0f / fClusterArea) : 0.0f;
+		vxmf3Centroids[c] = XMFLOAT3(xmf3Centroid.x * fInverseArea, xmf3Centroid.y * fInverseArea, xmf3Centroid.z * fInverseArea);
+		vxmf3Normals[c] = xmf3Normal;
+
+		xmf3MeshCenter.x += xmf3Centroid.x; xmf3MeshCenter.y += xmf3Centroid.y; xmf3MeshCenter.z += xmf3Centroid.z;
+		fMeshArea += fClusterArea;
+	}
+	if (fMeshArea > 0.0f) xmf3MeshCenter = XMFLOAT3(xmf3MeshCenter.x / fMeshArea, xmf3MeshCenter.y / fMeshArea, xmf3MeshCenter.z / fMeshArea);
+
+	for (size_t c = 0; c < vClusters.size(); c++)
+	{
+		XMFLOAT3 &n = vxmf3Normals[c];
+		float fLength = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+		if (fLength > 0.0f) fLength = 1.0f / fLength;
+		XMFLOAT3 d(vxmf3Centroids[c].x - xmf3MeshCenter.x, vxmf3Centroids[c].y - xmf3MeshCenter.y, vxmf3Centroids[c].z - xmf3MeshCenter.z);
+		vClusters[c].m_fSortKey = (d.x * n.x + d.y * n.y + d.z * n.z) * fLength;
+	}
+
+	vector<OVERDRAWCLUSTER> vSorted(vClusters);
+	std::stable_sort(vSorted.begin(), vSorted.end(), [](const OVERDRAWCLUSTER &a, const OVERDRAWCLUSTER &b) { return(a.m_fSortKey > b.m_fSortKey); });
+
+	vector<UINT> vnSorted;
+	vnSorted.reserve(nTriangles * 3);
+	for (size_t c = 0; c < vSorted.size(); c++)
+	{
+		vnSorted.insert(vnSorted.end(), pnIndices + vSorted[c].m_nFirstTriangle * 3, pnIndices + (vSorted[c].m_nFirstTriangle + vSorted[c].m_nTriangles) * 3);
+	}
+
+	int nMissesBefore = ::SimulateVertexCache(pnIndices, nTriangles * 3, nVertices, MESH_SIMULATE_CACHE_SIZE);
+	int nMissesAfter = ::SimulateVertexCache(vnSorted.data(), nTriangles * 3, nVertices, MESH_SIMULATE_CACHE_SIZE);
+	if (float(nMissesAfter) <= float(nMissesBefore) * fThreshold) memcpy(pnIndices, vnSorted.data(), sizeof(UINT) * nTriangles * 3);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//Vertices are renumbered in first-use order over all submeshes; unreferenced ones keep their relative order at the end
+void OptimizeVertexFetch(CMeshLoadInfo *pMeshInfo)
+{
+	int nVertices = pMeshInfo->m_nVertices;
+	vector<UINT> vnRemap(nVertices, UINT(-1)), vnSources;
+	vnSources.reserve(nVertices);
+
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++)
+	{
+		for (int j = 0; j < pMeshInfo->m_pnSubSetIndices[i]; j++)
+		{
+			UINT v = pMeshInfo->m_ppnSubSetIndices[i][j];
+			if (vnRemap[v] == UINT(-1))
+			{
+				vnRemap[v] = (UINT)vnSources.size();
+				vnSources.push_back(v);
+			}
+		}
+	}
+	for (int v = 0; v < nVertices; v++)
+	{
+		if (vnRemap[v] == UINT(-1))
+		{
+			vnRemap[v] = (UINT)vnSources.size();
+			vnSources.push_back(v);
+		}
+	}
+
+	::RemapMeshVertices(pMeshInfo, vnSources.data(), nVertices, vnRemap.data());
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+static bool IsValidMeshIndices(CMeshLoadInfo *pMeshInfo)
+{
+	for (int i = 0; i < pMeshInfo->m_nIndices; i++) if (pMeshInfo->m_pnIndices[i] >= (UINT)pMeshInfo->m_nVertices) return(false);
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++)
+	{
+		if (!pMeshInfo->m_ppnSubSetIndices[i]) continue;
+		for (int j = 0; j < pMeshInfo->m_pnSubSetIndices[i]; j++) if (pMeshInfo->m_ppnSubSetIndices[i][j] >= (UINT)pMeshInfo->m_nVertices) return(false);
+	}
+	return(true);
+}
+
+static void AccumulateCacheStats(CMeshLoadInfo *pMeshInfo, int *pnMisses, int *pnUsedVertices)
+{
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++)
+	{
+		if (!pMeshInfo->m_ppnSubSetIndices[i]) continue;
+
+		int nUsedVertices = 0;
+		*pnMisses += ::SimulateVertexCache(pMeshInfo->m_ppnSubSetIndices[i], pMeshInfo->m_pnSubSetIndices[i], pMeshInfo->m_nVertices, MESH_SIMULATE_CACHE_SIZE, &nUsedVertices);
+		*pnUsedVertices += nUsedVertices;
+	}
+}
+
+void OptimizeMeshLoadInfo(CMeshLoadInfo *pMeshInfo, MESHOPTIMIZESTATS *pStats)
+{
+	if ((pMeshInfo->m_nVertices <= 0) || !::IsValidMeshIndices(pMeshInfo)) return;
+
+	MESHOPTIMIZESTATS xStats;
+	xStats.m_nMeshes = 1;
+	xStats.m_nVerticesBefore = pMeshInfo->m_nVertices;
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++) xStats.m_nTriangles += pMeshInfo->m_pnSubSetIndices[i] / 3;
+	::AccumulateCacheStats(pMeshInfo, &xStats.m_nCacheMissesBefore, &xStats.m_nUsedVerticesBefore);
+
+	::TakeMeshArrays(pMeshInfo);
+
+	vector<UINT> vnRemap(pMeshInfo->m_nVertices);
+	::WeldVertices(pMeshInfo, vnRemap.data());
+
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++)
+	{
+		if (!pMeshInfo->m_ppnSubSetIndices[i]) continue;
+		::OptimizeVertexCache(pMeshInfo->m_ppnSubSetIndices[i], pMeshInfo->m_pnSubSetIndices[i], pMeshInfo->m_nVertices);
+		::OptimizeOverdraw(pMeshInfo->m_ppnSubSetIndices[i], pMeshInfo->m_pnSubSetIndices[i], pMeshInfo->m_pxmf3Positions, pMeshInfo->m_nVertices, MESH_OVERDRAW_THRESHOLD);
+	}
+
+	::OptimizeVertexFetch(pMeshInfo);
+
+	xStats.m_nVerticesAfter = pMeshInfo->m_nVertices;
+	::AccumulateCacheStats(pMeshInfo, &xStats.m_nCacheMissesAfter, &xStats.m_nUsedVerticesAfter);
+
+	if (pStats) pStats->Add(&xStats);
+}
@@ -0,0 +1,47 @@
+//-----------------------------------------------------------------------------
+// File: MeshOptimizer.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Mesh.h"
+
+//Import-time mesh optimization, run on CMeshLoadInfo before the GPU buffers are created:
+//weld -> per-submesh vertex cache order (Forsyth) -> overdraw cluster sort -> vertex fetch remap.
+//Everything here is CPU only and has no device dependency.
+
+#define MESH_OPTIMIZE_CACHE_SIZE		32 //LRU size used by the reordering score
+#define MESH_SIMULATE_CACHE_SIZE		16 //FIFO size used for the ACMR/ATVR report
+#define MESH_OVERDRAW_THRESHOLD			1.05f //Allowed ACMR loss for the overdraw pass
+
+struct MESHOPTIMIZESTATS
+{
+	int								m_nMeshes = 0;
+	int								m_nTriangles = 0;
+
+	int								m_nVerticesBefore = 0;
+	int								m_nVerticesAfter = 0;
+	int								m_nCacheMissesBefore = 0;
+	int								m_nCacheMissesAfter = 0;
+	int								m_nUsedVerticesBefore = 0;
+	int								m_nUsedVerticesAfter = 0;
+
+	float GetACMRBefore() { return((m_nTriangles > 0) ? float(m_nCacheMissesBefore) / float(m_nTriangles) : 0.0f); }
+	float GetACMRAfter() { return((m_nTriangles > 0) ? float(m_nCacheMissesAfter) / float(m_nTriangles) : 0.0f); }
+	float GetATVRBefore() { return((m_nUsedVerticesBefore > 0) ? float(m_nCacheMissesBefore) / float(m_nUsedVerticesBefore) : 0.0f); }
+	float GetATVRAfter() { return((m_nUsedVerticesAfter > 0) ? float(m_nCacheMissesAfter) / float(m_nUsedVerticesAfter) : 0.0f); }
+
+	void Add(MESHOPTIMIZESTATS *pStats);
+};
+
+int SimulateVertexCache(UINT *pnIndices, int nIndices, int nVertices, int nCacheSize, int *pnUsedVertices = NULL);
+
+//Every vertex maps to the lowest-numbered vertex with a bitwise identical position (ignores the other streams)
+void BuildPositionIds(XMFLOAT3 *pxmf3Positions, int nVertices, UINT *pnPositionIds);
+int WeldVertices(CMeshLoadInfo *pMeshInfo, UINT *pnRemap);
+void OptimizeVertexCache(UINT *pnIndices, int nIndices, int nVertices);
+void OptimizeOverdraw(UINT *pnIndices, int nIndices, XMFLOAT3 *pxmf3Positions, int nVertices, float fThreshold);
+void OptimizeVertexFetch(CMeshLoadInfo *pMeshInfo);
+
+//Runs the whole pipeline; the arrays of pMeshInfo are replaced by owned copies (m_bMappedArrays is cleared)
+void OptimizeMeshLoadInfo(CMeshLoadInfo *pMeshInfo, MESHOPTIMIZESTATS *pStats = NULL);
@@ -0,0 +1,330 @@
+//-----------------------------------------------------------------------------
+// File: MeshSimplifier.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <unordered_set>
+#include <cfloat>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+void MESHLODSTATS::Add(CMeshLoadInfo *pMeshInfo)
+{
+	XMFLOAT3& xmf3Extents = pMeshInfo->m_xmf3AABBExtents;
+	float fDiagonal = 2.0f * sqrtf(xmf3Extents.x * xmf3Extents.x + xmf3Extents.y * xmf3Extents.y + xmf3Extents.z * xmf3Extents.z);
+
+	m_nMeshes++;
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++) m_pnTriangles[0] += pMeshInfo->m_pnSubSetIndices[i] / 3;
+	for (int l = 1; l < MESH_MAX_LODS; l++)
+	{
+		//Meshes with a shorter chain draw their last level
+		int nLod = min(l, pMeshInfo->m_nLods - 1);
+		for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++)
+		{
+			m_pnTriangles[l] += ((nLod > 0) ? pMeshInfo->m_pnLodSubSetIndices[(nLod - 1) * pMeshInfo->m_nSubMeshes + i] : pMeshInfo->m_pnSubSetIndices[i]) / 3;
+		}
+		if (fDiagonal > 0.0f) m_pfMaxErrors[l] = max(m_pfMaxErrors[l], pMeshInfo->m_pfLodErrors[nLod] / fDiagonal);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//Symmetric 4x4 quadric of the summed squared plane distances, weighted by triangle area
+struct QUADRIC
+{
+	double							a00, a01, a02, a11, a12, a22;
+	double							b0, b1, b2;
+	double							c;
+	double							w;
+};
+
+static void AddPlaneQuadric(QUADRIC *pQuadric, double a, double b, double c, double d, double fWeight)
+{
+	pQuadric->a00 += fWeight * a * a; pQuadric->a01 += fWeight * a * b; pQuadric->a02 += fWeight * a * c;
+	pQuadric->a11 += fWeight * b * b; pQuadric->a12 += fWeight * b * c;
+	pQuadric->a22 += fWeight * c * c;
+	pQuadric->b0 += fWeight * a * d; pQuadric->b1 += fWeight * b * d; pQuadric->b2 += fWeight * c * d;
+	pQuadric->c += fWeight * d * d;
+	pQuadric->w += fWeight;
+}
+
+static void AddQuadric(QUADRIC *pQuadric, QUADRIC *pOther)
+{
+	pQuadric->a00 += pOther->a00; pQuadric->a01 += pOther->a01; pQuadric->a02 += pOther->a02;
+	pQuadric->a11 += pOther->a11; pQuadric->a12 += pOther->a12;
+	pQuadric->a22 += pOther->a22;
+	pQuadric->b0 += pOther->b0; pQuadric->b1 += pOther->b1; pQuadric->b2 += pOther->b2;
+	pQuadric->c += pOther->c;
+	pQuadric->w += pOther->w;
+}
+
+//Mean squared distance to the accumulated planes
+static double EvaluateQuadric(QUADRIC *pQuadric, XMFLOAT3& xmf3Position)
+{
+	double x = xmf3Position.x, y = xmf3Position.y, z = xmf3Position.z;
+	double fError = pQuadric->a00 * x * x + pQuadric->a11 * y * y + pQuadric->a22 * z * z;
+	fError += 2.0 * (pQuadric->a01 * x * y + pQuadric->a02 * x * z + pQuadric->a12 * y * z);
+	fError += 2.0 * (pQuadric->b0 * x + pQuadric->b1 * y + pQuadric->b2 * z) + pQuadric->c;
+
+	return(max(fError, 0.0));
+}
+
+static XMFLOAT3 TriangleNormal(XMFLOAT3& p0, XMFLOAT3& p1, XMFLOAT3& p2)
+{
+	float e1x = p1.x - p0.x, e1y = p1.y - p0.y, e1z = p1.z - p0.z;
+	float e2x = p2.x - p0.x, e2y = p2.y - p0.y, e2z = p2.z - p0.z;
+	return(XMFLOAT3(e1y * e2z - e1z * e2y, e1z * e2x - e1x * e2z, e1x * e2y - e1y * e2x));
+}
+
+struct COLLAPSE
+{
+	UINT							m_nFrom;
+	UINT							m_nTo;
+	float							m_fError;
+};
+
+int SimplifyMesh(UINT *pnDestIndices, UINT *pnIndices, int nIndices, XMFLOAT3 *pxmf3Positions, int nVertices, int nTargetIndices, float fTargetError, float *pfResultError)
+{
+	vector<UINT> vnIndices(pnIndices, pnIndices + nIndices);
+	vector<UINT> vnPositionIds(nVertices);
+	::BuildPositionIds(pxmf3Positions, nVertices, &vnPositionIds[0]);
+
+	//Plane quadrics per position id
+	vector<QUADRIC> vQuadrics(nVertices);
+	memset(&vQuadrics[0], 0, sizeof(QUADRIC) * nVertices);
+	for (int i = 0; i + 2 < nIndices; i += 3)
+	{
+		XMFLOAT3& p0 = pxmf3Positions[vnIndices[i]];
+		XMFLOAT3 xmf3Normal = ::TriangleNormal(p0, pxmf3Positions[vnIndices[i + 1]], pxmf3Positions[vnIndices[i + 2]]);
+		double fLength = sqrt(double(xmf3Normal.x) * xmf3Normal.x + double(xmf3Normal.y) * xmf3Normal.y + double(xmf3Normal.z) * xmf3Normal.z);
+		if (fLength <= 0.0) continue;
+
+		double a = xmf3Normal.x / fLength, b = xmf3Normal.y / fLength, c = xmf3Normal.z / fLength;
+		double d = -(a * p0.x + b * p0.y + c * p0.z);
+		for (int k = 0; k < 3; k++) ::AddPlaneQuadric(&vQuadrics[vnPositionIds[vnIndices[i + k]]], a, b, c, d, 1.0);
+	}
+
+	//Open and non-manifold edges lock both ends: submesh borders must match their neighbours at every level
+	vector<bool> vbLocked(nVertices, false);
+	unordered_set<UINT64> setEdges;
+	setEdges.reserve(nIndices * 2);
+	for (int i = 0; i + 2 < nIndices; i += 3)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			UINT a = vnPositionIds[vnIndices[i + k]], b = vnPositionIds[vnIndices[i + ((k + 1) % 3)]];
+			if (a == b) continue;
+			if (!setEdges.insert((UINT64(a) << 32) | b).second) vbLocked[a] = vbLocked[b] = true;
+		}
+	}
+	for (auto nEdge : setEdges)
+	{
+		UINT a = UINT(nEdge >> 32), b = UINT(nEdge & 0xFFFFFFFF);
+		if (!setEdges.count((UINT64(b) << 32) | a)) vbLocked[a] = vbLocked[b] = true;
+	}
+
+	double fMaxError = double(fTargetError) * double(fTargetError);
+	float fResultError = 0.0f;
+
+	vector<UINT> vnRemap(nVertices);
+	vector<bool> vbTouched(nVertices);
+	vector<int> vnTriangleOffsets(nVertices + 1);
+	vector<int> vnTriangles;
+	vector<COLLAPSE> vCollapses;
+	vector<pair<UINT, UINT>> vSeamPairs;
+
+	while ((int)vnIndices.size() > nTargetIndices)
+	{
+		int nTriangles = (int)vnIndices.size() / 3;
+
+		//Triangles around each position id (CSR)
+		std::fill(vnTriangleOffsets.begin(), vnTriangleOffsets.end(), 0);
+		for (int i = 0; i < nTriangles * 3; i++) vnTriangleOffsets[vnPositionIds[vnIndices[i]] + 1]++;
+		for (int i = 0; i < nVertices; i++) vnTriangleOffsets[i + 1] += vnTriangleOffsets[i];
+		vnTriangles.resize(nTriangles * 3);
+		vector<int> vnFill(vnTriangleOffsets.begin(), vnTriangleOffsets.end() - 1);
+		for (int i = 0; i < nTriangles * 3; i++) vnTriangles[vnFill[vnPositionIds[vnIndices[i]]]++] = i / 3;
+
+		//Cheaper direction of every edge
+		vCollapses.clear();
+		for (int i = 0; i < nTriangles * 3; i++)
+		{
+			UINT a = vnPositionIds[vnIndices[i]], b = vnPositionIds[vnIndices[(i % 3 == 2) ? (i - 2) : (i + 1)]];
+			if ((a == b) || (vbLocked[a] && vbLocked[b])) continue;
+			//Each interior edge is seen from both triangles; keep the one with a < b when the reverse also exists
+			if ((a > b) && setEdges.count((UINT64(b) << 32) | a)) continue;
+
+			QUADRIC xQuadric = vQuadrics[a];
+			::AddQuadric(&xQuadric, &vQuadrics[b]);
+			double fErrorAB = (vbLocked[a]) ? DBL_MAX : ::EvaluateQuadric(&xQuadric, pxmf3Positions[b]);
+			double fErrorBA = (vbLocked[b]) ? DBL_MAX : ::EvaluateQuadric(&xQuadric, pxmf3Positions[a]);
+
+			COLLAPSE xCollapse;
+			xCollapse.m_nFrom = (fErrorAB <= fErrorBA) ? a : b;
+			xCollapse.m_nTo = (fErrorAB <= fErrorBA) ? b : a;
+			xCollapse.m_fError = float(min(fErrorAB, fErrorBA));
+			if (xCollapse.m_fError <= fMaxError) vCollapses.push_back(xCollapse);
+		}
+		if (vCollapses.empty()) break;
+		std::sort(vCollapses.begin(), vCollapses.end(), [](const COLLAPSE& a, const COLLAPSE& b) { return(a.m_fError < b.m_fError); });
+
+		for (int i = 0; i < nVertices; i++) vnRemap[i] = i;
+		std::fill(vbTouched.begin(), vbTouched.end(), false);
+
+		//Each collapse removes about two triangles
+		int nBudget = max(1, (nTriangles - nTargetIndices / 3) / 2), nCollapsed = 0;
+		for (size_t c = 0; (c < vCollapses.size()) && (nCollapsed < nBudget); c++)
+		{
+			UINT nFrom = vCollapses[c].m_nFrom, nTo = vCollapses[c].m_nTo;
+			if (vbTouched[nFrom] || vbTouched[nTo]) continue;
+
+			//Every vertex at nFrom must have a partner at nTo on a shared triangle (seams collapse along the seam)
+			vSeamPairs.clear();
+			for (int t = vnTriangleOffsets[nFrom]; t < vnTriangleOffsets[nFrom + 1]; t++)
+			{
+				UINT *pnTriangle = &vnIndices[vnTriangles[t] * 3];
+				for (int k = 0; k < 3; k++)
+				{
+					if (vnPositionIds[pnTriangle[k]] != nFrom) continue;
+					for (int j = 0; j < 3; j++)
+					{
+						if (vnPositionIds[pnTriangle[j]] == nTo) vSeamPairs.push_back(make_pair(pnTriangle[k], pnTriangle[j]));
+					}
+				}
+			}
+
+			bool bValid = !vSeamPairs.empty();
+			for (int t = vnTriangleOffsets[nFrom]; bValid && (t < vnTriangleOffsets[nFrom + 1]); t++)
+			{
+				UINT *pnTriangle = &vnIndices[vnTriangles[t] * 3];
+				int nCorner = -1;
+				bool bHasTo = false;
+				for (int k = 0; k < 3; k++)
+				{
+					if (vnPositionIds[pnTriangle[k]] == nFrom) nCorner = k;
+					if (vnPositionIds[pnTriangle[k]] == nTo) bHasTo = true;
+				}
+				if (nCorner < 0) continue;
+
+				bool bPaired = false;
+				for (auto& xPair : vSeamPairs) if (xPair.first == pnTriangle[nCorner]) bPaired = true;
+				if (!bPaired) bValid = false;
+				if (bHasTo || !bValid) continue;
+
+				//Reject collapses that flip or nearly flip a remaining triangle
+				XMFLOAT3 p[3], q[3];
+				for (int k = 0; k < 3; k++)
+				{
+					p[k] = q[k] = pxmf3Positions[vnRemap[pnTriangle[k]]];
+					if (k == nCorner) q[k] = pxmf3Positions[nTo];
+				}
+				XMFLOAT3 n0 = ::TriangleNormal(p[0], p[1], p[2]), n1 = ::TriangleNormal(q[0], q[1], q[2]);
+				float fDot = n0.x * n1.x + n0.y * n1.y + n0.z * n1.z;
+				float fLengths = sqrtf((n0.x * n0.x + n0.y * n0.y + n0.z * n0.z) * (n1.x * n1.x + n1.y * n1.y + n1.z * n1.z));
+				if (fDot <= 0.25f * fLengths) bValid = false;
+			}
+			if (!bValid) continue;
+
+			for (auto& xPair : vSeamPairs) vnRemap[xPair.first] = xPair.second;
+			::AddQuadric(&vQuadrics[nTo], &vQuadrics[nFrom]);
+			vbTouched[nFrom] = vbTouched[nTo] = true;
+			fResultError = max(fResultError, sqrtf(vCollapses[c].m_fError));
+			nCollapsed++;
+		}
+		if (!nCollapsed) break;
+
+		//Apply the remap and drop triangles that became degenerate
+		int nWrite = 0;
+		for (int i = 0; i < nTriangles * 3; i += 3)
+		{
+			UINT a = vnRemap[vnIndices[i]], b = vnRemap[vnIndices[i + 1]], c = vnRemap[vnIndices[i + 2]];
+			UINT pa = vnPositionIds[a], pb = vnPositionIds[b], pc = vnPositionIds[c];
+			if ((pa == pb) || (pb == pc) || (pc == pa)) continue;
+			vnIndices[nWrite++] = a; vnIndices[nWrite++] = b; vnIndices[nWrite++] = c;
+		}
+		vnIndices.resize(nWrite);
+
+		//The collapsed edges are gone; rebuild the directed edge set used for the interior test
+		setEdges.clear();
+		for (int i = 0; i < nWrite; i++) setEdges.insert((UINT64(vnPositionIds[vnIndices[i]]) << 32) | vnPositionIds[vnIndices[(i % 3 == 2) ? (i - 2) : (i + 1)]]);
+	}
+
+	if (vnIndices.size()) memcpy(pnDestIndices, &vnIndices[0], sizeof(UINT) * vnIndices.size());
+	if (pfResultError) *pfResultError = fResultError;
+
+	return((int)vnIndices.size());
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+void GenerateMeshLods(CMeshLoadInfo *pMeshInfo, MESHLODSTATS *pStats)
+{
+	if (!pMeshInfo->m_pxmf3Positions || (pMeshInfo->m_nSubMeshes <= 0)) return;
+
+	XMFLOAT3& xmf3Extents = pMeshInfo->m_xmf3AABBExtents;
+	float fDiagonal = 2.0f * sqrtf(xmf3Extents.x * xmf3Extents.x + xmf3Extents.y * xmf3Extents.y + xmf3Extents.z * xmf3Extents.z);
+	float fTargetError = MESH_LOD_MAX_ERROR * fDiagonal;
+
+	int nSubMeshes = pMeshInfo->m_nSubMeshes;
+	pMeshInfo->m_pnLodSubSetIndices = new int[(MESH_MAX_LODS - 1) * nSubMeshes];
+	pMeshInfo->m_ppnLodSubSetIndices = new UINT*[(MESH_MAX_LODS - 1) * nSubMeshes];
+	memset(pMeshInfo->m_ppnLodSubSetIndices, 0, sizeof(UINT *) * (MESH_MAX_LODS - 1) * nSubMeshes);
+
+	pMeshInfo->m_nLods = 1;
+	pMeshInfo->m_pfLodErrors[0] = 0.0f;
+
+	//Each level is simplified from the previous one, so the error of level l bounds every collapse up to l
+	for (int l = 1; l < MESH_MAX_LODS; l++)
+	{
+		int nSourceIndices = 0, nLodIndices = 0;
+		float fLodError = pMeshInfo->m_pfLodErrors[l - 1];
+		for (int i = 0; i < nSubMeshes; i++)
+		{
+			int nSource = (l > 1) ? pMeshInfo->m_pnLodSubSetIndices[(l - 2) * nSubMeshes + i] : pMeshInfo->m_pnSubSetIndices[i];
+			UINT *pnSource = (l > 1) ? pMeshInfo->m_ppnLodSubSetIndices[(l - 2) * nSubMeshes + i] : pMeshInfo->m_ppnSubSetIndices[i];
+
+			UINT *pnLod = new UINT[max(nSource, 3)];
+			float fError = 0.0f;
+			int nTarget = int(nSource / 3 * MESH_LOD_REDUCTION) * 3;
+			int nLod = (nSource > 0) ? ::SimplifyMesh(pnLod, pnSource, nSource, pMeshInfo->m_pxmf3Positions, pMeshInfo->m_nVertices, nTarget, fTargetError, &fError) : 0;
+			if (nLod > 0) ::OptimizeVertexCache(pnLod, nLod, pMeshInfo->m_nVertices);
+
+			pMeshInfo->m_pnLodSubSetIndices[(l - 1) * nSubMeshes + i] = nLod;
+			pMeshInfo->m_ppnLodSubSetIndices[(l - 1) * nSubMeshes + i] = pnLod;
+			nSourceIndices += nSource;
+			nLodIndices += nLod;
+			fLodError = max(fLodError, pMeshInfo->m_pfLodErrors[l - 1] + fError);
+		}
+
+		if (nLodIndices > nSourceIndices * MESH_LOD_MIN_REDUCTION)
+		{
+			for (int i = 0; i < nSubMeshes; i++)
+			{
+				delete[] pMeshInfo->m_ppnLodSubSetIndices[(l - 1) * nSubMeshes + i];
+				pMeshInfo->m_ppnLodSubSetIndices[(l - 1) * nSubMeshes + i] = NULL;
+			}
+			break;
+		}
+		pMeshInfo->m_pfLodErrors[l] = fLodError;
+		pMeshInfo->m_nLods = l + 1;
+	}
+
+	if (pStats) pStats->Add(pMeshInfo);
+}
+
+int SelectMeshLod(float *pfLodErrors, int nLods, float fScale, float fDistance, float fPixelsPerUnit)
+{
+	fDistance = max(fDistance, 1.0e-3f);
+
+	int nLod = 0;
+	for (int l = 1; l < nLods; l++)
+	{
+		if (pfLodErrors[l] * fScale * fPixelsPerUnit / fDistance > MESH_LOD_PIXEL_ERROR) break;
+		nLod = l;
+	}
+
+	return(nLod);
+}
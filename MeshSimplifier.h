@@ -0,0 +1,38 @@
+//-----------------------------------------------------------------------------
+// File: MeshSimplifier.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Mesh.h"
+
+//Import-time LOD chain: quadric error (Garland-Heckbert) edge collapse on the index sets only.
+//Vertices are never moved or added, every collapse snaps one position onto a neighbouring one,
+//so all levels share the vertex buffer of level 0 and only need extra index ranges.
+//Borders (including submesh borders) are locked so that neighbouring submeshes stay closed;
+//attribute seams collapse only along the seam. CPU only, no device dependency.
+
+#define MESH_LOD_REDUCTION				0.5f //Each level keeps this fraction of the previous level's triangles
+#define MESH_LOD_MIN_REDUCTION			0.85f //A level that keeps more than this is dropped and the chain ends
+#define MESH_LOD_MAX_ERROR				0.02f //Error limit per level, relative to the AABB diagonal
+#define MESH_LOD_PIXEL_ERROR			1.0f //Selection: coarsest level whose projected error is below this many pixels
+
+struct MESHLODSTATS
+{
+	int								m_nMeshes = 0;
+	int								m_pnTriangles[MESH_MAX_LODS] = { 0 };
+	float							m_pfMaxErrors[MESH_MAX_LODS] = { 0.0f }; //Relative to the AABB diagonal
+
+	void Add(CMeshLoadInfo *pMeshInfo);
+};
+
+//Writes at most nIndices indices to pnDestIndices and returns the count. fTargetError is in model units;
+//*pfResultError receives the largest collapse error (RMS distance to the merged planes) that was accepted.
+int SimplifyMesh(UINT *pnDestIndices, UINT *pnIndices, int nIndices, XMFLOAT3 *pxmf3Positions, int nVertices, int nTargetIndices, float fTargetError, float *pfResultError);
+
+//Fills m_nLods/m_pfLodErrors/m_pnLodSubSetIndices/m_ppnLodSubSetIndices of pMeshInfo (owned arrays)
+void GenerateMeshLods(CMeshLoadInfo *pMeshInfo, MESHLODSTATS *pStats = NULL);
+
+//fScale: largest world scale of the object, fDistance: distance from the eye to the bounds,
+//fPixelsPerUnit: projection _22 * viewport height / 2 (pixels covered by one unit at distance 1)
+int SelectMeshLod(float *pfLodErrors, int nLods, float fScale, float fDistance, float fPixelsPerUnit);
@@ -0,0 +1,351 @@
+//-----------------------------------------------------------------------------
+// File: ModelCooker.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "ModelFile.h"
+#include "Object.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "MeshCluster.h"
+#include <stdarg.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//Converts the tag stream written by ExtractMeshByBinaryWithNormal.cs into the cooked layout in ModelFile.h
+class CModelCooker
+{
+public:
+	CModelCooker() { }
+	~CModelCooker() { }
+
+private:
+	vector<COOKEDFRAME>				m_vFrames;
+	vector<COOKEDMESH>				m_vMeshes;
+	vector<COOKEDSUBMESH>			m_vSubMeshes;
+	vector<COOKEDMATERIAL>			m_vMaterials;
+	vector<BYTE>					m_vBlob;
+
+	UINT64 AppendBlob(void *pData, UINT64 nBytes);
+	void AppendClusters(CMeshLoadInfo *pMeshInfo, int nRange, COOKEDSUBMESH *pSubMesh);
+	void AppendMesh(CMeshLoadInfo *pMeshInfo, COOKEDFRAME *pFrame);
+	void AppendMaterials(MATERIALSLOADINFO *pMaterialsInfo, COOKEDFRAME *pFrame);
+
+public:
+	MESHOPTIMIZESTATS				m_OptimizeStats;
+	MESHLODSTATS					m_LodStats;
+	MESHCLUSTERSTATS				m_ClusterStats;
+
+	int ReadFrameHierarchy(CModelStreamReader *pReader, int nParent);
+	bool Write(char *pstrFileName, UINT64 nSourceHash, UINT64 nSourceSize, UINT64 nSourceWriteTime);
+};
+
+static UINT64 AlignCookedOffset(UINT64 nOffset)
+{
+	return((nOffset + (COOKED_MODEL_ALIGNMENT - 1)) & ~UINT64(COOKED_MODEL_ALIGNMENT - 1));
+}
+
+UINT64 CModelCooker::AppendBlob(void *pData, UINT64 nBytes)
+{
+	if (!pData || !nBytes) return(UINT64(-1));
+
+	UINT64 nOffset = ::AlignCookedOffset(m_vBlob.size());
+	m_vBlob.resize((size_t)(nOffset + nBytes), 0);
+	memcpy(&m_vBlob[(size_t)nOffset], pData, (size_t)nBytes);
+
+	return(nOffset);
+}
+
+//nRange is the level-major submesh table position, the same index as in m_ppSubSetClusters
+void CModelCooker::AppendClusters(CMeshLoadInfo *pMeshInfo, int nRange, COOKEDSUBMESH *pSubMesh)
+{
+	pSubMesh->m_nClusters = (pMeshInfo->m_ppSubSetClusters) ? pMeshInfo->m_pnSubSetClusters[nRange] : 0;
+	pSubMesh->m_nClusterArray = (pSubMesh->m_nClusters > 0) ? AppendBlob(pMeshInfo->m_ppSubSetClusters[nRange], sizeof(MESHCLUSTER) * (UINT64)pSubMesh->m_nClusters) : UINT64(-1);
+}
+
+void CModelCooker::AppendMesh(CMeshLoadInfo *pMeshInfo, COOKEDFRAME *pFrame)
+{
+	COOKEDMESH xMesh;
+	memset(&xMesh, 0, sizeof(COOKEDMESH));
+
+	strncpy_s(xMesh.m_pstrMeshName, sizeof(xMesh.m_pstrMeshName), pMeshInfo->m_pstrMeshName, _TRUNCATE);
+	xMesh.m_nType = pMeshInfo->m_nType;
+	xMesh.m_nVertices = pMeshInfo->m_nVertices;
+	xMesh.m_xmf3AABBCenter = pMeshInfo->m_xmf3AABBCenter;
+	xMesh.m_xmf3AABBExtents = pMeshInfo->m_xmf3AABBExtents;
+
+	UINT64 nVertices = (UINT64)pMeshInfo->m_nVertices;
+	xMesh.m_nPositions = AppendBlob(pMeshInfo->m_pxmf3Positions, sizeof(XMFLOAT3) * nVertices);
+	xMesh.m_nColors = AppendBlob(pMeshInfo->m_pxmf4Colors, sizeof(XMFLOAT4) * nVertices);
+	xMesh.m_nNormals = AppendBlob(pMeshInfo->m_pxmf3Normals, sizeof(XMFLOAT3) * nVertices);
+	xMesh.m_nTexCoords = AppendBlob(pMeshInfo->m_pxmf2TexCoords, sizeof(XMFLOAT2) * nVertices);
+
+	xMesh.m_nIndices = pMeshInfo->m_nIndices;
+	xMesh.m_nIndexArray = AppendBlob(pMeshInfo->m_pnIndices, sizeof(UINT) * (UINT64)pMeshInfo->m_nIndices);
+
+	xMesh.m_nSubMeshes = pMeshInfo->m_nSubMeshes;
+	xMesh.m_nFirstSubMesh = (int)m_vSubMeshes.size();
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++)
+	{
+		COOKEDSUBMESH xSubMesh;
+		xSubMesh.m_nIndices = pMeshInfo->m_pnSubSetIndices[i];
+		xSubMesh.m_nIndexArray = AppendBlob(pMeshInfo->m_ppnSubSetIndices[i], sizeof(UINT) * (UINT64)xSubMesh.m_nIndices);
+		AppendClusters(pMeshInfo, i, &xSubMesh);
+		m_vSubMeshes.push_back(xSubMesh);
+	}
+
+	//Simplified levels follow level 0 in the submesh table
+	xMesh.m_nLods = (pMeshInfo->m_ppnLodSubSetIndices) ? pMeshInfo->m_nLods : 1;
+	for (int l = 0; l < xMesh.m_nLods; l++) xMesh.m_pfLodErrors[l] = pMeshInfo->m_pfLodErrors[l];
+	for (int i = 0; i < (xMesh.m_nLods - 1) * pMeshInfo->m_nSubMeshes; i++)
+	{
+		COOKEDSUBMESH xSubMesh;
+		xSubMesh.m_nIndices = pMeshInfo->m_pnLodSubSetIndices[i];
+		xSubMesh.m_nIndexArray = AppendBlob(pMeshInfo->m_ppnLodSubSetIndices[i], sizeof(UINT) * (UINT64)xSubMesh.m_nIndices);
+		AppendClusters(pMeshInfo, pMeshInfo->m_nSubMeshes + i, &xSubMesh);
+		m_vSubMeshes.push_back(xSubMesh);
+	}
+
+	pFrame->m_nMesh = (int)m_vMeshes.size();
+	m_vMeshes.push_back(xMesh);
+}
+
+void CModelCooker::AppendMaterials(MATERIALSLOADINFO *pMaterialsInfo, COOKEDFRAME *pFrame)
+{
+	pFrame->m_nFirstMaterial = (int)m_vMaterials.size();
+	pFrame->m_nMaterials = pMaterialsInfo->m_nMaterials;
+	for (int i = 0; i < pMaterialsInfo->m_nMaterials; i++)
+	{
+		MATERIALLOADINFO *pMaterial = &pMaterialsInfo->m_pMaterials[i];
+
+		COOKEDMATERIAL xMaterial;
+		memset(&xMaterial, 0, sizeof(COOKEDMATERIAL));
+		xMaterial.m_xmf4AlbedoColor = pMaterial->m_xmf4AlbedoColor;
+		xMaterial.m_xmf4EmissiveColor = pMaterial->m_xmf4EmissiveColor;
+		xMaterial.m_xmf4SpecularColor = pMaterial->m_xmf4SpecularColor;
+		xMaterial.m_fGlossiness = pMaterial->m_fGlossiness;
+		xMaterial.m_fSmoothness = pMaterial->m_fSmoothness;
+		xMaterial.m_fSpecularHighlight = pMaterial->m_fSpecularHighlight;
+		xMaterial.m_fMetallic = pMaterial->m_fMetallic;
+		xMaterial.m_fGlossyReflection = pMaterial->m_fGlossyReflection;
+		xMaterial.m_nType = pMaterial->m_nType;
+		m_vMaterials.push_back(xMaterial);
+	}
+}
+
+//Same token flow as CGameObject::LoadFrameHierarchyFromFile; returns the frame index or -1
+int CModelCooker::ReadFrameHierarchy(CModelStreamReader *pReader, int nParent)
+{
+	char *pstrToken = NULL;
+	BYTE nLength = 0;
+
+	int nFrame = -1;
+
+	while (pReader->IsValid())
+	{
+		nLength = pReader->ReadToken(&pstrToken);
+		if (::IsModelToken(pstrToken, nLength, "<Frame>:"))
+		{
+			COOKEDFRAME xFrame;
+			memset(&xFrame, 0, sizeof(COOKEDFRAME));
+			xFrame.m_nParent = nParent;
+			xFrame.m_nMesh = -1;
+			xFrame.m_xmf4x4Transform = Matrix4x4::Identity();
+
+			pReader->ReadInteger();
+			pReader->ReadString(xFrame.m_pstrFrameName, sizeof(xFrame.m_pstrFrameName));
+			xFrame.m_nNameHash = ::HashFrameName(xFrame.m_pstrFrameName);
+
+			nFrame = (int)m_vFrames.size();
+			m_vFrames.push_back(xFrame);
+		}
+		else if (nFrame < 0)
+		{
+			continue;
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Transform>:"))
+		{
+			pReader->ReadArray(sizeof(float) * 13);
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<TransformMatrix>:"))
+		{
+			void *pTransform = pReader->ReadArray(sizeof(XMFLOAT4X4));
+			if (pTransform) memcpy(&m_vFrames[nFrame].m_xmf4x4Transform, pTransform, sizeof(XMFLOAT4X4));
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Mesh>:"))
+		{
+			CMeshLoadInfo *pMeshInfo = ::LoadMappedMeshInfo(pReader);
+			::OptimizeMeshLoadInfo(pMeshInfo, &m_OptimizeStats);
+			::GenerateMeshLods(pMeshInfo, &m_LodStats);
+			::GenerateMeshClusters(pMeshInfo, &m_ClusterStats);
+			AppendMesh(pMeshInfo, &m_vFrames[nFrame]);
+			delete pMeshInfo;
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Materials>:"))
+		{
+			MATERIALSLOADINFO *pMaterialsInfo = ::LoadMappedMaterialsInfo(pReader);
+			AppendMaterials(pMaterialsInfo, &m_vFrames[nFrame]);
+			delete[] pMaterialsInfo->m_pMaterials;
+			delete pMaterialsInfo;
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Children>:"))
+		{
+			int nChilds = pReader->ReadInteger();
+			for (int i = 0; i < nChilds; i++)
+			{
+				if (ReadFrameHierarchy(pReader, nFrame) >= 0) m_vFrames[nFrame].m_nChildren++;
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "</Frame>"))
+		{
+			break;
+		}
+	}
+	return(nFrame);
+}
+
+bool CModelCooker::Write(char *pstrFileName, UINT64 nSourceHash, UINT64 nSourceSize, UINT64 nSourceWriteTime)
+{
+	COOKEDMODELHEADER xHeader;
+	memset(&xHeader, 0, sizeof(COOKEDMODELHEADER));
+	xHeader.m_nMagic = COOKED_MODEL_MAGIC;
+	xHeader.m_nVersion = COOKED_MODEL_VERSION;
+	xHeader.m_nSourceHash = nSourceHash;
+	xHeader.m_nSourceSize = nSourceSize;
+	xHeader.m_nSourceWriteTime = nSourceWriteTime;
+	xHeader.m_nFrames = (UINT)m_vFrames.size();
+	xHeader.m_nMeshes = (UINT)m_vMeshes.size();
+	xHeader.m_nSubMeshes = (UINT)m_vSubMeshes.size();
+	xHeader.m_nMaterials = (UINT)m_vMaterials.size();
+
+	xHeader.m_nFrameTableOffset = ::AlignCookedOffset(sizeof(COOKEDMODELHEADER));
+	xHeader.m_nMeshTableOffset = ::AlignCookedOffset(xHeader.m_nFrameTableOffset + sizeof(COOKEDFRAME) * m_vFrames.size());
+	xHeader.m_nSubMeshTableOffset = ::AlignCookedOffset(xHeader.m_nMeshTableOffset + sizeof(COOKEDMESH) * m_vMeshes.size());
+	xHeader.m_nMaterialTableOffset = ::AlignCookedOffset(xHeader.m_nSubMeshTableOffset + sizeof(COOKEDSUBMESH) * m_vSubMeshes.size());
+	xHeader.m_nBlobOffset = ::AlignCookedOffset(xHeader.m_nMaterialTableOffset + sizeof(COOKEDMATERIAL) * m_vMaterials.size());
+	xHeader.m_nFileSize = xHeader.m_nBlobOffset + m_vBlob.size();
+
+	vector<BYTE> vFile((size_t)xHeader.m_nFileSize, 0);
+	memcpy(&vFile[0], &xHeader, sizeof(COOKEDMODELHEADER));
+	if (m_vFrames.size()) memcpy(&vFile[(size_t)xHeader.m_nFrameTableOffset], &m_vFrames[0], sizeof(COOKEDFRAME) * m_vFrames.size());
+	if (m_vMeshes.size()) memcpy(&vFile[(size_t)xHeader.m_nMeshTableOffset], &m_vMeshes[0], sizeof(COOKEDMESH) * m_vMeshes.size());
+	if (m_vSubMeshes.size()) memcpy(&vFile[(size_t)xHeader.m_nSubMeshTableOffset], &m_vSubMeshes[0], sizeof(COOKEDSUBMESH) * m_vSubMeshes.size());
+	if (m_vMaterials.size()) memcpy(&vFile[(size_t)xHeader.m_nMaterialTableOffset], &m_vMaterials[0], sizeof(COOKEDMATERIAL) * m_vMaterials.size());
+	if (m_vBlob.size()) memcpy(&vFile[(size_t)xHeader.m_nBlobOffset], &m_vBlob[0], m_vBlob.size());
+
+	FILE *pOutFile = NULL;
+	if (::fopen_s(&pOutFile, pstrFileName, "wb") || !pOutFile) return(false);
+	size_t nWrites = ::fwrite(&vFile[0], 1, vFile.size(), pOutFile);
+	::fclose(pOutFile);
+
+	return(nWrites == vFile.size());
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//"/cook" messages go to the console (LabProject07-9-1.cpp attaches the one of the command prompt) and to the debugger
+static void PrintCookMessage(FILE *pStream, const char *pstrFormat, ...)
+{
+	char pstrMessage[256] = { '\0' };
+	va_list vArgs;
+	va_start(vArgs, pstrFormat);
+	::vsprintf_s(pstrMessage, 256, pstrFormat, vArgs);
+	va_end(vArgs);
+
+	::fputs(pstrMessage, pStream);
+	::OutputDebugStringA(pstrMessage);
+}
+
+//Re-cooks when the source hash, size or write time differs from the existing cooked header; the runtime only compares the
+//size and the write time, so a source that was touched without being changed is cooked again to refresh them
+bool CookModelFile(char *pstrFileName, bool bForce)
+{
+	CMappedModelFile xSourceFile;
+	if (!xSourceFile.Open(pstrFileName))
+	{
+		::PrintCookMessage(stderr, "Cook: cannot open %s\n", pstrFileName);
+		return(false);
+	}
+
+	UINT64 nSourceHash = ::HashModelBytes(xSourceFile.GetData(), xSourceFile.GetSize());
+	UINT64 nSourceSize = 0, nSourceWriteTime = 0;
+	::GetModelFileInfo(pstrFileName, &nSourceSize, &nSourceWriteTime);
+
+	char pstrCookedFileName[256] = { '\0' };
+	::GetCookedModelFileName(pstrFileName, pstrCookedFileName, 256);
+
+	if (!bForce)
+	{
+		CCookedModelFile xCookedFile;
+		if (xCookedFile.Open(pstrCookedFileName) && (xCookedFile.GetHeader()->m_nSourceHash == nSourceHash) && (xCookedFile.GetHeader()->m_nSourceSize == xSourceFile.GetSize()) && (xCookedFile.GetHeader()->m_nSourceWriteTime == nSourceWriteTime))
+		{
+			::PrintCookMessage(stdout, "Cook: %s is up to date\n", pstrCookedFileName);
+			return(true);
+		}
+	}
+
+	CModelCooker xCooker;
+	CModelStreamReader xReader(xSourceFile.GetData(), xSourceFile.GetSize());
+	char *pstrToken = NULL;
+	BYTE nLength = 0;
+	while (xReader.IsValid())
+	{
+		nLength = xReader.ReadToken(&pstrToken);
+		if (::IsModelToken(pstrToken, nLength, "<Hierarchy>:"))
+		{
+			xCooker.ReadFrameHierarchy(&xReader, -1);
+		}
+		else if (::IsModelToken(pstrToken, nLength, "</Hierarchy>"))
+		{
+			break;
+		}
+	}
+
+	bool bCooked = xCooker.Write(pstrCookedFileName, nSourceHash, xSourceFile.GetSize(), nSourceWriteTime);
+	if (!bCooked)
+	{
+		::PrintCookMessage(stderr, "Cook: cannot write %s\n", pstrCookedFileName);
+		return(false);
+	}
+	::PrintCookMessage(stdout, "Cook: %s -> %s done\n", pstrFileName, pstrCookedFileName);
+
+	MESHOPTIMIZESTATS *pStats = &xCooker.m_OptimizeStats;
+	::PrintCookMessage(stdout, "Cook: %d meshes, %d triangles, vertices %d -> %d, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", pStats->m_nMeshes, pStats->m_nTriangles, pStats->m_nVerticesBefore, pStats->m_nVerticesAfter, pStats->GetACMRBefore(), pStats->GetACMRAfter(), pStats->GetATVRBefore(), pStats->GetATVRAfter());
+
+	MESHCLUSTERSTATS *pClusterStats = &xCooker.m_ClusterStats;
+	::PrintCookMessage(stdout, "Cook: %d clusters, %.1f triangles and %.1f vertices per cluster, %d with a usable cone\n", pClusterStats->m_nClusters, pClusterStats->GetAverageTriangles(), pClusterStats->GetAverageVertices(), pClusterStats->m_nConeClusters);
+
+	MESHLODSTATS *pLodStats = &xCooker.m_LodStats;
+	for (int l = 1; l < MESH_MAX_LODS; l++)
+	{
+		::PrintCookMessage(stdout, "Cook: LOD %d, %d triangles (%.0f%%), max error %.4f of the AABB diagonal\n", l, pLodStats->m_pnTriangles[l], (pLodStats->m_pnTriangles[0] > 0) ? (100.0f * pLodStats->m_pnTriangles[l] / pLodStats->m_pnTriangles[0]) : 0.0f, pLodStats->m_pfMaxErrors[l]);
+	}
+
+	return(bCooked);
+}
+
+int CookModelFiles(int nFiles, wchar_t **ppstrFileNames)
+{
+	int nFailures = 0, nModels = 0;
+	bool bForce = false;
+	for (int i = 0; i < nFiles; i++)
+	{
+		if (!wcscmp(ppstrFileNames[i], L"/force"))
+		{
+			bForce = true;
+			continue;
+		}
+
+		char pstrFileName[256] = { '\0' };
+		size_t nConverted = 0;
+		::wcstombs_s(&nConverted, pstrFileName, 256, ppstrFileNames[i], _TRUNCATE);
+		if (!::CookModelFile(pstrFileName, bForce)) nFailures++;
+		nModels++;
+	}
+	if (nModels == 0)
+	{
+		::PrintCookMessage(stderr, "Usage: LabProject07-9-1.exe /cook [/force] Model/Apache.bin ...\n");
+		return(1);
+	}
+	return(nFailures);
+}
@@ -0,0 +1,738 @@
+//-----------------------------------------------------------------------------
+// File: ModelFile.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "ModelFile.h"
+#include "Object.h"
+#include "MeshCluster.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+bool CMappedModelFile::Open(char *pstrFileName)
+{
+	Close();
+
+	m_hFile = ::CreateFileA(pstrFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE) return(false);
+
+	LARGE_INTEGER nFileSize;
+	if (!::GetFileSizeEx(m_hFile, &nFileSize) || (nFileSize.QuadPart == 0))
+	{
+		Close();
+		return(false);
+	}
+	m_nSize = (UINT64)nFileSize.QuadPart;
+
+	m_hFileMapping = ::CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_hFileMapping) m_pData = (BYTE *)::MapViewOfFile(m_hFileMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m_pData)
+	{
+		Close();
+		return(false);
+	}
+
+	return(true);
+}
+
+void CMappedModelFile::Close()
+{
+	if (m_pData) ::UnmapViewOfFile(m_pData);
+	if (m_hFileMapping) ::CloseHandle(m_hFileMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE) ::CloseHandle(m_hFile);
+
+	m_pData = NULL;
+	m_hFileMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_nSize = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+void *CModelStreamReader::ReadArray(UINT64 nBytes)
+{
+	if (m_bError || (nBytes > m_nSize - m_nOffset))
+	{
+		m_bError = true;
+		return(NULL);
+	}
+	void *pArray = m_pData + m_nOffset;
+	m_nOffset += nBytes;
+
+	return(pArray);
+}
+
+int CModelStreamReader::ReadInteger()
+{
+	int nValue = 0;
+	void *pValue = ReadArray(sizeof(int));
+	if (pValue) memcpy(&nValue, pValue, sizeof(int));
+
+	return(nValue);
+}
+
+float CModelStreamReader::ReadFloat()
+{
+	float fValue = 0.0f;
+	void *pValue = ReadArray(sizeof(float));
+	if (pValue) memcpy(&fValue, pValue, sizeof(float));
+
+	return(fValue);
+}
+
+BYTE CModelStreamReader::ReadToken(char **ppstrToken)
+{
+	BYTE *pnLength = (BYTE *)ReadArray(sizeof(BYTE));
+	BYTE nLength = (pnLength) ? *pnLength : 0;
+	*ppstrToken = (char *)ReadArray(nLength);
+	if (!*ppstrToken) nLength = 0;
+
+	m_Stats.m_nTags++;
+
+	return(nLength);
+}
+
+void CModelStreamReader::ReadString(char *pstrBuffer, int nBufferSize)
+{
+	char *pstrToken = NULL;
+	int nLength = ReadToken(&pstrToken);
+	if (nLength > nBufferSize - 1) nLength = nBufferSize - 1;
+	if (nLength > 0) memcpy(pstrBuffer, pstrToken, nLength);
+	pstrBuffer[nLength] = '\0';
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//The arrays are left pointing into the mapping (m_bMappedArrays), so the view must stay open until the
+//mesh buffers are created. The tag stream has no alignment padding; the pointers are only 1-byte aligned,
+//which is fine for the memcpy into the upload heap.
+CMeshLoadInfo *LoadMappedMeshInfo(CModelStreamReader *pReader)
+{
+	char *pstrToken = NULL;
+	BYTE nLength = 0;
+
+	CMeshLoadInfo *pMeshInfo = new CMeshLoadInfo;
+	pMeshInfo->m_bMappedArrays = true;
+	pReader->m_Stats.m_nAllocations++;
+	pReader->m_Stats.m_nMeshes++;
+
+	pMeshInfo->m_nVertices = pReader->ReadInteger();
+	pReader->ReadString(pMeshInfo->m_pstrMeshName, sizeof(pMeshInfo->m_pstrMeshName));
+
+	while (pReader->IsValid())
+	{
+		nLength = pReader->ReadToken(&pstrToken);
+
+		if (::IsModelToken(pstrToken, nLength, "<Bounds>:"))
+		{
+			void *pBounds = pReader->ReadArray(sizeof(XMFLOAT3) * 2);
+			if (pBounds)
+			{
+				memcpy(&pMeshInfo->m_xmf3AABBCenter, pBounds, sizeof(XMFLOAT3));
+				memcpy(&pMeshInfo->m_xmf3AABBExtents, (BYTE *)pBounds + sizeof(XMFLOAT3), sizeof(XMFLOAT3));
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Positions>:"))
+		{
+			int nPositions = pReader->ReadInteger();
+			if (nPositions > 0)
+			{
+				pMeshInfo->m_nType |= VERTEXT_POSITION;
+				pMeshInfo->m_pxmf3Positions = (XMFLOAT3 *)pReader->ReadArray(sizeof(XMFLOAT3) * (UINT64)nPositions);
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Colors>:"))
+		{
+			int nColors = pReader->ReadInteger();
+			if (nColors > 0)
+			{
+				pMeshInfo->m_nType |= VERTEXT_COLOR;
+				pMeshInfo->m_pxmf4Colors = (XMFLOAT4 *)pReader->ReadArray(sizeof(XMFLOAT4) * (UINT64)nColors);
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Normals>:"))
+		{
+			int nNormals = pReader->ReadInteger();
+			if (nNormals > 0)
+			{
+				pMeshInfo->m_nType |= VERTEXT_NORMAL;
+				pMeshInfo->m_pxmf3Normals = (XMFLOAT3 *)pReader->ReadArray(sizeof(XMFLOAT3) * (UINT64)nNormals);
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<TexCoords>:"))
+		{
+			int nUVs = pReader->ReadInteger();
+			if (nUVs > 0)
+			{
+				pMeshInfo->m_nType |= VERTEXT_UV;
+				pMeshInfo->m_pxmf2TexCoords = (XMFLOAT2 *)pReader->ReadArray(sizeof(XMFLOAT2) * (UINT64)nUVs);
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Indices>:"))
+		{
+			pMeshInfo->m_nIndices = pReader->ReadInteger();
+			if (pMeshInfo->m_nIndices > 0) pMeshInfo->m_pnIndices = (UINT *)pReader->ReadArray(sizeof(UINT) * (UINT64)pMeshInfo->m_nIndices);
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<SubMeshes>:"))
+		{
+			pMeshInfo->m_nSubMeshes = pReader->ReadInteger();
+			if (pMeshInfo->m_nSubMeshes > 0)
+			{
+				pMeshInfo->m_pnSubSetIndices = new int[pMeshInfo->m_nSubMeshes];
+				pMeshInfo->m_ppnSubSetIndices = new UINT*[pMeshInfo->m_nSubMeshes];
+				pReader->m_Stats.m_nAllocations += 2;
+				for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++)
+				{
+					pMeshInfo->m_pnSubSetIndices[i] = 0;
+					pMeshInfo->m_ppnSubSetIndices[i] = NULL;
+
+					nLength = pReader->ReadToken(&pstrToken);
+					if (::IsModelToken(pstrToken, nLength, "<SubMesh>:"))
+					{
+						int nIndex = pReader->ReadInteger();
+						pMeshInfo->m_pnSubSetIndices[i] = pReader->ReadInteger();
+						if (pMeshInfo->m_pnSubSetIndices[i] > 0) pMeshInfo->m_ppnSubSetIndices[i] = (UINT *)pReader->ReadArray(sizeof(UINT) * (UINT64)pMeshInfo->m_pnSubSetIndices[i]);
+					}
+				}
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "</Mesh>"))
+		{
+			break;
+		}
+	}
+
+	return(pMeshInfo);
+}
+
+MATERIALSLOADINFO *LoadMappedMaterialsInfo(CModelStreamReader *pReader)
+{
+	char *pstrToken = NULL;
+	BYTE nLength = 0;
+
+	int nMaterial = 0;
+
+	MATERIALSLOADINFO *pMaterialsInfo = new MATERIALSLOADINFO;
+
+	pMaterialsInfo->m_nMaterials = pReader->ReadInteger();
+	pMaterialsInfo->m_pMaterials = new MATERIALLOADINFO[(pMaterialsInfo->m_nMaterials > 0) ? pMaterialsInfo->m_nMaterials : 1];
+	pReader->m_Stats.m_nAllocations += 2;
+
+	while (pReader->IsValid())
+	{
+		nLength = pReader->ReadToken(&pstrToken);
+
+		if (::IsModelToken(pstrToken, nLength, "<Material>:"))
+		{
+			nMaterial = pReader->ReadInteger();
+			if ((nMaterial < 0) || (nMaterial >= pMaterialsInfo->m_nMaterials)) nMaterial = 0;
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<AlbedoColor>:"))
+		{
+			void *pColor = pReader->ReadArray(sizeof(XMFLOAT4));
+			if (pColor) memcpy(&pMaterialsInfo->m_pMaterials[nMaterial].m_xmf4AlbedoColor, pColor, sizeof(XMFLOAT4));
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<EmissiveColor>:"))
+		{
+			void *pColor = pReader->ReadArray(sizeof(XMFLOAT4));
+			if (pColor) memcpy(&pMaterialsInfo->m_pMaterials[nMaterial].m_xmf4EmissiveColor, pColor, sizeof(XMFLOAT4));
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<SpecularColor>:"))
+		{
+			void *pColor = pReader->ReadArray(sizeof(XMFLOAT4));
+			if (pColor) memcpy(&pMaterialsInfo->m_pMaterials[nMaterial].m_xmf4SpecularColor, pColor, sizeof(XMFLOAT4));
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Glossiness>:"))
+		{
+			pMaterialsInfo->m_pMaterials[nMaterial].m_fGlossiness = pReader->ReadFloat();
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Smoothness>:"))
+		{
+			pMaterialsInfo->m_pMaterials[nMaterial].m_fSmoothness = pReader->ReadFloat();
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Metallic>:"))
+		{
+			pMaterialsInfo->m_pMaterials[nMaterial].m_fSpecularHighlight = pReader->ReadFloat();
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<SpecularHighlight>:"))
+		{
+			pMaterialsInfo->m_pMaterials[nMaterial].m_fMetallic = pReader->ReadFloat();
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<GlossyReflection>:"))
+		{
+			pMaterialsInfo->m_pMaterials[nMaterial].m_fGlossyReflection = pReader->ReadFloat();
+		}
+		else if (::IsModelToken(pstrToken, nLength, "</Materials>"))
+		{
+			break;
+		}
+	}
+
+	return(pMaterialsInfo);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+UINT64 HashModelBytes(BYTE *pData, UINT64 nSize)
+{
+	UINT64 nHash = 0xcbf29ce484222325ULL; //FNV-1a
+	for (UINT64 i = 0; i < nSize; i++)
+	{
+		nHash ^= pData[i];
+		nHash *= 0x100000001b3ULL;
+	}
+	return(nHash);
+}
+
+UINT HashFrameName(char *pstrFrameName)
+{
+	UINT nHash = 0x811c9dc5; //FNV-1a
+	for (BYTE *pc = (BYTE *)pstrFrameName; *pc; pc++)
+	{
+		nHash ^= *pc;
+		nHash *= 0x01000193;
+	}
+	return(nHash);
+}
+
+bool GetModelFileInfo(char *pstrFileName, UINT64 *pnSize, UINT64 *pnWriteTime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA xFileData;
+	if (!::GetFileAttributesExA(pstrFileName, GetFileExInfoStandard, &xFileData) || (xFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) return(false);
+
+	*pnSize = (UINT64(xFileData.nFileSizeHigh) << 32) | xFileData.nFileSizeLow;
+	*pnWriteTime = (UINT64(xFileData.ftLastWriteTime.dwHighDateTime) << 32) | xFileData.ftLastWriteTime.dwLowDateTime;
+	return(true);
+}
+
+void GetCookedModelFileName(char *pstrFileName, char *pstrCookedFileName, int nBufferSize)
+{
+	strcpy_s(pstrCookedFileName, nBufferSize, pstrFileName);
+	char *pstrExtension = strrchr(pstrCookedFileName, '.');
+	char *pstrSeparator = strrchr(pstrCookedFileName, '/');
+	if (pstrExtension && (!pstrSeparator || (pstrExtension > pstrSeparator))) *pstrExtension = '\0';
+	strcat_s(pstrCookedFileName, nBufferSize, ".cmdl");
+}
+
+bool CCookedModelFile::Open(char *pstrFileName)
+{
+	Close();
+	if (!m_MappedFile.Open(pstrFileName)) return(false);
+
+	m_pHeader = (COOKEDMODELHEADER *)m_MappedFile.GetData();
+	if ((m_MappedFile.GetSize() < sizeof(COOKEDMODELHEADER)) || (m_pHeader->m_nMagic != COOKED_MODEL_MAGIC) || (m_pHeader->m_nVersion != COOKED_MODEL_VERSION) || (m_pHeader->m_nFileSize != m_MappedFile.GetSize()) || !IsValid())
+	{
+		Close();
+		return(false);
+	}
+
+	return(true);
+}
+
+//[nOffset, nOffset + nBytes) inside nSize bytes, without overflowing
+static bool IsCookedRange(UINT64 nOffset, UINT64 nCount, UINT64 nStride, UINT64 nSize)
+{
+	if (nOffset > nSize) return(false);
+	return((nStride == 0) || (nCount <= (nSize - nOffset) / nStride));
+}
+
+bool CCookedModelFile::IsBlobRange(UINT64 nOffset, int nCount, UINT64 nStride, bool bRequired)
+{
+	if (nOffset == UINT64(-1)) return(!bRequired || (nCount == 0));
+	if ((nCount < 0) || (nOffset % COOKED_MODEL_ALIGNMENT)) return(false);
+	return(::IsCookedRange(nOffset, UINT64(nCount), nStride, m_pHeader->m_nFileSize - m_pHeader->m_nBlobOffset));
+}
+
+bool CCookedModelFile::IsValid()
+{
+	UINT64 nFileSize = m_pHeader->m_nFileSize;
+	if (!::IsCookedRange(m_pHeader->m_nFrameTableOffset, m_pHeader->m_nFrames, sizeof(COOKEDFRAME), nFileSize)) return(false);
+	if (!::IsCookedRange(m_pHeader->m_nMeshTableOffset, m_pHeader->m_nMeshes, sizeof(COOKEDMESH), nFileSize)) return(false);
+	if (!::IsCookedRange(m_pHeader->m_nSubMeshTableOffset, m_pHeader->m_nSubMeshes, sizeof(COOKEDSUBMESH), nFileSize)) return(false);
+	if (!::IsCookedRange(m_pHeader->m_nMaterialTableOffset, m_pHeader->m_nMaterials, sizeof(COOKEDMATERIAL), nFileSize)) return(false);
+	if ((m_pHeader->m_nBlobOffset > nFileSize) || (m_pHeader->m_nBlobOffset % COOKED_MODEL_ALIGNMENT)) return(false);
+	//The tables are read in place
+	if ((m_pHeader->m_nFrameTableOffset | m_pHeader->m_nMeshTableOffset | m_pHeader->m_nSubMeshTableOffset | m_pHeader->m_nMaterialTableOffset) % 8) return(false);
+
+	for (UINT i = 0; i < m_pHeader->m_nSubMeshes; i++)
+	{
+		COOKEDSUBMESH *pCookedSubMesh = GetSubMesh(int(i));
+		if (!IsBlobRange(pCookedSubMesh->m_nIndexArray, pCookedSubMesh->m_nIndices, sizeof(UINT), true)) return(false);
+		if (!IsBlobRange(pCookedSubMesh->m_nClusterArray, pCookedSubMesh->m_nClusters, sizeof(MESHCLUSTER), true)) return(false);
+		//The culler draws m_nIndices from m_nIndexStart of the submesh's index range
+		MESHCLUSTER *pClusters = (MESHCLUSTER *)GetBlob(pCookedSubMesh->m_nClusterArray);
+		UINT nIndices = UINT(pCookedSubMesh->m_nIndices);
+		for (int j = 0; j < pCookedSubMesh->m_nClusters; j++)
+		{
+			if ((pClusters[j].m_nIndexStart > nIndices) || (pClusters[j].m_nIndices > nIndices - pClusters[j].m_nIndexStart)) return(false);
+		}
+	}
+
+	for (UINT i = 0; i < m_pHeader->m_nMeshes; i++)
+	{
+		COOKEDMESH *pCookedMesh = GetMesh(int(i));
+		if (!memchr(pCookedMesh->m_pstrMeshName, '\0', sizeof(pCookedMesh->m_pstrMeshName))) return(false);
+		//A vertex array may be missing only when m_nType does not ask for it
+		UINT nType = pCookedMesh->m_nType;
+		if (!IsBlobRange(pCookedMesh->m_nPositions, pCookedMesh->m_nVertices, sizeof(XMFLOAT3), (nType & VERTEXT_POSITION) != 0)) return(false);
+		if (!IsBlobRange(pCookedMesh->m_nColors, pCookedMesh->m_nVertices, sizeof(XMFLOAT4), (nType & VERTEXT_COLOR) != 0)) return(false);
+		if (!IsBlobRange(pCookedMesh->m_nNormals, pCookedMesh->m_nVertices, sizeof(XMFLOAT3), (nType & VERTEXT_NORMAL) != 0)) return(false);
+		if (!IsBlobRange(pCookedMesh->m_nTexCoords, pCookedMesh->m_nVertices, sizeof(XMFLOAT2), (nType & VERTEXT_UV) != 0)) return(false);
+		if (!IsBlobRange(pCookedMesh->m_nIndexArray, pCookedMesh->m_nIndices, sizeof(UINT), true)) return(false);
+
+		//m_nSubMeshes * m_nLods entries of the submesh table (CreateMeshInfo)
+		if ((pCookedMesh->m_nSubMeshes < 0) || (pCookedMesh->m_nLods < 0) || (pCookedMesh->m_nLods > MESH_MAX_LODS)) return(false);
+		if (pCookedMesh->m_nSubMeshes > 0)
+		{
+			if ((pCookedMesh->m_nFirstSubMesh < 0) || !::IsCookedRange(UINT64(pCookedMesh->m_nFirstSubMesh), UINT64(pCookedMesh->m_nSubMeshes) * max(pCookedMesh->m_nLods, 1), 1, m_pHeader->m_nSubMeshes)) return(false);
+		}
+	}
+
+	//Every frame reached by the depth-first walk of LoadFrameHierarchyFromFile from frame 0 is in the table
+	UINT nPending = 1;
+	for (UINT i = 0; (i < m_pHeader->m_nFrames) && (nPending > 0); i++)
+	{
+		COOKEDFRAME *pCookedFrame = GetFrame(int(i));
+		if (!memchr(pCookedFrame->m_pstrFrameName, '\0', sizeof(pCookedFrame->m_pstrFrameName))) return(false);
+		if ((pCookedFrame->m_nMesh < -1) || (pCookedFrame->m_nMesh >= int(m_pHeader->m_nMeshes))) return(false);
+		if ((pCookedFrame->m_nMaterials > 0) && ((pCookedFrame->m_nFirstMaterial < 0) || !::IsCookedRange(UINT64(pCookedFrame->m_nFirstMaterial), UINT64(pCookedFrame->m_nMaterials), 1, m_pHeader->m_nMaterials))) return(false);
+		if ((pCookedFrame->m_nChildren < 0) || (UINT(pCookedFrame->m_nChildren) > m_pHeader->m_nFrames)) return(false);
+		nPending += UINT(pCookedFrame->m_nChildren) - 1;
+	}
+	return((m_pHeader->m_nFrames == 0) || (nPending == 0));
+}
+
+bool CCookedModelFile::IsCookedFrom(char *pstrSourceFileName)
+{
+	UINT64 nSourceSize = 0, nSourceWriteTime = 0;
+	if (!::GetModelFileInfo(pstrSourceFileName, &nSourceSize, &nSourceWriteTime)) return(true);
+
+	return((nSourceSize == m_pHeader->m_nSourceSize) && (nSourceWriteTime == m_pHeader->m_nSourceWriteTime));
+}
+
+//Pointer fixup only: every array of the returned CMeshLoadInfo lives in the mapping
+CMeshLoadInfo *CCookedModelFile::CreateMeshInfo(int nMesh)
+{
+	COOKEDMESH *pCookedMesh = GetMesh(nMesh);
+
+	CMeshLoadInfo *pMeshInfo = new CMeshLoadInfo;
+	pMeshInfo->m_bMappedArrays = true;
+
+	strcpy_s(pMeshInfo->m_pstrMeshName, sizeof(pMeshInfo->m_pstrMeshName), pCookedMesh->m_pstrMeshName);
+	pMeshInfo->m_nType = pCookedMesh->m_nType;
+	pMeshInfo->m_xmf3AABBCenter = pCookedMesh->m_xmf3AABBCenter;
+	pMeshInfo->m_xmf3AABBExtents = pCookedMesh->m_xmf3AABBExtents;
+
+	pMeshInfo->m_nVertices = pCookedMesh->m_nVertices;
+	pMeshInfo->m_pxmf3Positions = (XMFLOAT3 *)GetBlob(pCookedMesh->m_nPositions);
+	pMeshInfo->m_pxmf4Colors = (XMFLOAT4 *)GetBlob(pCookedMesh->m_nColors);
+	pMeshInfo->m_pxmf3Normals = (XMFLOAT3 *)GetBlob(pCookedMesh->m_nNormals);
+	pMeshInfo->m_pxmf2TexCoords = (XMFLOAT2 *)GetBlob(pCookedMesh->m_nTexCoords);
+
+	pMeshInfo->m_nIndices = pCookedMesh->m_nIndices;
+	pMeshInfo->m_pnIndices = (UINT *)GetBlob(pCookedMesh->m_nIndexArray);
+
+	pMeshInfo->m_nSubMeshes = pCookedMesh->m_nSubMeshes;
+	if (pMeshInfo->m_nSubMeshes > 0)
+	{
+		pMeshInfo->m_pnSubSetIndices = new int[pMeshInfo->m_nSubMeshes];
+		pMeshInfo->m_ppnSubSetIndices = new UINT*[pMeshInfo->m_nSubMeshes];
+		for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++)
+		{
+			COOKEDSUBMESH *pCookedSubMesh = GetSubMesh(pCookedMesh->m_nFirstSubMesh + i);
+			pMeshInfo->m_pnSubSetIndices[i] = pCookedSubMesh->m_nIndices;
+			pMeshInfo->m_ppnSubSetIndices[i] = (UINT *)GetBlob(pCookedSubMesh->m_nIndexArray);
+		}
+
+		pMeshInfo->m_nLods = pCookedMesh->m_nLods;
+		for (int l = 0; l < pCookedMesh->m_nLods; l++) pMeshInfo->m_pfLodErrors[l] = pCookedMesh->m_pfLodErrors[l];
+		if (pMeshInfo->m_nLods > 1)
+		{
+			int nLodSubMeshes = (pMeshInfo->m_nLods - 1) * pMeshInfo->m_nSubMeshes;
+			pMeshInfo->m_pnLodSubSetIndices = new int[nLodSubMeshes];
+			pMeshInfo->m_ppnLodSubSetIndices = new UINT*[nLodSubMeshes];
+			for (int i = 0; i < nLodSubMeshes; i++)
+			{
+				COOKEDSUBMESH *pCookedSubMesh = GetSubMesh(pCookedMesh->m_nFirstSubMesh + pMeshInfo->m_nSubMeshes + i);
+				pMeshInfo->m_pnLodSubSetIndices[i] = pCookedSubMesh->m_nIndices;
+				pMeshInfo->m_ppnLodSubSetIndices[i] = (UINT *)GetBlob(pCookedSubMesh->m_nIndexArray);
+			}
+		}
+
+		//Same level-major order as the submesh table
+		int nRanges = pMeshInfo->m_nLods * pMeshInfo->m_nSubMeshes, nClusters = 0;
+		for (int i = 0; i < nRanges; i++) nClusters += GetSubMesh(pCookedMesh->m_nFirstSubMesh + i)->m_nClusters;
+		if (nClusters > 0)
+		{
+			pMeshInfo->m_pnSubSetClusters = new int[nRanges];
+			pMeshInfo->m_ppSubSetClusters = new MESHCLUSTER*[nRanges];
+			for (int i = 0; i < nRanges; i++)
+			{
+				COOKEDSUBMESH *pCookedSubMesh = GetSubMesh(pCookedMesh->m_nFirstSubMesh + i);
+				pMeshInfo->m_pnSubSetClusters[i] = pCookedSubMesh->m_nClusters;
+				pMeshInfo->m_ppSubSetClusters[i] = (MESHCLUSTER *)GetBlob(pCookedSubMesh->m_nClusterArray);
+			}
+		}
+	}
+
+	return(pMeshInfo);
+}
+
+MATERIALSLOADINFO *CCookedModelFile::CreateMaterialsInfo(int nFrame)
+{
+	COOKEDFRAME *pCookedFrame = GetFrame(nFrame);
+	if (pCookedFrame->m_nMaterials <= 0) return(NULL);
+
+	MATERIALSLOADINFO *pMaterialsInfo = new MATERIALSLOADINFO;
+	pMaterialsInfo->m_nMaterials = pCookedFrame->m_nMaterials;
+	pMaterialsInfo->m_pMaterials = new MATERIALLOADINFO[pCookedFrame->m_nMaterials];
+	for (int i = 0; i < pCookedFrame->m_nMaterials; i++)
+	{
+		COOKEDMATERIAL *pCookedMaterial = GetMaterial(pCookedFrame->m_nFirstMaterial + i);
+		MATERIALLOADINFO *pMaterial = &pMaterialsInfo->m_pMaterials[i];
+		pMaterial->m_xmf4AlbedoColor = pCookedMaterial->m_xmf4AlbedoColor;
+		pMaterial->m_xmf4EmissiveColor = pCookedMaterial->m_xmf4EmissiveColor;
+		pMaterial->m_xmf4SpecularColor = pCookedMaterial->m_xmf4SpecularColor;
+		pMaterial->m_fGlossiness = pCookedMaterial->m_fGlossiness;
+		pMaterial->m_fSmoothness = pCookedMaterial->m_fSmoothness;
+		pMaterial->m_fSpecularHighlight = pCookedMaterial->m_fSpecularHighlight;
+		pMaterial->m_fMetallic = pCookedMaterial->m_fMetallic;
+		pMaterial->m_fGlossyReflection = pCookedMaterial->m_fGlossyReflection;
+		pMaterial->m_nType = pCookedMaterial->m_nType;
+	}
+
+	return(pMaterialsInfo);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+static void WalkMappedHierarchy(CModelStreamReader *pReader, PFNMODELMESHCALLBACK pfnMeshCallback, void *pContext)
+{
+	char *pstrToken = NULL;
+	BYTE nLength = 0;
+
+	while (pReader->IsValid())
+	{
+		nLength = pReader->ReadToken(&pstrToken);
+		if (::IsModelToken(pstrToken, nLength, "<Frame>:"))
+		{
+			char pstrFrameName[64];
+			pReader->m_Stats.m_nFrames++;
+			pReader->m_Stats.m_nAllocations++;
+			pReader->ReadInteger();
+			pReader->ReadString(pstrFrameName, sizeof(pstrFrameName));
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Transform>:"))
+		{
+			pReader->ReadArray(sizeof(float) * 13);
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<TransformMatrix>:"))
+		{
+			pReader->ReadArray(sizeof(float) * 16);
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Mesh>:"))
+		{
+			CMeshLoadInfo *pMeshInfo = ::LoadMappedMeshInfo(pReader);
+			if (pfnMeshCallback) pfnMeshCallback(pMeshInfo, pContext);
+			delete pMeshInfo;
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Materials>:"))
+		{
+			MATERIALSLOADINFO *pMaterialsInfo = ::LoadMappedMaterialsInfo(pReader);
+			delete[] pMaterialsInfo->m_pMaterials;
+			delete pMaterialsInfo;
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Children>:"))
+		{
+			pReader->ReadInteger();
+		}
+		else if (::IsModelToken(pstrToken, nLength, "</Hierarchy>"))
+		{
+			break;
+		}
+	}
+}
+
+int EnumerateModelMeshes(char *pstrFileName, PFNMODELMESHCALLBACK pfnMeshCallback, void *pContext)
+{
+	CMappedModelFile xModelFile;
+	if (!xModelFile.Open(pstrFileName)) return(0);
+
+	CModelStreamReader xReader(xModelFile.GetData(), xModelFile.GetSize());
+	::WalkMappedHierarchy(&xReader, pfnMeshCallback, pContext);
+
+	return(xReader.m_Stats.m_nMeshes);
+}
+
+#ifdef _WITH_MODEL_PARSE_BENCHMARK
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//Parse-only walks of both loaders; no device objects are created so the numbers are pure file parsing.
+extern int ReadIntegerFromFile(FILE *pInFile);
+extern BYTE ReadStringFromFile(FILE *pInFile, char *pstrToken);
+
+static int CountMeshInfoAllocations(CMeshLoadInfo *pMeshInfo)
+{
+	int nAllocations = 1;
+	if (pMeshInfo->m_pxmf3Positions) nAllocations++;
+	if (pMeshInfo->m_pxmf4Colors) nAllocations++;
+	if (pMeshInfo->m_pxmf3Normals) nAllocations++;
+	if (pMeshInfo->m_pxmf2TexCoords) nAllocations++;
+	if (pMeshInfo->m_pnIndices) nAllocations++;
+	if (pMeshInfo->m_nSubMeshes > 0) nAllocations += 2;
+	for (int i = 0; i < pMeshInfo->m_nSubMeshes; i++) if (pMeshInfo->m_ppnSubSetIndices[i]) nAllocations++;
+
+	return(nAllocations);
+}
+
+static void WalkStreamHierarchy(FILE *pInFile, MODELPARSESTATS *pStats)
+{
+	char pstrToken[256] = { '\0' };
+
+	while (::ReadStringFromFile(pInFile, pstrToken) && !::feof(pInFile))
+	{
+		pStats->m_nTags++;
+		if (!strcmp(pstrToken, "<Frame>:"))
+		{
+			pStats->m_nFrames++;
+			pStats->m_nAllocations++;
+			::ReadIntegerFromFile(pInFile);
+			::ReadStringFromFile(pInFile, pstrToken);
+		}
+		else if (!strcmp(pstrToken, "<Transform>:"))
+		{
+			::fseek(pInFile, sizeof(float) * 13, SEEK_CUR);
+		}
+		else if (!strcmp(pstrToken, "<TransformMatrix>:"))
+		{
+			::fseek(pInFile, sizeof(float) * 16, SEEK_CUR);
+		}
+		else if (!strcmp(pstrToken, "<Mesh>:"))
+		{
+			CMeshLoadInfo *pMeshInfo = CGameObject::LoadMeshInfoFromFile(pInFile);
+			pStats->m_nMeshes++;
+			pStats->m_nAllocations += ::CountMeshInfoAllocations(pMeshInfo);
+			delete pMeshInfo;
+		}
+		else if (!strcmp(pstrToken, "<Materials>:"))
+		{
+			MATERIALSLOADINFO *pMaterialsInfo = CGameObject::LoadMaterialsInfoFromFile(NULL, NULL, pInFile);
+			pStats->m_nAllocations += 2;
+			delete[] pMaterialsInfo->m_pMaterials;
+			delete pMaterialsInfo;
+		}
+		else if (!strcmp(pstrToken, "<Children>:"))
+		{
+			::ReadIntegerFromFile(pInFile);
+		}
+		else if (!strcmp(pstrToken, "</Hierarchy>"))
+		{
+			break;
+		}
+	}
+}
+
+static void WalkCookedHierarchy(CCookedModelFile *pCookedFile, MODELPARSESTATS *pStats)
+{
+	COOKEDMODELHEADER *pHeader = pCookedFile->GetHeader();
+	for (UINT i = 0; i < pHeader->m_nFrames; i++)
+	{
+		COOKEDFRAME *pCookedFrame = pCookedFile->GetFrame(i);
+		pStats->m_nFrames++;
+		pStats->m_nAllocations++;
+		if (pCookedFrame->m_nMesh >= 0)
+		{
+			CMeshLoadInfo *pMeshInfo = pCookedFile->CreateMeshInfo(pCookedFrame->m_nMesh);
+			pStats->m_nMeshes++;
+			pStats->m_nAllocations += ((pMeshInfo->m_nSubMeshes > 0) ? 3 : 1) + ((pMeshInfo->m_nLods > 1) ? 2 : 0) + ((pMeshInfo->m_ppSubSetClusters) ? 2 : 0);
+			delete pMeshInfo;
+		}
+		MATERIALSLOADINFO *pMaterialsInfo = pCookedFile->CreateMaterialsInfo(i);
+		if (pMaterialsInfo)
+		{
+			pStats->m_nAllocations += 2;
+			delete[] pMaterialsInfo->m_pMaterials;
+			delete pMaterialsInfo;
+		}
+	}
+}
+
+int BenchmarkModelParsing(char **ppstrFileNames, int nFiles, int nRepeats)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	int nFailures = 0;
+	TCHAR pstrDebug[256] = { 0 };
+	for (int i = 0; i < nFiles; i++)
+	{
+		MODELPARSESTATS xStreamStats, xMappedStats;
+
+		::QueryPerformanceCounter(&nBegin);
+		for (int j = 0; j < nRepeats; j++)
+		{
+			FILE *pInFile = NULL;
+			if (::fopen_s(&pInFile, ppstrFileNames[i], "rb") || !pInFile) break;
+
+			::fseek(pInFile, 0, SEEK_END);
+			xStreamStats.m_nBytes += (UINT64)::ftell(pInFile);
+			::rewind(pInFile);
+
+			::WalkStreamHierarchy(pInFile, &xStreamStats);
+			::fclose(pInFile);
+		}
+		::QueryPerformanceCounter(&nEnd);
+		xStreamStats.m_fSeconds = float(double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart));
+
+		::QueryPerformanceCounter(&nBegin);
+		for (int j = 0; j < nRepeats; j++)
+		{
+			CMappedModelFile xModelFile;
+			if (!xModelFile.Open(ppstrFileNames[i])) break;
+
+			CModelStreamReader xReader(xModelFile.GetData(), xModelFile.GetSize());
+			::WalkMappedHierarchy(&xReader, NULL, NULL);
+
+			xMappedStats.m_nBytes += xModelFile.GetSize();
+			xMappedStats.m_nTags += xReader.m_Stats.m_nTags;
+			xMappedStats.m_nFrames += xReader.m_Stats.m_nFrames;
+			xMappedStats.m_nMeshes += xReader.m_Stats.m_nMeshes;
+			xMappedStats.m_nAllocations += xReader.m_Stats.m_nAllocations;
+		}
+		::QueryPerformanceCounter(&nEnd);
+		xMappedStats.m_fSeconds = float(double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart));
+
+		//The cooked file is optional; run "/cook" first to include it. Its MB/s is measured against the source size.
+		MODELPARSESTATS xCookedStats;
+		char pstrCookedFileName[256] = { '\0' };
+		::GetCookedModelFileName(ppstrFileNames[i], pstrCookedFileName, 256);
+
+		::QueryPerformanceCounter(&nBegin);
+		for (int j = 0; j < nRepeats; j++)
+		{
+			CCookedModelFile xCookedFile;
+			if (!xCookedFile.Open(pstrCookedFileName)) break;
+
+			xCookedStats.m_nBytes += xCookedFile.GetHeader()->m_nSourceSize;
+			::WalkCookedHierarchy(&xCookedFile, &xCookedStats);
+		}
+		::QueryPerformanceCounter(&nEnd);
+		xCookedStats.m_fSeconds = float(double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart));
+
+		MODELPARSESTATS *ppStats[3] = { &xStreamStats, &xMappedStats, &xCookedStats };
+		const TCHAR *ppstrModes[3] = { _T("fread"), _T("mapped"), _T("cooked") };
+		for (int k = 0; k < ((xCookedStats.m_nBytes > 0) ? 3 : 2); k++)
+		{
+			double fMBytes = double(ppStats[k]->m_nBytes) / (1024.0 * 1024.0);
+			double fMBPerSecond = (ppStats[k]->m_fSeconds > 0.0f) ? (fMBytes / ppStats[k]->m_fSeconds) : 0.0;
+			_stprintf_s(pstrDebug, 256, _T("%hs [%s] %.1f MB/s, %d allocations/load, %d frames, %d meshes\n"), ppstrFileNames[i], ppstrModes[k], fMBPerSecond, ppStats[k]->m_nAllocations / nRepeats, ppStats[k]->m_nFrames / nRepeats, ppStats[k]->m_nMeshes / nRepeats);
+			OutputDebugString(pstrDebug);
+
+			//Every loader has to see the hierarchy the stream walk sees
+			if ((ppStats[k]->m_nBytes == 0) || (ppStats[k]->m_nFrames != xStreamStats.m_nFrames) || (ppStats[k]->m_nMeshes != xStreamStats.m_nMeshes)) nFailures++;
+		}
+	}
+
+	return(nFailures);
+}
+#endif
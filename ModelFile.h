@@ -0,0 +1,220 @@
+//-----------------------------------------------------------------------------
+// File: ModelFile.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Mesh.h"
+
+struct MATERIALSLOADINFO;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+struct MODELPARSESTATS
+{
+	UINT64							m_nBytes = 0;
+	int								m_nTags = 0;
+	int								m_nFrames = 0;
+	int								m_nMeshes = 0;
+	int								m_nAllocations = 0;
+	float							m_fSeconds = 0.0f;
+};
+
+//Read-only view of a whole model file (CreateFileMapping + MapViewOfFile)
+class CMappedModelFile
+{
+public:
+	CMappedModelFile() { }
+	~CMappedModelFile() { Close(); }
+
+private:
+	HANDLE							m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE							m_hFileMapping = NULL;
+	BYTE							*m_pData = NULL;
+	UINT64							m_nSize = 0;
+
+public:
+	bool Open(char *pstrFileName);
+	void Close();
+
+	BYTE *GetData() { return(m_pData); }
+	UINT64 GetSize() { return(m_nSize); }
+};
+
+//Cursor over the tag stream written by ExtractMeshByBinaryWithNormal.cs.
+//Tokens and arrays are returned as pointers into the mapping; nothing is copied.
+class CModelStreamReader
+{
+public:
+	CModelStreamReader(BYTE *pData, UINT64 nSize) { m_pData = pData; m_nSize = nSize; }
+
+private:
+	BYTE							*m_pData = NULL;
+	UINT64							m_nSize = 0;
+	UINT64							m_nOffset = 0;
+	bool							m_bError = false;
+
+public:
+	MODELPARSESTATS					m_Stats;
+
+	bool IsValid() { return(!m_bError && (m_nOffset < m_nSize)); }
+	UINT64 GetOffset() { return(m_nOffset); }
+
+	int ReadInteger();
+	float ReadFloat();
+	BYTE ReadToken(char **ppstrToken);
+	void ReadString(char *pstrBuffer, int nBufferSize);
+	void *ReadArray(UINT64 nBytes);
+};
+
+//Length check first, then memcmp: most tags are rejected without touching the string
+template <int N> inline bool IsModelToken(char *pstrToken, BYTE nLength, const char (&pstrTag)[N])
+{
+	return((nLength == (N - 1)) && !memcmp(pstrToken, pstrTag, N - 1));
+}
+
+CMeshLoadInfo *LoadMappedMeshInfo(CModelStreamReader *pReader);
+MATERIALSLOADINFO *LoadMappedMaterialsInfo(CModelStreamReader *pReader);
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//Cooked model (.cmdl): header, fixed-size tables, then a blob of 16-byte aligned arrays.
+//Frames are stored in the same depth-first order as the tag stream, so the hierarchy is rebuilt by
+//walking the table once with m_nChildren. Blob offsets are relative to m_nBlobOffset.
+#define COOKED_MODEL_MAGIC			0x4C444D43 //'CMDL'
+#define COOKED_MODEL_VERSION		6 //2: meshes are welded and reordered by MeshOptimizer at cook time, 3: LOD index sets, 4: clusters, 5: frame name hashes, 6: source write time
+#define COOKED_MODEL_ALIGNMENT		16
+
+struct COOKEDMODELHEADER
+{
+	UINT							m_nMagic;
+	UINT							m_nVersion;
+	UINT64							m_nSourceHash; //HashModelBytes of the source, compared by the cooker only
+	UINT64							m_nSourceSize;
+	UINT64							m_nSourceWriteTime; //FILETIME of the source's last write
+
+	UINT							m_nFrames;
+	UINT							m_nMeshes;
+	UINT							m_nSubMeshes;
+	UINT							m_nMaterials;
+
+	UINT64							m_nFrameTableOffset;
+	UINT64							m_nMeshTableOffset;
+	UINT64							m_nSubMeshTableOffset;
+	UINT64							m_nMaterialTableOffset;
+	UINT64							m_nBlobOffset;
+	UINT64							m_nFileSize;
+};
+
+struct COOKEDFRAME
+{
+	char							m_pstrFrameName[64];
+	XMFLOAT4X4						m_xmf4x4Transform;
+	int								m_nParent;
+	int								m_nChildren;
+	int								m_nMesh;
+	int								m_nFirstMaterial;
+	int								m_nMaterials;
+	UINT							m_nNameHash; //HashFrameName(m_pstrFrameName)
+	int								m_nReserved[2];
+};
+
+struct COOKEDMESH
+{
+	char							m_pstrMeshName[64];
+	UINT							m_nType;
+	int								m_nVertices;
+	XMFLOAT3						m_xmf3AABBCenter;
+	XMFLOAT3						m_xmf3AABBExtents;
+
+	UINT64							m_nPositions;
+	UINT64							m_nColors;
+	UINT64							m_nNormals;
+	UINT64							m_nTexCoords;
+
+	int								m_nIndices;
+	int								m_nSubMeshes;
+	UINT64							m_nIndexArray;
+	int								m_nFirstSubMesh; //m_nSubMeshes * m_nLods entries, level-major
+	int								m_nLods;
+	float							m_pfLodErrors[MESH_MAX_LODS];
+};
+
+struct COOKEDSUBMESH
+{
+	UINT64							m_nIndexArray;
+	int								m_nIndices;
+	int								m_nClusters;
+	UINT64							m_nClusterArray; //MESHCLUSTER[m_nClusters], the index array is stored cluster by cluster
+};
+
+struct COOKEDMATERIAL
+{
+	XMFLOAT4						m_xmf4AlbedoColor;
+	XMFLOAT4						m_xmf4EmissiveColor;
+	XMFLOAT4						m_xmf4SpecularColor;
+
+	float							m_fGlossiness;
+	float							m_fSmoothness;
+	float							m_fSpecularHighlight;
+	float							m_fMetallic;
+	float							m_fGlossyReflection;
+	UINT							m_nType;
+	UINT							m_nReserved[2];
+};
+
+class CCookedModelFile
+{
+public:
+	CCookedModelFile() { }
+	~CCookedModelFile() { Close(); }
+
+private:
+	CMappedModelFile				m_MappedFile;
+	COOKEDMODELHEADER				*m_pHeader = NULL;
+
+	void *GetBlob(UINT64 nOffset) { return((nOffset != UINT64(-1)) ? (m_MappedFile.GetData() + m_pHeader->m_nBlobOffset + nOffset) : NULL); }
+
+	//nCount elements of nStride bytes at nOffset of the blob; no array (-1) unless bRequired with elements
+	bool IsBlobRange(UINT64 nOffset, int nCount, UINT64 nStride, bool bRequired);
+	//Every table, blob array and cross reference of the header inside the file
+	bool IsValid();
+
+public:
+	//Fails on a file that is not a whole cooked model of COOKED_MODEL_VERSION
+	bool Open(char *pstrFileName);
+	//The source size and last write time of the header match pstrSourceFileName; nothing of the source is read. A missing
+	//source also passes: a build can ship the cooked files without the .bin files they were cooked from
+	bool IsCookedFrom(char *pstrSourceFileName);
+	void Close() { m_MappedFile.Close(); m_pHeader = NULL; }
+
+	COOKEDMODELHEADER *GetHeader() { return(m_pHeader); }
+	COOKEDFRAME *GetFrame(int nIndex) { return((COOKEDFRAME *)(m_MappedFile.GetData() + m_pHeader->m_nFrameTableOffset) + nIndex); }
+	COOKEDMESH *GetMesh(int nIndex) { return((COOKEDMESH *)(m_MappedFile.GetData() + m_pHeader->m_nMeshTableOffset) + nIndex); }
+	COOKEDSUBMESH *GetSubMesh(int nIndex) { return((COOKEDSUBMESH *)(m_MappedFile.GetData() + m_pHeader->m_nSubMeshTableOffset) + nIndex); }
+	COOKEDMATERIAL *GetMaterial(int nIndex) { return((COOKEDMATERIAL *)(m_MappedFile.GetData() + m_pHeader->m_nMaterialTableOffset) + nIndex); }
+
+	CMeshLoadInfo *CreateMeshInfo(int nMesh);
+	MATERIALSLOADINFO *CreateMaterialsInfo(int nFrame);
+};
+
+void GetCookedModelFileName(char *pstrFileName, char *pstrCookedFileName, int nBufferSize);
+//Size and last write time (FILETIME) from the directory entry; false if the file does not exist
+bool GetModelFileInfo(char *pstrFileName, UINT64 *pnSize, UINT64 *pnWriteTime);
+UINT64 HashModelBytes(BYTE *pData, UINT64 nSize);
+UINT HashFrameName(char *pstrFrameName);
+
+//Offline cooker (ModelCooker.cpp); run as "LabProject07-9-1.exe /cook Model/Apache.bin ..."
+bool CookModelFile(char *pstrFileName, bool bForce = false);
+//Messages go to stdout, errors to stderr; returns the number of models that failed (1 if no model is given)
+int CookModelFiles(int nFiles, wchar_t **ppstrFileNames);
+
+//Maps the file and hands every mesh to pfnMeshCallback in file order (arrays still point into the mapping);
+//used by the offline reports. Returns the number of meshes visited.
+typedef void (*PFNMODELMESHCALLBACK)(CMeshLoadInfo *pMeshInfo, void *pContext);
+int EnumerateModelMeshes(char *pstrFileName, PFNMODELMESHCALLBACK pfnMeshCallback, void *pContext);
+
+#ifdef _WITH_MODEL_PARSE_BENCHMARK
+//Returns the files that fail to load or whose loaders disagree on the frames and meshes
+int BenchmarkModelParsing(char **ppstrFileNames, int nFiles, int nRepeats);
+#endif
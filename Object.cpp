@@ -5,6 +5,17 @@
 #include "stdafx.h"
 #include "Object.h"
 #include "Shader.h"
+#include "ModelFile.h"
+#include "MeshOptimizer.h"
+#include "VertexPacking.h"
+#include "MeshSimplifier.h"
+#include "MeshCluster.h"
+#include "FrameIndex.h"
+#include "TransformHierarchy.h"
+#include "TerrainQuadtree.h"
+#include "TerrainTessellation.h"
+#include "TerrainGeomipmap.h"
+#include "ThreadPool.h"
 
 CTexture::CTexture(int nTextures, UINT nTextureType, int nSamplers)
 {
@@ -105,6 +116,7 @@ CMaterialColors::CMaterialColors(MATERIALLOADINFO *pMaterialInfo)
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
 CShader	*CMaterial::m_pIlluminatedShader = NULL;
+CShader	*CMaterial::m_pPackedIlluminatedShader = NULL;
 
 CMaterial::CMaterial()
 {
@@ -160,10 +172,19 @@ void CMaterial::PrepareShaders(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandLi
 	m_pIlluminatedShader->CreateShaderVariables(pd3dDevice, pd3dCommandList); 
 	m_pIlluminatedShader->CreateCbvSrvDescriptorHeaps(pd3dDevice, pd3dCommandList, 2, 2);
 
+#ifdef _WITH_PACKED_VERTEX_STREAMS
+	//Textures are created in the heap of m_pIlluminatedShader (CVillainObject, CPlayer); both shaders bind that heap
+	m_pPackedIlluminatedShader = new CPackedIlluminatedShader();
+	m_pPackedIlluminatedShader->CreateShader(pd3dDevice, pd3dGraphicsRootSignature);
+	m_pPackedIlluminatedShader->CreateShaderVariables(pd3dDevice, pd3dCommandList);
+	m_pPackedIlluminatedShader->ShareCbvSrvDescriptorHeap(m_pIlluminatedShader);
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
+TRANSFORMSTATS CGameObject::m_xTransformStats;
+
 CGameObject::CGameObject()
 {
 	m_xmf4x4Transform = Matrix4x4::Identity();
@@ -182,31 +203,38 @@ CGameObject::~CGameObject()
 		}
 	}
 	if (m_ppMaterials) delete[] m_ppMaterials;
+
+	if (m_pFrameIndex) delete m_pFrameIndex;
+	if (m_pTransformHierarchy && (m_nTransformNode == 0)) delete m_pTransformHierarchy;
+	if (m_pPose) delete m_pPose;
+
+	//The siblings are read first: a released child can be deleted
+	for (CGameObject *pChild = m_pChild, *pSibling = NULL; pChild; pChild = pSibling)
+	{
+		pSibling = pChild->m_pSibling;
+		pChild->Release();
+	}
 }
 
 void CGameObject::AddRef()
 {
-	m_nReferences++;
-
-	if (m_pSibling) m_pSibling->AddRef();
-	if (m_pChild) m_pChild->AddRef();
+	::InterlockedIncrement(&m_nReferences);
 }
 
 void CGameObject::Release()
 {
-	if (m_pChild) m_pChild->Release();
-	if (m_pSibling) m_pSibling->Release();
-
-	if (--m_nReferences <= 0) delete this;
+	if (::InterlockedDecrement(&m_nReferences) <= 0) delete this;
 }
 
 void CGameObject::SetChild(CGameObject* pChild, bool bReferenceUpdate)
 {
 	if (pChild)
 	{
-		pChild->m_pParent = this;
+		//A shared model has no single parent and is only touched through its reference count
 		if (bReferenceUpdate) pChild->AddRef();
+		else pChild->m_pParent = this;
 	}
+
 	if (m_pChild)
 	{
 		if (pChild) pChild->m_pSibling = m_pChild->m_pSibling;
@@ -259,25 +287,90 @@ void CGameObject::Animate(float fTimeElapsed, XMFLOAT4X4 *pxmf4x4Parent)
 }
 
 CGameObject *CGameObject::FindFrame(char *pstrFrameName)
+{
+	return(FindFrame(pstrFrameName, ::HashFrameName(pstrFrameName)));
+}
+
+CGameObject *CGameObject::FindFrame(char *pstrFrameName, UINT nHash)
 {
 	CGameObject *pFrameObject = NULL;
-	if (!strncmp(m_pstrFrameName, pstrFrameName, strlen(pstrFrameName))) return(this);
+	if (m_pFrameIndex)
+	{
+		if (pFrameObject = m_pFrameIndex->Find(pstrFrameName, nHash)) return(pFrameObject);
+		if (m_pSibling) if (pFrameObject = m_pSibling->FindFrame(pstrFrameName, nHash)) return(pFrameObject);
 
-	if (m_pSibling) if (pFrameObject = m_pSibling->FindFrame(pstrFrameName)) return(pFrameObject);
-	if (m_pChild) if (pFrameObject = m_pChild->FindFrame(pstrFrameName)) return(pFrameObject);
+		return(NULL);
+	}
+
+	if ((m_nFrameNameHash == nHash) && !strcmp(m_pstrFrameName, pstrFrameName)) return(this);
+
+	if (m_pSibling) if (pFrameObject = m_pSibling->FindFrame(pstrFrameName, nHash)) return(pFrameObject);
+	if (m_pChild) if (pFrameObject = m_pChild->FindFrame(pstrFrameName, nHash)) return(pFrameObject);
 
 	return(NULL);
 }
 
+void CGameObject::IndexFrameHierarchy()
+{
+	m_pFrameIndex = new CFrameIndex(this);
+#ifdef _WITH_FLAT_TRANSFORM_HIERARCHY
+	CTransformHierarchy *pTransformHierarchy = new CTransformHierarchy(this);
+	pTransformHierarchy->AttachFrames();
+#endif
+}
+
+void CGameObject::CreateTransformPose()
+{
+	if (m_pChild && m_pChild->m_pTransformHierarchy && (m_pChild->m_nTransformNode == 0)) m_pPose = m_pChild->m_pTransformHierarchy->CreatePose();
+}
+
 void CGameObject::Render(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera)
 {
 	OnPrepareRender();
 
-	UpdateShaderVariable(pd3dCommandList, &m_xmf4x4World);
+	RenderFrame(pd3dCommandList, pCamera, GetWorldTransform());
+
+	if (m_pSibling) m_pSibling->Render(pd3dCommandList, pCamera);
+	if (m_pPose) m_pPose->Render(pd3dCommandList, pCamera);
+	else if (m_pChild) m_pChild->Render(pd3dCommandList, pCamera);
+}
+
+void CGameObject::RenderInterpolated(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, XMFLOAT4X4 *pxmf4x4Previous, float fInterpolation)
+{
+	//Every world matrix below the root is (its path to the root) * m_xmf4x4Transform; the blended root replaces the last factor
+	XMFLOAT4X4 xmf4x4Interpolated = Matrix4x4::Interpolate(*pxmf4x4Previous, m_xmf4x4Transform, fInterpolation);
+	XMFLOAT4X4 xmf4x4Inverse = Matrix4x4::Inverse(m_xmf4x4Transform);
+	XMFLOAT4X4 xmf4x4Offset = Matrix4x4::Multiply(xmf4x4Inverse, xmf4x4Interpolated);
+	RenderOffset(pd3dCommandList, pCamera, &xmf4x4Offset);
+}
+
+void CGameObject::RenderOffset(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, XMFLOAT4X4 *pxmf4x4Offset)
+{
+	OnPrepareRender();
+
+	XMFLOAT4X4 xmf4x4World = Matrix4x4::Multiply(*GetWorldTransform(), *pxmf4x4Offset);
+	RenderFrame(pd3dCommandList, pCamera, &xmf4x4World);
+
+	if (m_pSibling) m_pSibling->RenderOffset(pd3dCommandList, pCamera, pxmf4x4Offset);
+	if (m_pPose) m_pPose->Render(pd3dCommandList, pCamera, pxmf4x4Offset);
+	else if (m_pChild) m_pChild->RenderOffset(pd3dCommandList, pCamera, pxmf4x4Offset);
+}
+
+void CGameObject::RenderFrame(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, XMFLOAT4X4 *pxmf4x4World)
+{
+	UpdateShaderVariable(pd3dCommandList, pxmf4x4World);
 
 	if (m_nMaterials > 0)
 	{
-		for (int i = 0; i < m_nMaterials; i++)
+		//One level for every subset of the frame so that neighbouring subsets keep matching borders
+		int nLod = (m_pMesh) ? m_pMesh->SelectLod(pCamera, pxmf4x4World) : 0;
+#ifdef _WITH_MESH_CLUSTER_CULLING
+		//No cluster of the frame survives: the material and shader setup is skipped as well
+		int nMaterials = (m_pMesh && !m_pMesh->CullClusters(pCamera, pxmf4x4World, nLod)) ? 0 : m_nMaterials;
+#else
+		int nMaterials = m_nMaterials;
+#endif
+		for (int i = 0; i < nMaterials; i++)
 		{
 			if (m_ppMaterials[i])
 			{
@@ -288,14 +381,9 @@ void CGameObject::Render(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pC
 				m_ppMaterials[i]->UpdateShaderVariable(pd3dCommandList);
 			}
 
-			if (m_pMesh) m_pMesh->Render(pd3dCommandList, i);
+			if (m_pMesh) m_pMesh->Render(pd3dCommandList, i, nLod);
 		}
-
 	}
-
-
-	if (m_pSibling) m_pSibling->Render(pd3dCommandList, pCamera);
-	if (m_pChild) m_pChild->Render(pd3dCommandList, pCamera);
 }
 
 void CGameObject::CreateShaderVariables(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList)
@@ -336,10 +424,44 @@ void CGameObject::ReleaseUploadBuffers()
 
 void CGameObject::UpdateTransform(XMFLOAT4X4 *pxmf4x4Parent)
 {
-	m_xmf4x4World = (pxmf4x4Parent) ? Matrix4x4::Multiply(m_xmf4x4Transform, *pxmf4x4Parent) : m_xmf4x4Transform;
+	//The caller's parent matrix may have changed in place; no parent cannot
+	PropagateTransform(pxmf4x4Parent, (pxmf4x4Parent != NULL));
+}
+
+int CGameObject::PropagateTransform(XMFLOAT4X4 *pxmf4x4Parent, bool bParentChanged)
+{
+	bool bChanged = m_bTransformDirty || bParentChanged || (pxmf4x4Parent != m_pxmf4x4LastParent);
+
+	int nFrames = 1;
+#ifdef _WITH_FLAT_TRANSFORM_HIERARCHY
+	if (m_pTransformHierarchy && (m_nTransformNode == 0))
+	{
+		nFrames = m_pTransformHierarchy->UpdateWorldTransforms(pxmf4x4Parent, bChanged);
+	}
+	else
+#endif
+	{
+		if (bChanged)
+		{
+			m_xmf4x4World = (pxmf4x4Parent) ? Matrix4x4::Multiply(m_xmf4x4Transform, *pxmf4x4Parent) : m_xmf4x4Transform;
+			m_xTransformStats.m_nUpdated++;
+		}
+		else
+		{
+			m_xTransformStats.m_nSkipped++;
+		}
+		if (m_pPose) nFrames += m_pPose->UpdateWorldTransforms(&m_xmf4x4World, bChanged);
+		else if (m_pChild) nFrames += m_pChild->PropagateTransform(&m_xmf4x4World, bChanged);
+	}
+	//Every edit used to update this frame and the frames below it at once
+	m_xTransformStats.m_nDeferred += m_nTransformEdits * nFrames;
 
-	if (m_pSibling) m_pSibling->UpdateTransform(pxmf4x4Parent);
-	if (m_pChild) m_pChild->UpdateTransform(&m_xmf4x4World);
+	m_bTransformDirty = false;
+	m_nTransformEdits = 0;
+	m_pxmf4x4LastParent = pxmf4x4Parent;
+
+	if (m_pSibling) nFrames += m_pSibling->PropagateTransform(pxmf4x4Parent, bParentChanged);
+	return(nFrames);
 }
 
 void CGameObject::SetPosition(float x, float y, float z)
@@ -348,7 +470,7 @@ void CGameObject::SetPosition(float x, float y, float z)
 	m_xmf4x4Transform._42 = y;
 	m_xmf4x4Transform._43 = z;
 
-	UpdateTransform(NULL);
+	MarkTransformDirty();
 }
 
 void CGameObject::SetPosition(XMFLOAT3 xmf3Position)
@@ -361,27 +483,52 @@ void CGameObject::SetScale(float x, float y, float z)
 	XMMATRIX mtxScale = XMMatrixScaling(x, y, z);
 	m_xmf4x4Transform = Matrix4x4::Multiply(mtxScale, m_xmf4x4Transform);
 
-	UpdateTransform(NULL);
+	MarkTransformDirty();
+}
+
+XMFLOAT4X4 *CGameObject::GetWorldTransform()
+{
+	XMFLOAT4X4 *pxmf4x4World = &m_xmf4x4World;
+#ifdef _WITH_FLAT_TRANSFORM_HIERARCHY
+	if (m_pTransformHierarchy)
+	{
+		//The frames below the root are only edited through the hierarchy
+		if (m_nTransformNode > 0) return(m_pTransformHierarchy->GetWorldTransform(m_nTransformNode));
+		pxmf4x4World = m_pTransformHierarchy->GetWorldTransform(0);
+	}
+#endif
+	if (m_bTransformDirty)
+	{
+		*pxmf4x4World = (m_pxmf4x4LastParent) ? Matrix4x4::Multiply(m_xmf4x4Transform, *m_pxmf4x4LastParent) : m_xmf4x4Transform;
+		m_xTransformStats.m_nUpdated++;
+		//Nothing below waits for UpdateTransform
+		if (!m_pChild) m_bTransformDirty = false;
+	}
+	return(pxmf4x4World);
 }
 
 XMFLOAT3 CGameObject::GetPosition()
 {
-	return(XMFLOAT3(m_xmf4x4World._41, m_xmf4x4World._42, m_xmf4x4World._43));
+	XMFLOAT4X4 *pxmf4x4World = GetWorldTransform();
+	return(XMFLOAT3(pxmf4x4World->_41, pxmf4x4World->_42, pxmf4x4World->_43));
 }
 
 XMFLOAT3 CGameObject::GetLook()
 {
-	return(Vector3::Normalize(XMFLOAT3(m_xmf4x4World._31, m_xmf4x4World._32, m_xmf4x4World._33)));
+	XMFLOAT4X4 *pxmf4x4World = GetWorldTransform();
+	return(Vector3::Normalize(XMFLOAT3(pxmf4x4World->_31, pxmf4x4World->_32, pxmf4x4World->_33)));
 }
 
 XMFLOAT3 CGameObject::GetUp()
 {
-	return(Vector3::Normalize(XMFLOAT3(m_xmf4x4World._21, m_xmf4x4World._22, m_xmf4x4World._23)));
+	XMFLOAT4X4 *pxmf4x4World = GetWorldTransform();
+	return(Vector3::Normalize(XMFLOAT3(pxmf4x4World->_21, pxmf4x4World->_22, pxmf4x4World->_23)));
 }
 
 XMFLOAT3 CGameObject::GetRight()
 {
-	return(Vector3::Normalize(XMFLOAT3(m_xmf4x4World._11, m_xmf4x4World._12, m_xmf4x4World._13)));
+	XMFLOAT4X4 *pxmf4x4World = GetWorldTransform();
+	return(Vector3::Normalize(XMFLOAT3(pxmf4x4World->_11, pxmf4x4World->_12, pxmf4x4World->_13)));
 }
 
 void CGameObject::MoveStrafe(float fDistance)
@@ -413,7 +560,7 @@ void CGameObject::Rotate(float fPitch, float fYaw, float fRoll)
 	XMMATRIX mtxRotate = XMMatrixRotationRollPitchYaw(XMConvertToRadians(fPitch), XMConvertToRadians(fYaw), XMConvertToRadians(fRoll));
 	m_xmf4x4Transform = Matrix4x4::Multiply(mtxRotate, m_xmf4x4Transform);
 
-	UpdateTransform(NULL);
+	MarkTransformDirty();
 }
 
 void CGameObject::Rotate(XMFLOAT3 *pxmf3Axis, float fAngle)
@@ -421,7 +568,7 @@ void CGameObject::Rotate(XMFLOAT3 *pxmf3Axis, float fAngle)
 	XMMATRIX mtxRotate = XMMatrixRotationAxis(XMLoadFloat3(pxmf3Axis), XMConvertToRadians(fAngle));
 	m_xmf4x4Transform = Matrix4x4::Multiply(mtxRotate, m_xmf4x4Transform);
 
-	UpdateTransform(NULL);
+	MarkTransformDirty();
 }
 
 void CGameObject::Rotate(XMFLOAT4 *pxmf4Quaternion)
@@ -429,7 +576,33 @@ void CGameObject::Rotate(XMFLOAT4 *pxmf4Quaternion)
 	XMMATRIX mtxRotate = XMMatrixRotationQuaternion(XMLoadFloat4(pxmf4Quaternion));
 	m_xmf4x4Transform = Matrix4x4::Multiply(mtxRotate, m_xmf4x4Transform);
 
-	UpdateTransform(NULL);
+	MarkTransformDirty();
+}
+
+void CGameObject::RotateLocal(XMFLOAT3 *pxmf3Axis, float fAngle)
+{
+	if (m_pTransformHierarchy && (m_nTransformNode > 0))
+	{
+		m_pTransformHierarchy->Rotate(m_nTransformNode, pxmf3Axis, XMConvertToRadians(fAngle));
+	}
+	else
+	{
+		XMMATRIX mtxRotate = XMMatrixRotationAxis(XMLoadFloat3(pxmf3Axis), XMConvertToRadians(fAngle));
+		m_xmf4x4Transform = Matrix4x4::Multiply(mtxRotate, m_xmf4x4Transform);
+		MarkTransformDirty();
+	}
+}
+
+void CGameObject::RotateFrame(CGameObject *pFrame, XMFLOAT3 *pxmf3Axis, float fAngle)
+{
+	if (m_pPose && (pFrame->m_pTransformHierarchy == m_pPose->GetHierarchy()) && (pFrame->m_nTransformNode > 0))
+	{
+		m_pPose->Rotate(pFrame->m_nTransformNode, pxmf3Axis, XMConvertToRadians(fAngle));
+	}
+	else
+	{
+		pFrame->RotateLocal(pxmf3Axis, fAngle);
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -460,6 +633,33 @@ BYTE ReadStringFromFile(FILE* pInFile, char* pstrToken)
 }
 
 #define _WITH_DEBUG_FRAME_HIERARCHY
+//Parse time of the mapped loader and the mesh optimization, LOD and cluster statistics of every model loaded
+//#define _WITH_MODEL_LOAD_STATS
+#define _WITH_MAPPED_MODEL_LOADER
+#define _WITH_COOKED_MODEL_LOADER
+//The cooker optimizes the meshes and builds their LODs (ModelCooker.cpp); these repeat it on every load of a model that
+//is not cooked, and the optimization replaces the mapped arrays of the tag stream loader with copies
+//#define _WITH_MESH_OPTIMIZATION
+//#define _WITH_MESH_LODS
+
+#ifdef _WITH_MESH_OPTIMIZATION
+static MESHOPTIMIZESTATS gMeshOptimizeStats;
+#endif
+#ifdef _WITH_MESH_LODS
+static MESHLODSTATS gMeshLodStats;
+#endif
+#ifdef _WITH_MESH_CLUSTER_CULLING
+static MESHCLUSTERSTATS gMeshClusterStats;
+#endif
+
+static CMesh *CreateIlluminatedMesh(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, CMeshLoadInfo *pMeshInfo)
+{
+#ifdef _WITH_PACKED_VERTEX_STREAMS
+	return(new CMeshPackedFromFile(pd3dDevice, pd3dCommandList, pMeshInfo));
+#else
+	return(new CMeshIlluminatedFromFile(pd3dDevice, pd3dCommandList, pMeshInfo));
+#endif
+}
 
 CMeshLoadInfo *CGameObject::LoadMeshInfoFromFile(FILE *pInFile)
 {
@@ -644,6 +844,7 @@ CGameObject *CGameObject::LoadFrameHierarchyFromFile(ID3D12Device *pd3dDevice, I
 
 			nFrame = ::ReadIntegerFromFile(pInFile);
 			::ReadStringFromFile(pInFile, pGameObject->m_pstrFrameName);
+			pGameObject->m_nFrameNameHash = ::HashFrameName(pGameObject->m_pstrFrameName);
 		}
 		else if (!strcmp(pstrToken, "<Transform>:"))
 		{
@@ -663,10 +864,19 @@ CGameObject *CGameObject::LoadFrameHierarchyFromFile(ID3D12Device *pd3dDevice, I
 			CMeshLoadInfo *pMeshInfo = pGameObject->LoadMeshInfoFromFile(pInFile);
 			if (pMeshInfo)
 			{
+#ifdef _WITH_MESH_OPTIMIZATION
+				::OptimizeMeshLoadInfo(pMeshInfo, &gMeshOptimizeStats);
+#endif
+#ifdef _WITH_MESH_LODS
+				::GenerateMeshLods(pMeshInfo, &gMeshLodStats);
+#endif
+#ifdef _WITH_MESH_CLUSTER_CULLING
+				::GenerateMeshClusters(pMeshInfo, &gMeshClusterStats);
+#endif
 				CMesh *pMesh = NULL;
 				if (pMeshInfo->m_nType & VERTEXT_NORMAL)
 				{
-					pMesh = new CMeshIlluminatedFromFile(pd3dDevice, pd3dCommandList, pMeshInfo);
+					pMesh = ::CreateIlluminatedMesh(pd3dDevice, pd3dCommandList, pMeshInfo);
 				}
 				if (pMesh) pGameObject->SetMesh(pMesh);
 				delete pMeshInfo;
@@ -675,24 +885,11 @@ CGameObject *CGameObject::LoadFrameHierarchyFromFile(ID3D12Device *pd3dDevice, I
 		else if (!strcmp(pstrToken, "<Materials>:"))
 		{
 			MATERIALSLOADINFO *pMaterialsInfo = pGameObject->LoadMaterialsInfoFromFile(pd3dDevice, pd3dCommandList, pInFile);
-			if (pMaterialsInfo && (pMaterialsInfo->m_nMaterials > 0))
+			if (pMaterialsInfo)
 			{
-				pGameObject->m_nMaterials = pMaterialsInfo->m_nMaterials;
-				pGameObject->m_ppMaterials = new CMaterial*[pMaterialsInfo->m_nMaterials];
-
-				for (int i = 0; i < pMaterialsInfo->m_nMaterials; i++)
-				{
-					pGameObject->m_ppMaterials[i] = NULL;
-
-					CMaterial *pMaterial = new CMaterial();
-
-					CMaterialColors *pMaterialColors = new CMaterialColors(&pMaterialsInfo->m_pMaterials[i]);
-					pMaterial->SetMaterialColors(pMaterialColors);
-
-					if (pGameObject->GetMeshType() & VERTEXT_NORMAL) pMaterial->SetIlluminatedShader();
-
-					pGameObject->SetMaterial(i, pMaterial);
-				}
+				pGameObject->SetMaterials(pMaterialsInfo);
+				if (pMaterialsInfo->m_pMaterials) delete[] pMaterialsInfo->m_pMaterials;
+				delete pMaterialsInfo;
 			}
 		}
 		else if (!strcmp(pstrToken, "<Children>:"))
@@ -720,6 +917,145 @@ CGameObject *CGameObject::LoadFrameHierarchyFromFile(ID3D12Device *pd3dDevice, I
 	return(pGameObject);
 }
 
+CGameObject *CGameObject::LoadFrameHierarchyFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, ID3D12RootSignature *pd3dGraphicsRootSignature, CModelStreamReader *pReader)
+{
+	char *pstrToken = NULL;
+	BYTE nLength = 0;
+
+	int nFrame = 0;
+
+	CGameObject* pGameObject = NULL;
+
+	while (pReader->IsValid())
+	{
+		nLength = pReader->ReadToken(&pstrToken);
+		if (::IsModelToken(pstrToken, nLength, "<Frame>:"))
+		{
+			pGameObject = new CGameObject();
+			pReader->m_Stats.m_nFrames++;
+			pReader->m_Stats.m_nAllocations++;
+
+			nFrame = pReader->ReadInteger();
+			pReader->ReadString(pGameObject->m_pstrFrameName, sizeof(pGameObject->m_pstrFrameName));
+			pGameObject->m_nFrameNameHash = ::HashFrameName(pGameObject->m_pstrFrameName);
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Transform>:"))
+		{
+			pReader->ReadArray(sizeof(float) * 13); //Position, Euler Angle, Scale, Quaternion
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<TransformMatrix>:"))
+		{
+			void *pTransform = pReader->ReadArray(sizeof(XMFLOAT4X4));
+			if (pTransform && pGameObject) memcpy(&pGameObject->m_xmf4x4Transform, pTransform, sizeof(XMFLOAT4X4));
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Mesh>:"))
+		{
+			CMeshLoadInfo *pMeshInfo = ::LoadMappedMeshInfo(pReader);
+			if (pMeshInfo)
+			{
+#ifdef _WITH_MESH_OPTIMIZATION
+				::OptimizeMeshLoadInfo(pMeshInfo, &gMeshOptimizeStats);
+#endif
+#ifdef _WITH_MESH_LODS
+				::GenerateMeshLods(pMeshInfo, &gMeshLodStats);
+#endif
+#ifdef _WITH_MESH_CLUSTER_CULLING
+				::GenerateMeshClusters(pMeshInfo, &gMeshClusterStats);
+#endif
+				CMesh *pMesh = NULL;
+				if (pMeshInfo->m_nType & VERTEXT_NORMAL)
+				{
+					pMesh = ::CreateIlluminatedMesh(pd3dDevice, pd3dCommandList, pMeshInfo);
+				}
+				if (pMesh) pGameObject->SetMesh(pMesh);
+				delete pMeshInfo;
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Materials>:"))
+		{
+			MATERIALSLOADINFO *pMaterialsInfo = ::LoadMappedMaterialsInfo(pReader);
+			if (pMaterialsInfo)
+			{
+				pGameObject->SetMaterials(pMaterialsInfo);
+				if (pMaterialsInfo->m_pMaterials) delete[] pMaterialsInfo->m_pMaterials;
+				delete pMaterialsInfo;
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Children>:"))
+		{
+			int nChilds = pReader->ReadInteger();
+			for (int i = 0; i < nChilds; i++)
+			{
+				CGameObject *pChild = CGameObject::LoadFrameHierarchyFromFile(pd3dDevice, pd3dCommandList, pd3dGraphicsRootSignature, pReader);
+				if (pChild) pGameObject->SetChild(pChild);
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "</Frame>"))
+		{
+			break;
+		}
+	}
+	return(pGameObject);
+}
+
+CGameObject *CGameObject::LoadFrameHierarchyFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, ID3D12RootSignature *pd3dGraphicsRootSignature, CCookedModelFile *pCookedFile, int *pnFrame)
+{
+	int nFrame = (*pnFrame)++;
+	COOKEDFRAME *pCookedFrame = pCookedFile->GetFrame(nFrame);
+
+	CGameObject *pGameObject = new CGameObject();
+	strcpy_s(pGameObject->m_pstrFrameName, sizeof(pGameObject->m_pstrFrameName), pCookedFrame->m_pstrFrameName);
+	pGameObject->m_nFrameNameHash = pCookedFrame->m_nNameHash;
+	pGameObject->m_xmf4x4Transform = pCookedFrame->m_xmf4x4Transform;
+
+	if (pCookedFrame->m_nMesh >= 0)
+	{
+		CMeshLoadInfo *pMeshInfo = pCookedFile->CreateMeshInfo(pCookedFrame->m_nMesh);
+		if (pMeshInfo->m_nType & VERTEXT_NORMAL) pGameObject->SetMesh(::CreateIlluminatedMesh(pd3dDevice, pd3dCommandList, pMeshInfo));
+		delete pMeshInfo;
+	}
+
+	MATERIALSLOADINFO *pMaterialsInfo = pCookedFile->CreateMaterialsInfo(nFrame);
+	if (pMaterialsInfo)
+	{
+		pGameObject->SetMaterials(pMaterialsInfo);
+		delete[] pMaterialsInfo->m_pMaterials;
+		delete pMaterialsInfo;
+	}
+
+	for (int i = 0; i < pCookedFrame->m_nChildren; i++)
+	{
+		CGameObject *pChild = CGameObject::LoadFrameHierarchyFromFile(pd3dDevice, pd3dCommandList, pd3dGraphicsRootSignature, pCookedFile, pnFrame);
+		if (pChild) pGameObject->SetChild(pChild);
+	}
+
+	return(pGameObject);
+}
+
+void CGameObject::SetMaterials(MATERIALSLOADINFO *pMaterialsInfo)
+{
+	if (pMaterialsInfo->m_nMaterials <= 0) return;
+
+	m_nMaterials = pMaterialsInfo->m_nMaterials;
+	m_ppMaterials = new CMaterial*[pMaterialsInfo->m_nMaterials];
+
+	for (int i = 0; i < pMaterialsInfo->m_nMaterials; i++)
+	{
+		m_ppMaterials[i] = NULL;
+
+		CMaterial *pMaterial = new CMaterial();
+
+		CMaterialColors *pMaterialColors = new CMaterialColors(&pMaterialsInfo->m_pMaterials[i]);
+		pMaterial->SetMaterialColors(pMaterialColors);
+
+		if (GetMeshType() & VERTEXT_PACKED) pMaterial->SetPackedIlluminatedShader();
+		else if (GetMeshType() & VERTEXT_NORMAL) pMaterial->SetIlluminatedShader();
+
+
+		SetMaterial(i, pMaterial);
+	}
+}
+
 void CGameObject::PrintFrameInfo(CGameObject *pGameObject, CGameObject *pParent)
 {
 	TCHAR pstrDebug[256] = { 0 };
@@ -733,26 +1069,125 @@ void CGameObject::PrintFrameInfo(CGameObject *pGameObject, CGameObject *pParent)
 
 CGameObject *CGameObject::LoadGeometryFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, ID3D12RootSignature *pd3dGraphicsRootSignature, char *pstrFileName)
 {
-	FILE *pInFile = NULL;
-	::fopen_s(&pInFile, pstrFileName, "rb");
-	::rewind(pInFile);
 	CGameObject *pGameObject = NULL;
-	char pstrToken[64] = { '\0' };
 
-	for ( ; ; )
+#ifdef _WITH_COOKED_MODEL_LOADER
+	//Prefer the cooked file written by "/cook"; fall back to the tag stream when it is missing or stale
+	char pstrCookedFileName[256] = { '\0' };
+	::GetCookedModelFileName(pstrFileName, pstrCookedFileName, 256);
+
+	CCookedModelFile xCookedFile;
+	if (xCookedFile.Open(pstrCookedFileName) && xCookedFile.IsCookedFrom(pstrFileName) && (xCookedFile.GetHeader()->m_nFrames > 0))
 	{
-		::ReadStringFromFile(pInFile, pstrToken);
+		int nFrame = 0;
+		pGameObject = CGameObject::LoadFrameHierarchyFromFile(pd3dDevice, pd3dCommandList, pd3dGraphicsRootSignature, &xCookedFile, &nFrame);
+	}
+	if (pGameObject)
+	{
+		pGameObject->IndexFrameHierarchy();
+		return(pGameObject);
+	}
+#endif
+
+#ifdef _WITH_MESH_OPTIMIZATION
+	gMeshOptimizeStats = MESHOPTIMIZESTATS();
+#endif
+#ifdef _WITH_MESH_LODS
+	gMeshLodStats = MESHLODSTATS();
+#endif
+#ifdef _WITH_MESH_CLUSTER_CULLING
+	gMeshClusterStats = MESHCLUSTERSTATS();
+#endif
+
+	bool bLoaded = false;
+#ifdef _WITH_MAPPED_MODEL_LOADER
+	//The mapping stays open until every CMeshFromFile has copied its arrays into the upload heaps
+	CMappedModelFile xModelFile;
+	if (xModelFile.Open(pstrFileName))
+	{
+#ifdef _WITH_MODEL_LOAD_STATS
+		LARGE_INTEGER nFrequency, nBegin, nEnd;
+		::QueryPerformanceFrequency(&nFrequency);
+		::QueryPerformanceCounter(&nBegin);
+#endif
 
-		if (!strcmp(pstrToken, "<Hierarchy>:"))
+		CModelStreamReader xReader(xModelFile.GetData(), xModelFile.GetSize());
+		char *pstrToken = NULL;
+		BYTE nLength = 0;
+		while (xReader.IsValid())
 		{
-			pGameObject = CGameObject::LoadFrameHierarchyFromFile(pd3dDevice, pd3dCommandList, pd3dGraphicsRootSignature, pInFile);
+			nLength = xReader.ReadToken(&pstrToken);
+
+			if (::IsModelToken(pstrToken, nLength, "<Hierarchy>:"))
+			{
+				pGameObject = CGameObject::LoadFrameHierarchyFromFile(pd3dDevice, pd3dCommandList, pd3dGraphicsRootSignature, &xReader);
+			}
+			else if (::IsModelToken(pstrToken, nLength, "</Hierarchy>"))
+			{
+				break;
+			}
 		}
-		else if (!strcmp(pstrToken, "</Hierarchy>"))
+		bLoaded = (pGameObject != NULL);
+
+#ifdef _WITH_MODEL_LOAD_STATS
+		::QueryPerformanceCounter(&nEnd);
+		xReader.m_Stats.m_nBytes = xModelFile.GetSize();
+		xReader.m_Stats.m_fSeconds = float(double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart));
+		TCHAR pstrStats[256] = { 0 };
+		_stprintf_s(pstrStats, 256, _T("%hs: %llu bytes, %d tags, %d frames, %d meshes, %d allocations, %.2f ms\n"), pstrFileName, xReader.m_Stats.m_nBytes, xReader.m_Stats.m_nTags, xReader.m_Stats.m_nFrames, xReader.m_Stats.m_nMeshes, xReader.m_Stats.m_nAllocations, xReader.m_Stats.m_fSeconds * 1000.0f);
+		OutputDebugString(pstrStats);
+#endif
+	}
+#endif
+
+	//The tag stream through fread, without the mapped loader or when the file cannot be mapped
+	if (!bLoaded)
+	{
+		FILE *pInFile = NULL;
+		::fopen_s(&pInFile, pstrFileName, "rb");
+		if (pInFile)
 		{
-			break;
+			::rewind(pInFile);
+			char pstrToken[64] = { '\0' };
+
+			for ( ; ; )
+			{
+				::ReadStringFromFile(pInFile, pstrToken);
+
+				if (!strcmp(pstrToken, "<Hierarchy>:"))
+				{
+					pGameObject = CGameObject::LoadFrameHierarchyFromFile(pd3dDevice, pd3dCommandList, pd3dGraphicsRootSignature, pInFile);
+				}
+				else if (!strcmp(pstrToken, "</Hierarchy>") || ::feof(pInFile))
+				{
+					break;
+				}
+			}
+			::fclose(pInFile);
 		}
 	}
 
+	if (pGameObject) pGameObject->IndexFrameHierarchy();
+
+#ifdef _WITH_MODEL_LOAD_STATS
+	TCHAR pstrLoadStats[256] = { 0 };
+#ifdef _WITH_MESH_OPTIMIZATION
+	_stprintf_s(pstrLoadStats, 256, _T("%hs: %d meshes, %d triangles, vertices %d -> %d, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n"), pstrFileName, gMeshOptimizeStats.m_nMeshes, gMeshOptimizeStats.m_nTriangles, gMeshOptimizeStats.m_nVerticesBefore, gMeshOptimizeStats.m_nVerticesAfter, gMeshOptimizeStats.GetACMRBefore(), gMeshOptimizeStats.GetACMRAfter(), gMeshOptimizeStats.GetATVRBefore(), gMeshOptimizeStats.GetATVRAfter());
+	OutputDebugString(pstrLoadStats);
+#endif
+#ifdef _WITH_MESH_LODS
+	for (int l = 1; l < MESH_MAX_LODS; l++)
+	{
+		_stprintf_s(pstrLoadStats, 256, _T("%hs: LOD %d, %d triangles, max error %.4f of the AABB diagonal\n"), pstrFileName, l, gMeshLodStats.m_pnTriangles[l], gMeshLodStats.m_pfMaxErrors[l]);
+		OutputDebugString(pstrLoadStats);
+	}
+#endif
+#ifdef _WITH_MESH_CLUSTER_CULLING
+	_stprintf_s(pstrLoadStats, 256, _T("%hs: %d clusters, %.1f triangles and %.1f vertices per cluster, %d with a usable cone\n"), pstrFileName, gMeshClusterStats.m_nClusters, gMeshClusterStats.GetAverageTriangles(), gMeshClusterStats.GetAverageVertices(), gMeshClusterStats.m_nConeClusters);
+	OutputDebugString(pstrLoadStats);
+#endif
+#endif
+
 #ifdef _WITH_DEBUG_FRAME_HIERARCHY
 	TCHAR pstrDebug[256] = { 0 };
 	_stprintf_s(pstrDebug, 256, _T("Frame Hierarchy\n"));
@@ -813,6 +1248,7 @@ void CRevolvingObject::Animate(float fTimeElapsed, XMFLOAT4X4 *pxmf4x4Parent)
 {
 	XMMATRIX mtxRotate = XMMatrixRotationAxis(XMLoadFloat3(&m_xmf3RevolutionAxis), XMConvertToRadians(m_fRevolutionSpeed * fTimeElapsed));
 	m_xmf4x4Transform = Matrix4x4::Multiply(m_xmf4x4Transform, mtxRotate);
+	MarkTransformDirty();
 
 	CGameObject::Animate(fTimeElapsed, pxmf4x4Parent);
 }
@@ -842,6 +1278,7 @@ void CVillainObject::SetLookAt(XMFLOAT3 & xmf3Target, XMFLOAT3 & xmf3Up)
 	m_xmf4x4Transform._11 = m_xmf3Right.x; m_xmf4x4Transform._21 = m_xmf3Up.x; m_xmf4x4Transform._31 = m_xmf3Look.x;
 	m_xmf4x4Transform._12 = m_xmf3Right.y; m_xmf4x4Transform._22 = m_xmf3Up.y; m_xmf4x4Transform._32 = m_xmf3Look.y;
 	m_xmf4x4Transform._13 = m_xmf3Right.z; m_xmf4x4Transform._23 = m_xmf3Up.z; m_xmf4x4Transform._33 = m_xmf3Look.z;
+	MarkTransformDirty();
 
 }
 	
@@ -849,6 +1286,10 @@ void CVillainObject::SetRandomMovePosition(){
 
 	XMFLOAT3 pos = GetPosition();
 	XMFLOAT3 pos2;
+	XMFLOAT3 xmf3Position = GetPosition();
+	//Below the terrain every ray hits at once: only the old "above the terrain" test applies then,
+	//and after a few blocked targets as well, so the search always ends like it did before
+	int nVisibleTests = (xmf3Position.y > m_pTerrain->GetHeight(xmf3Position.x, xmf3Position.z)) ? 16 : 0;
 	while (true)
 	{
 		pos = GetPosition();
@@ -862,7 +1303,9 @@ void CVillainObject::SetRandomMovePosition(){
 		if (pos.y > 300 || pos.y < 30 || 
 			pos.x <100 || pos.x > 800 ||
 			pos.z < 100 || pos.z > 800) continue;
-		if (pos.y > m_pTerrain->GetHeight(pos.x, pos.z))
+		//Above the terrain and with nothing in the way (the villain flies straight to it)
+		if (pos.y <= m_pTerrain->GetHeight(pos.x, pos.z)) continue;
+		if ((nVisibleTests-- <= 0) || m_pTerrain->IsVisible(xmf3Position, pos))
 			break;
 	}
 	m_xmf3RandomPos = pos;
@@ -870,8 +1313,11 @@ void CVillainObject::SetRandomMovePosition(){
 
 void CVillainObject::OnInitialize(XMFLOAT3 pos)
 {
-	m_pMainRotorFrame = m_pChild -> m_pChild->m_pChild;
-	m_pTailRotorFrame = m_pChild->m_pChild->m_pSibling->m_pChild;
+	m_pMainRotorFrame = FindFrame("Rotor_L");
+	m_pTailRotorFrame = FindFrame("Rotor_R");
+	//The villains share one helicopter model; each animates its rotors in its own pose
+	CreateTransformPose();
+
 	SetPosition(pos);
 	m_xmf3RandomPos = pos;
 }
@@ -879,16 +1325,9 @@ void CVillainObject::OnInitialize(XMFLOAT3 pos)
 void CVillainObject::Animate(float fTimeElapsed, XMFLOAT4X4 *pxmf4x4Parent)
 {
 	XMFLOAT3 xmf3Position = GetPosition();
-	if (m_pMainRotorFrame)
-	{
-		XMMATRIX xmmtxRotate = XMMatrixRotationZ(XMConvertToRadians(30.f ) * fTimeElapsed);
-		m_pMainRotorFrame->m_xmf4x4Transform = Matrix4x4::Multiply(xmmtxRotate, m_pMainRotorFrame->m_xmf4x4Transform);
-	}
-	if (m_pTailRotorFrame)
-	{
-		XMMATRIX xmmtxRotate = XMMatrixRotationZ(XMConvertToRadians(30.0f ) * fTimeElapsed);
-		m_pTailRotorFrame->m_xmf4x4Transform = Matrix4x4::Multiply(xmmtxRotate, m_pTailRotorFrame->m_xmf4x4Transform);
-	}
+	XMFLOAT3 xmf3RotorAxis(0.0f, 0.0f, 1.0f);
+	if (m_pMainRotorFrame) RotateFrame(m_pMainRotorFrame, &xmf3RotorAxis, 60.0f * fTimeElapsed);
+	if (m_pTailRotorFrame) RotateFrame(m_pTailRotorFrame, &xmf3RotorAxis, 60.0f * fTimeElapsed);
 
 
 	if (m_bFalling)
@@ -929,16 +1368,11 @@ void CSuperCobraObject::OnInitialize()
 
 void CSuperCobraObject::Animate(float fTimeElapsed, XMFLOAT4X4 *pxmf4x4Parent)
 {
-	if (m_pMainRotorFrame)
-	{
-		XMMATRIX xmmtxRotate = XMMatrixRotationY(XMConvertToRadians(360.0f * 2.0f) * fTimeElapsed);
-		m_pMainRotorFrame->m_xmf4x4Transform = Matrix4x4::Multiply(xmmtxRotate, m_pMainRotorFrame->m_xmf4x4Transform);
-	}
-	if (m_pTailRotorFrame)
-	{
-		XMMATRIX xmmtxRotate = XMMatrixRotationX(XMConvertToRadians(360.0f * 4.0f) * fTimeElapsed);
-		m_pTailRotorFrame->m_xmf4x4Transform = Matrix4x4::Multiply(xmmtxRotate, m_pTailRotorFrame->m_xmf4x4Transform);
-	}
+	XMFLOAT3 xmf3MainRotorAxis(0.0f, 1.0f, 0.0f), xmf3TailRotorAxis(1.0f, 0.0f, 0.0f);
+	if (m_pMainRotorFrame) m_pMainRotorFrame->RotateLocal(&xmf3MainRotorAxis, 360.0f * 2.0f * fTimeElapsed);
+	if (m_pTailRotorFrame) m_pTailRotorFrame->RotateLocal(&xmf3TailRotorAxis, 360.0f * 4.0f * fTimeElapsed);
+
+
 
 	CGameObject::Animate(fTimeElapsed, pxmf4x4Parent);
 }
@@ -946,42 +1380,49 @@ void CSuperCobraObject::Animate(float fTimeElapsed, XMFLOAT4X4 *pxmf4x4Parent)
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
-CHeightMapTerrain::CHeightMapTerrain(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, ID3D12RootSignature* pd3dGraphicsRootSignature, LPCTSTR pFileName, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, XMFLOAT4 xmf4Color) 
+CHeightMapTerrain::CHeightMapTerrain(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, ID3D12RootSignature* pd3dGraphicsRootSignature, LPCTSTR pFileName, int nFormat, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, XMFLOAT4 xmf4Color) 
 {
 	m_xmf4x4World = Matrix4x4::Identity();
 
 	m_nWidth = nWidth;
 	m_nLength = nLength;
 
-	m_pxmf2TessFactor = new XMFLOAT2();
-	int cxQuadsPerBlock = nBlockWidth - 1;
-	int czQuadsPerBlock = nBlockLength - 1;
+	m_pxmf2TessFactor = NULL; //Into the constant buffer of CreateShaderVariables
 
 	m_xmf3Scale = xmf3Scale;
 
-	m_pHeightMapImage = new CHeightMapImage(pFileName, nWidth, nLength, xmf3Scale);
+	//Cooked next to the raw once (pFileName with .hfld), then only reopened; the meshes read every tile once, the queries
+	//of the game only the tiles around the player (TERRAIN_RESIDENT_TILES)
+	m_pHeightField = new CHeightField(TERRAIN_RESIDENT_TILES);
+	if (!m_pHeightField->OpenRaw(pFileName, nWidth, nLength, nFormat, xmf3Scale)) OutputDebugString(_T("Terrain: the height field could not be opened, the terrain is flat\n"));
 
-	long cxBlocks = (m_nWidth - 1) / cxQuadsPerBlock;
-	long czBlocks = (m_nLength - 1) / czQuadsPerBlock;
+	//The geometry of the meshes is built on the workers of a pool, their buffers uploaded from this thread
+	CThreadPool *pThreadPool = new CThreadPool();
 
-	m_nMeshes = cxBlocks * czBlocks;
-	m_ppMeshes = new CMesh * [m_nMeshes];
-	for (int i = 0; i < m_nMeshes; i++)	m_ppMeshes[i] = NULL;
+	m_pGridMesh = new CHeightMapGridMesh(pd3dDevice, pd3dCommandList, nWidth, nLength, nBlockWidth, nBlockLength, xmf3Scale, xmf4Color, m_pHeightField, pThreadPool);
+	m_pGridMesh->AddRef();
 
-	CHeightMapGridMesh* pHeightMapGridMesh = NULL;
-	for (int z = 0, zStart = 0; z < czBlocks; z++)
-	{
-		for (int x = 0, xStart = 0; x < cxBlocks; x++)
-		{
-			xStart = x * (nBlockWidth - 1);
-			zStart = z * (nBlockLength - 1);
-			pHeightMapGridMesh = new CHeightMapGridMesh(pd3dDevice, pd3dCommandList, xStart, zStart, nBlockWidth, nBlockLength, xmf3Scale, xmf4Color, m_pHeightMapImage);
-			SetMesh(x + (z * cxBlocks), pHeightMapGridMesh);
-		}
-	}
+	m_pQuadtree = new CTerrainQuadtree(m_pGridMesh->GetPatchesX(), m_pGridMesh->GetPatchesZ(), m_pGridMesh->GetPatchAABBCenters(), m_pGridMesh->GetPatchAABBExtents());
+	m_pTessellation = new CTerrainTessellation(m_pGridMesh->GetPatchesX(), m_pGridMesh->GetPatchesZ(), m_pGridMesh->GetPatchAABBCenters(), m_pGridMesh->GetPatchAABBExtents(), m_pGridMesh->GetPatchErrors());
+	int nMaxPatches = m_pGridMesh->GetPatches();
+
+#ifdef _WITH_TERRAIN_GEOMIPMAPPING
+	m_pGeomipMesh = new CHeightMapGeomipMesh(pd3dDevice, pd3dCommandList, nWidth, nLength, TERRAIN_GEOMIPMAP_PATCH_QUADS, xmf3Scale, xmf4Color, m_pHeightField, pThreadPool);
+	m_pGeomipMesh->AddRef();
+	m_pGeomipmap = new CTerrainGeomipmap(m_pGeomipMesh->GetPatchesX(), m_pGeomipMesh->GetPatchesZ(), m_pGeomipMesh->GetLevels(), m_pGeomipMesh->GetPatchAABBCenters(), m_pGeomipMesh->GetPatchAABBExtents());
+	m_pGeomipQuadtree = new CTerrainQuadtree(m_pGeomipMesh->GetPatchesX(), m_pGeomipMesh->GetPatchesZ(), m_pGeomipMesh->GetPatchAABBCenters(), m_pGeomipMesh->GetPatchAABBExtents());
+	if (m_pGeomipMesh->GetPatches() > nMaxPatches) nMaxPatches = m_pGeomipMesh->GetPatches();
+#endif
+	m_pnVisiblePatches = new int[nMaxPatches];
+
+	delete pThreadPool;
 
 	CreateShaderVariables(pd3dDevice, pd3dCommandList);
 	*m_pxmf2TessFactor = XMFLOAT2(2,2);
+	m_pcbMappedTessInfo->m_xmf4PatchGrid = XMFLOAT4(1.0f / ((nBlockWidth - 1) * xmf3Scale.x), 1.0f / ((nBlockLength - 1) * xmf3Scale.z), float(m_pGridMesh->GetPatchesX()), 0.0f);
+#ifdef _WITH_TERRAIN_ADAPTIVE_TESSELLATION
+	if (m_pGridMesh->GetPatches() <= TERRAIN_MAX_TESS_PATCHES) m_pcbMappedTessInfo->m_xmf4PatchGrid.w = 1.0f;
+#endif
 	CTexture* pTerrainTexture = new CTexture(2, RESOURCE_TEXTURE2D, 0);
 
 	pTerrainTexture->LoadTextureFromFile(pd3dDevice, pd3dCommandList, L"Image/Base_Texture.dds", 0);
@@ -1005,17 +1446,26 @@ CHeightMapTerrain::CHeightMapTerrain(ID3D12Device* pd3dDevice, ID3D12GraphicsCom
 
 CHeightMapTerrain::~CHeightMapTerrain(void)
 {
-	if (m_pHeightMapImage) delete m_pHeightMapImage;
+	if (m_pHeightField) delete m_pHeightField;
+	if (m_pGridMesh) m_pGridMesh->Release();
+	if (m_pQuadtree) delete m_pQuadtree;
+	if (m_pTessellation) delete m_pTessellation;
+	if (m_pGeomipMesh) m_pGeomipMesh->Release();
+	if (m_pGeomipmap) delete m_pGeomipmap;
+	if (m_pGeomipQuadtree) delete m_pGeomipQuadtree;
+	if (m_pnVisiblePatches) delete[] m_pnVisiblePatches;
 }
 
-void CHeightMapTerrain::SetMesh(int nIndex, CMesh* pMesh)
+void CHeightMapTerrain::GetHeightsAndNormals(float *pfx, float *pfz, int nPoints, float *pfHeights, XMFLOAT3 *pxmf3Normals, bool bReverseQuad)
 {
-	if (m_ppMeshes)
-	{
-		if (m_ppMeshes[nIndex]) m_ppMeshes[nIndex]->Release();
-		m_ppMeshes[nIndex] = pMesh;
-		if (pMesh) pMesh->AddRef();
-	}
+	m_pHeightField->GetHeightsAndNormals(pfx, pfz, nPoints, pfHeights, pxmf3Normals, bReverseQuad);
+}
+
+void CHeightMapTerrain::ReleaseUploadBuffers()
+{
+	if (m_pGridMesh) m_pGridMesh->ReleaseUploadBuffers();
+	if (m_pGeomipMesh) m_pGeomipMesh->ReleaseUploadBuffers();
+	CGameObject::ReleaseUploadBuffers();
 }
 
 XMFLOAT2 CHeightMapTerrain::GetPipelineMode()
@@ -1025,10 +1475,11 @@ XMFLOAT2 CHeightMapTerrain::GetPipelineMode()
 
 void CHeightMapTerrain::CreateShaderVariables(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList)
 {
-	UINT ncbElementBytes = sizeof(float)*2; //256 
+	UINT ncbElementBytes = ((sizeof(CB_TERRAIN_TESS_INFO) + 255) & ~255); //256 
 	m_pd3dcbTessFactor = ::CreateBufferResource(pd3dDevice, pd3dCommandList, NULL, ncbElementBytes, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, NULL);
 
-	m_pd3dcbTessFactor->Map(0, NULL, (void**)&m_pxmf2TessFactor);
+	m_pd3dcbTessFactor->Map(0, NULL, (void**)&m_pcbMappedTessInfo);
+	m_pxmf2TessFactor = &m_pcbMappedTessInfo->m_xmf2TessFactor;
 
 	CGameObject::CreateShaderVariables(pd3dDevice, pd3dCommandList);
 }
@@ -1059,24 +1510,77 @@ void CHeightMapTerrain::ChangePipeLine()
 	m_bPipelineStateIndex = (!m_bPipelineStateIndex);
 }
 
+void CHeightMapTerrain::SetGeomipmapping(bool bGeomipmapping)
+{
+	//Without whole patches of TERRAIN_GEOMIPMAP_PATCH_QUADS there is nothing to draw
+	m_bGeomipmapping = bGeomipmapping && m_pGeomipMesh && (m_pGeomipMesh->GetPatches() > 0);
+}
+
 void CHeightMapTerrain::Render(ID3D12GraphicsCommandList* pd3dCommandList, CCamera* pCamera)
 {
 	OnPrepareRender();
 
 
-	m_ppMaterials[0]->m_pShader->Render(pd3dCommandList, pCamera, m_bPipelineStateIndex);
+	m_ppMaterials[0]->m_pShader->Render(pd3dCommandList, pCamera, m_bPipelineStateIndex + ((m_bGeomipmapping) ? 2 : 0));
 	m_ppMaterials[0]->UpdateShaderVariable(pd3dCommandList);
 	UpdateShaderVariable(pd3dCommandList,&m_xmf4x4World);
 	UpdateShaderVariables(pd3dCommandList);
 
 	//pd3dCommandList->SetGraphicsRootDescriptorTable(2, m_d3dCbvGPUDescriptorHandle);
 
-	if (m_ppMeshes)
+	if (m_bGeomipmapping)
 	{
-		for (int i = 0; i < m_nMeshes; i++)
+		//Every patch (at the levels of the last Update) without a camera
+		int *pnPatches = NULL, nPatches = 0;
+		if (pCamera)
 		{
-			if (m_ppMeshes[i]) m_ppMeshes[i]->Render(pd3dCommandList,i);
+			XMFLOAT4X4 xmf4x4Inverse = Matrix4x4::Inverse(m_xmf4x4World);
+			XMFLOAT3 xmf3CameraPosition = Vector3::TransformCoord(pCamera->GetPosition(), xmf4x4Inverse);
+			m_pGeomipmap->SetLodDistance(TERRAIN_GEOMIPMAP_LOD_DISTANCE * m_pxmf2TessFactor->x * 0.5f);
+			m_pGeomipmap->Update(xmf3CameraPosition);
+#ifdef _WITH_TERRAIN_PATCH_CULLING
+			XMFLOAT4X4 xmf4x4View = pCamera->GetViewMatrix();
+			XMFLOAT4X4 xmf4x4Projection = pCamera->GetProjectionMatrix();
+			MESHCLUSTERCULLINFO xCullInfo;
+			::GetMeshClusterCullInfo(&m_xmf4x4World, &xmf4x4View, &xmf4x4Projection, &xCullInfo);
+
+			nPatches = m_pGeomipQuadtree->Cull(&xCullInfo, m_pnVisiblePatches);
+			pnPatches = m_pnVisiblePatches;
+#endif
 		}
+		m_pGeomipMesh->Render(pd3dCommandList, pnPatches, nPatches, m_pGeomipmap->GetLevels(), m_pGeomipmap->GetEdgeMasks());
+		m_nVisiblePatches = m_pGeomipMesh->GetPatchDraws();
+		return;
+	}
+
+#ifdef _WITH_TERRAIN_ADAPTIVE_TESSELLATION
+	if (m_pTessellation && pCamera && (m_pcbMappedTessInfo->m_xmf4PatchGrid.w > 0.0f))
+	{
+		XMFLOAT4X4 xmf4x4Inverse = Matrix4x4::Inverse(m_xmf4x4World);
+		XMFLOAT3 xmf3CameraPosition = Vector3::TransformCoord(pCamera->GetPosition(), xmf4x4Inverse);
+		XMFLOAT4X4 xmf4x4Projection = pCamera->GetProjectionMatrix();
+		m_pTessellation->SetTargetPixelError(TERRAIN_TESS_FACTOR_PIXELS / m_pxmf2TessFactor->x);
+		m_pTessellation->Update(xmf3CameraPosition, CTerrainTessellation::GetProjectionScale(xmf4x4Projection, pCamera->GetViewport().Height), m_pcbMappedTessInfo->m_pPatchFactors);
+	}
+#endif
+
+#ifdef _WITH_TERRAIN_PATCH_CULLING
+	if (m_pGridMesh && m_pQuadtree && pCamera)
+	{
+		XMFLOAT4X4 xmf4x4View = pCamera->GetViewMatrix();
+		XMFLOAT4X4 xmf4x4Projection = pCamera->GetProjectionMatrix();
+		MESHCLUSTERCULLINFO xCullInfo;
+		::GetMeshClusterCullInfo(&m_xmf4x4World, &xmf4x4View, &xmf4x4Projection, &xCullInfo);
+
+		m_nVisiblePatches = m_pQuadtree->Cull(&xCullInfo, m_pnVisiblePatches);
+		m_pGridMesh->Render(pd3dCommandList, m_pnVisiblePatches, m_nVisiblePatches);
+		return;
+	}
+#endif
+	if (m_pGridMesh)
+	{
+		m_pGridMesh->Render(pd3dCommandList, NULL, 0);
+		m_nVisiblePatches = m_pGridMesh->GetPatches();
 	}
 }
 
@@ -1179,18 +1683,6 @@ CDiffuseCube::CDiffuseCube(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList*
 	SetCbvGPUDescriptorHandle(pShader->GetGPUCbvDescriptorStartHandle());
 }
 
-CBullet::CBullet()
-{
-	m_CollisionBox = BoundingOrientedBox(XMFLOAT3(0, 0, 0), XMFLOAT3(0.4f, 0.4f, 1), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
-}
-
-void CBullet::Move(float fTimeElapsed)
-{
-	MoveForward(fTimeElapsed * m_fSpeed);
-
-	m_CollisionBox.Center = GetPosition();
-}
-
 CUI::CUI(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, ID3D12RootSignature* pd3dGraphicsRootSignature, float posX, float posY, float Width, float Height )
 {
 	m_xmf4x4World = Matrix4x4::Identity(); 
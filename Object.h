@@ -6,6 +6,7 @@
 
 #include "Mesh.h"
 #include "Camera.h"
+#include "HeightField.h"
 
 #define DIR_FORWARD					0x01
 #define DIR_BACKWARD				0x02
@@ -21,6 +22,15 @@
 #define RESOURCE_BUFFER				0x05
 
 class CShader;
+class CModelStreamReader;
+class CCookedModelFile;
+class CFrameIndex;
+class CTransformHierarchy;
+class CTransformPose;
+class CTerrainQuadtree;
+class CTerrainTessellation;
+class CTerrainGeomipmap;
+struct CB_TERRAIN_TESS_INFO;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -159,11 +169,13 @@ public:
 	void SetTexture(CTexture *pTexture);
 	void SetShader(CShader *pShader);
 	void SetIlluminatedShader() { SetShader(m_pIlluminatedShader); }
+	void SetPackedIlluminatedShader() { SetShader(m_pPackedIlluminatedShader); }
 
 	void UpdateShaderVariable(ID3D12GraphicsCommandList *pd3dCommandList);
 
 public:
 	static CShader					*m_pIlluminatedShader;
+	static CShader					*m_pPackedIlluminatedShader;
 
 public:
 	static void CMaterial::PrepareShaders(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, ID3D12RootSignature *pd3dGraphicsRootSignature);
@@ -175,14 +187,29 @@ struct CB_GAMEOBJECT_INFO
 };
 
 
+//Counters of the world matrix updates done by CGameObject::UpdateTransform since the last ResetTransformStats
+struct TRANSFORMSTATS
+{
+	int								m_nUpdated = 0; //World matrices recomputed
+	int								m_nSkipped = 0; //Frames visited whose local and parent transforms had not changed
+	int								m_nDeferred = 0; //World matrices the edits would have recomputed when each edit updated its subtree
+};
+
+//Prints the transform counters of every frame to the debug output (CGameFramework::FrameAdvance)
+//#define _WITH_TRANSFORM_STATS
+
 class CGameObject
 {
 private:
-	int								m_nReferences = 0;
+	//Only this object's count: a parent holds one reference on each of its children (SetChild) and releases
+	//them when it is deleted, so AddRef/Release never walk the hierarchy. Interlocked, any thread may attach
+	//or release instances of a shared model.
+	volatile LONG					m_nReferences = 0;
 
 public:
 	void AddRef();
 	void Release();
+	LONG GetReferences() { return(m_nReferences); }
 
 public:
 	CGameObject();
@@ -195,7 +222,16 @@ protected:
 	BoundingOrientedBox				m_CollisionBox;
 
 public:
-	char							m_pstrFrameName[64];
+	char							m_pstrFrameName[64] = { '\0' };
+	UINT							m_nFrameNameHash = 0; //HashFrameName(m_pstrFrameName), set by the loaders
+
+	//Only on the root frame returned by LoadGeometryFromFile; covers the root and everything below it
+	CFrameIndex						*m_pFrameIndex = NULL;
+	//Set on every frame of a loaded model; the root frame (node 0) owns it (TransformHierarchy.h)
+	CTransformHierarchy				*m_pTransformHierarchy = NULL;
+	int								m_nTransformNode = -1;
+	//Own pose of the shared model attached as the only child (CreateTransformPose); the shared frames are not edited
+	CTransformPose					*m_pPose = NULL;
 
 	CMesh							*m_pMesh = NULL;
 
@@ -205,6 +241,12 @@ public:
 	XMFLOAT4X4						m_xmf4x4Transform;
 	XMFLOAT4X4						m_xmf4x4World;
 
+	//m_xmf4x4Transform was edited since the last UpdateTransform; code that writes m_xmf4x4Transform directly calls MarkTransformDirty
+	bool							m_bTransformDirty = true;
+	int								m_nTransformEdits = 0;
+	//The parent matrix of the last UpdateTransform; shared model frames are updated below more than one parent
+	XMFLOAT4X4						*m_pxmf4x4LastParent = NULL;
+
 	CGameObject 					*m_pParent = NULL;
 	CGameObject 					*m_pChild = NULL;
 	CGameObject 					*m_pSibling = NULL;
@@ -222,6 +264,7 @@ public:
 	D3D12_GPU_DESCRIPTOR_HANDLE GetCbvGPUDescriptorHandle() { return(m_d3dCbvGPUDescriptorHandle); }
 
 
+	//bReferenceUpdate: pChild is a shared model (AddRef); otherwise this object owns pChild and becomes its parent
 	void SetChild(CGameObject* pChild, bool bReferenceUpdate = false);
 
 	virtual void BuildMaterials(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList) { }
@@ -231,6 +274,13 @@ public:
 
 	virtual void OnPrepareRender() { }
 	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera=NULL);
+	//Draws the mesh of this frame only
+	void RenderFrame(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, XMFLOAT4X4 *pxmf4x4World);
+	//Render with the root frame blended from pxmf4x4Previous (its transform one simulation tick ago) toward the current
+	//transform (fixed timestep); the world matrices of the last UpdateTransform are read, not updated
+	virtual void RenderInterpolated(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, XMFLOAT4X4 *pxmf4x4Previous, float fInterpolation);
+	//Render with every world matrix post-multiplied by pxmf4x4Offset
+	void RenderOffset(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, XMFLOAT4X4 *pxmf4x4Offset);
 
 	virtual void CreateShaderVariables(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList);
 	virtual void UpdateShaderVariables(ID3D12GraphicsCommandList *pd3dCommandList);
@@ -241,6 +291,9 @@ public:
 
 	virtual void ReleaseUploadBuffers();
 
+	//m_xmf4x4World, or the world matrix in the transform hierarchy for the frames of a loaded model. An edited
+	//frame gets its own world matrix updated under its last parent; the frames below it wait for UpdateTransform
+	XMFLOAT4X4 *GetWorldTransform();
 	XMFLOAT3 GetPosition();
 	XMFLOAT3 GetLook();
 	XMFLOAT3 GetUp();
@@ -258,18 +311,41 @@ public:
 	void Rotate(float fPitch = 10.0f, float fYaw = 10.0f, float fRoll = 10.0f);
 	void Rotate(XMFLOAT3 *pxmf3Axis, float fAngle);
 	void Rotate(XMFLOAT4 *pxmf4Quaternion);
+	//Rotates the local transform about a local axis without touching the world matrices (animated frames of a model)
+	void RotateLocal(XMFLOAT3 *pxmf3Axis, float fAngle);
+	//RotateLocal of pFrame of the model below this object, in this object's pose when it has one
+	void RotateFrame(CGameObject *pFrame, XMFLOAT3 *pxmf3Axis, float fAngle);
 
 	CGameObject *GetParent() { return(m_pParent); }
+	//Edits only mark the frame; UpdateTransform recomputes the edited frames and the frames below them
+	void MarkTransformDirty() { m_bTransformDirty = true; m_nTransformEdits++; }
 	void UpdateTransform(XMFLOAT4X4 *pxmf4x4Parent=NULL);
+	//Exact name match; O(1) below a loaded model root, otherwise walks the siblings and children
 	CGameObject *FindFrame(char *pstrFrameName);
+	CGameObject *FindFrame(char *pstrFrameName, UINT nHash);
 
 	UINT GetMeshType() { return((m_pMesh) ? m_pMesh->GetType() : 0); }
+	void SetMaterials(MATERIALSLOADINFO *pMaterialsInfo);
+	//Builds the frame index and the flattened transform hierarchy of a loaded model root
+	void IndexFrameHierarchy();
+	//Gives this object its own pose of the loaded model attached below it with SetChild
+	void CreateTransformPose();
+
+protected:
+	//Returns the frames visited, siblings included
+	int PropagateTransform(XMFLOAT4X4 *pxmf4x4Parent, bool bParentChanged);
 
 public:
+	static TRANSFORMSTATS			m_xTransformStats;
+
+	static void ResetTransformStats() { m_xTransformStats = TRANSFORMSTATS(); }
+
 	static MATERIALSLOADINFO *LoadMaterialsInfoFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, FILE *pInFile);
 	static CMeshLoadInfo *LoadMeshInfoFromFile(FILE *pInFile);
 
 	static CGameObject *LoadFrameHierarchyFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, ID3D12RootSignature *pd3dGraphicsRootSignature, FILE *pInFile);
+	static CGameObject *LoadFrameHierarchyFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, ID3D12RootSignature *pd3dGraphicsRootSignature, CModelStreamReader *pReader);
+	static CGameObject *LoadFrameHierarchyFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, ID3D12RootSignature *pd3dGraphicsRootSignature, CCookedModelFile *pCookedFile, int *pnFrame);
 	static CGameObject *LoadGeometryFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, ID3D12RootSignature *pd3dGraphicsRootSignature, char *pstrFileName);
 
 	static void PrintFrameInfo(CGameObject *pGameObject, CGameObject *pParent);
@@ -328,19 +404,25 @@ public:
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
+#define TERRAIN_RESIDENT_TILES			64 //Of the height field, the tiles around the player stay mapped
+
 class CHeightMapTerrain : public CGameObject
 {
 public:
-	CHeightMapTerrain(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, ID3D12RootSignature* pd3dGraphicsRootSignature, LPCTSTR pFileName, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, XMFLOAT4 xmf4Color);
+	CHeightMapTerrain(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, ID3D12RootSignature* pd3dGraphicsRootSignature, LPCTSTR pFileName, int nFormat, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, XMFLOAT4 xmf4Color);
 	virtual ~CHeightMapTerrain();
-	void SetMesh(int nIndex, CMesh* pMesh);
 	XMFLOAT2 GetPipelineMode();
 	virtual void CreateShaderVariables(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList);
 	virtual void UpdateShaderVariables(ID3D12GraphicsCommandList* pd3dCommandList);
 	void SetTessellationMode(ID3D12GraphicsCommandList* pd3dCommandList);
 	void ChangePipeLine();
+	//Geomipmapping instead of tessellation (_WITH_TERRAIN_GEOMIPMAPPING)
+	void SetGeomipmapping(bool bGeomipmapping);
+	void ChangeRenderMode() { SetGeomipmapping(!m_bGeomipmapping); }
+	bool IsGeomipmapping() { return(m_bGeomipmapping); }
 private:
-	CHeightMapImage* m_pHeightMapImage;
+	//Cooked from the raw of the constructor (HEIGHT_FIELD_FORMAT_...), its tiles mapped on demand
+	CHeightField					*m_pHeightField = NULL;
 	bool							m_bPipelineStateIndex = 0;
 
 	int								m_nWidth;
@@ -349,18 +431,46 @@ private:
 	XMFLOAT3						m_xmf3Scale;
 	XMFLOAT2						* m_pxmf2TessFactor =NULL;
 
-	CMesh** m_ppMeshes;
-	int								m_nMeshes;
+	//Every patch, in one set of buffers
+	CHeightMapGridMesh				*m_pGridMesh = NULL;
+
+	//Over the patches of m_pGridMesh; Render draws the m_nVisiblePatches that the camera sees
+	CTerrainQuadtree				*m_pQuadtree = NULL;
+	int								*m_pnVisiblePatches = NULL;
+	int								m_nVisiblePatches = 0;
 
 	ID3D12Resource* m_pd3dcbTessFactor = NULL;
+	CB_TERRAIN_TESS_INFO			*m_pcbMappedTessInfo = NULL; //m_pxmf2TessFactor points into it
+
+	//Per patch factors from the camera, written to m_pcbMappedTessInfo by Render
+	CTerrainTessellation			*m_pTessellation = NULL;
+
+	//Every sample in patches of TERRAIN_GEOMIPMAP_PATCH_QUADS, drawn instead of m_pGridMesh at the levels of
+	//m_pGeomipmap while m_bGeomipmapping (pipeline states 2 and 3 of CTerrainShader)
+	CHeightMapGeomipMesh			*m_pGeomipMesh = NULL;
+	CTerrainGeomipmap				*m_pGeomipmap = NULL;
+	CTerrainQuadtree				*m_pGeomipQuadtree = NULL;
+	bool							m_bGeomipmapping = false;
 
 public:
+	virtual void ReleaseUploadBuffers();
 	virtual void Render(ID3D12GraphicsCommandList* pd3dCommandList, CCamera* pCamera = NULL);
-	float GetHeight(float x, float z, bool bReverseQuad = false) { return(m_pHeightMapImage->GetHeight(x, z, bReverseQuad) * m_xmf3Scale.y); } //World
-	XMFLOAT3 GetNormal(float x, float z) { return(m_pHeightMapImage->GetHeightMapNormal(int(x / m_xmf3Scale.x), int(z / m_xmf3Scale.z))); }
-
-	int GetHeightMapWidth() { return(m_pHeightMapImage->GetHeightMapWidth()); }
-	int GetHeightMapLength() { return(m_pHeightMapImage->GetHeightMapLength()); }
+	float GetHeight(float x, float z, bool bReverseQuad = false) { return(m_pHeightField->GetHeight(x, z, bReverseQuad)); } //World
+	bool IntersectSegment(XMFLOAT3& xmf3Start, XMFLOAT3& xmf3End, float *pfHit, XMFLOAT3 *pxmf3Normal = NULL) { return(m_pHeightField->IntersectSegment(xmf3Start, xmf3End, pfHit, pxmf3Normal)); } //World
+	bool IntersectRay(XMFLOAT3& xmf3Origin, XMFLOAT3& xmf3Direction, float fMaxDistance, float *pfDistance, XMFLOAT3 *pxmf3Normal = NULL) { return(m_pHeightField->IntersectRay(xmf3Origin, xmf3Direction, fMaxDistance, pfDistance, pxmf3Normal)); } //World
+	bool IsVisible(XMFLOAT3& xmf3From, XMFLOAT3& xmf3To) { return(m_pHeightField->IsVisible(xmf3From, xmf3To)); } //World
+	XMFLOAT3 GetNormal(float x, float z) { return(m_pHeightField->GetNormal(int(x / m_xmf3Scale.x), int(z / m_xmf3Scale.z))); }
+	//GetHeight and GetNormal of nPoints points at once
+	void GetHeightsAndNormals(float *pfx, float *pfz, int nPoints, float *pfHeights, XMFLOAT3 *pxmf3Normals = NULL, bool bReverseQuad = false);
+
+	int GetHeightMapWidth() { return(m_pHeightField->GetWidth()); }
+	int GetHeightMapLength() { return(m_pHeightField->GetLength()); }
+
+	int GetPatches() { return(m_pGridMesh->GetPatches()); }
+	int GetVisiblePatches() { return(m_nVisiblePatches); } //Drawn by the last Render
+	int GetPatchDraws() { return((m_bGeomipmapping) ? m_pGeomipMesh->GetPatchDraws() : m_pGridMesh->GetPatchDraws()); } //Draw calls of the last Render
+	CTerrainTessellation *GetTessellation() { return(m_pTessellation); }
+	CTerrainGeomipmap *GetGeomipmap() { return(m_pGeomipmap); }
 
 	XMFLOAT3 GetScale() { return(m_xmf3Scale); }
 	float GetWidth() { return(m_nWidth * m_xmf3Scale.x); }
@@ -425,17 +535,6 @@ private:
 
 };
 
-class CBullet : public CGameObject
-{
-public:
-	CBullet();
-	virtual ~CBullet() {}
-
-	void Move(float fTimeElapsed);
-private:
-	float		m_fSpeed= 100;
-};
-
 class CUI : public CGameObject
 {
 public:
@@ -471,7 +570,7 @@ private:
 	XMFLOAT3					m_xmf3RandomPos;
 	CHeightMapTerrain			*m_pTerrain = NULL;
 	int						m_fRandomMoveRange = 100;
-	float						m_fMoveSpeed = 10;
+	float						m_fMoveSpeed = 20;
 
 public:
 	virtual void SetLookAt(XMFLOAT3& xmf3Target, XMFLOAT3& xmf3Up = XMFLOAT3(0.0f, 1.0f, 0.0f));
@@ -174,6 +174,8 @@ void CPlayer::Update(float fTimeElapsed)
 	float fDeceleration = (m_fFriction * fTimeElapsed);
 	if (fDeceleration > fLength) fDeceleration = fLength;
 	m_xmf3Velocity = Vector3::Add(m_xmf3Velocity, Vector3::ScalarProduct(m_xmf3Velocity, -fDeceleration, true));
+
+	UpdateTransformFromAxes();
 }
 
 float CPlayer::GetPlayerSpeed()
@@ -225,12 +227,13 @@ CCamera *CPlayer::OnChangeCamera(DWORD nNewCameraMode, DWORD nCurrentCameraMode)
 	return(pNewCamera);
 }
 
-void CPlayer::OnPrepareRender()
+void CPlayer::UpdateTransformFromAxes()
 {
 	m_xmf4x4Transform._11 = m_xmf3Right.x; m_xmf4x4Transform._12 = m_xmf3Right.y; m_xmf4x4Transform._13 = m_xmf3Right.z;
 	m_xmf4x4Transform._21 = m_xmf3Up.x; m_xmf4x4Transform._22 = m_xmf3Up.y; m_xmf4x4Transform._23 = m_xmf3Up.z;
 	m_xmf4x4Transform._31 = m_xmf3Look.x; m_xmf4x4Transform._32 = m_xmf3Look.y; m_xmf4x4Transform._33 = m_xmf3Look.z;
 	m_xmf4x4Transform._41 = m_xmf3Position.x; m_xmf4x4Transform._42 = m_xmf3Position.y; m_xmf4x4Transform._43 = m_xmf3Position.z;
+	MarkTransformDirty();
 
 	UpdateTransform(NULL);
 }
@@ -241,6 +244,12 @@ void CPlayer::Render(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamer
 	if (nCameraMode == THIRD_PERSON_CAMERA) CGameObject::Render(pd3dCommandList, pCamera);
 }
 
+void CPlayer::RenderInterpolated(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, XMFLOAT4X4 *pxmf4x4Previous, float fInterpolation)
+{
+	DWORD nCameraMode = (pCamera) ? pCamera->GetMode() : 0x00;
+	if (nCameraMode == THIRD_PERSON_CAMERA) CGameObject::RenderInterpolated(pd3dCommandList, pCamera, pxmf4x4Previous, fInterpolation);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // CAirplanePlayer
 
@@ -279,30 +288,36 @@ void CAirplanePlayer::OnInitialize()
 
 void CAirplanePlayer::Animate(float fTimeElapsed, XMFLOAT4X4 *pxmf4x4Parent)
 {
-	if (m_pMainRotorFrame)
-	{
-		XMMATRIX xmmtxRotate = XMMatrixRotationZ(XMConvertToRadians(300.f) * fTimeElapsed);
-		m_pMainRotorFrame->m_xmf4x4Transform = Matrix4x4::Multiply(xmmtxRotate, m_pMainRotorFrame->m_xmf4x4Transform);
-	}
-	if (m_pTailRotorFrame)
-	{
-		XMMATRIX xmmtxRotate = XMMatrixRotationZ(XMConvertToRadians(300.0f) * fTimeElapsed);
-		m_pTailRotorFrame->m_xmf4x4Transform = Matrix4x4::Multiply(xmmtxRotate, m_pTailRotorFrame->m_xmf4x4Transform);
-	}
+	XMFLOAT3 xmf3RotorAxis(0.0f, 0.0f, 1.0f);
+	if (m_pMainRotorFrame) m_pMainRotorFrame->RotateLocal(&xmf3RotorAxis, 300.0f * fTimeElapsed);
+	if (m_pTailRotorFrame) m_pTailRotorFrame->RotateLocal(&xmf3RotorAxis, 300.0f * fTimeElapsed);
+
 
 	CPlayer::Animate(fTimeElapsed, pxmf4x4Parent);
 }
 
-void CAirplanePlayer::OnPrepareRender()
-{
-	CPlayer::OnPrepareRender();
-}
 void CAirplanePlayer::OnPlayerUpdateCallback(float fTimeElapsed)
 {
 	float fHeight = m_pTerrain->GetHeight(m_xmf3Position.x, m_xmf3Position.z);
 	if (GetPosition().y < fHeight) m_xmf3Position.y = fHeight;
 }
 
+void CAirplanePlayer::OnCameraUpdateCallback(float fTimeElapsed)
+{
+	//Pulls the third person camera in front of the terrain between it and the player
+	if (m_pCamera->GetMode() != THIRD_PERSON_CAMERA) return;
+
+	XMFLOAT3 xmf3Target = GetPosition();
+	xmf3Target.y += 3.0f;
+	XMFLOAT3 xmf3CameraPosition = m_pCamera->GetPosition();
+	float fHit;
+	if (m_pTerrain->IntersectSegment(xmf3Target, xmf3CameraPosition, &fHit))
+	{
+		XMFLOAT3 xmf3Offset = Vector3::Subtract(xmf3CameraPosition, xmf3Target);
+		m_pCamera->SetPosition(Vector3::Add(xmf3Target, xmf3Offset, fHit * 0.9f));
+	}
+}
+
 CCamera *CAirplanePlayer::ChangeCamera(DWORD nNewCameraMode, float fTimeElapsed)
 {
 	DWORD nCurrentCameraMode = (m_pCamera) ? m_pCamera->GetMode() : 0x00;
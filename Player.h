@@ -81,8 +81,10 @@ public:
 	CCamera *OnChangeCamera(DWORD nNewCameraMode, DWORD nCurrentCameraMode);
 
 	virtual CCamera *ChangeCamera(DWORD nNewCameraMode, float fTimeElapsed) { return(NULL); }
-	virtual void OnPrepareRender();
+	//m_xmf4x4Transform from the position and the axes; Update calls it, so rendering finds the transform of the last tick
+	void UpdateTransformFromAxes();
 	virtual void Render(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera = NULL);
+	virtual void RenderInterpolated(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, XMFLOAT4X4 *pxmf4x4Previous, float fInterpolation);
 };
 
 class CAirplanePlayer : public CPlayer
@@ -100,8 +102,8 @@ private:
 
 public:
 	virtual void OnPlayerUpdateCallback(float fTimeElapsed);
+	virtual void OnCameraUpdateCallback(float fTimeElapsed);
 	virtual CCamera *ChangeCamera(DWORD nNewCameraMode, float fTimeElapsed);
-	virtual void OnPrepareRender();
 };
 
 
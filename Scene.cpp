@@ -5,6 +5,7 @@
 #include "stdafx.h"
 #include "Scene.h"
 
+
 CGameScene::CGameScene()
 {
 }
@@ -61,7 +62,7 @@ void CGameScene::BuildObjects(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandLis
 	CMaterial::PrepareShaders(pd3dDevice, pd3dCommandList, m_pd3dGraphicsRootSignature);
 	XMFLOAT3 xmf3Scale(4.0f, 6.0f, 4.0f);
 	XMFLOAT4 xmf4Color(0.6f, 0.5f, 0.2f, 0.0f);
-	m_pTerrain = new CHeightMapTerrain(pd3dDevice, pd3dCommandList, m_pd3dGraphicsRootSignature, _T("Image/terrain.raw"), 257, 257, 9, 9, xmf3Scale, xmf4Color);
+	m_pTerrain = new CHeightMapTerrain(pd3dDevice, pd3dCommandList, m_pd3dGraphicsRootSignature, TERRAIN_HEIGHT_MAP_FILE, TERRAIN_HEIGHT_MAP_FORMAT, TERRAIN_WIDTH, TERRAIN_LENGTH, 9, 9, xmf3Scale, xmf4Color);
 	xmf3Scale = XMFLOAT3(8.0f, 1.0f, 8.0f);
 	m_pWater = new CWater(pd3dDevice, pd3dCommandList, m_pd3dGraphicsRootSignature, 128, 128, 128, 128, xmf3Scale);
 	BuildDefaultLightsAndMaterials();
@@ -70,12 +71,15 @@ void CGameScene::BuildObjects(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandLis
 
 	m_pPlayer = new CAirplanePlayer(pd3dDevice, pd3dCommandList, m_pd3dGraphicsRootSignature);
 	m_pPlayer->SetPosition(XMFLOAT3(625, m_pTerrain->GetHeight(625, 425) + 3, 425));
+	m_pPlayer->UpdateTransformFromAxes();
 	//m_pPlayer->SetPosition(XMFLOAT3(0, 0, 0));
 
 	m_pPlayer->SetTerrain(m_pTerrain);
+	m_pPlayer->SetCameraUpdatedContext(m_pTerrain);
 
 	m_nGameObjects = 6;
 	m_ppVillains = new CVillainObject*[m_nGameObjects];
+	m_pxmf4x4PreviousVillains = new XMFLOAT4X4[m_nGameObjects];
 
 	CGameObject *pApacheModel = CGameObject::LoadGeometryFromFile(pd3dDevice, pd3dCommandList, m_pd3dGraphicsRootSignature, "Model/helicopter.bin");
 	CVillainObject* pApacheObject = NULL;
@@ -119,7 +123,11 @@ void CGameScene::BuildObjects(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandLis
 	pApacheObject->OnInitialize(XMFLOAT3(165, 153, 408));
 	m_ppVillains[5] = pApacheObject;
 
-	m_pBulletList = new list<CBullet*>();
+	m_pBulletPool = new CBulletPool(BULLET_POOL_CAPACITY);
+	m_pVillainGrid = new CCollisionGrid(0.0f, 0.0f, m_pTerrain->GetWidth(), m_pTerrain->GetLength(), COLLISION_GRID_CELL_SIZE);
+	m_pxmVillainBoxes = new BoundingOrientedBox[m_nGameObjects];
+	m_pnVillainBoxes = new int[m_nGameObjects];
+	m_pVillainBatch = new CBoxBatch(m_nGameObjects);
 	m_pBulletModel = new CDiffuseCube(pd3dDevice, pd3dCommandList, m_pd3dGraphicsRootSignature, 0.4f , 0.4f, 1);
 	m_pBulletModel->SetPosition(0,0,0);
 
@@ -128,6 +136,8 @@ void CGameScene::BuildObjects(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandLis
 	m_pBillboardShader->BuildObjects(pd3dDevice, pd3dCommandList, m_pTerrain);
 
 	CreateShaderVariables(pd3dDevice, pd3dCommandList);
+
+	BeginTick();
 }
 
 void CGameScene::ReleaseObjects()
@@ -139,12 +149,14 @@ void CGameScene::ReleaseObjects()
 		for (int i = 0; i < m_nGameObjects; i++) if (m_ppVillains[i]) m_ppVillains[i]->Release();
 		delete[] m_ppVillains;
 	}
+	if (m_pxmf4x4PreviousVillains) delete[] m_pxmf4x4PreviousVillains;
 
-	for (auto p : *m_pBulletList)
-	{
-		p->Release();
-	}
-	delete m_pBulletList;
+	if (m_pBulletPool) delete m_pBulletPool;
+	if (m_pBulletModel) m_pBulletModel->Release();
+	if (m_pVillainGrid) delete m_pVillainGrid;
+	if (m_pxmVillainBoxes) delete[] m_pxmVillainBoxes;
+	if (m_pnVillainBoxes) delete[] m_pnVillainBoxes;
+	if (m_pVillainBatch) delete m_pVillainBatch;
 
 	m_pWater->Release();;
 	if (m_pSkyBox) delete m_pSkyBox;
@@ -204,7 +216,7 @@ ID3D12RootSignature *CGameScene::CreateGraphicsRootSignature(ID3D12Device *pd3dD
 	pd3dRootParameters[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
 
 	pd3dRootParameters[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
-	pd3dRootParameters[1].Constants.Num32BitValues = 32;
+	pd3dRootParameters[1].Constants.Num32BitValues = 40; //World(16) + Material(16) + packed position scale/bias(8)
 	pd3dRootParameters[1].Constants.ShaderRegister = 2; //GameObject
 	pd3dRootParameters[1].Constants.RegisterSpace = 0;
 	pd3dRootParameters[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
@@ -319,6 +331,7 @@ void CGameScene::ReleaseShaderVariables()
 
 void CGameScene::ReleaseUploadBuffers()
 {
+	if (m_pTerrain) m_pTerrain->ReleaseUploadBuffers();
 	for (int i = 0; i < m_nGameObjects; i++) m_ppVillains[i]->ReleaseUploadBuffers();
 }
 
@@ -349,6 +362,16 @@ bool CGameScene::ProcessInput(UCHAR *pKeysBuffer)
 	return(false);
 }
 
+void CGameScene::BeginTick()
+{
+	for (int i = 0; i < m_nGameObjects; i++)
+	{
+		if (m_ppVillains[i]) m_pxmf4x4PreviousVillains[i] = m_ppVillains[i]->m_xmf4x4Transform;
+	}
+	m_xmf4x4PreviousPlayer = m_pPlayer->m_xmf4x4Transform;
+	m_xmf3PreviousCamera = m_pPlayer->GetCamera()->GetPosition();
+}
+
 void CGameScene::AnimateObjects(float fTimeElapsed, ID3D12GraphicsCommandList* pd3dCommandList)
 {
 	m_fElapsedTime = fTimeElapsed;
@@ -371,6 +394,26 @@ void CGameScene::AnimateObjects(float fTimeElapsed, ID3D12GraphicsCommandList* p
 	}
 	m_pPlayer->Animate(fTimeElapsed, NULL);
 
+	m_nVillainBoxes = 0;
+	for (int i = 0; i < m_nGameObjects; i++)
+	{
+		if (m_ppVillains[i] && !m_ppVillains[i]->m_bFalling)
+		{
+			m_pxmVillainBoxes[m_nVillainBoxes] = m_ppVillains[i]->GetCollisionBox();
+			m_pnVillainBoxes[m_nVillainBoxes++] = i;
+		}
+	}
+	//The bullets are rotated freely against the villains: both phases grow the villain boxes by the bullet's bounding radius
+	m_pVillainGrid->Build(m_pxmVillainBoxes, m_nVillainBoxes, BULLET_BOUNDING_RADIUS);
+	XMFLOAT3 xmf3BulletMargin(BULLET_BOUNDING_RADIUS, BULLET_BOUNDING_RADIUS, BULLET_BOUNDING_RADIUS);
+	m_pVillainBatch->SetBoxes(m_pxmVillainBoxes, m_nVillainBoxes, xmf3BulletMargin);
+
+	m_pBulletPool->Move(fTimeElapsed);
+	for (int i = m_pBulletPool->GetBullets() - 1; i >= 0; i--)
+	{
+		if (BulletCollision(*m_pBulletPool->GetPosition(i), *m_pBulletPool->GetVelocity(i), fTimeElapsed)) m_pBulletPool->Despawn(i);
+	}
+
 	m_pBillboardShader->AnimateObjects(fTimeElapsed);
 
 	if (m_pLights)
@@ -385,6 +428,11 @@ void CGameScene::Render(ID3D12GraphicsCommandList *pd3dCommandList, D3D12_CPU_DE
 {
 	pd3dCommandList->SetGraphicsRootSignature(m_pd3dGraphicsRootSignature);
 
+	//The camera, the player, the villains and the bullets are drawn m_fInterpolation of the way through the last tick
+	XMFLOAT3 xmf3Camera = pCamera->GetPosition();
+	pCamera->SetPosition(Vector3::Add(Vector3::ScalarProduct(m_xmf3PreviousCamera, 1.0f - m_fInterpolation, false), Vector3::ScalarProduct(xmf3Camera, m_fInterpolation, false)));
+	pCamera->RegenerateViewMatrix();
+
 	pCamera->SetViewportsAndScissorRects(pd3dCommandList);
 	pCamera->UpdateShaderVariables(pd3dCommandList);
 
@@ -396,30 +444,13 @@ void CGameScene::Render(ID3D12GraphicsCommandList *pd3dCommandList, D3D12_CPU_DE
 	if (m_pSkyBox) m_pSkyBox->Render(pd3dCommandList, pCamera);
 
 	m_pTerrain->Render(pd3dCommandList, pCamera);
-	m_pPlayer->Render(pd3dCommandList, pCamera);
+	m_pPlayer->RenderInterpolated(pd3dCommandList, pCamera, &m_xmf4x4PreviousPlayer, m_fInterpolation);
 	for (int i = 0; i < m_nGameObjects; i++)
 	{
-		if (m_ppVillains[i])
-		{
-			m_ppVillains[i]->Animate(m_fElapsedTime);
-			m_ppVillains[i]->UpdateTransform(NULL);
-			m_ppVillains[i]->Render(pd3dCommandList, pCamera);
-		}
+		if (m_ppVillains[i]) m_ppVillains[i]->RenderInterpolated(pd3dCommandList, pCamera, &m_pxmf4x4PreviousVillains[i], m_fInterpolation);
 	}
 
-	list<CBullet*>::iterator iter = m_pBulletList->begin();
-	list<CBullet*>::iterator iter_end = m_pBulletList->end();
-	for (iter;iter!= iter_end; iter++)
-	{
-		(*iter)->Move(m_fElapsedTime);
-		(*iter)->UpdateTransform(NULL);
-		(*iter)->Render(pd3dCommandList, pCamera);
-		if (BulletCollision(*iter))
-		{
-			iter = m_pBulletList->erase(iter);
-			if (iter == iter_end) break;
-		}
-	}
+	m_pBulletPool->Render(pd3dCommandList, pCamera, m_pBulletModel, (1.0f - m_fInterpolation) * m_fElapsedTime);
 	
 	if(m_bShowBillboards)
 		m_pBillboardShader->Render(pd3dCommandList, pCamera);
@@ -429,6 +460,9 @@ void CGameScene::Render(ID3D12GraphicsCommandList *pd3dCommandList, D3D12_CPU_DE
 	pd3dCommandList->OMSetStencilRef(1);
 	m_pWater->UpdateShaderVariables(pd3dCommandList);
 	m_pWater->Render(pd3dCommandList, pCamera);
+
+	pCamera->SetPosition(xmf3Camera);
+	pCamera->RegenerateViewMatrix();
 }
 
 void CGameScene::SetTessellationMode(ID3D12GraphicsCommandList* pd3dCommandList)
@@ -438,31 +472,32 @@ void CGameScene::SetTessellationMode(ID3D12GraphicsCommandList* pd3dCommandList)
 
 void CGameScene::CreateBullet()
 {
-	CBullet* pBullet = new CBullet();
-	pBullet->SetChild(m_pBulletModel, true);
-	pBullet->m_xmf4x4Transform = m_pPlayer->m_xmf4x4Transform;
-	pBullet->UpdateTransform(NULL);
-	m_pBulletList->push_back(pBullet);
+	m_pBulletPool->Spawn(&m_pPlayer->m_xmf4x4Transform, BULLET_SPEED, BULLET_LIFETIME);
 }
 
-bool CGameScene::BulletCollision(CBullet* pBullet)
+bool CGameScene::BulletCollision(XMFLOAT3& xmf3Position, XMFLOAT3& xmf3Velocity, float fTimeElapsed)
 {
-	XMFLOAT3 pos = pBullet->GetPosition();
-	if (m_pTerrain->GetHeight(pos.x, pos.z) > pos.y)
-		return true;
-	else if (pos.x < 0 || pos.x >900 || pos.z < 0 || pos.z > 900)
-		return true;
+	XMFLOAT3 xmf3Start = Vector3::Add(xmf3Position, xmf3Velocity, -fTimeElapsed);
 
-	for (int i = 0; i< m_nGameObjects; i++){
-		if (!m_ppVillains[i]) continue;
-		if (m_ppVillains[i]->m_bFalling) continue;
+	//The earliest hit on the step counts, so a bullet can not pass through a ridge or a villain between two frames
+	float fHit, fVillainHit;
+	if (!m_pTerrain->IntersectSegment(xmf3Start, xmf3Position, &fHit)) fHit = FLT_MAX;
 
-		if (pBullet->GetCollisionBox().Intersects(m_ppVillains[i]->GetCollisionBox()))
-		{
-			m_ppVillains[i]->m_bFalling = true;
-			return true;
-		}
+	//Only the villains in the grid cells the step crosses, four boxes per test; a villain hit earlier this frame is
+	//still in the grid but disabled in the batch
+	int nCandidates, *pnCandidates = m_pVillainGrid->GetCandidates(xmf3Start, xmf3Position, &nCandidates);
+	int nHitBox = m_pVillainBatch->IntersectSegment(xmf3Start, xmf3Position, pnCandidates, nCandidates, &fVillainHit);
+	if ((nHitBox >= 0) && (fVillainHit < fHit))
+	{
+		m_ppVillains[m_pnVillainBoxes[nHitBox]]->m_bFalling = true;
+		m_pVillainBatch->DisableBox(nHitBox);
+		return true;
 	}
+
+	if (fHit <= 1.0f)
+		return true;
+	else if (xmf3Position.x < 0 || xmf3Position.x >900 || xmf3Position.z < 0 || xmf3Position.z > 900)
+		return true;
 	return false;
 }
 
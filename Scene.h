@@ -6,7 +6,16 @@
 
 #include "Shader.h"
 #include "Player.h"
-#include <list>
+#include "BulletPool.h"
+#include "CollisionGrid.h"
+#include "BoxBatch.h"
+
+//The raw terrain height map the scene is built on (HEIGHT_FIELD_FORMAT_..., the shipped one is 8-bit; a 16-bit or float
+//raw only needs its format here); samples across and along. The terrain reads it cooked, Image/terrain.hfld
+#define TERRAIN_HEIGHT_MAP_FILE	_T("Image/terrain.raw")
+#define TERRAIN_HEIGHT_MAP_FORMAT	HEIGHT_FIELD_FORMAT_R8
+#define TERRAIN_WIDTH		257
+#define TERRAIN_LENGTH		257
 
 #define MAX_LIGHTS			16 
 
@@ -58,12 +67,17 @@ public:
 	ID3D12RootSignature* GetGraphicsRootSignature() { return(m_pd3dGraphicsRootSignature);}
 
 	virtual bool ProcessInput(UCHAR* pKeysBuffer) { return false; }
+	//Fixed timestep: BeginTick keeps the state before every simulation tick (AnimateObjects), Render draws between
+	//that state and the current one at SetInterpolation (0: the previous tick, 1: the last tick)
+	virtual void BeginTick() {}
 	virtual void AnimateObjects(float fTimeElapsed, ID3D12GraphicsCommandList* pd3dCommandList) {}
+	void SetInterpolation(float fInterpolation) { m_fInterpolation = fInterpolation; }
 	virtual void Render(ID3D12GraphicsCommandList* pd3dCommandList, D3D12_CPU_DESCRIPTOR_HANDLE dsvHandle, CCamera* pCamera = NULL) {}
 	virtual void ReleaseUploadBuffers() {}
 protected:
 
 	ID3D12RootSignature* m_pd3dGraphicsRootSignature = NULL;
+	float				m_fInterpolation = 1.0f;
 
 };
 
@@ -102,7 +116,9 @@ public:
 	void BuildDefaultLightsAndMaterials();
 	virtual void ReleaseObjects();
 
-	bool BulletCollision(CBullet* pBullet);
+	//Swept over the last step of the bullet (back to xmf3Position - xmf3Velocity * fTimeElapsed)
+	bool BulletCollision(XMFLOAT3& xmf3Position, XMFLOAT3& xmf3Velocity, float fTimeElapsed);
+	virtual void BeginTick();
 	virtual void AnimateObjects(float fTimeElapsed, ID3D12GraphicsCommandList* pd3dCommandList);
 
 	virtual bool ProcessInput(UCHAR* pKeysBuffer);
@@ -128,8 +144,16 @@ public:
 	CSkyBox*					m_pSkyBox = NULL;
 	CGameObject*				 m_pBulletModel = NULL;
 	CVillainObject					**m_ppVillains = NULL;
-	list<CBullet*>			 *m_pBulletList = NULL;
+	CBulletPool					*m_pBulletPool = NULL;
+	CCollisionGrid				*m_pVillainGrid = NULL;
+	BoundingOrientedBox			*m_pxmVillainBoxes = NULL; //Boxes of the villains bullets can hit this frame (m_pVillainGrid)
+	CBoxBatch					*m_pVillainBatch = NULL; //The same boxes grown by the bullet's half extents, for the swept test
+	int							*m_pnVillainBoxes = NULL; //Index into m_ppVillains of every box
+	int							m_nVillainBoxes = 0;
 	int							m_nGameObjects = 0;
+	XMFLOAT4X4					*m_pxmf4x4PreviousVillains = NULL; //Transforms before the last tick (BeginTick)
+	XMFLOAT4X4					m_xmf4x4PreviousPlayer;
+	XMFLOAT3					m_xmf3PreviousCamera;
 
 	LIGHT						*m_pLights = NULL;
 	int							m_nLights = 0;
@@ -4,6 +4,7 @@
 
 #include "stdafx.h"
 #include "Shader.h"
+#include "VertexPacking.h"
 #include <iostream>
 #include <fstream>
 
@@ -251,6 +252,16 @@ void CShader::CreateCbvSrvDescriptorHeaps(ID3D12Device * pd3dDevice, ID3D12Graph
 
 }
 
+void CShader::ShareCbvSrvDescriptorHeap(CShader *pShader)
+{
+	m_pd3dCbvSrvDescriptorHeap = pShader->m_pd3dCbvSrvDescriptorHeap;
+
+	m_d3dCbvCPUDescriptorStartHandle = pShader->m_d3dCbvCPUDescriptorStartHandle;
+	m_d3dCbvGPUDescriptorStartHandle = pShader->m_d3dCbvGPUDescriptorStartHandle;
+	m_d3dSrvCPUDescriptorStartHandle = pShader->m_d3dSrvCPUDescriptorStartHandle;
+	m_d3dSrvGPUDescriptorStartHandle = pShader->m_d3dSrvGPUDescriptorStartHandle;
+}
+
 void CShader::CreateConstantBufferViews(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, int nConstantBufferViews, ID3D12Resource *pd3dConstantBuffers, UINT nStride)
 {
 	D3D12_GPU_VIRTUAL_ADDRESS d3dGpuVirtualAddress = pd3dConstantBuffers->GetGPUVirtualAddress();
@@ -414,6 +425,36 @@ void CIlluminatedShader::Render(ID3D12GraphicsCommandList *pd3dCommandList, CCam
 	OnPrepareRender(pd3dCommandList, nPipelineState);
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+CPackedIlluminatedShader::CPackedIlluminatedShader()
+{
+}
+
+CPackedIlluminatedShader::~CPackedIlluminatedShader()
+{
+}
+
+D3D12_INPUT_LAYOUT_DESC CPackedIlluminatedShader::CreateInputLayout()
+{
+	PACKEDVERTEXLAYOUT xLayout;
+	::GetPackedVertexLayout(PACKED_VERTEX_FLAGS, &xLayout);
+
+	D3D12_INPUT_ELEMENT_DESC *pd3dInputElementDescs = new D3D12_INPUT_ELEMENT_DESC[VERTEX_PACK_INPUT_ELEMENTS];
+
+	D3D12_INPUT_LAYOUT_DESC d3dInputLayoutDesc;
+	d3dInputLayoutDesc.pInputElementDescs = pd3dInputElementDescs;
+	d3dInputLayoutDesc.NumElements = ::CreatePackedInputElementDescs(&xLayout, pd3dInputElementDescs);
+
+	return(d3dInputLayoutDesc);
+}
+
+D3D12_SHADER_BYTECODE CPackedIlluminatedShader::CreateVertexShader()
+{
+	return(CShader::CompileShaderFromFile(L"Shaders.hlsl", "VSPackedLighting", "vs_5_1", &m_pd3dVertexShaderBlob));
+}
+
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
 CTerrainShader::CTerrainShader()
@@ -463,7 +504,7 @@ D3D12_SHADER_BYTECODE CTerrainShader::CreateDomainShader()
 
 void CTerrainShader::CreateShader(ID3D12Device* pd3dDevice, ID3D12RootSignature* pd3dGraphicsRootSignature, UINT nRenderTargets)
 {
-	m_nPipelineStates = 2;
+	m_nPipelineStates = 4;
 	m_ppd3dPipelineStates = new ID3D12PipelineState * [m_nPipelineStates];
 
 	::ZeroMemory(&m_d3dPipelineStateDesc, sizeof(D3D12_GRAPHICS_PIPELINE_STATE_DESC));
@@ -490,6 +531,20 @@ void CTerrainShader::CreateShader(ID3D12Device* pd3dDevice, ID3D12RootSignature*
 
 	hResult = pd3dDevice->CreateGraphicsPipelineState(&m_d3dPipelineStateDesc, __uuidof(ID3D12PipelineState), (void**)&m_ppd3dPipelineStates[1]);
 
+	//Geomipmapping (CHeightMapGeomipMesh): triangles straight from the vertex shader, solid and wireframe
+	ID3DBlob *pd3dGeomipmapVertexShaderBlob = NULL;
+	m_d3dPipelineStateDesc.VS = CShader::CompileShaderFromFile(L"Shaders.hlsl", "VSTerrainGeomipmap", "vs_5_1", &pd3dGeomipmapVertexShaderBlob);
+	::ZeroMemory(&m_d3dPipelineStateDesc.HS, sizeof(D3D12_SHADER_BYTECODE));
+	::ZeroMemory(&m_d3dPipelineStateDesc.DS, sizeof(D3D12_SHADER_BYTECODE));
+	m_d3dPipelineStateDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+	m_d3dPipelineStateDesc.RasterizerState.FillMode = D3D12_FILL_MODE_SOLID;
+
+	hResult = pd3dDevice->CreateGraphicsPipelineState(&m_d3dPipelineStateDesc, __uuidof(ID3D12PipelineState), (void**)&m_ppd3dPipelineStates[2]);
+	m_d3dPipelineStateDesc.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
+
+	hResult = pd3dDevice->CreateGraphicsPipelineState(&m_d3dPipelineStateDesc, __uuidof(ID3D12PipelineState), (void**)&m_ppd3dPipelineStates[3]);
+
+	if (pd3dGeomipmapVertexShaderBlob) pd3dGeomipmapVertexShaderBlob->Release();
 	if (m_pd3dVertexShaderBlob) m_pd3dVertexShaderBlob->Release();
 	if (m_pd3dPixelShaderBlob) m_pd3dPixelShaderBlob->Release();
 	if (m_pd3dHullShaderBlob) m_pd3dHullShaderBlob->Release();
@@ -17,6 +17,8 @@ cbuffer cbGameObjectInfo : register(b2)
 {
 	matrix					gmtxGameObject : packoffset(c0);
 	MATERIAL				gMaterial : packoffset(c4);
+	float4					gf4PositionScale : packoffset(c8); //VSPackedLighting only
+	float4					gf4PositionBias : packoffset(c9);
 };
 
 cbuffer cbWaterWave : register(b5)
@@ -24,9 +26,18 @@ cbuffer cbWaterWave : register(b5)
 	float					gfWaterWave : packoffset(c0);
 };
 
+struct TERRAINTESSFACTORS
+{
+	float4					f4Edges; //SV_TessFactor: u = 0, v = 0, u = 1, v = 1
+	float2					f2Insides;
+};
+
+//CB_TERRAIN_TESS_INFO of TerrainTessellation.h
 cbuffer cbTessFactor : register(b6)
 {
 	float2					gfTessFactor : packoffset(c0); //x : tessfactor , y : tessinsidefactor
+	float4					gf4TessPatchGrid : packoffset(c1); //x, y: 1 / the width and length of a patch, z: patches along x, w: 1 with per patch factors
+	TERRAINTESSFACTORS		gTessPatchFactors[1024] : packoffset(c2); //TERRAIN_MAX_TESS_PATCHES
 };
 
 
@@ -111,6 +122,38 @@ VS_LIGHTING_OUTPUT VSLighting(VS_LIGHTING_INPUT input)
 	return(output);
 }
 
+struct VS_PACKED_LIGHTING_INPUT
+{
+	float3 position : POSITION; //R32G32B32_FLOAT or R16G16B16A16_UNORM
+	float2 normal : NORMAL; //R16G16_SNORM octahedral
+	float2 uv : TEXCOORD; //R16G16_FLOAT
+};
+
+float3 OctahedralDecode(float2 f2Encoded)
+{
+	float3 f3Normal = float3(f2Encoded.x, f2Encoded.y, 1.0f - abs(f2Encoded.x) - abs(f2Encoded.y));
+	float t = saturate(-f3Normal.z);
+	f3Normal.xy += (f3Normal.xy >= 0.0f) ? -t : t;
+
+	return(normalize(f3Normal));
+}
+
+VS_LIGHTING_OUTPUT VSPackedLighting(VS_PACKED_LIGHTING_INPUT input)
+{
+	VS_LIGHTING_OUTPUT output;
+
+	float3 f3Position = input.position * gf4PositionScale.xyz + gf4PositionBias.xyz;
+	output.normalW = mul(OctahedralDecode(input.normal), (float3x3)gmtxGameObject);
+	output.positionW = (float3)mul(float4(f3Position, 1.0f), gmtxGameObject);
+	output.position = mul(mul(float4(output.positionW, 1.0f), gmtxView), gmtxProjection);
+#ifdef _WITH_VERTEX_LIGHTING
+	output.normalW = normalize(output.normalW);
+	output.color = Lighting(output.positionW, output.normalW);
+#endif
+	output.uv = input.uv;
+	return(output);
+}
+
 float4 PSLighting(VS_LIGHTING_OUTPUT input) : SV_TARGET
 {
 #ifdef _WITH_VERTEX_LIGHTING
@@ -226,6 +269,20 @@ HS_TERRAIN_TESSELLATION_OUTPUT HSTerrainTessellation(InputPatch<VS_TERRAIN_OUTPU
 
 HS_TERRAIN_TESSELLATION_CONSTANT VSTerrainTessellationConstant(InputPatch<VS_TERRAIN_OUTPUT, 25> input)
 {
+	if (gf4TessPatchGrid.w > 0.0f)
+	{
+		//The first control point is the corner of the patch at its least x and greatest z
+		int nPatch = (int)round(input[0].position.x * gf4TessPatchGrid.x) + ((int)round(input[0].position.z * gf4TessPatchGrid.y) - 1) * (int)gf4TessPatchGrid.z;
+		HS_TERRAIN_TESSELLATION_CONSTANT patchOutput;
+		patchOutput.fTessEdges[0] = gTessPatchFactors[nPatch].f4Edges.x;
+		patchOutput.fTessEdges[1] = gTessPatchFactors[nPatch].f4Edges.y;
+		patchOutput.fTessEdges[2] = gTessPatchFactors[nPatch].f4Edges.z;
+		patchOutput.fTessEdges[3] = gTessPatchFactors[nPatch].f4Edges.w;
+		patchOutput.fTessInsides[0] = gTessPatchFactors[nPatch].f2Insides.x;
+		patchOutput.fTessInsides[1] = gTessPatchFactors[nPatch].f2Insides.y;
+		return(patchOutput);
+	}
+
 
 	float3 vCenter;
 	for (int i = 0; i < 25; i++)
@@ -268,6 +325,24 @@ DS_TERRAIN_TESSELLATION_OUTPUT DSTerrainTessellation(HS_TERRAIN_TESSELLATION_CON
 	return(output);
 }
 
+//Geomipmapping (CHeightMapGeomipMesh): the samples themselves as triangles, with the gradation of VSTerrain
+DS_TERRAIN_TESSELLATION_OUTPUT VSTerrainGeomipmap(VS_TERRAIN_INPUT input)
+{
+	DS_TERRAIN_TESSELLATION_OUTPUT output;
+
+	output.color = input.color;
+	if (input.position.y > 170) {
+		float gradation = (input.position.y - 170) / 100.f;
+		output.color += gradation * float4(1, 1, 1, 1);
+	}
+	matrix mtxWorldViewProjection = mul(mul(gmtxGameObject, gmtxView), gmtxProjection);
+	output.position = mul(float4(input.position, 1.0f), mtxWorldViewProjection);
+	output.uv0 = input.uv0;
+	output.uv1 = input.uv1;
+
+	return(output);
+}
+
 
 float4 PSTerrain(DS_TERRAIN_TESSELLATION_OUTPUT input) : SV_TARGET
 {
@@ -0,0 +1,293 @@
+//-----------------------------------------------------------------------------
+// File: TerrainGeomipmap.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "TerrainGeomipmap.h"
+
+CTerrainGeomipmap::CTerrainGeomipmap(int cxPatches, int czPatches, int nLevels, XMFLOAT3 *pxmf3Centers, XMFLOAT3 *pxmf3Extents)
+{
+	m_cxPatches = cxPatches;
+	m_czPatches = czPatches;
+	m_nLevels = nLevels;
+
+	int nPatches = cxPatches * czPatches;
+	m_pxmf3Centers = new XMFLOAT3[nPatches];
+	m_pxmf3Extents = new XMFLOAT3[nPatches];
+	m_pnLevels = new int[nPatches];
+	m_pnEdgeMasks = new BYTE[nPatches];
+	for (int i = 0; i < nPatches; i++)
+	{
+		m_pxmf3Centers[i] = pxmf3Centers[i];
+		m_pxmf3Extents[i] = pxmf3Extents[i];
+		m_pnLevels[i] = 0;
+		m_pnEdgeMasks[i] = 0;
+	}
+}
+
+CTerrainGeomipmap::~CTerrainGeomipmap()
+{
+	if (m_pxmf3Centers) delete[] m_pxmf3Centers;
+	if (m_pxmf3Extents) delete[] m_pxmf3Extents;
+	if (m_pnLevels) delete[] m_pnLevels;
+	if (m_pnEdgeMasks) delete[] m_pnEdgeMasks;
+}
+
+int CTerrainGeomipmap::GetPatchLevel(int nPatch, XMFLOAT3& xmf3CameraPosition)
+{
+	XMFLOAT3& c = m_pxmf3Centers[nPatch], &e = m_pxmf3Extents[nPatch];
+	float dx = max(fabsf(xmf3CameraPosition.x - c.x) - e.x, 0.0f);
+	float dy = max(fabsf(xmf3CameraPosition.y - c.y) - e.y, 0.0f);
+	float dz = max(fabsf(xmf3CameraPosition.z - c.z) - e.z, 0.0f);
+	float fDistance = sqrtf(dx * dx + dy * dy + dz * dz);
+
+	//Level l (l > 0) covers [m_fLodDistance * 2^(l-1), m_fLodDistance * 2^l)
+	if (fDistance < m_fLodDistance) return(0);
+	int nLevel = 1 + int(floorf(log2f(fDistance / m_fLodDistance)));
+	return((nLevel < m_nLevels - 1) ? nLevel : (m_nLevels - 1));
+}
+
+void CTerrainGeomipmap::Update(XMFLOAT3& xmf3CameraPosition)
+{
+	int nPatches = m_cxPatches * m_czPatches;
+	for (int i = 0; i < nPatches; i++) m_pnLevels[i] = GetPatchLevel(i, xmf3CameraPosition);
+
+	//The least of its own level and every other patch's plus the steps between them: a city block distance transform,
+	//exact in two sweeps, after which neighbours are at most one level apart. Levels only get finer.
+	for (int i = 0, z = 0; z < m_czPatches; z++)
+	{
+		for (int x = 0; x < m_cxPatches; x++, i++)
+		{
+			if (x > 0) m_pnLevels[i] = min(m_pnLevels[i], m_pnLevels[i - 1] + 1);
+			if (z > 0) m_pnLevels[i] = min(m_pnLevels[i], m_pnLevels[i - m_cxPatches] + 1);
+		}
+	}
+	for (int i = nPatches - 1, z = m_czPatches - 1; z >= 0; z--)
+	{
+		for (int x = m_cxPatches - 1; x >= 0; x--, i--)
+		{
+			if (x < m_cxPatches - 1) m_pnLevels[i] = min(m_pnLevels[i], m_pnLevels[i + 1] + 1);
+			if (z < m_czPatches - 1) m_pnLevels[i] = min(m_pnLevels[i], m_pnLevels[i + m_cxPatches] + 1);
+		}
+	}
+
+	for (int i = 0, z = 0; z < m_czPatches; z++)
+	{
+		for (int x = 0; x < m_cxPatches; x++, i++)
+		{
+			int nLevel = m_pnLevels[i];
+			BYTE nEdgeMask = 0;
+			if ((x > 0) && (m_pnLevels[i - 1] > nLevel)) nEdgeMask |= GEOMIPMAP_EDGE_LEFT;
+			if ((z < m_czPatches - 1) && (m_pnLevels[i + m_cxPatches] > nLevel)) nEdgeMask |= GEOMIPMAP_EDGE_TOP;
+			if ((x < m_cxPatches - 1) && (m_pnLevels[i + 1] > nLevel)) nEdgeMask |= GEOMIPMAP_EDGE_RIGHT;
+			if ((z > 0) && (m_pnLevels[i - m_cxPatches] > nLevel)) nEdgeMask |= GEOMIPMAP_EDGE_BOTTOM;
+			m_pnEdgeMasks[i] = nEdgeMask;
+		}
+	}
+}
+
+#ifdef _WITH_TERRAIN_GEOMIPMAP_BENCHMARK
+#include "TerrainQuadtree.h"
+#include "HeightField.h"
+
+//Sides of a patch in the order of the GEOMIPMAP_EDGE_ bits
+#define GEOMIPMAP_SIDES			4
+
+//The triangles of an index set relative to its patch (vertex x + z * (nPatchQuads + 1)). *pnArea: twice the area
+//covered, positive clockwise from above; pnSides: the positions along each side (z for the left and right, x for the
+//top and bottom) of the edges that have no twin. pnEdgeCounts: (nPatchQuads + 1)^4 zeros, left zeroed. Returns the
+//triangles that are not clockwise, the edges drawn twice and the edges without a twin inside the patch.
+static int CheckGeomipIndexSet(UINT *pnIndices, int nIndices, int nWidth, int nPatchQuads, BYTE *pnEdgeCounts, long long *pnArea, unsigned long long *pnSides)
+{
+	int nSideVertices = nPatchQuads + 1, nVertices = nSideVertices * nSideVertices, nViolations = 0;
+	int *pnVertices = new int[nIndices];
+	for (int i = 0; i < nIndices; i++) pnVertices[i] = int(pnIndices[i] % nWidth) + int(pnIndices[i] / nWidth) * nSideVertices;
+
+	*pnArea = 0;
+	for (int s = 0; s < GEOMIPMAP_SIDES; s++) pnSides[s] = 0;
+	for (int i = 0; i < nIndices; i += 3)
+	{
+		int *v = &pnVertices[i];
+		int ax = v[0] % nSideVertices, az = v[0] / nSideVertices;
+		int bx = v[1] % nSideVertices, bz = v[1] / nSideVertices;
+		int cx = v[2] % nSideVertices, cz = v[2] / nSideVertices;
+		long long nCross = (long long)(bx - ax) * (cz - az) - (long long)(bz - az) * (cx - ax);
+		if (nCross >= 0) nViolations++;
+		*pnArea -= nCross;
+		for (int e = 0; e < 3; e++)
+		{
+			int a = v[e], b = v[(e + 1) % 3];
+			if (pnEdgeCounts[a * nVertices + b]++) nViolations++;
+		}
+	}
+	for (int i = 0; i < nIndices; i += 3)
+	{
+		int *v = &pnVertices[i];
+		for (int e = 0; e < 3; e++)
+		{
+			int a = v[e], b = v[(e + 1) % 3];
+			if (pnEdgeCounts[b * nVertices + a]) continue;
+			int ax = a % nSideVertices, az = a / nSideVertices, bx = b % nSideVertices, bz = b / nSideVertices;
+			if ((ax == 0) && (bx == 0)) pnSides[0] |= (1ull << az) | (1ull << bz);
+			else if ((az == nPatchQuads) && (bz == nPatchQuads)) pnSides[1] |= (1ull << ax) | (1ull << bx);
+			else if ((ax == nPatchQuads) && (bx == nPatchQuads)) pnSides[2] |= (1ull << az) | (1ull << bz);
+			else if ((az == 0) && (bz == 0)) pnSides[3] |= (1ull << ax) | (1ull << bx);
+			else nViolations++;
+		}
+	}
+	for (int i = 0; i < nIndices; i += 3)
+	{
+		for (int e = 0; e < 3; e++) pnEdgeCounts[pnVertices[i + e] * nVertices + pnVertices[i + (e + 1) % 3]] = 0;
+	}
+
+	delete[] pnVertices;
+	return(nViolations);
+}
+
+//Eye and target of frame f of a path over the terrain: 0 circles it as BenchmarkTerrainCulling, every fourth frame
+//from high above; 1 flies low along its diagonal, looking ahead
+static void GetGeomipmapBenchmarkCamera(int nPath, int f, int nFrames, float fTerrainWidth, float fTerrainLength, CHeightField *pHeightField, XMFLOAT3 *pxmf3Eye, XMFLOAT3 *pxmf3Target)
+{
+	if (nPath == 0)
+	{
+		float fAngle = XM_2PI * f / nFrames;
+		float fRadius = min(fTerrainWidth, fTerrainLength) * 0.35f, fHeight = ((f % 4) == 3) ? 800.0f : 300.0f;
+		*pxmf3Eye = XMFLOAT3(fTerrainWidth * 0.5f + fRadius * cosf(fAngle), fHeight, fTerrainLength * 0.5f + fRadius * sinf(fAngle));
+		*pxmf3Target = XMFLOAT3(pxmf3Eye->x - sinf(fAngle) * 100.0f, fHeight - (((f % 4) == 3) ? 150.0f : 30.0f), pxmf3Eye->z + cosf(fAngle) * 100.0f);
+	}
+	else
+	{
+		float t = 0.1f + 0.8f * f / nFrames;
+		*pxmf3Eye = XMFLOAT3(fTerrainWidth * t, 0.0f, fTerrainLength * t);
+		pxmf3Eye->y = pHeightField->GetHeight(pxmf3Eye->x, pxmf3Eye->z) + 40.0f;
+		*pxmf3Target = XMFLOAT3(pxmf3Eye->x + 70.0f, pxmf3Eye->y - 20.0f, pxmf3Eye->z + 70.0f);
+	}
+}
+
+int BenchmarkTerrainGeomipmap(LPCTSTR pstrFileName, int nFormat, int nWidth, int nLength, int nPatchQuads, XMFLOAT3 xmf3Scale, int nFrames)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	CHeightField *pHeightField = new CHeightField(64);
+	if (!pHeightField->OpenRaw(pstrFileName, nWidth, nLength, nFormat, xmf3Scale))
+	{
+		delete pHeightField;
+		return(1);
+	}
+	CHeightMapGeomipMesh *pGeomipMesh = new CHeightMapGeomipMesh(NULL, NULL, nWidth, nLength, nPatchQuads, xmf3Scale, XMFLOAT4(0.6f, 0.5f, 0.2f, 0.0f), pHeightField);
+	int cxPatches = pGeomipMesh->GetPatchesX(), czPatches = pGeomipMesh->GetPatchesZ(), nPatches = cxPatches * czPatches, nLevels = pGeomipMesh->GetLevels();
+	XMFLOAT3 *pxmf3Centers = pGeomipMesh->GetPatchAABBCenters(), *pxmf3Extents = pGeomipMesh->GetPatchAABBExtents();
+
+	//Every index set alone, then the sides of neighbours: a patch at level l stitched towards a neighbour at l + 1, or
+	//unstitched towards one at l, against that neighbour's opposite side
+	int nSideVertices = nPatchQuads + 1, nSetViolations = 0, nSideMismatches = 0;
+	BYTE *pnEdgeCounts = new BYTE[nSideVertices * nSideVertices * nSideVertices * nSideVertices];
+	::memset(pnEdgeCounts, 0, nSideVertices * nSideVertices * nSideVertices * nSideVertices);
+	unsigned long long *pnSides = new unsigned long long[nLevels * GEOMIPMAP_EDGE_MASKS * GEOMIPMAP_SIDES];
+	for (int l = 0; l < nLevels; l++)
+	{
+		for (int m = 0; m < GEOMIPMAP_EDGE_MASKS; m++)
+		{
+			TERRAINPATCHDRAW *pIndexSet = pGeomipMesh->GetIndexSet(l, m);
+			unsigned long long *pnSetSides = &pnSides[(l * GEOMIPMAP_EDGE_MASKS + m) * GEOMIPMAP_SIDES];
+			long long nArea = 0;
+			nSetViolations += ::CheckGeomipIndexSet(&pGeomipMesh->GetIndices()[pIndexSet->m_nStartIndex], pIndexSet->m_nIndices, nWidth, nPatchQuads, pnEdgeCounts, &nArea, pnSetSides);
+			if (nArea != 2LL * nPatchQuads * nPatchQuads) nSetViolations++;
+			for (int s = 0; s < GEOMIPMAP_SIDES; s++)
+			{
+				int nStep = ((l < nLevels - 1) && (m & (1 << s))) ? (2 << l) : (1 << l);
+				unsigned long long nExpected = 0;
+				for (int p = 0; p <= nPatchQuads; p += nStep) nExpected |= (1ull << p);
+				if (pnSetSides[s] != nExpected) nSetViolations++;
+			}
+		}
+	}
+	for (int l = 0; l < nLevels; l++)
+	{
+		for (int d = 0; (d <= 1) && (l + d < nLevels); d++)
+		{
+			for (int s = 0; s < GEOMIPMAP_SIDES; s++)
+			{
+				int nMask = (d) ? (1 << s) : 0, nOpposite = (s + 2) % GEOMIPMAP_SIDES;
+				if (pnSides[(l * GEOMIPMAP_EDGE_MASKS + nMask) * GEOMIPMAP_SIDES + s] != pnSides[((l + d) * GEOMIPMAP_EDGE_MASKS) * GEOMIPMAP_SIDES + nOpposite]) nSideMismatches++;
+			}
+		}
+	}
+
+	CTerrainGeomipmap *pGeomipmap = new CTerrainGeomipmap(cxPatches, czPatches, nLevels, pxmf3Centers, pxmf3Extents);
+	CTerrainQuadtree *pQuadtree = new CTerrainQuadtree(cxPatches, czPatches, pxmf3Centers, pxmf3Extents);
+	int *pnVisiblePatches = new int[nPatches];
+	TERRAINPATCHDRAW *pDraws = new TERRAINPATCHDRAW[nPatches];
+	XMFLOAT4X4 xmf4x4World = Matrix4x4::Identity();
+	XMFLOAT4X4 xmf4x4Projection = Matrix4x4::PerspectiveFovLH(XMConvertToRadians(60.0f), float(FRAME_BUFFER_WIDTH) / float(FRAME_BUFFER_HEIGHT), 1.01f, 5000.0f);
+	float fTerrainWidth = (nWidth - 1) * xmf3Scale.x, fTerrainLength = (nLength - 1) * xmf3Scale.z;
+	XMFLOAT3 xmf3Up(0.0f, 1.0f, 0.0f);
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Terrain geomipmapping: %d x %d patches of %d quads, %d levels, %u indices; index sets %d violations, neighbour sides %d mismatches\n"), cxPatches, czPatches, nPatchQuads, nLevels, pGeomipMesh->GetIndexCount(), nSetViolations, nSideMismatches);
+	OutputDebugString(pstrDebug);
+
+	int nFailures = nSetViolations + nSideMismatches;
+	LPCTSTR ppstrPaths[2] = { _T("orbit"), _T("low flight") };
+	for (int nPath = 0; nPath < 2; nPath++)
+	{
+		double fSeconds = 0.0, fTriangles = 0.0, fFullTriangles = 0.0, fDraws = 0.0, fLevels = 0.0;
+		long long nNeighbourViolations = 0, nLowered = 0, nMinTriangles = 2LL * nPatchQuads * nPatchQuads * nPatches, nMaxTriangles = 0;
+		for (int f = 0; f < nFrames; f++)
+		{
+			XMFLOAT3 xmf3Eye, xmf3Target;
+			::GetGeomipmapBenchmarkCamera(nPath, f, nFrames, fTerrainWidth, fTerrainLength, pHeightField, &xmf3Eye, &xmf3Target);
+
+			::QueryPerformanceCounter(&nBegin);
+			pGeomipmap->Update(xmf3Eye);
+			::QueryPerformanceCounter(&nEnd);
+			fSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+			int *pnLevels = pGeomipmap->GetLevels();
+			BYTE *pnEdgeMasks = pGeomipmap->GetEdgeMasks();
+			for (int i = 0, z = 0; z < czPatches; z++)
+			{
+				for (int x = 0; x < cxPatches; x++, i++)
+				{
+					if ((x < cxPatches - 1) && ((abs(pnLevels[i] - pnLevels[i + 1]) > 1) || (((pnEdgeMasks[i] & GEOMIPMAP_EDGE_RIGHT) != 0) != (pnLevels[i + 1] > pnLevels[i])) || (((pnEdgeMasks[i + 1] & GEOMIPMAP_EDGE_LEFT) != 0) != (pnLevels[i] > pnLevels[i + 1])))) nNeighbourViolations++;
+					if ((z < czPatches - 1) && ((abs(pnLevels[i] - pnLevels[i + cxPatches]) > 1) || (((pnEdgeMasks[i] & GEOMIPMAP_EDGE_TOP) != 0) != (pnLevels[i + cxPatches] > pnLevels[i])) || (((pnEdgeMasks[i + cxPatches] & GEOMIPMAP_EDGE_BOTTOM) != 0) != (pnLevels[i] > pnLevels[i + cxPatches])))) nNeighbourViolations++;
+					if (pnLevels[i] != pGeomipmap->GetPatchLevel(i, xmf3Eye)) nLowered++;
+				}
+			}
+
+			XMFLOAT4X4 xmf4x4View = Matrix4x4::LookAtLH(xmf3Eye, xmf3Target, xmf3Up);
+			MESHCLUSTERCULLINFO xCullInfo;
+			::GetMeshClusterCullInfo(&xmf4x4World, &xmf4x4View, &xmf4x4Projection, &xCullInfo);
+			int nVisiblePatches = pQuadtree->Cull(&xCullInfo, pnVisiblePatches);
+			int nDraws = pGeomipMesh->BuildPatchDraws(pnVisiblePatches, nVisiblePatches, pnLevels, pnEdgeMasks, pDraws);
+
+			long long nTriangles = 0;
+			for (int i = 0; i < nDraws; i++) nTriangles += pDraws[i].m_nIndices / 3;
+			for (int i = 0; i < nVisiblePatches; i++) fLevels += pnLevels[pnVisiblePatches[i]];
+			fTriangles += double(nTriangles);
+			fFullTriangles += 2.0 * nPatchQuads * nPatchQuads * nVisiblePatches;
+			fDraws += nDraws;
+			nMinTriangles = min(nMinTriangles, nTriangles);
+			nMaxTriangles = max(nMaxTriangles, nTriangles);
+		}
+
+		_stprintf_s(pstrDebug, 256, _T("    %s, %d frames: %.2f us per Update, %.1f draws, mean level %.2f, %.1f patches lowered, %lld neighbours more than a level apart\n"), ppstrPaths[nPath], nFrames, fSeconds * 1.0e6 / nFrames, fDraws / nFrames, (fDraws > 0.0) ? (fLevels / fDraws) : 0.0, double(nLowered) / nFrames, nNeighbourViolations);
+		OutputDebugString(pstrDebug);
+		_stprintf_s(pstrDebug, 256, _T("        triangles %.0f per frame (%lld to %lld) against %.0f at full resolution (%.1f%%)\n"), fTriangles / nFrames, nMinTriangles, nMaxTriangles, fFullTriangles / nFrames, (fFullTriangles > 0.0) ? (fTriangles * 100.0 / fFullTriangles) : 0.0);
+		OutputDebugString(pstrDebug);
+		nFailures += int(nNeighbourViolations);
+	}
+
+	delete[] pnEdgeCounts;
+	delete[] pnSides;
+	delete[] pnVisiblePatches;
+	delete[] pDraws;
+	delete pQuadtree;
+	delete pGeomipmap;
+	delete pGeomipMesh;
+	delete pHeightField;
+
+	return(nFailures);
+}
+#endif
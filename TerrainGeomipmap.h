@@ -0,0 +1,61 @@
+//-----------------------------------------------------------------------------
+// File: TerrainGeomipmap.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Mesh.h"
+
+//Geomipmapping of the terrain, the alternative of CHeightMapTerrain to hull/domain tessellation: every patch of a
+//CHeightMapGeomipMesh draws one of its precomputed index levels, chosen from the distance of the camera to its bounds.
+//Level 0 takes every sample; each level past the distance of TERRAIN_GEOMIPMAP_LOD_DISTANCE doubles the distance it
+//covers and the step between samples. The levels are then lowered until no two neighbouring patches are more than one
+//level apart, and an edge next to a coarser patch draws the stitched index set of its level.
+
+//CHeightMapTerrain builds the mesh, and SetRenderMode (F5) switches to it
+#define _WITH_TERRAIN_GEOMIPMAPPING
+
+#define TERRAIN_GEOMIPMAP_PATCH_QUADS		32 //A power of two; levels 0 to log2 of it
+#define TERRAIN_GEOMIPMAP_LOD_DISTANCE		128.0f //Of level 0 at the initial gfTessFactor.x of 2, so SetTessellationMode (F1) still trades detail
+
+class CTerrainGeomipmap
+{
+public:
+	//Patch (x, z) is patch x + z * cxPatches, as CHeightMapGeomipMesh
+	CTerrainGeomipmap(int cxPatches, int czPatches, int nLevels, XMFLOAT3 *pxmf3Centers, XMFLOAT3 *pxmf3Extents);
+	virtual ~CTerrainGeomipmap();
+
+private:
+	int								m_cxPatches = 0;
+	int								m_czPatches = 0;
+	int								m_nLevels = 0;
+	XMFLOAT3						*m_pxmf3Centers = NULL;
+	XMFLOAT3						*m_pxmf3Extents = NULL;
+
+	//Of each patch by the last Update
+	int								*m_pnLevels = NULL;
+	BYTE							*m_pnEdgeMasks = NULL; //GEOMIPMAP_EDGE_ bits of the neighbours one level coarser
+
+	float							m_fLodDistance = TERRAIN_GEOMIPMAP_LOD_DISTANCE;
+
+public:
+	void SetLodDistance(float fLodDistance) { m_fLodDistance = fLodDistance; }
+	float GetLodDistance() { return(m_fLodDistance); }
+	int *GetLevels() { return(m_pnLevels); }
+	BYTE *GetEdgeMasks() { return(m_pnEdgeMasks); }
+
+	//The level of a patch seen from xmf3CameraPosition (the terrain's model space), from the nearest point of its bounds
+	int GetPatchLevel(int nPatch, XMFLOAT3& xmf3CameraPosition);
+	//The levels and edge masks of every patch
+	void Update(XMFLOAT3& xmf3CameraPosition);
+};
+
+#ifdef _WITH_TERRAIN_GEOMIPMAP_BENCHMARK
+//Headless: a CHeightMapGeomipMesh built without a device. Checks that every index set is a clockwise, watertight
+//cover of its patch whose edges carry the vertices of its level (of the coarser level where stitched), so that the
+//edges of neighbours at every pair of levels match; then, along nFrames of an orbit and of a low flight over the
+//terrain, the time of Update, neighbours more than a level apart and the triangles drawn against full resolution.
+//nPatchQuads: at most 32. Returns the violations and mismatches of the checks (1 when the height map cannot be opened).
+int BenchmarkTerrainGeomipmap(
+LPCTSTR pstrFileName, int nFormat, int nWidth, int nLength, int nPatchQuads, XMFLOAT3 xmf3Scale, int nFrames);
+#endif
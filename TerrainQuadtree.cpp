@@ -0,0 +1,484 @@
+//-----------------------------------------------------------------------------
+// File: TerrainQuadtree.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "TerrainQuadtree.h"
+#include <cfloat>
+
+CTerrainQuadtree::CTerrainQuadtree(int cxPatches, int czPatches, XMFLOAT3 *pxmf3Centers, XMFLOAT3 *pxmf3Extents)
+{
+	m_cxPatches = cxPatches;
+	m_pnPatches = new int[cxPatches * czPatches];
+
+	//Every inner node has at least two children, so there are fewer inner nodes than patches (one block each, plus the root's)
+	m_pBlocks = new TERRAINQUADBLOCK[cxPatches * czPatches + 1];
+	m_nBlocks = 1;
+	for (int i = 0; i < 4; i++)
+	{
+		m_pBlocks[0].m_pnChildBlocks[i] = -1;
+		m_pBlocks[0].m_pnFirstPatches[i] = m_pBlocks[0].m_pnPatches[i] = 0;
+	}
+	m_pBlocks[0].m_xmf4CenterX = m_pBlocks[0].m_xmf4CenterY = m_pBlocks[0].m_xmf4CenterZ = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+	m_pBlocks[0].m_xmf4ExtentX = m_pBlocks[0].m_xmf4ExtentY = m_pBlocks[0].m_xmf4ExtentZ = XMFLOAT4(-FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	XMFLOAT3 xmf3Min, xmf3Max;
+	if ((cxPatches > 0) && (czPatches > 0)) BuildNode(0, 0, 0, 0, cxPatches, czPatches, pxmf3Centers, pxmf3Extents, xmf3Min, xmf3Max);
+}
+
+CTerrainQuadtree::~CTerrainQuadtree()
+{
+	if (m_pnPatches) delete[] m_pnPatches;
+	if (m_pBlocks) delete[] m_pBlocks;
+}
+
+static void SetTerrainQuadLane(TERRAINQUADBLOCK *pBlock, int nLane, XMFLOAT3& xmf3Min, XMFLOAT3& xmf3Max)
+{
+	(&pBlock->m_xmf4CenterX.x)[nLane] = (xmf3Min.x + xmf3Max.x) * 0.5f;
+	(&pBlock->m_xmf4CenterY.x)[nLane] = (xmf3Min.y + xmf3Max.y) * 0.5f;
+	(&pBlock->m_xmf4CenterZ.x)[nLane] = (xmf3Min.z + xmf3Max.z) * 0.5f;
+	(&pBlock->m_xmf4ExtentX.x)[nLane] = (xmf3Max.x - xmf3Min.x) * 0.5f;
+	(&pBlock->m_xmf4ExtentY.x)[nLane] = (xmf3Max.y - xmf3Min.y) * 0.5f;
+	(&pBlock->m_xmf4ExtentZ.x)[nLane] = (xmf3Max.z - xmf3Min.z) * 0.5f;
+}
+
+//The node of patches [x0, x1) x [z0, z1) into lane nLane of block nBlock; its bounds into xmf3Min/xmf3Max
+void CTerrainQuadtree::BuildNode(int nBlock, int nLane, int x0, int z0, int x1, int z1, XMFLOAT3 *pxmf3Centers, XMFLOAT3 *pxmf3Extents, XMFLOAT3& xmf3Min, XMFLOAT3& xmf3Max)
+{
+	m_nNodes++;
+	m_pBlocks[nBlock].m_pnFirstPatches[nLane] = m_nPatches;
+	m_pBlocks[nBlock].m_pnPatches[nLane] = (x1 - x0) * (z1 - z0);
+
+	if (m_pBlocks[nBlock].m_pnPatches[nLane] == 1)
+	{
+		int nPatch = x0 + z0 * m_cxPatches;
+		m_pnPatches[m_nPatches++] = nPatch;
+		m_pBlocks[nBlock].m_pnChildBlocks[nLane] = -1;
+		xmf3Min = Vector3::Subtract(pxmf3Centers[nPatch], pxmf3Extents[nPatch]);
+		xmf3Max = Vector3::Add(pxmf3Centers[nPatch], pxmf3Extents[nPatch]);
+		//The patch's own center and extents, so a patch lane decides exactly as IsTerrainPatchVisible
+		TERRAINQUADBLOCK *pBlock = &m_pBlocks[nBlock];
+		(&pBlock->m_xmf4CenterX.x)[nLane] = pxmf3Centers[nPatch].x;
+		(&pBlock->m_xmf4CenterY.x)[nLane] = pxmf3Centers[nPatch].y;
+		(&pBlock->m_xmf4CenterZ.x)[nLane] = pxmf3Centers[nPatch].z;
+		(&pBlock->m_xmf4ExtentX.x)[nLane] = pxmf3Extents[nPatch].x;
+		(&pBlock->m_xmf4ExtentY.x)[nLane] = pxmf3Extents[nPatch].y;
+		(&pBlock->m_xmf4ExtentZ.x)[nLane] = pxmf3Extents[nPatch].z;
+		return;
+	}
+
+	int nChildBlock = m_nBlocks++;
+	m_pBlocks[nBlock].m_pnChildBlocks[nLane] = nChildBlock;
+	TERRAINQUADBLOCK *pChildBlock = &m_pBlocks[nChildBlock];
+	for (int i = 0; i < 4; i++)
+	{
+		pChildBlock->m_pnChildBlocks[i] = -1;
+		pChildBlock->m_pnFirstPatches[i] = pChildBlock->m_pnPatches[i] = 0;
+	}
+	pChildBlock->m_xmf4CenterX = pChildBlock->m_xmf4CenterY = pChildBlock->m_xmf4CenterZ = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+	pChildBlock->m_xmf4ExtentX = pChildBlock->m_xmf4ExtentY = pChildBlock->m_xmf4ExtentZ = XMFLOAT4(-FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	//Halves along x and z; a side one patch wide is not split
+	int xMid = (x1 - x0 > 1) ? (x0 + x1) / 2 : x1, zMid = (z1 - z0 > 1) ? (z0 + z1) / 2 : z1;
+	int pnRects[4][4] = { { x0, z0, xMid, zMid }, { xMid, z0, x1, zMid }, { x0, zMid, xMid, z1 }, { xMid, zMid, x1, z1 } };
+	xmf3Min = XMFLOAT3(+FLT_MAX, +FLT_MAX, +FLT_MAX);
+	xmf3Max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < 4; i++)
+	{
+		int *r = pnRects[i];
+		if ((r[2] <= r[0]) || (r[3] <= r[1])) continue;
+
+		XMFLOAT3 xmf3ChildMin, xmf3ChildMax;
+		BuildNode(nChildBlock, i, r[0], r[1], r[2], r[3], pxmf3Centers, pxmf3Extents, xmf3ChildMin, xmf3ChildMax);
+		xmf3Min = XMFLOAT3(min(xmf3Min.x, xmf3ChildMin.x), min(xmf3Min.y, xmf3ChildMin.y), min(xmf3Min.z, xmf3ChildMin.z));
+		xmf3Max = XMFLOAT3(max(xmf3Max.x, xmf3ChildMax.x), max(xmf3Max.y, xmf3ChildMax.y), max(xmf3Max.z, xmf3ChildMax.z));
+	}
+	::SetTerrainQuadLane(&m_pBlocks[nBlock], nLane, xmf3Min, xmf3Max);
+}
+
+int CTerrainQuadtree::Cull(MESHCLUSTERCULLINFO *pCullInfo, int *pnVisiblePatches)
+{
+	TERRAINCULLPLANES xPlanes;
+	for (int i = 0; i < 6; i++)
+	{
+		XMFLOAT4& p = pCullInfo->m_pxmf4FrustumPlanes[i];
+		xPlanes.m_pxmvPlaneX[i] = XMVectorReplicate(p.x);
+		xPlanes.m_pxmvPlaneY[i] = XMVectorReplicate(p.y);
+		xPlanes.m_pxmvPlaneZ[i] = XMVectorReplicate(p.z);
+		xPlanes.m_pxmvPlaneW[i] = XMVectorReplicate(p.w);
+		xPlanes.m_pxmvAbsPlaneX[i] = XMVectorReplicate(fabsf(p.x));
+		xPlanes.m_pxmvAbsPlaneY[i] = XMVectorReplicate(fabsf(p.y));
+		xPlanes.m_pxmvAbsPlaneZ[i] = XMVectorReplicate(fabsf(p.z));
+	}
+
+	m_nNodesTested = 0;
+	return(CullBlock(0, &xPlanes, pnVisiblePatches, 0));
+}
+
+int CTerrainQuadtree::CullBlock(int nBlock, TERRAINCULLPLANES *pPlanes, int *pnVisiblePatches, int nVisiblePatches)
+{
+	TERRAINQUADBLOCK *pBlock = &m_pBlocks[nBlock];
+	XMVECTOR xmvCenterX = XMLoadFloat4(&pBlock->m_xmf4CenterX);
+	XMVECTOR xmvCenterY = XMLoadFloat4(&pBlock->m_xmf4CenterY);
+	XMVECTOR xmvCenterZ = XMLoadFloat4(&pBlock->m_xmf4CenterZ);
+	XMVECTOR xmvExtentX = XMLoadFloat4(&pBlock->m_xmf4ExtentX);
+	XMVECTOR xmvExtentY = XMLoadFloat4(&pBlock->m_xmf4ExtentY);
+	XMVECTOR xmvExtentZ = XMLoadFloat4(&pBlock->m_xmf4ExtentZ);
+
+	//Outside a plane when even the corner farthest along its normal is behind it, inside all when the nearest corner is in front of every plane
+	XMVECTOR xmvVisible = XMVectorTrueInt(), xmvInside = XMVectorTrueInt();
+	for (int i = 0; i < 6; i++)
+	{
+		XMVECTOR xmvDistance = XMVectorMultiplyAdd(xmvCenterX, pPlanes->m_pxmvPlaneX[i], XMVectorMultiplyAdd(xmvCenterY, pPlanes->m_pxmvPlaneY[i], XMVectorMultiplyAdd(xmvCenterZ, pPlanes->m_pxmvPlaneZ[i], pPlanes->m_pxmvPlaneW[i])));
+		XMVECTOR xmvRadius = XMVectorMultiplyAdd(xmvExtentX, pPlanes->m_pxmvAbsPlaneX[i], XMVectorMultiplyAdd(xmvExtentY, pPlanes->m_pxmvAbsPlaneY[i], XMVectorMultiply(xmvExtentZ, pPlanes->m_pxmvAbsPlaneZ[i])));
+		xmvVisible = XMVectorAndInt(xmvVisible, XMVectorGreater(xmvDistance, XMVectorNegate(xmvRadius)));
+		xmvInside = XMVectorAndInt(xmvInside, XMVectorGreater(xmvDistance, xmvRadius));
+	}
+
+#if defined(_XM_SSE_INTRINSICS_)
+	int nVisibleMask = _mm_movemask_ps(xmvVisible), nInsideMask = _mm_movemask_ps(xmvInside);
+#else
+	XMUINT4 xmu4Visible, xmu4Inside;
+	XMStoreUInt4(&xmu4Visible, xmvVisible);
+	XMStoreUInt4(&xmu4Inside, xmvInside);
+	int nVisibleMask = (xmu4Visible.x ? 1 : 0) | (xmu4Visible.y ? 2 : 0) | (xmu4Visible.z ? 4 : 0) | (xmu4Visible.w ? 8 : 0);
+	int nInsideMask = (xmu4Inside.x ? 1 : 0) | (xmu4Inside.y ? 2 : 0) | (xmu4Inside.z ? 4 : 0) | (xmu4Inside.w ? 8 : 0);
+#endif
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (pBlock->m_pnPatches[i] == 0) continue;
+		m_nNodesTested++;
+		if (!(nVisibleMask & (1 << i))) continue;
+
+		if ((pBlock->m_pnChildBlocks[i] < 0) || (nInsideMask & (1 << i)))
+		{
+			int *pnPatches = &m_pnPatches[pBlock->m_pnFirstPatches[i]];
+			for (int j = 0; j < pBlock->m_pnPatches[i]; j++) pnVisiblePatches[nVisiblePatches++] = pnPatches[j];
+		}
+		else
+		{
+			nVisiblePatches = CullBlock(pBlock->m_pnChildBlocks[i], pPlanes, pnVisiblePatches, nVisiblePatches);
+		}
+	}
+
+	return(nVisiblePatches);
+}
+
+//The same sums in the same order as one lane of CullBlock
+bool IsTerrainPatchVisible(XMFLOAT3& xmf3Center, XMFLOAT3& xmf3Extents, MESHCLUSTERCULLINFO *pCullInfo)
+{
+	XMFLOAT3& c = xmf3Center, &e = xmf3Extents;
+	for (int i = 0; i < 6; i++)
+	{
+		XMFLOAT4& p = pCullInfo->m_pxmf4FrustumPlanes[i];
+		float fDistance = c.x * p.x + (c.y * p.y + (c.z * p.z + p.w));
+		float fRadius = e.x * fabsf(p.x) + (e.y * fabsf(p.y) + e.z * fabsf(p.z));
+		if (!(fDistance > -fRadius)) return(false);
+	}
+
+	return(true);
+}
+
+#if defined(_WITH_TERRAIN_CULLING_BENCHMARK) || defined(_WITH_TERRAIN_SUBMISSION_BENCHMARK)
+#include "HeightField.h"
+
+//Frame f of nFrames: circles over the terrain at a player's height, looking along the path and a little down; every fourth frame from high above
+static XMFLOAT4X4 GetTerrainBenchmarkView(int f, int nFrames, float fTerrainWidth, float fTerrainLength)
+{
+	float fAngle = XM_2PI * f / nFrames;
+	float fRadius = min(fTerrainWidth, fTerrainLength) * 0.35f, fHeight = ((f % 4) == 3) ? 800.0f : 300.0f;
+	XMFLOAT3 xmf3Eye(fTerrainWidth * 0.5f + fRadius * cosf(fAngle), fHeight, fTerrainLength * 0.5f + fRadius * sinf(fAngle));
+	XMFLOAT3 xmf3Target(xmf3Eye.x - sinf(fAngle) * 100.0f, fHeight - (((f % 4) == 3) ? 150.0f : 30.0f), xmf3Eye.z + cosf(fAngle) * 100.0f);
+	XMFLOAT3 xmf3Up(0.0f, 1.0f, 0.0f);
+	return(Matrix4x4::LookAtLH(xmf3Eye, xmf3Target, xmf3Up));
+}
+#endif
+
+#ifdef _WITH_TERRAIN_CULLING_BENCHMARK
+//The control point bounds of every patch, as the CHeightMapGridMesh constructor computes them
+static void GetTerrainPatchBounds(CHeightField *pHeightField, int xStart, int zStart, int nBlockWidth, int nBlockLength, XMFLOAT3& xmf3Scale, XMFLOAT3 *pxmf3Center, XMFLOAT3 *pxmf3Extents)
+{
+	XMFLOAT3 xmf3Min(+FLT_MAX, +FLT_MAX, +FLT_MAX), xmf3Max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int z = (zStart + nBlockLength - 1); z >= zStart; z -= 2)
+	{
+		for (int x = xStart; x < (xStart + nBlockWidth); x += 2)
+		{
+			XMFLOAT3 xmf3Position((x * xmf3Scale.x), pHeightField->GetSample(x, z) * xmf3Scale.y, (z * xmf3Scale.z));
+			xmf3Min = XMFLOAT3(min(xmf3Min.x, xmf3Position.x), min(xmf3Min.y, xmf3Position.y), min(xmf3Min.z, xmf3Position.z));
+			xmf3Max = XMFLOAT3(max(xmf3Max.x, xmf3Position.x), max(xmf3Max.y, xmf3Position.y), max(xmf3Max.z, xmf3Position.z));
+		}
+	}
+	*pxmf3Center = XMFLOAT3((xmf3Min.x + xmf3Max.x) * 0.5f, (xmf3Min.y + xmf3Max.y) * 0.5f, (xmf3Min.z + xmf3Max.z) * 0.5f);
+	*pxmf3Extents = XMFLOAT3((xmf3Max.x - xmf3Min.x) * 0.5f, (xmf3Max.y - xmf3Min.y) * 0.5f, (xmf3Max.z - xmf3Min.z) * 0.5f);
+}
+
+int BenchmarkTerrainCulling(LPCTSTR pstrFileName, int nFormat, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, int nFrames)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	CHeightField *pHeightField = new CHeightField(64);
+	if (!pHeightField->OpenRaw(pstrFileName, nWidth, nLength, nFormat, xmf3Scale))
+	{
+		delete pHeightField;
+		return(1);
+	}
+	int cxPatches = (nWidth - 1) / (nBlockWidth - 1), czPatches = (nLength - 1) / (nBlockLength - 1), nPatches = cxPatches * czPatches;
+	XMFLOAT3 *pxmf3Centers = new XMFLOAT3[nPatches], *pxmf3Extents = new XMFLOAT3[nPatches];
+	for (int z = 0; z < czPatches; z++)
+	{
+		for (int x = 0; x < cxPatches; x++) ::GetTerrainPatchBounds(pHeightField, x * (nBlockWidth - 1), z * (nBlockLength - 1), nBlockWidth, nBlockLength, xmf3Scale, &pxmf3Centers[x + z * cxPatches], &pxmf3Extents[x + z * cxPatches]);
+	}
+	CTerrainQuadtree *pQuadtree = new CTerrainQuadtree(cxPatches, czPatches, pxmf3Centers, pxmf3Extents);
+
+	int *pnVisiblePatches = new int[nPatches];
+	char *pbVisible = new char[nPatches];
+	XMFLOAT4X4 xmf4x4World = Matrix4x4::Identity();
+	XMFLOAT4X4 xmf4x4Projection = Matrix4x4::PerspectiveFovLH(XMConvertToRadians(60.0f), float(FRAME_BUFFER_WIDTH) / float(FRAME_BUFFER_HEIGHT), 1.01f, 5000.0f);
+	float fTerrainWidth = (nWidth - 1) * xmf3Scale.x, fTerrainLength = (nLength - 1) * xmf3Scale.z;
+
+	long long nDrawn = 0, nNodesTested = 0;
+	int nMismatches = 0, nMinDrawn = nPatches, nMaxDrawn = 0;
+	double fQuadtreeSeconds = 0.0, fScalarSeconds = 0.0;
+	for (int f = 0; f < nFrames; f++)
+	{
+		XMFLOAT4X4 xmf4x4View = ::GetTerrainBenchmarkView(f, nFrames, fTerrainWidth, fTerrainLength);
+		MESHCLUSTERCULLINFO xCullInfo;
+		::GetMeshClusterCullInfo(&xmf4x4World, &xmf4x4View, &xmf4x4Projection, &xCullInfo);
+
+		::QueryPerformanceCounter(&nBegin);
+		int nVisiblePatches = pQuadtree->Cull(&xCullInfo, pnVisiblePatches);
+		::QueryPerformanceCounter(&nEnd);
+		fQuadtreeSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nPatches; i++) pbVisible[i] = ::IsTerrainPatchVisible(pxmf3Centers[i], pxmf3Extents[i], &xCullInfo) ? 1 : 0;
+		::QueryPerformanceCounter(&nEnd);
+		fScalarSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		int nScalarVisible = 0;
+		for (int i = 0; i < nPatches; i++) nScalarVisible += pbVisible[i];
+		for (int i = 0; i < nVisiblePatches; i++) pbVisible[pnVisiblePatches[i]] -= 1;
+		for (int i = 0; i < nPatches; i++) nMismatches += (pbVisible[i] != 0) ? 1 : 0;
+
+		nDrawn += nVisiblePatches;
+		nNodesTested += pQuadtree->GetNodesTested();
+		nMinDrawn = min(nMinDrawn, nVisiblePatches);
+		nMaxDrawn = max(nMaxDrawn, nVisiblePatches);
+	}
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Terrain culling: %d x %d patches, %d quadtree nodes, %d frames\n"), cxPatches, czPatches, pQuadtree->GetNodes(), nFrames);
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    %.1f patches drawn per frame (%d to %d) of %d, %.1f nodes tested; quadtree %.2f us, every patch %.2f us per frame; %d mismatches\n"), double(nDrawn) / nFrames, nMinDrawn, nMaxDrawn, nPatches, double(nNodesTested) / nFrames, fQuadtreeSeconds * 1.0e6 / nFrames, fScalarSeconds * 1.0e6 / nFrames, nMismatches);
+	OutputDebugString(pstrDebug);
+
+	delete[] pnVisiblePatches;
+	delete[] pbVisible;
+	delete[] pxmf3Centers;
+	delete[] pxmf3Extents;
+	delete pQuadtree;
+	delete pHeightField;
+
+	return(nMismatches);
+}
+#endif
+
+#ifdef _WITH_TERRAIN_SUBMISSION_BENCHMARK
+#define TERRAIN_RECORDED_TOPOLOGY		0
+#define TERRAIN_RECORDED_VERTEX_BUFFERS	1
+#define TERRAIN_RECORDED_INDEX_BUFFER	2
+#define TERRAIN_RECORDED_DRAW			3
+#define TERRAIN_RECORDED_DRAW_INDEXED	4
+
+struct TERRAINRECORDEDCALL
+{
+	UINT							m_nCall;
+	UINT							m_nArguments;
+	UINT64							m_pnArguments[4];
+};
+
+//Stands in for ID3D12GraphicsCommandList in SubmitTerrainPatchDraws: every call is written to a buffer with its
+//arguments (the vertex buffer views one by one), as a command list records them
+class CRecordingCommandList
+{
+public:
+	CRecordingCommandList(int nMaxCalls) { m_pCalls = new TERRAINRECORDEDCALL[nMaxCalls]; m_nMaxCalls = nMaxCalls; }
+	~CRecordingCommandList() { delete[] m_pCalls; }
+
+	TERRAINRECORDEDCALL				*m_pCalls = NULL;
+	int								m_nMaxCalls = 0;
+	int								m_nCalls = 0;
+	int								m_nDraws = 0;
+
+	void Reset() { m_nCalls = m_nDraws = 0; }
+	void Record(UINT nCall, UINT nArguments, UINT64 n0 = 0, UINT64 n1 = 0, UINT64 n2 = 0, UINT64 n3 = 0)
+	{
+		if (m_nCalls >= m_nMaxCalls) return;
+		TERRAINRECORDEDCALL *pCall = &m_pCalls[m_nCalls++];
+		pCall->m_nCall = nCall;
+		pCall->m_nArguments = nArguments;
+		pCall->m_pnArguments[0] = n0; pCall->m_pnArguments[1] = n1; pCall->m_pnArguments[2] = n2; pCall->m_pnArguments[3] = n3;
+	}
+
+	void IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY d3dPrimitiveTopology) { Record(TERRAIN_RECORDED_TOPOLOGY, 1, d3dPrimitiveTopology); }
+	void IASetVertexBuffers(UINT nStartSlot, UINT nViews, const D3D12_VERTEX_BUFFER_VIEW *pd3dViews)
+	{
+		for (UINT i = 0; i < nViews; i++) Record(TERRAIN_RECORDED_VERTEX_BUFFERS, 3, nStartSlot + i, pd3dViews[i].BufferLocation, pd3dViews[i].SizeInBytes | (UINT64(pd3dViews[i].StrideInBytes) << 32));
+	}
+	void IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW *pd3dView) { Record(TERRAIN_RECORDED_INDEX_BUFFER, 3, pd3dView->BufferLocation, pd3dView->SizeInBytes, pd3dView->Format); }
+	void DrawInstanced(UINT nVertices, UINT nInstances, UINT nStartVertex, UINT nStartInstance)
+	{
+		Record(TERRAIN_RECORDED_DRAW, 4, nVertices, nInstances, nStartVertex, nStartInstance);
+		m_nDraws++;
+	}
+	void DrawIndexedInstanced(UINT nIndices, UINT nInstances, UINT nStartIndex, INT nBaseVertex, UINT nStartInstance)
+	{
+		Record(TERRAIN_RECORDED_DRAW_INDEXED, 4, nIndices, nInstances, nStartIndex, UINT64(UINT(nBaseVertex)) | (UINT64(nStartInstance) << 32));
+		m_nDraws++;
+	}
+};
+
+//The patches of the draws recorded by SubmitTerrainPatchDraws into pnMarks (one per patch), and the control points of
+//each against the samples of the height map in the order of the hull shader; returns the control point mismatches
+static int CheckTerrainPatchDraws(CRecordingCommandList *pCommandList, CHeightMapGridMesh *pGridMesh, CHeightField *pHeightField, int nBlockWidth, int nBlockLength, XMFLOAT3& xmf3Scale, BYTE *pnMarks)
+{
+	int cxPatches = pGridMesh->GetPatchesX(), nPatchControlPoints = ((nBlockWidth - 1) / 2 + 1) * ((nBlockLength - 1) / 2 + 1);
+	int nRowVertices = ((nBlockLength - 1) / 2) * (cxPatches * ((nBlockWidth - 1) / 2) + 1);
+	XMFLOAT3 *pxmf3Positions = pGridMesh->GetPositions();
+	UINT *pnIndices = pGridMesh->GetIndices();
+
+	int nMismatches = 0;
+	for (int i = 0; i < pCommandList->m_nCalls; i++)
+	{
+		TERRAINRECORDEDCALL *pCall = &pCommandList->m_pCalls[i];
+		if (pCall->m_nCall != TERRAIN_RECORDED_DRAW_INDEXED) continue;
+		UINT nIndices = UINT(pCall->m_pnArguments[0]), nStartIndex = UINT(pCall->m_pnArguments[2]);
+		INT nBaseVertex = INT(UINT(pCall->m_pnArguments[3]));
+		int z = nBaseVertex / nRowVertices;
+		for (UINT j = 0; j < nIndices; j++)
+		{
+			int x = (nStartIndex + j) / nPatchControlPoints, k = (nStartIndex + j) % nPatchControlPoints, cxPatchControlPoints = (nBlockWidth - 1) / 2 + 1;
+			if (k == 0) pnMarks[x + z * cxPatches]++;
+			int xSample = x * (nBlockWidth - 1) + (k % cxPatchControlPoints) * 2;
+			int zSample = z * (nBlockLength - 1) + (nBlockLength - 1) - (k / cxPatchControlPoints) * 2;
+			XMFLOAT3& xmf3Position = pxmf3Positions[pnIndices[nStartIndex + j] + nBaseVertex];
+			if ((xmf3Position.x != xSample * xmf3Scale.x) || (xmf3Position.z != zSample * xmf3Scale.z) || (xmf3Position.y != pHeightField->GetSample(xSample, zSample) * xmf3Scale.y)) nMismatches++;
+		}
+	}
+	return(nMismatches);
+}
+
+int BenchmarkTerrainSubmission(LPCTSTR pstrFileName, int nFormat, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, int nFrames)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	CHeightField *pHeightField = new CHeightField(64);
+	if (!pHeightField->OpenRaw(pstrFileName, nWidth, nLength, nFormat, xmf3Scale))
+	{
+		delete pHeightField;
+		return(1);
+	}
+	CHeightMapGridMesh *pGridMesh = new CHeightMapGridMesh(NULL, NULL, nWidth, nLength, nBlockWidth, nBlockLength, xmf3Scale, XMFLOAT4(0.6f, 0.5f, 0.2f, 0.0f), pHeightField);
+	int nPatches = pGridMesh->GetPatches();
+	CTerrainQuadtree *pQuadtree = new CTerrainQuadtree(pGridMesh->GetPatchesX(), pGridMesh->GetPatchesZ(), pGridMesh->GetPatchAABBCenters(), pGridMesh->GetPatchAABBExtents());
+
+	//A patch of its own as before: four vertex buffers and an index buffer, each with an upload buffer
+	D3D12_VERTEX_BUFFER_VIEW *pd3dPatchViews = new D3D12_VERTEX_BUFFER_VIEW[nPatches * 4];
+	UINT pnStrides[4] = { sizeof(XMFLOAT3), sizeof(XMFLOAT4), sizeof(XMFLOAT2), sizeof(XMFLOAT2) };
+	for (int i = 0; i < nPatches * 4; i++)
+	{
+		pd3dPatchViews[i].BufferLocation = D3D12_GPU_VIRTUAL_ADDRESS(i + 1) << 16;
+		pd3dPatchViews[i].StrideInBytes = pnStrides[i % 4];
+		pd3dPatchViews[i].SizeInBytes = pnStrides[i % 4] * 25;
+	}
+	D3D12_VERTEX_BUFFER_VIEW pd3dSharedViews[4];
+	for (int i = 0; i < 4; i++)
+	{
+		pd3dSharedViews[i].BufferLocation = D3D12_GPU_VIRTUAL_ADDRESS(nPatches * 4 + i + 1) << 16;
+		pd3dSharedViews[i].StrideInBytes = pnStrides[i];
+		pd3dSharedViews[i].SizeInBytes = pnStrides[i] * pGridMesh->GetVertexCount();
+	}
+	D3D12_INDEX_BUFFER_VIEW d3dSharedIndexView = { D3D12_GPU_VIRTUAL_ADDRESS(nPatches * 4 + 5) << 16, UINT(sizeof(UINT) * pGridMesh->GetIndexCount()), DXGI_FORMAT_R32_UINT };
+
+	CRecordingCommandList *pCommandList = new CRecordingCommandList(nPatches * 6 + 8);
+	TERRAINPATCHDRAW *pDraws = new TERRAINPATCHDRAW[nPatches];
+	int *pnVisiblePatches = new int[nPatches];
+	BYTE *pnMarks = new BYTE[nPatches], *pnDrawn = new BYTE[nPatches];
+	XMFLOAT4X4 xmf4x4World = Matrix4x4::Identity();
+	XMFLOAT4X4 xmf4x4Projection = Matrix4x4::PerspectiveFovLH(XMConvertToRadians(60.0f), float(FRAME_BUFFER_WIDTH) / float(FRAME_BUFFER_HEIGHT), 1.01f, 5000.0f);
+	float fTerrainWidth = (nWidth - 1) * xmf3Scale.x, fTerrainLength = (nLength - 1) * xmf3Scale.z;
+
+	//Every patch once, for the control points of the whole terrain
+	::ZeroMemory(pnMarks, nPatches);
+	pCommandList->Reset();
+	::SubmitTerrainPatchDraws(pCommandList, pGridMesh->GetPrimitiveTopology(), pd3dSharedViews, &d3dSharedIndexView, pDraws, pGridMesh->BuildPatchDraws(NULL, 0, pDraws));
+	int nControlPointMismatches = ::CheckTerrainPatchDraws(pCommandList, pGridMesh, pHeightField, nBlockWidth, nBlockLength, xmf3Scale, pnMarks);
+	int nPatchMismatches = 0;
+	for (int i = 0; i < nPatches; i++) nPatchMismatches += (pnMarks[i] != 1) ? 1 : 0;
+
+	long long nVisible = 0, nPatchCalls = 0, nPatchDraws = 0, nMergedCalls = 0, nMergedDraws = 0;
+	double fPatchSeconds = 0.0, fMergedSeconds = 0.0;
+	for (int f = 0; f < nFrames; f++)
+	{
+		XMFLOAT4X4 xmf4x4View = ::GetTerrainBenchmarkView(f, nFrames, fTerrainWidth, fTerrainLength);
+		MESHCLUSTERCULLINFO xCullInfo;
+		::GetMeshClusterCullInfo(&xmf4x4World, &xmf4x4View, &xmf4x4Projection, &xCullInfo);
+		int nVisiblePatches = pQuadtree->Cull(&xCullInfo, pnVisiblePatches);
+		nVisible += nVisiblePatches;
+
+		pCommandList->Reset();
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nVisiblePatches; i++)
+		{
+			pCommandList->IASetPrimitiveTopology(pGridMesh->GetPrimitiveTopology());
+			pCommandList->IASetVertexBuffers(0, 4, &pd3dPatchViews[pnVisiblePatches[i] * 4]);
+			pCommandList->DrawInstanced(25, 1, 0, 0);
+		}
+		::QueryPerformanceCounter(&nEnd);
+		fPatchSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+		nPatchCalls += pCommandList->m_nCalls;
+		nPatchDraws += pCommandList->m_nDraws;
+
+		pCommandList->Reset();
+		::QueryPerformanceCounter(&nBegin);
+		int nDraws = pGridMesh->BuildPatchDraws(pnVisiblePatches, nVisiblePatches, pDraws);
+		::SubmitTerrainPatchDraws(pCommandList, pGridMesh->GetPrimitiveTopology(), pd3dSharedViews, &d3dSharedIndexView, pDraws, nDraws);
+		::QueryPerformanceCounter(&nEnd);
+		fMergedSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+		nMergedCalls += pCommandList->m_nCalls;
+		nMergedDraws += pCommandList->m_nDraws;
+
+		::ZeroMemory(pnMarks, nPatches);
+		for (int i = 0; i < nVisiblePatches; i++) pnMarks[pnVisiblePatches[i]] = 1;
+		::ZeroMemory(pnDrawn, nPatches);
+		nControlPointMismatches += ::CheckTerrainPatchDraws(pCommandList, pGridMesh, pHeightField, nBlockWidth, nBlockLength, xmf3Scale, pnDrawn);
+		for (int i = 0; i < nPatches; i++) nPatchMismatches += (pnDrawn[i] != pnMarks[i]) ? 1 : 0;
+	}
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Terrain submission: %d x %d patches, %d frames, %.1f patches visible per frame\n"), pGridMesh->GetPatchesX(), pGridMesh->GetPatchesZ(), nFrames, double(nVisible) / nFrames);
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    buffers: %d for a buffer set per patch, 10 shared\n"), nPatches * 10);
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    per patch: %.1f calls, %.1f draws, %.2f us; merged: %.1f calls, %.1f draws, %.2f us per frame\n"), double(nPatchCalls) / nFrames, double(nPatchDraws) / nFrames, fPatchSeconds * 1.0e6 / nFrames, double(nMergedCalls) / nFrames, double(nMergedDraws) / nFrames, fMergedSeconds * 1.0e6 / nFrames);
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    %d patch mismatches, %d control point mismatches\n"), nPatchMismatches, nControlPointMismatches);
+	OutputDebugString(pstrDebug);
+
+	delete[] pd3dPatchViews;
+	delete[] pDraws;
+	delete[] pnVisiblePatches;
+	delete[] pnMarks;
+	delete[] pnDrawn;
+	delete pCommandList;
+	delete pQuadtree;
+	delete pGridMesh;
+	delete pHeightField;
+
+	return(nPatchMismatches + nControlPointMismatches);
+}
+#endif
+
@@ -0,0 +1,92 @@
+//-----------------------------------------------------------------------------
+// File: TerrainQuadtree.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include "MeshCluster.h"
+
+//Frustum culling of the terrain patches (CHeightMapGridMesh) through a quadtree over the patch grid. Every node keeps
+//the AABB of its patches; the four children of a node are stored together and tested against the six planes in one
+//pass, and a node entirely inside the frustum takes all its patches without testing them.
+//The patches are Bezier surfaces of their 25 control points, so the AABB of the control points bounds the
+//tessellated surface as well.
+
+//CHeightMapTerrain::Render draws only the patches that pass
+#define _WITH_TERRAIN_PATCH_CULLING
+
+//Four sibling nodes in SoA form; unused lanes have extents of -FLT_MAX and never pass the planes
+struct TERRAINQUADBLOCK
+{
+	XMFLOAT4						m_xmf4CenterX;
+	XMFLOAT4						m_xmf4CenterY;
+	XMFLOAT4						m_xmf4CenterZ;
+	XMFLOAT4						m_xmf4ExtentX;
+	XMFLOAT4						m_xmf4ExtentY;
+	XMFLOAT4						m_xmf4ExtentZ;
+	int								m_pnChildBlocks[4]; //The block of the four children of the node, -1 for a patch
+	int								m_pnFirstPatches[4]; //The patches of the node are [m_pnFirstPatches, +m_pnPatches) of CTerrainQuadtree::m_pnPatches
+	int								m_pnPatches[4];
+};
+
+//The planes of a MESHCLUSTERCULLINFO replicated across the lanes, with the absolute normals for the AABB extents
+struct TERRAINCULLPLANES
+{
+	XMVECTOR						m_pxmvPlaneX[6];
+	XMVECTOR						m_pxmvPlaneY[6];
+	XMVECTOR						m_pxmvPlaneZ[6];
+	XMVECTOR						m_pxmvPlaneW[6];
+	XMVECTOR						m_pxmvAbsPlaneX[6];
+	XMVECTOR						m_pxmvAbsPlaneY[6];
+	XMVECTOR						m_pxmvAbsPlaneZ[6];
+};
+
+class CTerrainQuadtree
+{
+public:
+	//Patch (x, z) is patch x + z * cxPatches, as CHeightMapGridMesh
+	CTerrainQuadtree(int cxPatches, int czPatches, XMFLOAT3 *pxmf3Centers, XMFLOAT3 *pxmf3Extents);
+	virtual ~CTerrainQuadtree();
+
+private:
+	int								m_cxPatches = 0;
+	int								m_nPatches = 0;
+	int								*m_pnPatches = NULL; //Node by node, so the patches of a node are contiguous
+
+	int								m_nNodes = 0;
+	int								m_nBlocks = 0;
+	TERRAINQUADBLOCK				*m_pBlocks = NULL; //Lane 0 of block 0 is the root
+
+	int								m_nNodesTested = 0;
+
+	void BuildNode(int nBlock, int nLane, int x0, int z0, int x1, int z1, XMFLOAT3 *pxmf3Centers, XMFLOAT3 *pxmf3Extents, XMFLOAT3& xmf3Min, XMFLOAT3& xmf3Max);
+	int CullBlock(int nBlock, TERRAINCULLPLANES *pPlanes, int *pnVisiblePatches, int nVisiblePatches);
+
+public:
+	int GetPatches() { return(m_nPatches); }
+	int GetNodes() { return(m_nNodes); }
+	//Nodes tested by the last Cull (each lane of a tested block that holds a node)
+	int GetNodesTested() { return(m_nNodesTested); }
+
+	//The visible patches into pnVisiblePatches (room for every patch), in quadtree order; returns their number
+	int Cull(MESHCLUSTERCULLINFO *pCullInfo, int *pnVisiblePatches);
+};
+
+//Scalar reference of one patch against the planes of Cull
+bool IsTerrainPatchVisible(XMFLOAT3& xmf3Center, XMFLOAT3& xmf3Extents, MESHCLUSTERCULLINFO *pCullInfo);
+
+#ifdef _WITH_TERRAIN_CULLING_BENCHMARK
+//The patch bounds of a terrain built from the height map as CHeightMapTerrain does, culled along nFrames of a camera
+//path over it: patches drawn against nodes tested, the quadtree against a scalar test of every patch, and mismatches
+//(returned, 1 when the height map cannot be opened)
+int BenchmarkTerrainCulling(LPCTSTR pstrFileName, int nFormat, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, int nFrames);
+#endif
+
+#ifdef _WITH_TERRAIN_SUBMISSION_BENCHMARK
+//Headless: a CHeightMapGridMesh without a device, culled along nFrames of the camera path of BenchmarkTerrainCulling and
+//submitted to a recording command list, a draw per patch with buffers of its own as before against the merged draws of
+//the shared buffers: buffers, calls, draws and CPU time of both. Checks that the draws take exactly the visible patches
+//and their control points in the order of the hull shader; returns the draws that do not (1 when the height map cannot
+//be opened)
+int BenchmarkTerrainSubmission(LPCTSTR pstrFileName, int nFormat, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, int nFrames);
+#endif
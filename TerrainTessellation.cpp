@@ -0,0 +1,222 @@
+//-----------------------------------------------------------------------------
+// File: TerrainTessellation.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "TerrainTessellation.h"
+
+CTerrainTessellation::CTerrainTessellation(int cxPatches, int czPatches, XMFLOAT3 *pxmf3Centers, XMFLOAT3 *pxmf3Extents, float *pfPatchErrors)
+{
+	m_cxPatches = cxPatches;
+	m_czPatches = czPatches;
+
+	int nPatches = cxPatches * czPatches;
+	m_pxmf3Centers = new XMFLOAT3[nPatches];
+	m_pxmf3Extents = new XMFLOAT3[nPatches];
+	m_pfPatchErrors = new float[nPatches];
+	m_pfFactors = new float[nPatches];
+	for (int i = 0; i < nPatches; i++)
+	{
+		m_pxmf3Centers[i] = pxmf3Centers[i];
+		m_pxmf3Extents[i] = pxmf3Extents[i];
+		m_pfPatchErrors[i] = pfPatchErrors[i];
+		m_pfFactors[i] = 1.0f;
+	}
+}
+
+CTerrainTessellation::~CTerrainTessellation()
+{
+	if (m_pxmf3Centers) delete[] m_pxmf3Centers;
+	if (m_pxmf3Extents) delete[] m_pxmf3Extents;
+	if (m_pfPatchErrors) delete[] m_pfPatchErrors;
+	if (m_pfFactors) delete[] m_pfFactors;
+}
+
+float CTerrainTessellation::GetPatchFactor(int nPatch, XMFLOAT3& xmf3CameraPosition, float fProjectionScale)
+{
+	XMFLOAT3& c = m_pxmf3Centers[nPatch], &e = m_pxmf3Extents[nPatch];
+	float dx = max(fabsf(xmf3CameraPosition.x - c.x) - e.x, 0.0f);
+	float dy = max(fabsf(xmf3CameraPosition.y - c.y) - e.y, 0.0f);
+	float dz = max(fabsf(xmf3CameraPosition.z - c.z) - e.z, 0.0f);
+	float fDistance = sqrtf(dx * dx + dy * dy + dz * dz);
+
+	//Pixels of the error at n = 1 times the distance; n^2 >= fPixels / (fDistance * target)
+	float fPixels = m_pfPatchErrors[nPatch] * fProjectionScale;
+	if (fPixels <= 0.0f) return(1.0f);
+	if (fDistance * m_fTargetPixelError * (TERRAIN_MAX_TESS_FACTOR * TERRAIN_MAX_TESS_FACTOR) <= fPixels) return(TERRAIN_MAX_TESS_FACTOR);
+	float fFactor = ceilf(sqrtf(fPixels / (fDistance * m_fTargetPixelError)));
+	return((fFactor < 1.0f) ? 1.0f : fFactor);
+}
+
+void CTerrainTessellation::Update(XMFLOAT3& xmf3CameraPosition, float fProjectionScale, TERRAINTESSFACTORS *pFactors)
+{
+	int nPatches = m_cxPatches * m_czPatches;
+	for (int i = 0; i < nPatches; i++) m_pfFactors[i] = GetPatchFactor(i, xmf3CameraPosition, fProjectionScale);
+
+	for (int i = 0, z = 0; z < m_czPatches; z++)
+	{
+		for (int x = 0; x < m_cxPatches; x++, i++)
+		{
+			float fFactor = m_pfFactors[i];
+			pFactors[i].m_xmf4Edges.x = (x > 0) ? max(fFactor, m_pfFactors[i - 1]) : fFactor;
+			pFactors[i].m_xmf4Edges.y = (z < m_czPatches - 1) ? max(fFactor, m_pfFactors[i + m_cxPatches]) : fFactor;
+			pFactors[i].m_xmf4Edges.z = (x < m_cxPatches - 1) ? max(fFactor, m_pfFactors[i + 1]) : fFactor;
+			pFactors[i].m_xmf4Edges.w = (z > 0) ? max(fFactor, m_pfFactors[i - m_cxPatches]) : fFactor;
+			pFactors[i].m_xmf2Insides = XMFLOAT2(fFactor, fFactor);
+		}
+	}
+}
+
+#ifdef _WITH_TERRAIN_TESSELLATION_BENCHMARK
+#include "HeightField.h"
+
+static void GetBernstein5(double t, double *pfBernstein)
+{
+	double tInv = 1.0 - t;
+	pfBernstein[0] = tInv * tInv * tInv * tInv;
+	pfBernstein[1] = 4.0 * t * tInv * tInv * tInv;
+	pfBernstein[2] = 6.0 * t * t * tInv * tInv;
+	pfBernstein[3] = 4.0 * t * t * t * tInv;
+	pfBernstein[4] = t * t * t * t;
+}
+
+//The height of the Bezier surface of 5 x 5 control heights at (u, v), as DSTerrainTessellation (in double, so that
+//flat patches measure no error)
+static double GetBezierHeight(float *pfHeights, double u, double v)
+{
+	double uB[5], vB[5], fHeight = 0.0;
+	GetBernstein5(u, uB);
+	GetBernstein5(v, vB);
+	for (int k = 0; k < 5; k++)
+	{
+		for (int j = 0; j < 5; j++) fHeight += vB[k] * uB[j] * pfHeights[j + k * 5];
+	}
+	return(fHeight);
+}
+
+//The most linear interpolation departs from the surface over the triangles of an n x n tessellation, either diagonal
+static float GetTessellationError(float *pfHeights, int n)
+{
+	static const double pfSamples[7][3] = { { 1.0 / 3.0, 1.0 / 3.0, 1.0 / 3.0 }, { 0.5, 0.5, 0.0 }, { 0.5, 0.0, 0.5 }, { 0.0, 0.5, 0.5 }, { 2.0 / 3.0, 1.0 / 6.0, 1.0 / 6.0 }, { 1.0 / 6.0, 2.0 / 3.0, 1.0 / 6.0 }, { 1.0 / 6.0, 1.0 / 6.0, 2.0 / 3.0 } };
+	static const int pnTriangles[4][3] = { { 0, 1, 2 }, { 0, 2, 3 }, { 0, 1, 3 }, { 1, 2, 3 } };
+	double fError = 0.0, h = 1.0 / n;
+	for (int b = 0; b < n; b++)
+	{
+		for (int a = 0; a < n; a++)
+		{
+			double pu[4] = { a * h, (a + 1) * h, (a + 1) * h, a * h }, pv[4] = { b * h, b * h, (b + 1) * h, (b + 1) * h }, pf[4];
+			for (int i = 0; i < 4; i++) pf[i] = ::GetBezierHeight(pfHeights, pu[i], pv[i]);
+			for (int t = 0; t < 4; t++)
+			{
+				const int *p = pnTriangles[t];
+				for (int s = 0; s < 7; s++)
+				{
+					const double *w = pfSamples[s];
+					double u = w[0] * pu[p[0]] + w[1] * pu[p[1]] + w[2] * pu[p[2]], v = w[0] * pv[p[0]] + w[1] * pv[p[1]] + w[2] * pv[p[2]];
+					double fLinear = w[0] * pf[p[0]] + w[1] * pf[p[1]] + w[2] * pf[p[2]];
+					fError = max(fError, fabs(::GetBezierHeight(pfHeights, u, v) - fLinear));
+				}
+			}
+		}
+	}
+	return(float(fError));
+}
+
+int BenchmarkTerrainTessellation(LPCTSTR pstrFileName, int nFormat, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, float fTargetPixelError, int nFrames)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	CHeightField *pHeightField = new CHeightField(64);
+	if (!pHeightField->OpenRaw(pstrFileName, nWidth, nLength, nFormat, xmf3Scale))
+	{
+		delete pHeightField;
+		return(1);
+	}
+	CHeightMapGridMesh *pGridMesh = new CHeightMapGridMesh(NULL, NULL, nWidth, nLength, nBlockWidth, nBlockLength, xmf3Scale, XMFLOAT4(0.6f, 0.5f, 0.2f, 0.0f), pHeightField);
+	int cxPatches = pGridMesh->GetPatchesX(), czPatches = pGridMesh->GetPatchesZ(), nPatches = cxPatches * czPatches;
+	XMFLOAT3 *pxmf3Centers = pGridMesh->GetPatchAABBCenters(), *pxmf3Extents = pGridMesh->GetPatchAABBExtents();
+	float *pfPatchErrors = pGridMesh->GetPatchErrors();
+	CTerrainTessellation *pTessellation = new CTerrainTessellation(cxPatches, czPatches, pxmf3Centers, pxmf3Extents, pfPatchErrors);
+	pTessellation->SetTargetPixelError(fTargetPixelError);
+
+	//The bound against the surface, for factors of 1 to 8
+	int nBoundViolations = 0;
+	float fBoundTightness = 0.0f, pfHeights[25];
+	int cxStep = (nBlockWidth - 1) / 2, czStep = (nBlockLength - 1) / 2, cxControlPoints = cxPatches * cxStep + 1;
+	for (int i = 0; i < nPatches; i++)
+	{
+		XMFLOAT3 *pxmf3First = &pGridMesh->GetPositions()[(i % cxPatches) * cxStep + (i / cxPatches) * czStep * cxControlPoints];
+		for (int k = 0; k < 5; k++)
+		{
+			for (int j = 0; j < 5; j++) pfHeights[j + k * 5] = pxmf3First[j + k * cxControlPoints].y;
+		}
+		for (int n = 1; n <= 8; n++)
+		{
+			float fError = ::GetTessellationError(pfHeights, n), fBound = pfPatchErrors[i] / (n * n);
+			if (fError > fBound * 1.0001f + 1.0e-4f) nBoundViolations++;
+			if (fBound > 0.0f) fBoundTightness = max(fBoundTightness, fError / fBound);
+		}
+	}
+
+	TERRAINTESSFACTORS *pFactors = new TERRAINTESSFACTORS[nPatches];
+	XMFLOAT4X4 xmf4x4Projection = Matrix4x4::PerspectiveFovLH(XMConvertToRadians(60.0f), float(FRAME_BUFFER_WIDTH) / float(FRAME_BUFFER_HEIGHT), 1.01f, 5000.0f);
+	float fProjectionScale = CTerrainTessellation::GetProjectionScale(xmf4x4Projection, float(FRAME_BUFFER_HEIGHT));
+	float fTerrainWidth = (nWidth - 1) * xmf3Scale.x, fTerrainLength = (nLength - 1) * xmf3Scale.z;
+
+	double fSeconds = 0.0, fTriangles = 0.0, fFixedTriangles = 0.0;
+	long long nCracks = 0, nOverTarget = 0, nFixedOverTarget = 0, nMaxFactors = 0;
+	for (int f = 0; f < nFrames; f++)
+	{
+		//Circles low over the terrain, every fourth frame from high above
+		float fAngle = XM_2PI * f / nFrames, fRadius = min(fTerrainWidth, fTerrainLength) * 0.35f;
+		XMFLOAT3 xmf3Camera(fTerrainWidth * 0.5f + fRadius * cosf(fAngle), ((f % 4) == 3) ? 800.0f : 300.0f, fTerrainLength * 0.5f + fRadius * sinf(fAngle));
+		xmf3Camera.y = max(xmf3Camera.y, pHeightField->GetHeight(xmf3Camera.x, xmf3Camera.z) + 10.0f);
+
+		::QueryPerformanceCounter(&nBegin);
+		pTessellation->Update(xmf3Camera, fProjectionScale, pFactors);
+		::QueryPerformanceCounter(&nEnd);
+		fSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		float *pfFactors = pTessellation->GetFactors();
+		for (int i = 0, z = 0; z < czPatches; z++)
+		{
+			for (int x = 0; x < cxPatches; x++, i++)
+			{
+				if ((x < cxPatches - 1) && (pFactors[i].m_xmf4Edges.z != pFactors[i + 1].m_xmf4Edges.x)) nCracks++;
+				if ((z < czPatches - 1) && (pFactors[i].m_xmf4Edges.y != pFactors[i + cxPatches].m_xmf4Edges.w)) nCracks++;
+
+				XMFLOAT3& c = pxmf3Centers[i], &e = pxmf3Extents[i];
+				float dx = max(fabsf(xmf3Camera.x - c.x) - e.x, 0.0f), dy = max(fabsf(xmf3Camera.y - c.y) - e.y, 0.0f), dz = max(fabsf(xmf3Camera.z - c.z) - e.z, 0.0f);
+				float fDistance = sqrtf(dx * dx + dy * dy + dz * dz);
+				float fFactor = pfFactors[i];
+				if (fFactor >= TERRAIN_MAX_TESS_FACTOR) nMaxFactors++;
+				else if (pfPatchErrors[i] / (fFactor * fFactor) * fProjectionScale > fTargetPixelError * fDistance * 1.0001f) nOverTarget++;
+				fTriangles += 2.0 * fFactor * fFactor;
+
+				//VSTerrainTessellationConstant with the initial gfTessFactor of 2, from the center of the patch
+				XMFLOAT3 xmf3ToCenter = Vector3::Subtract(xmf3Camera, c);
+				float fCenterDistance = Vector3::Length(xmf3ToCenter);
+				float fFixed = min(max(ceilf((1.0f / fCenterDistance) * 100.0f * 2.0f), 1.0f), TERRAIN_MAX_TESS_FACTOR);
+				if (pfPatchErrors[i] / (fFixed * fFixed) * fProjectionScale > fTargetPixelError * fDistance * 1.0001f) nFixedOverTarget++;
+				fFixedTriangles += 2.0 * fFixed * fFixed;
+			}
+		}
+	}
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Terrain tessellation: %d x %d patches, %d frames, target %.2f pixels; error bound %d violations (at most %.2f of the bound)\n"), cxPatches, czPatches, nFrames, fTargetPixelError, nBoundViolations, fBoundTightness);
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    adaptive: %.2f us per frame, %.0f triangles, %.1f patches over the target, %.1f at the maximum factor, %lld cracks\n"), fSeconds * 1.0e6 / nFrames, fTriangles / nFrames, double(nOverTarget) / nFrames, double(nMaxFactors) / nFrames, nCracks);
+	OutputDebugString(pstrDebug);
+	_stprintf_s(pstrDebug, 256, _T("    fixed factor: %.0f triangles, %.1f patches over the target\n"), fFixedTriangles / nFrames, double(nFixedOverTarget) / nFrames);
+	OutputDebugString(pstrDebug);
+
+	delete[] pFactors;
+	delete pTessellation;
+	delete pGridMesh;
+	delete pHeightField;
+
+	return(nBoundViolations + int(nCracks));
+}
+#endif
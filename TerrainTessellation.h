@@ -0,0 +1,78 @@
+//-----------------------------------------------------------------------------
+// File: TerrainTessellation.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Mesh.h"
+
+//Per patch tessellation factors of the terrain from a screen space error. Tessellating a patch (a degree 4 Bezier
+//surface of its 25 control points) n times along each side leaves the triangles at most m_pfPatchErrors / n^2 world
+//units from the surface (CHeightMapGridMesh); seen from a distance d that error covers e * fProjectionScale / d
+//pixels, and the factor of a patch is the least n that keeps it under the target. An edge takes the greater factor
+//of the two patches it separates, so both tessellate it alike and there are no cracks.
+
+//CHeightMapTerrain::Render computes the factors every frame and the hull shader takes them (cbTessFactor)
+#define _WITH_TERRAIN_ADAPTIVE_TESSELLATION
+
+#define TERRAIN_MAX_TESS_PATCHES		1024 //gTessPatchFactors of Shaders.hlsl; more patches fall back to gfTessFactor
+#define TERRAIN_MAX_TESS_FACTOR			64.0f //[maxtessfactor] of HSTerrainTessellation
+#define TERRAIN_TESS_FACTOR_PIXELS		8.0f //Target pixel error over gfTessFactor.x, so SetTessellationMode (F1) still trades detail
+
+//The SV_TessFactor edges of a patch in the hull shader's order (u = 0, v = 0, u = 1, v = 1: least x, greatest z,
+//greatest x, least z) and its two SV_InsideTessFactor
+struct TERRAINTESSFACTORS
+{
+	XMFLOAT4						m_xmf4Edges;
+	XMFLOAT2						m_xmf2Insides;
+	XMFLOAT2						m_xmf2Padding;
+};
+
+//cbTessFactor (b6)
+struct CB_TERRAIN_TESS_INFO
+{
+	XMFLOAT2						m_xmf2TessFactor; //x : tessfactor , y : tessinsidefactor (without per patch factors)
+	XMFLOAT2						m_xmf2Padding;
+	XMFLOAT4						m_xmf4PatchGrid; //x, y: 1 / the width and length of a patch, z: patches along x, w: 1 with per patch factors
+	TERRAINTESSFACTORS				m_pPatchFactors[TERRAIN_MAX_TESS_PATCHES];
+};
+
+class CTerrainTessellation
+{
+public:
+	//Patch (x, z) is patch x + z * cxPatches, as CHeightMapGridMesh
+	CTerrainTessellation(int cxPatches, int czPatches, XMFLOAT3 *pxmf3Centers, XMFLOAT3 *pxmf3Extents, float *pfPatchErrors);
+	virtual ~CTerrainTessellation();
+
+private:
+	int								m_cxPatches = 0;
+	int								m_czPatches = 0;
+	XMFLOAT3						*m_pxmf3Centers = NULL;
+	XMFLOAT3						*m_pxmf3Extents = NULL;
+	float							*m_pfPatchErrors = NULL;
+	float							*m_pfFactors = NULL; //Of each patch by the last Update, before the edges
+
+	float							m_fTargetPixelError = 1.0f;
+
+public:
+	void SetTargetPixelError(float fTargetPixelError) { m_fTargetPixelError = fTargetPixelError; }
+	float GetTargetPixelError() { return(m_fTargetPixelError); }
+	float *GetFactors() { return(m_pfFactors); }
+
+	//Pixels per world unit at a distance of one: _22 of the projection times half the viewport height
+	static float GetProjectionScale(XMFLOAT4X4& xmf4x4Projection, float fViewportHeight) { return(xmf4x4Projection._22 * fViewportHeight * 0.5f); }
+
+	//The factor of a patch seen from xmf3CameraPosition (the terrain's model space), the distance to the nearest point of its bounds
+	float GetPatchFactor(int nPatch, XMFLOAT3& xmf3CameraPosition, float fProjectionScale);
+	//The factors of every patch into pFactors
+	void Update(XMFLOAT3& xmf3CameraPosition, float fProjectionScale, TERRAINTESSFACTORS *pFactors);
+};
+
+#ifdef _WITH_TERRAIN_TESSELLATION_BENCHMARK
+//Headless: the factors of a CHeightMapGridMesh built without a device along nFrames of a flight over the terrain; the
+//time of Update, the triangles against the fixed factors of SetTessellationMode, edges whose two patches disagree and
+//patches over the target error. Also checks the error bound of every patch against its Bezier surface. Returns the
+//edges that disagree plus the bound violations (1 when the height map cannot be opened).
+int BenchmarkTerrainTessellation(
+LPCTSTR pstrFileName, int nFormat, int nWidth, int nLength, int nBlockWidth, int nBlockLength, XMFLOAT3 xmf3Scale, float fTargetPixelError, int nFrames);
+#endif
@@ -0,0 +1,95 @@
+//-----------------------------------------------------------------------------
+// File: ThreadPool.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "ThreadPool.h"
+
+CThreadPool::CThreadPool(int nThreads)
+{
+	if (nThreads < 0) nThreads = int(std::thread::hardware_concurrency()) - 1;
+	m_nThreads = (nThreads > 0) ? nThreads : 0;
+
+	if (m_nThreads > 0)
+	{
+		m_pThreads = new std::thread[m_nThreads];
+		for (int i = 0; i < m_nThreads; i++) m_pThreads[i] = std::thread(CThreadPool::WorkerThread, this);
+	}
+}
+
+CThreadPool::~CThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mtxJob);
+		m_bExit = true;
+	}
+	m_cvJob.notify_all();
+	for (int i = 0; i < m_nThreads; i++) m_pThreads[i].join();
+	if (m_pThreads) delete[] m_pThreads;
+}
+
+void CThreadPool::RunChunks()
+{
+	for ( ; ; )
+	{
+		LONG nFirst = ::InterlockedExchangeAdd(&m_nNextItem, m_nGrain);
+		if (nFirst >= m_nItems) break;
+		m_pfnJob(int(nFirst), int(min(nFirst + m_nGrain, m_nItems)), m_pContext);
+	}
+}
+
+void CThreadPool::WorkerThread(CThreadPool *pThreadPool)
+{
+	UINT nJob = 0;
+	for ( ; ; )
+	{
+		{
+			std::unique_lock<std::mutex> lock(pThreadPool->m_mtxJob);
+			while (!pThreadPool->m_bExit && (pThreadPool->m_nJob == nJob)) pThreadPool->m_cvJob.wait(lock);
+			if (pThreadPool->m_bExit) return;
+			nJob = pThreadPool->m_nJob;
+		}
+
+		pThreadPool->RunChunks();
+
+		//Every worker checks in once per job, even with no chunk left for it, so the next job cannot start under it
+		std::unique_lock<std::mutex> lock(pThreadPool->m_mtxJob);
+		if (--pThreadPool->m_nBusyThreads == 0) pThreadPool->m_cvDone.notify_one();
+	}
+}
+
+void CThreadPool::ParallelFor(int nItems, int nGrain, PARALLELFORJOB pfnJob, void *pContext)
+{
+	if (nItems <= 0) return;
+	if (nGrain < 1) nGrain = 1;
+	if ((m_nThreads == 0) || (nItems <= nGrain))
+	{
+		pfnJob(0, nItems, pContext);
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_mtxJob);
+		m_pfnJob = pfnJob;
+		m_pContext = pContext;
+		m_nItems = nItems;
+		m_nGrain = nGrain;
+		m_nNextItem = 0;
+		m_nBusyThreads = m_nThreads;
+		m_nJob++;
+	}
+	m_cvJob.notify_all();
+
+	RunChunks();
+
+	std::unique_lock<std::mutex> lock(m_mtxJob);
+	while (m_nBusyThreads > 0) m_cvDone.wait(lock);
+}
+
+void ParallelFor(CThreadPool *pThreadPool, int nItems, int nGrain, PARALLELFORJOB pfnJob, void *pContext)
+{
+	if (pThreadPool)
+		pThreadPool->ParallelFor(nItems, nGrain, pfnJob, pContext);
+	else if (nItems > 0)
+		pfnJob(0, nItems, pContext);
+}
@@ -0,0 +1,51 @@
+//-----------------------------------------------------------------------------
+// File: ThreadPool.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//Items [nFirst, nLast) of a ParallelFor
+typedef void (*PARALLELFORJOB)(int nFirst, int nLast, void *pContext);
+
+//Worker threads that wait for a ParallelFor and share its items with the calling thread, in chunks taken from one
+//interlocked counter. One ParallelFor at a time, from one thread.
+class CThreadPool
+{
+public:
+	//nThreads: the workers, besides the calling thread; -1 for one less than the hardware threads
+	CThreadPool(int nThreads = -1);
+	virtual ~CThreadPool();
+
+private:
+	int								m_nThreads = 0;
+	std::thread						*m_pThreads = NULL;
+
+	std::mutex						m_mtxJob;
+	std::condition_variable			m_cvJob; //A new job (m_nJob) or m_bExit
+	std::condition_variable			m_cvDone; //m_nBusyThreads down to 0
+	UINT							m_nJob = 0;
+	int								m_nBusyThreads = 0;
+	bool							m_bExit = false;
+
+	PARALLELFORJOB					m_pfnJob = NULL;
+	void							*m_pContext = NULL;
+	LONG							m_nItems = 0;
+	LONG							m_nGrain = 1;
+	volatile LONG					m_nNextItem = 0;
+
+	void RunChunks();
+	static void WorkerThread(CThreadPool *pThreadPool);
+
+public:
+	int GetThreads() { return(m_nThreads + 1); } //The calling thread included
+
+	//pfnJob over [0, nItems) in chunks of nGrain; returns when every chunk is done
+	void ParallelFor(int nItems, int nGrain, PARALLELFORJOB pfnJob, void *pContext);
+};
+
+//On pThreadPool, or in one chunk on the calling thread without one
+void ParallelFor(CThreadPool *pThreadPool, int nItems, int nGrain, PARALLELFORJOB pfnJob, void *pContext);
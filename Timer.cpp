@@ -30,6 +30,7 @@ void CGameTimer::Tick(float fLockFPS)
 	if (m_bStopped)
 	{
 		m_fTimeElapsed = 0.0f;
+		m_fFrameTimeElapsed = 0.0f;
 		return;
 	}
 	float fTimeElapsed;
@@ -47,6 +48,7 @@ void CGameTimer::Tick(float fLockFPS)
     } 
 
 	m_nLastPerformanceCounter = m_nCurrentPerformanceCounter;
+	m_fFrameTimeElapsed = fTimeElapsed;
 
     if (fabsf(fTimeElapsed - m_fTimeElapsed) < 1.0f)
     {
@@ -123,3 +125,139 @@ void CGameTimer::Stop()
 		m_bStopped = true;
 	}
 }
+
+CFixedTimestep::CFixedTimestep(float fTicksPerSecond, int nMaxTicks)
+{
+	m_fTickTime = 1.0f / fTicksPerSecond;
+	m_nMaxTicks = nMaxTicks;
+}
+
+int CFixedTimestep::Advance(float fFrameTime)
+{
+	m_fAccumulator += fFrameTime;
+	int nTicks = int(m_fAccumulator / m_fTickTime);
+	if (nTicks > m_nMaxTicks)
+	{
+		m_nDroppedTicks += nTicks - m_nMaxTicks;
+		nTicks = m_nMaxTicks;
+		m_fAccumulator = fmodf(m_fAccumulator, m_fTickTime);
+	}
+	else
+	{
+		m_fAccumulator -= nTicks * m_fTickTime;
+		if (m_fAccumulator < 0.0f) m_fAccumulator = 0.0f;
+	}
+	return(nTicks);
+}
+
+#ifdef _WITH_FIXED_TIMESTEP_BENCHMARK
+#include "BulletPool.h"
+
+#define BENCHMARK_SHOOT_INTERVAL		(1.0f / 30.0f)
+
+//One simulation step: a gun turning above the ground fires on its shoot timer (as CGameFramework does), the bullets
+//move and the ones below the ground are despawned
+static void SimulateBenchmarkStep(CBulletPool *pBulletPool, float fTimeElapsed, float *pfGunTime, float *pfShootTime)
+{
+	*pfGunTime += fTimeElapsed;
+	*pfShootTime += fTimeElapsed;
+	if (*pfShootTime >= BENCHMARK_SHOOT_INTERVAL)
+	{
+		XMFLOAT4X4 xmf4x4Gun;
+		XMMATRIX xmmtxGun = XMMatrixRotationX(XMConvertToRadians(10.0f)) * XMMatrixRotationY(*pfGunTime);
+		xmmtxGun.r[3] = XMVectorSet(450.0f, 50.0f, 450.0f, 1.0f);
+		XMStoreFloat4x4(&xmf4x4Gun, xmmtxGun);
+		pBulletPool->Spawn(&xmf4x4Gun, BULLET_SPEED, 3.0f);
+		*pfShootTime = 0.0f;
+	}
+	pBulletPool->Move(fTimeElapsed);
+	for (int i = pBulletPool->GetBullets() - 1; i >= 0; i--)
+	{
+		if (pBulletPool->GetPosition(i)->y < 0.0f) pBulletPool->Despawn(i);
+	}
+}
+
+static UINT HashBenchmarkBullets(CBulletPool *pBulletPool)
+{
+	UINT nHash = 2166136261u;
+	for (int i = 0; i < pBulletPool->GetBullets(); i++)
+	{
+		UINT *pnBits = (UINT *)pBulletPool->GetPosition(i);
+		for (int j = 0; j < 3; j++) nHash = (nHash ^ pnBits[j]) * 16777619u;
+	}
+	return(nHash ^ UINT(pBulletPool->GetBullets()));
+}
+
+int BenchmarkFixedTimestep(float fTicksPerSecond, float fSeconds)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	CBulletPool *pBulletPool = new CBulletPool(BULLET_POOL_CAPACITY);
+	int nTicks = int(fSeconds * fTicksPerSecond);
+	float *pfFrameTimes = new float[int(fSeconds * 250.0f) + 2];
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("Fixed timestep: %.0f ticks per second, %d ticks (%.0f s of game time)\n"), fTicksPerSecond, nTicks, fSeconds);
+	OutputDebugString(pstrDebug);
+
+	//Steady 30, 60 and 144 frames per second, then frame times jittering between 4 ms and 66 ms
+	float pfFrameRates[4] = { 30.0f, 60.0f, 144.0f, 0.0f };
+	UINT nReferenceHash = 0;
+	int nFailures = 0;
+	for (int k = 0; k < 4; k++)
+	{
+		UINT nRandom = 1;
+		int nFrames = 0;
+		for (float fTime = 0.0f; fTime < fSeconds; nFrames++)
+		{
+			if (pfFrameRates[k] > 0.0f)
+			{
+				pfFrameTimes[nFrames] = 1.0f / pfFrameRates[k];
+			}
+			else
+			{
+				nRandom = nRandom * 1664525 + 1013904223;
+				pfFrameTimes[nFrames] = 0.004f + 0.062f * ((nRandom >> 8) / float(1 << 24));
+			}
+			fTime += pfFrameTimes[nFrames];
+		}
+
+		//Fixed ticks, stopped at exactly nTicks even in the middle of a frame
+		float fGunTime = 0.0f, fShootTime = 0.0f;
+		pBulletPool->Clear();
+		CFixedTimestep xTimestep(fTicksPerSecond, 5);
+		int nSimulatedTicks = 0;
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; (i < nFrames) && (nSimulatedTicks < nTicks); i++)
+		{
+			for (int j = xTimestep.Advance(pfFrameTimes[i]); (j > 0) && (nSimulatedTicks < nTicks); j--, nSimulatedTicks++)
+			{
+				::SimulateBenchmarkStep(pBulletPool, xTimestep.GetTickTime(), &fGunTime, &fShootTime);
+			}
+		}
+		::QueryPerformanceCounter(&nEnd);
+		double fFixedSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+		UINT nFixedHash = ::HashBenchmarkBullets(pBulletPool);
+		int nFixedBullets = pBulletPool->GetBullets();
+
+		//The old loop: one step of the frame time per frame
+		fGunTime = fShootTime = 0.0f;
+		pBulletPool->Clear();
+		for (int i = 0; i < nFrames; i++) ::SimulateBenchmarkStep(pBulletPool, pfFrameTimes[i], &fGunTime, &fShootTime);
+		UINT nFrameHash = ::HashBenchmarkBullets(pBulletPool);
+
+		_stprintf_s(pstrDebug, 256, _T("    %s: %d frames, fixed ticks %d ticks (%d dropped), %d bullets, state %08x, %.0f ticks/s; one step per frame: %d bullets, state %08x\n"), (k == 0) ? _T("30 fps") : ((k == 1) ? _T("60 fps") : ((k == 2) ? _T("144 fps") : _T("4-66 ms"))), nFrames, nSimulatedTicks, xTimestep.GetDroppedTicks(), nFixedBullets, nFixedHash, nSimulatedTicks / fFixedSeconds, pBulletPool->GetBullets(), nFrameHash);
+		OutputDebugString(pstrDebug);
+
+		//Fixed ticks reach the same state whatever the frame rate
+		if (k == 0) nReferenceHash = nFixedHash;
+		if ((nSimulatedTicks != nTicks) || (nFixedHash != nReferenceHash)) nFailures++;
+	}
+
+	delete pBulletPool;
+	delete[] pfFrameTimes;
+
+	return(nFailures);
+}
+#endif
@@ -18,11 +18,13 @@ public:
 
     unsigned long GetFrameRate(LPTSTR lpszString = NULL, int nCharacters=0);
     float GetTimeElapsed();
+	float GetFrameTimeElapsed() { return(m_fFrameTimeElapsed); } //The last frame alone, not averaged
 	float GetTotalTime();
 
 private:
 	double							m_fTimeScale;						
 	float							m_fTimeElapsed;		
+	float							m_fFrameTimeElapsed = 0.0f;
 
 	__int64							m_nBasePerformanceCounter;
 	__int64							m_nPausedPerformanceCounter;
@@ -41,3 +43,35 @@ private:
 
 	bool							m_bStopped;
 };
+
+//Fixed timestep: the real time of every frame goes into an accumulator that is spent in ticks of the same length.
+//At most m_nMaxTicks run per frame; after a longer stall (a breakpoint, a window drag) the rest is dropped instead of
+//being caught up. The time left over is the part of the next tick that has already passed (GetInterpolation).
+class CFixedTimestep
+{
+public:
+	CFixedTimestep(float fTicksPerSecond, int nMaxTicks);
+	virtual ~CFixedTimestep() { }
+
+private:
+	float							m_fTickTime;
+	int								m_nMaxTicks;
+	float							m_fAccumulator = 0.0f;
+	int								m_nDroppedTicks = 0;
+
+public:
+	//Adds the real time of a frame; returns the number of ticks to simulate for it
+	int Advance(float fFrameTime);
+	float GetTickTime() { return(m_fTickTime); }
+	float GetInterpolation() { return(m_fAccumulator / m_fTickTime); }
+	int GetDroppedTicks() { return(m_nDroppedTicks); }
+};
+
+#ifdef _WITH_FIXED_TIMESTEP_BENCHMARK
+//Headless bullet simulation (CBulletPool, a gun firing every tick) over fSeconds of game time under frame schedules
+//of different frame rates: the state reached with fixed ticks against the old one step per frame (hash of the bullet
+//positions, same or not across the schedules), and the simulated ticks per second of real time. Returns the schedules
+//whose fixed ticks fall short or reach another state than the first.
+int BenchmarkFixedTimestep(
+float fTicksPerSecond, float fSeconds);
+#endif
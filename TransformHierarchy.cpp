@@ -0,0 +1,648 @@
+//-----------------------------------------------------------------------------
+// File: TransformHierarchy.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "TransformHierarchy.h"
+#include "Object.h"
+
+CTransformHierarchy::CTransformHierarchy(CGameObject *pRootFrame)
+{
+	int nNodes = 1 + ((pRootFrame->m_pChild) ? CountFrames(pRootFrame->m_pChild) : 0);
+
+	m_pnParents = new int[nNodes];
+	m_pxmf3Scales = new XMFLOAT3[nNodes];
+	m_pxmf4Rotations = new XMFLOAT4[nNodes];
+	m_pxmf3Translations = new XMFLOAT3[nNodes];
+	m_pxmf4x4Locals = new XMFLOAT4X4[nNodes];
+	m_pxmf4x4Worlds = new XMFLOAT4X4[nNodes];
+	m_ppFrames = new CGameObject*[nNodes];
+	m_pbDirty = new bool[nNodes];
+	memset(m_pbDirty, 0, sizeof(bool) * nNodes);
+
+	//The root is added without its siblings; they belong to whatever the model is attached to
+	m_nNodes = 1;
+	m_pnParents[0] = -1;
+	m_ppFrames[0] = pRootFrame;
+	if (pRootFrame->m_pChild) AddFrames(pRootFrame->m_pChild, 0);
+
+	for (int i = 0; i < m_nNodes; i++)
+	{
+		XMVECTOR xmvScale, xmvRotation, xmvTranslation;
+		if (!XMMatrixDecompose(&xmvScale, &xmvRotation, &xmvTranslation, XMLoadFloat4x4(&m_ppFrames[i]->m_xmf4x4Transform)))
+		{
+			xmvScale = XMVectorSplatOne();
+			xmvRotation = XMQuaternionIdentity();
+			xmvTranslation = XMVectorSet(m_ppFrames[i]->m_xmf4x4Transform._41, m_ppFrames[i]->m_xmf4x4Transform._42, m_ppFrames[i]->m_xmf4x4Transform._43, 1.0f);
+		}
+		XMStoreFloat3(&m_pxmf3Scales[i], xmvScale);
+		XMStoreFloat4(&m_pxmf4Rotations[i], xmvRotation);
+		XMStoreFloat3(&m_pxmf3Translations[i], xmvTranslation);
+		m_pxmf4x4Locals[i] = m_ppFrames[i]->m_xmf4x4Transform;
+		m_pxmf4x4Worlds[i] = m_ppFrames[i]->m_xmf4x4World;
+	}
+}
+
+CTransformHierarchy::~CTransformHierarchy()
+{
+	if (m_pnParents) delete[] m_pnParents;
+	if (m_pxmf3Scales) delete[] m_pxmf3Scales;
+	if (m_pxmf4Rotations) delete[] m_pxmf4Rotations;
+	if (m_pxmf3Translations) delete[] m_pxmf3Translations;
+	if (m_pxmf4x4Locals) delete[] m_pxmf4x4Locals;
+	if (m_pxmf4x4Worlds) delete[] m_pxmf4x4Worlds;
+	if (m_ppFrames) delete[] m_ppFrames;
+	if (m_pbDirty) delete[] m_pbDirty;
+}
+
+int CTransformHierarchy::CountFrames(CGameObject *pFrame)
+{
+	int nFrames = 1;
+	if (pFrame->m_pSibling) nFrames += CountFrames(pFrame->m_pSibling);
+	if (pFrame->m_pChild) nFrames += CountFrames(pFrame->m_pChild);
+	return(nFrames);
+}
+
+void CTransformHierarchy::AddFrames(CGameObject *pFrame, int nParent)
+{
+	int nNode = m_nNodes++;
+	m_pnParents[nNode] = nParent;
+	m_ppFrames[nNode] = pFrame;
+
+	if (pFrame->m_pChild) AddFrames(pFrame->m_pChild, nNode);
+	if (pFrame->m_pSibling) AddFrames(pFrame->m_pSibling, nParent);
+}
+
+void CTransformHierarchy::AttachFrames()
+{
+	for (int i = 0; i < m_nNodes; i++)
+	{
+		m_ppFrames[i]->m_pTransformHierarchy = this;
+		m_ppFrames[i]->m_nTransformNode = i;
+	}
+}
+
+//S * R * T, the same layout as the matrices in the model files
+void CTransformHierarchy::ComposeLocalTransform(int nNode, XMFLOAT4 *pxmf4Rotation, XMFLOAT4X4 *pxmf4x4Local)
+{
+	XMFLOAT3& xmf3Scale = m_pxmf3Scales[nNode];
+	XMMATRIX xmmtxLocal = XMMatrixRotationQuaternion(XMLoadFloat4(pxmf4Rotation));
+	xmmtxLocal.r[0] = XMVectorScale(xmmtxLocal.r[0], xmf3Scale.x);
+	xmmtxLocal.r[1] = XMVectorScale(xmmtxLocal.r[1], xmf3Scale.y);
+	xmmtxLocal.r[2] = XMVectorScale(xmmtxLocal.r[2], xmf3Scale.z);
+	xmmtxLocal.r[3] = XMVectorSetW(XMLoadFloat3(&m_pxmf3Translations[nNode]), 1.0f);
+	XMStoreFloat4x4(pxmf4x4Local, xmmtxLocal);
+}
+
+void CTransformHierarchy::Rotate(int nNode, XMFLOAT3 *pxmf3Axis, float fAngle)
+{
+	XMVECTOR xmvRotation = XMQuaternionMultiply(XMQuaternionRotationAxis(XMLoadFloat3(pxmf3Axis), fAngle), XMLoadFloat4(&m_pxmf4Rotations[nNode]));
+	XMStoreFloat4(&m_pxmf4Rotations[nNode], XMQuaternionNormalize(xmvRotation));
+
+	ComposeLocalTransform(nNode, &m_pxmf4Rotations[nNode], &m_pxmf4x4Locals[nNode]);
+	m_ppFrames[nNode]->m_xmf4x4Transform = m_pxmf4x4Locals[nNode];
+
+	m_pbDirty[nNode] = true;
+	m_bDirty = true;
+}
+
+int CTransformHierarchy::UpdateWorldTransforms(short *pnLocals, XMFLOAT4X4 *pxmf4x4Locals, XMFLOAT4X4 *pxmf4x4Worlds, bool *pbDirty, bool bDirty, XMFLOAT4X4 *pxmf4x4Parent, bool bRootChanged)
+{
+	TRANSFORMSTATS *pStats = &CGameObject::m_xTransformStats;
+
+	if (bRootChanged)
+	{
+		XMMATRIX xmmtxRoot = XMLoadFloat4x4(&m_ppFrames[0]->m_xmf4x4Transform);
+		if (pxmf4x4Parent) xmmtxRoot = XMMatrixMultiply(xmmtxRoot, XMLoadFloat4x4(pxmf4x4Parent));
+		XMStoreFloat4x4(&pxmf4x4Worlds[0], xmmtxRoot);
+
+		//Parents precede their children, so every parent world matrix is final when it is read
+		for (int i = 1; i < m_nNodes; i++)
+		{
+			XMFLOAT4X4 *pxmf4x4Local = (pnLocals && (pnLocals[i] >= 0)) ? &pxmf4x4Locals[pnLocals[i]] : &m_pxmf4x4Locals[i];
+			XMStoreFloat4x4(&pxmf4x4Worlds[i], XMMatrixMultiply(XMLoadFloat4x4(pxmf4x4Local), XMLoadFloat4x4(&pxmf4x4Worlds[m_pnParents[i]])));
+		}
+		pStats->m_nUpdated += m_nNodes;
+	}
+	else if (bDirty)
+	{
+		//The dirty marks flow down in the same order, so only the edited subtrees are recomputed
+		int nUpdated = 0;
+		for (int i = 1; i < m_nNodes; i++)
+		{
+			if (pbDirty[m_pnParents[i]]) pbDirty[i] = true;
+			if (pbDirty[i])
+			{
+				XMFLOAT4X4 *pxmf4x4Local = (pnLocals && (pnLocals[i] >= 0)) ? &pxmf4x4Locals[pnLocals[i]] : &m_pxmf4x4Locals[i];
+				XMStoreFloat4x4(&pxmf4x4Worlds[i], XMMatrixMultiply(XMLoadFloat4x4(pxmf4x4Local), XMLoadFloat4x4(&pxmf4x4Worlds[m_pnParents[i]])));
+				nUpdated++;
+			}
+		}
+		pStats->m_nUpdated += nUpdated;
+		pStats->m_nSkipped += m_nNodes - nUpdated;
+	}
+	else
+	{
+		pStats->m_nSkipped += m_nNodes;
+	}
+
+	if (bDirty) memset(pbDirty, 0, sizeof(bool) * m_nNodes);
+
+	return(m_nNodes);
+}
+
+int CTransformHierarchy::UpdateWorldTransforms(XMFLOAT4X4 *pxmf4x4Parent, bool bRootChanged)
+{
+	int nNodes = UpdateWorldTransforms(NULL, NULL, m_pxmf4x4Worlds, m_pbDirty, m_bDirty, pxmf4x4Parent, bRootChanged);
+	m_bDirty = false;
+
+	return(nNodes);
+}
+
+CTransformPose *CTransformHierarchy::CreatePose()
+{
+	return(new CTransformPose(this));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+CTransformPose::CTransformPose(CTransformHierarchy *pHierarchy)
+{
+	m_pHierarchy = pHierarchy;
+	m_nNodes = pHierarchy->GetNodes();
+
+	//The world matrices are valid after the first UpdateWorldTransforms
+	m_pxmf4x4Worlds = new XMFLOAT4X4[m_nNodes];
+	m_pbDirty = new bool[m_nNodes];
+	memset(m_pbDirty, 0, sizeof(bool) * m_nNodes);
+
+	m_pnLocals = new short[m_nNodes];
+	for (int i = 0; i < m_nNodes; i++) m_pnLocals[i] = -1;
+}
+
+CTransformPose::~CTransformPose()
+{
+	if (m_pxmf4x4Worlds) delete[] m_pxmf4x4Worlds;
+	if (m_pbDirty) delete[] m_pbDirty;
+	if (m_pnLocals) delete[] m_pnLocals;
+	if (m_pxmf4Rotations) delete[] m_pxmf4Rotations;
+	if (m_pxmf4x4Locals) delete[] m_pxmf4x4Locals;
+}
+
+void CTransformPose::Rotate(int nNode, XMFLOAT3 *pxmf3Axis, float fAngle)
+{
+	int nLocal = m_pnLocals[nNode];
+	if (nLocal < 0)
+	{
+		//First edit of the node: it gets its own copy of the shared rotation
+		if (m_nLocals == m_nMaxLocals)
+		{
+			int nMaxLocals = (m_nMaxLocals) ? min(m_nMaxLocals * 2, m_nNodes) : min(2, m_nNodes);
+			XMFLOAT4 *pxmf4Rotations = new XMFLOAT4[nMaxLocals];
+			XMFLOAT4X4 *pxmf4x4Locals = new XMFLOAT4X4[nMaxLocals];
+			if (m_nLocals)
+			{
+				memcpy(pxmf4Rotations, m_pxmf4Rotations, sizeof(XMFLOAT4) * m_nLocals);
+				memcpy(pxmf4x4Locals, m_pxmf4x4Locals, sizeof(XMFLOAT4X4) * m_nLocals);
+				delete[] m_pxmf4Rotations;
+				delete[] m_pxmf4x4Locals;
+			}
+			m_pxmf4Rotations = pxmf4Rotations;
+			m_pxmf4x4Locals = pxmf4x4Locals;
+			m_nMaxLocals = nMaxLocals;
+		}
+		nLocal = m_nLocals++;
+		m_pnLocals[nNode] = short(nLocal);
+		m_pxmf4Rotations[nLocal] = *m_pHierarchy->GetRotation(nNode);
+	}
+
+	XMVECTOR xmvRotation = XMQuaternionMultiply(XMQuaternionRotationAxis(XMLoadFloat3(pxmf3Axis), fAngle), XMLoadFloat4(&m_pxmf4Rotations[nLocal]));
+	XMStoreFloat4(&m_pxmf4Rotations[nLocal], XMQuaternionNormalize(xmvRotation));
+
+	m_pHierarchy->ComposeLocalTransform(nNode, &m_pxmf4Rotations[nLocal], &m_pxmf4x4Locals[nLocal]);
+
+	m_pbDirty[nNode] = true;
+	m_bDirty = true;
+}
+
+int CTransformPose::UpdateWorldTransforms(XMFLOAT4X4 *pxmf4x4Parent, bool bRootChanged)
+{
+	int nNodes = m_pHierarchy->UpdateWorldTransforms(m_pnLocals, m_pxmf4x4Locals, m_pxmf4x4Worlds, m_pbDirty, m_bDirty, pxmf4x4Parent, bRootChanged);
+	m_bDirty = false;
+
+	return(nNodes);
+}
+
+void CTransformPose::Render(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, XMFLOAT4X4 *pxmf4x4Offset)
+{
+	if (!pxmf4x4Offset)
+	{
+		for (int i = 0; i < m_nNodes; i++) m_pHierarchy->GetFrame(i)->RenderFrame(pd3dCommandList, pCamera, &m_pxmf4x4Worlds[i]);
+		return;
+	}
+
+	XMFLOAT4X4 xmf4x4World;
+	for (int i = 0; i < m_nNodes; i++)
+	{
+		xmf4x4World = Matrix4x4::Multiply(m_pxmf4x4Worlds[i], *pxmf4x4Offset);
+		m_pHierarchy->GetFrame(i)->RenderFrame(pd3dCommandList, pCamera, &xmf4x4World);
+	}
+}
+
+#if defined(_WITH_TRANSFORM_HIERARCHY_BENCHMARK) || defined(_WITH_TRANSFORM_POSE_BENCHMARK) || defined(_WITH_OBJECT_REFERENCE_BENCHMARK)
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+#include "ModelFile.h"
+
+//Frames only (no device): the transforms of the tag stream, meshes and materials are skipped
+static CGameObject *LoadBenchmarkFrames(CModelStreamReader *pReader)
+{
+	char *pstrToken = NULL;
+	BYTE nLength = 0;
+
+	CGameObject *pFrame = NULL;
+
+	while (pReader->IsValid())
+	{
+		nLength = pReader->ReadToken(&pstrToken);
+		if (::IsModelToken(pstrToken, nLength, "<Frame>:"))
+		{
+			pFrame = new CGameObject();
+			pReader->ReadInteger();
+			pReader->ReadString(pFrame->m_pstrFrameName, sizeof(pFrame->m_pstrFrameName));
+		}
+		else if (!pFrame)
+		{
+			continue;
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Transform>:"))
+		{
+			pReader->ReadArray(sizeof(float) * 13);
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<TransformMatrix>:"))
+		{
+			void *pTransform = pReader->ReadArray(sizeof(XMFLOAT4X4));
+			if (pTransform) memcpy(&pFrame->m_xmf4x4Transform, pTransform, sizeof(XMFLOAT4X4));
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Mesh>:"))
+		{
+			delete ::LoadMappedMeshInfo(pReader);
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Materials>:"))
+		{
+			MATERIALSLOADINFO *pMaterialsInfo = ::LoadMappedMaterialsInfo(pReader);
+			delete[] pMaterialsInfo->m_pMaterials;
+			delete pMaterialsInfo;
+		}
+		else if (::IsModelToken(pstrToken, nLength, "<Children>:"))
+		{
+			int nChilds = pReader->ReadInteger();
+			for (int i = 0; i < nChilds; i++)
+			{
+				CGameObject *pChild = ::LoadBenchmarkFrames(pReader);
+				if (pChild) pFrame->SetChild(pChild);
+			}
+		}
+		else if (::IsModelToken(pstrToken, nLength, "</Frame>"))
+		{
+			break;
+		}
+	}
+	return(pFrame);
+}
+
+static CGameObject *LoadBenchmarkModel(char *pstrFileName)
+{
+	CMappedModelFile xModelFile;
+	if (!xModelFile.Open(pstrFileName)) return(NULL);
+
+	CGameObject *pRootFrame = NULL;
+	CModelStreamReader xReader(xModelFile.GetData(), xModelFile.GetSize());
+	char *pstrToken = NULL;
+	BYTE nLength = 0;
+	while (xReader.IsValid() && !pRootFrame)
+	{
+		nLength = xReader.ReadToken(&pstrToken);
+		if (::IsModelToken(pstrToken, nLength, "<Hierarchy>:")) pRootFrame = ::LoadBenchmarkFrames(&xReader);
+	}
+	return(pRootFrame);
+}
+#endif
+
+#ifdef _WITH_TRANSFORM_HIERARCHY_BENCHMARK
+//Copies the frames of pSource below pParent (the same depth-first allocation order as the loader)
+static void CloneBenchmarkFrames(CGameObject *pSource, CGameObject *pParent)
+{
+	CGameObject *pFrame = new CGameObject();
+	strcpy_s(pFrame->m_pstrFrameName, sizeof(pFrame->m_pstrFrameName), pSource->m_pstrFrameName);
+	pFrame->m_xmf4x4Transform = pSource->m_xmf4x4Transform;
+	pParent->SetChild(pFrame);
+
+	if (pSource->m_pChild) ::CloneBenchmarkFrames(pSource->m_pChild, pFrame);
+	if (pSource->m_pSibling) ::CloneBenchmarkFrames(pSource->m_pSibling, pParent);
+}
+
+//Returns 1 when the flat pass is off the recursive one by more than rounding
+static int MeasureTransformHierarchy(char *pstrName, CGameObject *pRootFrame, int nRepeats)
+{
+	CTransformHierarchy *pHierarchy = new CTransformHierarchy(pRootFrame);
+	int nNodes = pHierarchy->GetNodes();
+
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	double fRecursiveSeconds = 0.0, fFlatSeconds = 0.0;
+	for (int r = 0; r < nRepeats; r++)
+	{
+		//Edits the root so that both passes recompute every frame
+		pRootFrame->MarkTransformDirty();
+		::QueryPerformanceCounter(&nBegin);
+		pRootFrame->UpdateTransform(NULL);
+		::QueryPerformanceCounter(&nEnd);
+		fRecursiveSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+		::QueryPerformanceCounter(&nBegin);
+		pHierarchy->UpdateWorldTransforms(NULL, true);
+		::QueryPerformanceCounter(&nEnd);
+		fFlatSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+	}
+
+	//Relative to the largest element of the recursive result
+	float fMaxError = 0.0f;
+	for (int i = 0; i < nNodes; i++)
+	{
+		float *pfFlat = &pHierarchy->GetWorldTransform(i)->_11, *pfRecursive = &pHierarchy->GetFrame(i)->m_xmf4x4World._11;
+		float fMagnitude = 1.0f, fError = 0.0f;
+		for (int j = 0; j < 16; j++)
+		{
+			fMagnitude = max(fMagnitude, fabsf(pfRecursive[j]));
+			fError = max(fError, fabsf(pfFlat[j] - pfRecursive[j]));
+		}
+		fMaxError = max(fMaxError, fError / fMagnitude);
+	}
+
+	TCHAR pstrDebug[256] = { 0 };
+	_stprintf_s(pstrDebug, 256, _T("%hs: %d frames, recursive %.2f us, flat %.2f us, %.1fx, max error %.2e\n"), pstrName, nNodes, fRecursiveSeconds * 1.0e6 / nRepeats, fFlatSeconds * 1.0e6 / nRepeats, fRecursiveSeconds / max(fFlatSeconds, 1.0e-12), fMaxError);
+	OutputDebugString(pstrDebug);
+
+	delete pHierarchy;
+
+	return((fMaxError > 1.0e-4f) ? 1 : 0);
+}
+
+int BenchmarkTransformHierarchy(char **ppstrFileNames, int nFiles, int nInstances, int nSyntheticNodes, int nRepeats)
+{
+	int nFailures = 0;
+	char pstrName[256];
+	for (int i = 0; i < nFiles; i++)
+	{
+		CGameObject *pModel = ::LoadBenchmarkModel(ppstrFileNames[i]);
+		if (!pModel)
+		{
+			nFailures++;
+			continue;
+		}
+
+		//One root with nInstances copies of the model, placed on a grid like the villains
+		CGameObject *pRootFrame = new CGameObject();
+		for (int j = 0; j < nInstances; j++)
+		{
+			pModel->m_xmf4x4Transform._41 = float(j % 32) * 20.0f;
+			pModel->m_xmf4x4Transform._43 = float(j / 32) * 20.0f;
+			::CloneBenchmarkFrames(pModel, pRootFrame);
+		}
+		sprintf_s(pstrName, 256, "%s x %d", ppstrFileNames[i], nInstances);
+		nFailures += ::MeasureTransformHierarchy(pstrName, pRootFrame, nRepeats);
+
+		pRootFrame->Release();
+		pModel->Release();
+	}
+
+	//Random tree: every frame hangs below one of the 16 frames created before it (long chains with some
+	//branching), with a random rotation, a small translation and a scale close to 1
+	srand(1);
+	CGameObject **ppFrames = new CGameObject*[nSyntheticNodes];
+	for (int i = 0; i < nSyntheticNodes; i++)
+	{
+		ppFrames[i] = new CGameObject();
+		XMVECTOR xmvAxis = XMVector3Normalize(XMVectorSet(float(rand() % 201 - 100), float(rand() % 201 - 100), float(rand() % 201 - 100) + 0.5f, 0.0f));
+		float fScale = 0.95f + 0.1f * float(rand() % 101) / 100.0f;
+		XMMATRIX xmmtxTransform = XMMatrixScaling(fScale, fScale, fScale) * XMMatrixRotationAxis(xmvAxis, XMConvertToRadians(float(rand() % 360))) * XMMatrixTranslation(float(rand() % 21 - 10) * 0.1f, float(rand() % 21 - 10) * 0.1f, 1.0f);
+		XMStoreFloat4x4(&ppFrames[i]->m_xmf4x4Transform, xmmtxTransform);
+		if (i > 0) ppFrames[i - 1 - rand() % min(i, 16)]->SetChild(ppFrames[i]);
+	}
+	sprintf_s(pstrName, 256, "synthetic");
+	nFailures += ::MeasureTransformHierarchy(pstrName, ppFrames[0], nRepeats);
+
+	ppFrames[0]->Release();
+	delete[] ppFrames;
+
+	return(nFailures);
+}
+#endif
+
+#ifdef _WITH_TRANSFORM_POSE_BENCHMARK
+int BenchmarkTransformPoses(char *pstrFileName, int *pnInstances, int nCounts, int nRepeats)
+{
+	CGameObject *pModel = ::LoadBenchmarkModel(pstrFileName);
+	if (!pModel) return(1);
+
+	//The shared pass edits the frames of pModel; the poses and the reference start from the frames as loaded
+	CTransformHierarchy *pHierarchy = new CTransformHierarchy(pModel);
+	CTransformHierarchy *pRestHierarchy = new CTransformHierarchy(pModel);
+	int nNodes = pHierarchy->GetNodes();
+
+	int nRotors = 0, pnRotors[8];
+	for (int i = 1; (i < nNodes) && (nRotors < 8); i++)
+	{
+		if (strstr(pHierarchy->GetFrame(i)->m_pstrFrameName, "Rotor")) pnRotors[nRotors++] = i;
+	}
+	if (!nRotors && (nNodes > 1)) pnRotors[nRotors++] = 1;
+
+	XMFLOAT3 xmf3RotorAxis(0.0f, 0.0f, 1.0f);
+	float fAngle = XMConvertToRadians(30.0f / 60.0f);
+
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	int nFailures = 0;
+	TCHAR pstrDebug[256] = { 0 };
+	for (int c = 0; c < nCounts; c++)
+	{
+		int nInstances = pnInstances[c];
+		XMFLOAT4X4 *pxmf4x4Instances = new XMFLOAT4X4[nInstances];
+		CTransformPose **ppPoses = new CTransformPose*[nInstances];
+		for (int j = 0; j < nInstances; j++)
+		{
+			XMStoreFloat4x4(&pxmf4x4Instances[j], XMMatrixTranslation(float(j % 100) * 20.0f, 150.0f, float(j / 100) * 20.0f));
+			ppPoses[j] = pRestHierarchy->CreatePose();
+			ppPoses[j]->UpdateWorldTransforms(&pxmf4x4Instances[j], true);
+		}
+
+		//The world matrices are read as Render would, so that no pass can be optimized away
+		float fSink = 0.0f;
+		double fSharedSeconds = 0.0, fPoseSeconds = 0.0, fMovingSeconds = 0.0;
+		for (int r = 0; r < nRepeats; r++)
+		{
+			//Shared frames: every instance edits the same rotors and recomputes the whole model below itself
+			::QueryPerformanceCounter(&nBegin);
+			for (int j = 0; j < nInstances; j++)
+			{
+				for (int k = 0; k < nRotors; k++) pHierarchy->Rotate(pnRotors[k], &xmf3RotorAxis, fAngle);
+				pHierarchy->UpdateWorldTransforms(&pxmf4x4Instances[j], true);
+				for (int i = 0; i < nNodes; i++) fSink += pHierarchy->GetWorldTransform(i)->_41;
+			}
+			::QueryPerformanceCounter(&nEnd);
+			fSharedSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+			//Poses of instances that did not move: only the rotor subtrees are recomputed
+			::QueryPerformanceCounter(&nBegin);
+			for (int j = 0; j < nInstances; j++)
+			{
+				for (int k = 0; k < nRotors; k++) ppPoses[j]->Rotate(pnRotors[k], &xmf3RotorAxis, fAngle);
+				ppPoses[j]->UpdateWorldTransforms(&pxmf4x4Instances[j], false);
+				for (int i = 0; i < nNodes; i++) fSink += ppPoses[j]->GetWorldTransform(i)->_41;
+			}
+			::QueryPerformanceCounter(&nEnd);
+			fPoseSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+			//Poses of instances that all moved
+			::QueryPerformanceCounter(&nBegin);
+			for (int j = 0; j < nInstances; j++)
+			{
+				for (int k = 0; k < nRotors; k++) ppPoses[j]->Rotate(pnRotors[k], &xmf3RotorAxis, fAngle);
+				ppPoses[j]->UpdateWorldTransforms(&pxmf4x4Instances[j], true);
+				for (int i = 0; i < nNodes; i++) fSink += ppPoses[j]->GetWorldTransform(i)->_41;
+			}
+			::QueryPerformanceCounter(&nEnd);
+			fMovingSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+		}
+
+		//Every pose against a hierarchy of a fresh copy of the model given the same rotations
+		CGameObject *pReferenceModel = ::LoadBenchmarkModel(pstrFileName);
+		CTransformHierarchy *pReference = new CTransformHierarchy(pReferenceModel);
+		for (int r = 0; r < nRepeats * 2; r++)
+		{
+			for (int k = 0; k < nRotors; k++) pReference->Rotate(pnRotors[k], &xmf3RotorAxis, fAngle);
+		}
+		float fMaxError = 0.0f;
+		for (int j = 0; j < nInstances; j++)
+		{
+			pReference->UpdateWorldTransforms(&pxmf4x4Instances[j], true);
+			for (int i = 0; i < nNodes; i++)
+			{
+				float *pfPose = &ppPoses[j]->GetWorldTransform(i)->_11, *pfReference = &pReference->GetWorldTransform(i)->_11;
+				for (int k = 0; k < 16; k++) fMaxError = max(fMaxError, fabsf(pfPose[k] - pfReference[k]));
+			}
+		}
+		delete pReference;
+		pReferenceModel->Release();
+
+		int nPoseBytes = ppPoses[0]->GetSize();
+		_stprintf_s(pstrDebug, 256, _T("%hs x %d: shared %.1f us, poses %.1f us (%.1fx), moving poses %.1f us (%.1fx), %d bytes per pose, max error %.2e (%g)\n"), pstrFileName, nInstances, fSharedSeconds * 1.0e6 / nRepeats, fPoseSeconds * 1.0e6 / nRepeats, fSharedSeconds / max(fPoseSeconds, 1.0e-12), fMovingSeconds * 1.0e6 / nRepeats, fSharedSeconds / max(fMovingSeconds, 1.0e-12), nPoseBytes, fMaxError, fSink);
+		OutputDebugString(pstrDebug);
+		//Absolute, on world positions of up to 2000 units
+		if (fMaxError > 1.0e-2f) nFailures++;
+
+		for (int j = 0; j < nInstances; j++) delete ppPoses[j];
+		delete[] ppPoses;
+		delete[] pxmf4x4Instances;
+	}
+
+	delete pHierarchy;
+	delete pRestHierarchy;
+	pModel->Release();
+
+	return(nFailures);
+}
+#endif
+
+#ifdef _WITH_OBJECT_REFERENCE_BENCHMARK
+#include <thread>
+
+//What every AddRef and Release did before: a walk over the whole attached subtree (siblings of the root included)
+static void WalkBenchmarkReferences(CGameObject *pFrame, int *pnReferences, int nDelta)
+{
+	pnReferences[pFrame->m_nTransformNode] += nDelta;
+	if (pFrame->m_pSibling) ::WalkBenchmarkReferences(pFrame->m_pSibling, pnReferences, nDelta);
+	if (pFrame->m_pChild) ::WalkBenchmarkReferences(pFrame->m_pChild, pnReferences, nDelta);
+}
+
+//Spawns the instances of one worker, then destroys them
+static void SpawnBenchmarkInstances(CGameObject *pModel, CGameObject **ppInstances, int nInstances, bool bPoses)
+{
+	for (int i = 0; i < nInstances; i++)
+	{
+		ppInstances[i] = new CGameObject();
+		ppInstances[i]->SetChild(pModel, true);
+		if (bPoses) ppInstances[i]->CreateTransformPose();
+	}
+	for (int i = 0; i < nInstances; i++) ppInstances[i]->Release();
+}
+
+static double MeasureBenchmarkInstances(CGameObject *pModel, CGameObject **ppInstances, int nInstances, int nThreads, bool bPoses)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+	::QueryPerformanceCounter(&nBegin);
+
+	std::thread *pThreads = new std::thread[nThreads];
+	int nPerThread = nInstances / nThreads;
+	for (int i = 0; i < nThreads; i++) pThreads[i] = std::thread(::SpawnBenchmarkInstances, pModel, ppInstances + i * nPerThread, nPerThread, bPoses);
+	for (int i = 0; i < nThreads; i++) pThreads[i].join();
+	delete[] pThreads;
+
+	::QueryPerformanceCounter(&nEnd);
+	return(double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart));
+}
+
+int BenchmarkObjectReferences(char **ppstrFileNames, int nFiles, int nInstances, int nThreads)
+{
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	int nFailures = 0;
+	CGameObject **ppInstances = new CGameObject*[nInstances];
+	TCHAR pstrDebug[256] = { 0 };
+	for (int f = 0; f < nFiles; f++)
+	{
+		CGameObject *pModel = ::LoadBenchmarkModel(ppstrFileNames[f]);
+		if (!pModel)
+		{
+			nFailures++;
+			continue;
+		}
+		(new CTransformHierarchy(pModel))->AttachFrames();
+		//The scene's reference: the model outlives all instances
+		pModel->AddRef();
+
+		double fSerialSeconds = ::MeasureBenchmarkInstances(pModel, ppInstances, nInstances, 1, false);
+		double fThreadedSeconds = ::MeasureBenchmarkInstances(pModel, ppInstances, nInstances, nThreads, false);
+		double fPoseSeconds = ::MeasureBenchmarkInstances(pModel, ppInstances, nInstances, nThreads, true);
+		LONG nReferences = pModel->GetReferences();
+
+		int nNodes = pModel->m_pTransformHierarchy->GetNodes();
+		int *pnReferences = new int[nNodes];
+		memset(pnReferences, 0, sizeof(int) * nNodes);
+		::QueryPerformanceCounter(&nBegin);
+		for (int i = 0; i < nInstances; i++)
+		{
+			::WalkBenchmarkReferences(pModel, pnReferences, 1);
+			::WalkBenchmarkReferences(pModel, pnReferences, -1);
+		}
+		::QueryPerformanceCounter(&nEnd);
+		double fWalkSeconds = double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+		delete[] pnReferences;
+
+		_stprintf_s(pstrDebug, 256, _T("%hs: %d instances spawned and destroyed in %.2f ms (%d threads %.2f ms, with poses %.2f ms), the recursive walks took %.2f ms, model references after %d\n"), ppstrFileNames[f], nInstances, fSerialSeconds * 1.0e3, nThreads, fThreadedSeconds * 1.0e3, fPoseSeconds * 1.0e3, fWalkSeconds * 1.0e3, nReferences);
+		OutputDebugString(pstrDebug);
+		//Only the scene's reference is left once every instance is gone
+		if (nReferences != 1) nFailures++;
+
+		pModel->Release();
+	}
+	delete[] ppInstances;
+
+	return(nFailures);
+}
+#endif
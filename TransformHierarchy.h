@@ -0,0 +1,127 @@
+//-----------------------------------------------------------------------------
+// File: TransformHierarchy.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+class CGameObject;
+class CCamera;
+class CTransformPose;
+
+//Flattened transform hierarchy of one loaded model. Nodes are stored depth-first, so every parent precedes
+//its children, and the parent indices, local TRS and world matrices live in separate arrays. The world
+//matrices are then one linear pass instead of a walk over m_pSibling/m_pChild. The local matrices are
+//composed from the TRS arrays only when a node is edited.
+//The world matrices stay here: frames of a loaded model read them through CGameObject::GetWorldTransform
+//and their own m_xmf4x4World is not updated.
+//Node 0 is the root frame: its local transform stays in CGameObject::m_xmf4x4Transform (SetPosition,
+//Rotate, ... keep working on it). The local transforms below it are owned here. CGameObject::RotateLocal
+//edits them and keeps the frame's m_xmf4x4Transform as a copy.
+//Edited nodes are only marked; UpdateWorldTransforms recomputes them and the nodes below them.
+
+//Loaded models update their world matrices through their CTransformHierarchy (CGameObject::UpdateTransform)
+#define _WITH_FLAT_TRANSFORM_HIERARCHY
+
+class CTransformHierarchy
+{
+public:
+	CTransformHierarchy(CGameObject *pRootFrame);
+	virtual ~CTransformHierarchy();
+
+private:
+	int								m_nNodes = 0;
+	int								*m_pnParents = NULL; //-1 for node 0
+	XMFLOAT3						*m_pxmf3Scales = NULL;
+	XMFLOAT4						*m_pxmf4Rotations = NULL; //Quaternions
+	XMFLOAT3						*m_pxmf3Translations = NULL;
+	XMFLOAT4X4						*m_pxmf4x4Locals = NULL; //S * R * T of the arrays above
+	XMFLOAT4X4						*m_pxmf4x4Worlds = NULL;
+	CGameObject						**m_ppFrames = NULL;
+	bool							*m_pbDirty = NULL; //Local transform edited since the last UpdateWorldTransforms
+	bool							m_bDirty = false; //Any of m_pbDirty
+
+	int CountFrames(CGameObject *pFrame);
+	void AddFrames(CGameObject *pFrame, int nParent);
+
+public:
+	int GetNodes() { return(m_nNodes); }
+	int GetParent(int nNode) { return(m_pnParents[nNode]); }
+	XMFLOAT4X4 *GetWorldTransform(int nNode) { return(&m_pxmf4x4Worlds[nNode]); }
+	CGameObject *GetFrame(int nNode) { return(m_ppFrames[nNode]); }
+	XMFLOAT4 *GetRotation(int nNode) { return(&m_pxmf4Rotations[nNode]); }
+
+	//Local transform of nNode from the shared scale and translation and the given rotation
+	void ComposeLocalTransform(int nNode, XMFLOAT4 *pxmf4Rotation, XMFLOAT4X4 *pxmf4x4Local);
+	//The world pass into any world array of this hierarchy (its own or a CTransformPose). pnLocals[i] >= 0
+	//takes the local transform of node i from pxmf4x4Locals[pnLocals[i]] instead of the shared one.
+	int UpdateWorldTransforms(short *pnLocals, XMFLOAT4X4 *pxmf4x4Locals, XMFLOAT4X4 *pxmf4x4Worlds, bool *pbDirty, bool bDirty, XMFLOAT4X4 *pxmf4x4Parent, bool bRootChanged);
+
+	//Sets m_pTransformHierarchy/m_nTransformNode of every frame (the root frame owns the hierarchy)
+	void AttachFrames();
+
+	//Rotation about a local axis applied before the node's own rotation; the same as pre-multiplying
+	//m_xmf4x4Transform by XMMatrixRotationAxis for uniformly scaled frames
+	void Rotate(int nNode, XMFLOAT3 *pxmf3Axis, float fAngle);
+
+	//bRootChanged: the root transform or the parent matrix changed and every node is recomputed. Returns the nodes.
+	int UpdateWorldTransforms(XMFLOAT4X4 *pxmf4x4Parent, bool bRootChanged);
+
+	CTransformPose *CreatePose();
+};
+
+//Per-instance pose of a shared model: every instance (CGameObject::CreateTransformPose) animates its own
+//rotations and gets its own world matrices while the frames, meshes and materials stay shared and unchanged.
+//Only the nodes the instance has rotated get their own rotation and local transform; the others (and the
+//root, node 0) read the shared ones.
+class CTransformPose
+{
+public:
+	CTransformPose(CTransformHierarchy *pHierarchy);
+	virtual ~CTransformPose();
+
+private:
+	CTransformHierarchy				*m_pHierarchy = NULL;
+	int								m_nNodes = 0;
+	XMFLOAT4X4						*m_pxmf4x4Worlds = NULL;
+	bool							*m_pbDirty = NULL;
+	bool							m_bDirty = false;
+
+	short							*m_pnLocals = NULL; //Per node: index into the arrays below, -1 for the shared local transform
+	int								m_nLocals = 0;
+	int								m_nMaxLocals = 0;
+	XMFLOAT4						*m_pxmf4Rotations = NULL;
+	XMFLOAT4X4						*m_pxmf4x4Locals = NULL;
+
+public:
+	CTransformHierarchy *GetHierarchy() { return(m_pHierarchy); }
+	XMFLOAT4X4 *GetWorldTransform(int nNode) { return(&m_pxmf4x4Worlds[nNode]); }
+	int GetSize() { return(sizeof(CTransformPose) + m_nNodes * (sizeof(XMFLOAT4X4) + sizeof(bool) + sizeof(short)) + m_nMaxLocals * (sizeof(XMFLOAT4) + sizeof(XMFLOAT4X4))); }
+
+	//The same as CTransformHierarchy::Rotate on this instance only (nNode > 0)
+	void Rotate(int nNode, XMFLOAT3 *pxmf3Axis, float fAngle);
+	int UpdateWorldTransforms(XMFLOAT4X4 *pxmf4x4Parent, bool bRootChanged);
+
+	//Draws the frames of the shared model with the world matrices of this pose (post-multiplied by pxmf4x4Offset), in node order
+	void Render(ID3D12GraphicsCommandList *pd3dCommandList, CCamera *pCamera, XMFLOAT4X4 *pxmf4x4Offset = NULL);
+};
+
+#ifdef _WITH_TRANSFORM_HIERARCHY_BENCHMARK
+//Recursive CGameObject::UpdateTransform against the flattened pass, on nInstances copies of each model
+//under one root and on a random tree of nSyntheticNodes frames; returns the models that fail to load or disagree
+int BenchmarkTransformHierarchy(char **ppstrFileNames, int nFiles, int nInstances, int nSyntheticNodes, int nRepeats);
+#endif
+
+#ifdef _WITH_TRANSFORM_POSE_BENCHMARK
+//Instances of one model animating their "Rotor" frames: the shared hierarchy edited and recomputed for every
+//instance (the villains before poses) against one CTransformPose per instance; returns the instance counts whose
+//poses are off the reference (1 when the model fails to load)
+int BenchmarkTransformPoses(char *pstrFileName, int *pnInstances, int nCounts, int nRepeats);
+#endif
+
+#ifdef _WITH_OBJECT_REFERENCE_BENCHMARK
+//nInstances instances of each model (an empty root with the model attached by reference) spawned and destroyed on
+//one and on nThreads threads, against the subtree walks of the old recursive AddRef/Release; returns the models
+//that fail to load or keep references of the instances
+int BenchmarkObjectReferences(
+char **ppstrFileNames, int nFiles, int nInstances, int nThreads);
+#endif
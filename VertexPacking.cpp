@@ -0,0 +1,295 @@
+//-----------------------------------------------------------------------------
+// File: VertexPacking.cpp
+//-----------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "VertexPacking.h"
+#include "ModelFile.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+void GetPackedVertexLayout(UINT nFlags, PACKEDVERTEXLAYOUT *pLayout)
+{
+	pLayout->m_nFlags = nFlags;
+	pLayout->m_nPositionOffset = 0;
+	if (nFlags & VERTEX_PACK_QUANTIZE_POSITION)
+	{
+		pLayout->m_dxgiPositionFormat = DXGI_FORMAT_R16G16B16A16_UNORM;
+		pLayout->m_nNormalOffset = sizeof(USHORT) * 4;
+	}
+	else
+	{
+		pLayout->m_dxgiPositionFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+		pLayout->m_nNormalOffset = sizeof(XMFLOAT3);
+	}
+	pLayout->m_nTexCoordOffset = pLayout->m_nNormalOffset + sizeof(short) * 2;
+	pLayout->m_nStride = pLayout->m_nTexCoordOffset + sizeof(HALF) * 2;
+
+	pLayout->m_xmf4PositionScale = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
+	pLayout->m_xmf4PositionBias = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+void GetPackedVertexLayout(CMeshLoadInfo *pMeshInfo, UINT nFlags, PACKEDVERTEXLAYOUT *pLayout)
+{
+	::GetPackedVertexLayout(nFlags, pLayout);
+	if (!(nFlags & VERTEX_PACK_QUANTIZE_POSITION)) return;
+
+	//<Bounds> is the exporter's AABB; grow it to the actual vertices so that nothing is clamped
+	XMFLOAT3 xmf3Min, xmf3Max;
+	xmf3Min.x = pMeshInfo->m_xmf3AABBCenter.x - pMeshInfo->m_xmf3AABBExtents.x;
+	xmf3Min.y = pMeshInfo->m_xmf3AABBCenter.y - pMeshInfo->m_xmf3AABBExtents.y;
+	xmf3Min.z = pMeshInfo->m_xmf3AABBCenter.z - pMeshInfo->m_xmf3AABBExtents.z;
+	xmf3Max.x = pMeshInfo->m_xmf3AABBCenter.x + pMeshInfo->m_xmf3AABBExtents.x;
+	xmf3Max.y = pMeshInfo->m_xmf3AABBCenter.y + pMeshInfo->m_xmf3AABBExtents.y;
+	xmf3Max.z = pMeshInfo->m_xmf3AABBCenter.z + pMeshInfo->m_xmf3AABBExtents.z;
+	for (int i = 0; i < pMeshInfo->m_nVertices; i++)
+	{
+		XMFLOAT3& xmf3Position = pMeshInfo->m_pxmf3Positions[i];
+		xmf3Min.x = min(xmf3Min.x, xmf3Position.x); xmf3Max.x = max(xmf3Max.x, xmf3Position.x);
+		xmf3Min.y = min(xmf3Min.y, xmf3Position.y); xmf3Max.y = max(xmf3Max.y, xmf3Position.y);
+		xmf3Min.z = min(xmf3Min.z, xmf3Position.z); xmf3Max.z = max(xmf3Max.z, xmf3Position.z);
+	}
+
+	//A flat axis still needs a non-zero scale to divide by
+	pLayout->m_xmf4PositionScale = XMFLOAT4(max(xmf3Max.x - xmf3Min.x, 1.0e-6f), max(xmf3Max.y - xmf3Min.y, 1.0e-6f), max(xmf3Max.z - xmf3Min.z, 1.0e-6f), 0.0f);
+	pLayout->m_xmf4PositionBias = XMFLOAT4(xmf3Min.x, xmf3Min.y, xmf3Min.z, 0.0f);
+}
+
+UINT CreatePackedInputElementDescs(PACKEDVERTEXLAYOUT *pLayout, D3D12_INPUT_ELEMENT_DESC *pd3dInputElementDescs)
+{
+	pd3dInputElementDescs[0] = { "POSITION", 0, pLayout->m_dxgiPositionFormat, 0, pLayout->m_nPositionOffset, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 };
+	pd3dInputElementDescs[1] = { "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, pLayout->m_nNormalOffset, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 };
+	pd3dInputElementDescs[2] = { "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, pLayout->m_nTexCoordOffset, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 };
+
+	return(VERTEX_PACK_INPUT_ELEMENTS);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+inline float SignNotZero(float fValue) { return((fValue >= 0.0f) ? 1.0f : -1.0f); }
+
+inline short FloatToSNorm16(float fValue)
+{
+	fValue = max(-1.0f, min(1.0f, fValue));
+	return(short(floorf(fValue * 32767.0f + 0.5f)));
+}
+
+inline float SNorm16ToFloat(short nValue) { return(max(float(nValue) / 32767.0f, -1.0f)); }
+
+//Project onto the octahedron |x|+|y|+|z| = 1 and fold the lower hemisphere over the diagonals
+void EncodeOctahedralNormal(XMFLOAT3& xmf3Normal, short *pnEncoded)
+{
+	float fL1Norm = fabsf(xmf3Normal.x) + fabsf(xmf3Normal.y) + fabsf(xmf3Normal.z);
+	if (fL1Norm <= 0.0f)
+	{
+		pnEncoded[0] = pnEncoded[1] = 0;
+		return;
+	}
+
+	float x = xmf3Normal.x / fL1Norm, y = xmf3Normal.y / fL1Norm;
+	if (xmf3Normal.z < 0.0f)
+	{
+		float fFoldedX = (1.0f - fabsf(y)) * SignNotZero(x);
+		float fFoldedY = (1.0f - fabsf(x)) * SignNotZero(y);
+		x = fFoldedX;
+		y = fFoldedY;
+	}
+	pnEncoded[0] = FloatToSNorm16(x);
+	pnEncoded[1] = FloatToSNorm16(y);
+}
+
+//Same as OctahedralDecode() in Shaders.hlsl
+XMFLOAT3 DecodeOctahedralNormal(short *pnEncoded)
+{
+	float x = SNorm16ToFloat(pnEncoded[0]), y = SNorm16ToFloat(pnEncoded[1]);
+	float z = 1.0f - fabsf(x) - fabsf(y);
+	float t = max(-z, 0.0f);
+	x += (x >= 0.0f) ? -t : t;
+	y += (y >= 0.0f) ? -t : t;
+
+	float fLength = sqrtf(x * x + y * y + z * z);
+	if (fLength <= 0.0f) return(XMFLOAT3(0.0f, 0.0f, 0.0f));
+
+	return(XMFLOAT3(x / fLength, y / fLength, z / fLength));
+}
+
+inline USHORT FloatToUNorm16(float fValue)
+{
+	fValue = max(0.0f, min(1.0f, fValue));
+	return(USHORT(floorf(fValue * 65535.0f + 0.5f)));
+}
+
+void QuantizePosition(XMFLOAT3& xmf3Position, PACKEDVERTEXLAYOUT *pLayout, USHORT *pnEncoded)
+{
+	pnEncoded[0] = FloatToUNorm16((xmf3Position.x - pLayout->m_xmf4PositionBias.x) / pLayout->m_xmf4PositionScale.x);
+	pnEncoded[1] = FloatToUNorm16((xmf3Position.y - pLayout->m_xmf4PositionBias.y) / pLayout->m_xmf4PositionScale.y);
+	pnEncoded[2] = FloatToUNorm16((xmf3Position.z - pLayout->m_xmf4PositionBias.z) / pLayout->m_xmf4PositionScale.z);
+	pnEncoded[3] = 0xFFFF;
+}
+
+XMFLOAT3 DequantizePosition(USHORT *pnEncoded, PACKEDVERTEXLAYOUT *pLayout)
+{
+	XMFLOAT3 xmf3Position;
+	xmf3Position.x = (float(pnEncoded[0]) / 65535.0f) * pLayout->m_xmf4PositionScale.x + pLayout->m_xmf4PositionBias.x;
+	xmf3Position.y = (float(pnEncoded[1]) / 65535.0f) * pLayout->m_xmf4PositionScale.y + pLayout->m_xmf4PositionBias.y;
+	xmf3Position.z = (float(pnEncoded[2]) / 65535.0f) * pLayout->m_xmf4PositionScale.z + pLayout->m_xmf4PositionBias.z;
+
+	return(xmf3Position);
+}
+
+BYTE *PackVertices(CMeshLoadInfo *pMeshInfo, PACKEDVERTEXLAYOUT *pLayout)
+{
+	BYTE *pVertices = new BYTE[pLayout->m_nStride * pMeshInfo->m_nVertices];
+	::memset(pVertices, 0, pLayout->m_nStride * pMeshInfo->m_nVertices);
+
+	for (int i = 0; i < pMeshInfo->m_nVertices; i++)
+	{
+		BYTE *pVertex = pVertices + pLayout->m_nStride * i;
+
+		if (pLayout->m_nFlags & VERTEX_PACK_QUANTIZE_POSITION)
+			::QuantizePosition(pMeshInfo->m_pxmf3Positions[i], pLayout, (USHORT *)(pVertex + pLayout->m_nPositionOffset));
+		else
+			::memcpy(pVertex + pLayout->m_nPositionOffset, &pMeshInfo->m_pxmf3Positions[i], sizeof(XMFLOAT3));
+
+		if (pMeshInfo->m_pxmf3Normals) ::EncodeOctahedralNormal(pMeshInfo->m_pxmf3Normals[i], (short *)(pVertex + pLayout->m_nNormalOffset));
+
+		if (pMeshInfo->m_pxmf2TexCoords)
+		{
+			HALF *pTexCoord = (HALF *)(pVertex + pLayout->m_nTexCoordOffset);
+			pTexCoord[0] = XMConvertFloatToHalf(pMeshInfo->m_pxmf2TexCoords[i].x);
+			pTexCoord[1] = XMConvertFloatToHalf(pMeshInfo->m_pxmf2TexCoords[i].y);
+		}
+	}
+
+	return(pVertices);
+}
+
+#ifdef _WITH_VERTEX_PACKING_BENCHMARK
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//CPU only: packs every mesh of the file, decodes it again and compares with the source arrays.
+//Position error is reported in model units and relative to the mesh AABB diagonal.
+struct VERTEXPACKINGREPORT
+{
+	UINT							m_nFlags = 0;
+	int								m_nMeshes = 0;
+	int								m_nVertices = 0;
+	UINT64							m_nSeparateBytes = 0;
+	UINT64							m_nPackedBytes = 0;
+	double							m_fEncodeSeconds = 0.0;
+
+	float							m_fMaxPositionError = 0.0f;
+	float							m_fMaxRelativePositionError = 0.0f;
+	double							m_fSumPositionError = 0.0;
+	float							m_fMaxNormalDegrees = 0.0f;
+	double							m_fSumNormalDegrees = 0.0;
+	int								m_nNormals = 0;
+	float							m_fMaxTexCoordError = 0.0f;
+	double							m_fSumTexCoordError = 0.0;
+	int								m_nTexCoords = 0;
+};
+
+static void MeasureVertexPacking(CMeshLoadInfo *pMeshInfo, void *pContext)
+{
+	VERTEXPACKINGREPORT *pReport = (VERTEXPACKINGREPORT *)pContext;
+	if (!pMeshInfo->m_pxmf3Positions || (pMeshInfo->m_nVertices <= 0)) return;
+
+	LARGE_INTEGER nFrequency, nBegin, nEnd;
+	::QueryPerformanceFrequency(&nFrequency);
+
+	PACKEDVERTEXLAYOUT xLayout;
+	::QueryPerformanceCounter(&nBegin);
+	::GetPackedVertexLayout(pMeshInfo, pReport->m_nFlags, &xLayout);
+	BYTE *pVertices = ::PackVertices(pMeshInfo, &xLayout);
+	::QueryPerformanceCounter(&nEnd);
+	pReport->m_fEncodeSeconds += double(nEnd.QuadPart - nBegin.QuadPart) / double(nFrequency.QuadPart);
+
+	pReport->m_nMeshes++;
+	pReport->m_nVertices += pMeshInfo->m_nVertices;
+	//CMeshIlluminatedFromFile always creates the three buffers, with or without uvs in the file
+	pReport->m_nSeparateBytes += UINT64(sizeof(XMFLOAT3) + sizeof(XMFLOAT3) + sizeof(XMFLOAT2)) * pMeshInfo->m_nVertices;
+	pReport->m_nPackedBytes += UINT64(xLayout.m_nStride) * pMeshInfo->m_nVertices;
+
+	XMFLOAT3 xmf3Extents = pMeshInfo->m_xmf3AABBExtents;
+	float fDiagonal = 2.0f * sqrtf(xmf3Extents.x * xmf3Extents.x + xmf3Extents.y * xmf3Extents.y + xmf3Extents.z * xmf3Extents.z);
+
+	for (int i = 0; i < pMeshInfo->m_nVertices; i++)
+	{
+		BYTE *pVertex = pVertices + xLayout.m_nStride * i;
+
+		XMFLOAT3 xmf3Position;
+		if (xLayout.m_nFlags & VERTEX_PACK_QUANTIZE_POSITION)
+			xmf3Position = ::DequantizePosition((USHORT *)(pVertex + xLayout.m_nPositionOffset), &xLayout);
+		else
+			::memcpy(&xmf3Position, pVertex + xLayout.m_nPositionOffset, sizeof(XMFLOAT3));
+		XMFLOAT3& xmf3Source = pMeshInfo->m_pxmf3Positions[i];
+		float dx = xmf3Position.x - xmf3Source.x, dy = xmf3Position.y - xmf3Source.y, dz = xmf3Position.z - xmf3Source.z;
+		float fError = sqrtf(dx * dx + dy * dy + dz * dz);
+		pReport->m_fMaxPositionError = max(pReport->m_fMaxPositionError, fError);
+		if (fDiagonal > 0.0f) pReport->m_fMaxRelativePositionError = max(pReport->m_fMaxRelativePositionError, fError / fDiagonal);
+		pReport->m_fSumPositionError += fError;
+
+		if (pMeshInfo->m_pxmf3Normals)
+		{
+			XMFLOAT3& xmf3Normal = pMeshInfo->m_pxmf3Normals[i];
+			float fLength = sqrtf(xmf3Normal.x * xmf3Normal.x + xmf3Normal.y * xmf3Normal.y + xmf3Normal.z * xmf3Normal.z);
+			if (fLength > 0.0f)
+			{
+				XMFLOAT3 xmf3Decoded = ::DecodeOctahedralNormal((short *)(pVertex + xLayout.m_nNormalOffset));
+				float fCosine = (xmf3Decoded.x * xmf3Normal.x + xmf3Decoded.y * xmf3Normal.y + xmf3Decoded.z * xmf3Normal.z) / fLength;
+				float fDegrees = XMConvertToDegrees(acosf(max(-1.0f, min(1.0f, fCosine))));
+				pReport->m_fMaxNormalDegrees = max(pReport->m_fMaxNormalDegrees, fDegrees);
+				pReport->m_fSumNormalDegrees += fDegrees;
+				pReport->m_nNormals++;
+			}
+		}
+
+		if (pMeshInfo->m_pxmf2TexCoords)
+		{
+			HALF *pTexCoord = (HALF *)(pVertex + xLayout.m_nTexCoordOffset);
+			float fErrorU = fabsf(XMConvertHalfToFloat(pTexCoord[0]) - pMeshInfo->m_pxmf2TexCoords[i].x);
+			float fErrorV = fabsf(XMConvertHalfToFloat(pTexCoord[1]) - pMeshInfo->m_pxmf2TexCoords[i].y);
+			pReport->m_fMaxTexCoordError = max(pReport->m_fMaxTexCoordError, max(fErrorU, fErrorV));
+			pReport->m_fSumTexCoordError += max(fErrorU, fErrorV);
+			pReport->m_nTexCoords++;
+		}
+	}
+
+	delete[] pVertices;
+}
+
+int BenchmarkVertexPacking(char **ppstrFileNames, int nFiles)
+{
+	int nFailures = 0;
+	TCHAR pstrDebug[512] = { 0 };
+	for (int i = 0; i < nFiles; i++)
+	{
+		for (UINT nFlags = 0; nFlags <= VERTEX_PACK_QUANTIZE_POSITION; nFlags++)
+		{
+			VERTEXPACKINGREPORT xReport;
+			xReport.m_nFlags = nFlags;
+			if (!::EnumerateModelMeshes(ppstrFileNames[i], ::MeasureVertexPacking, &xReport))
+			{
+				nFailures++;
+				break;
+			}
+
+			double fRatio = (xReport.m_nSeparateBytes > 0) ? (double(xReport.m_nPackedBytes) / double(xReport.m_nSeparateBytes)) : 0.0;
+			_stprintf_s(pstrDebug, 512, _T("%hs [%s] %d meshes, %d vertices: %llu -> %llu bytes (%.0f%%), encode %.2f ms\n"), ppstrFileNames[i], (nFlags & VERTEX_PACK_QUANTIZE_POSITION) ? _T("quantized") : _T("float position"), xReport.m_nMeshes, xReport.m_nVertices, xReport.m_nSeparateBytes, xReport.m_nPackedBytes, fRatio * 100.0, xReport.m_fEncodeSeconds * 1000.0);
+			OutputDebugString(pstrDebug);
+
+			double fMeanPosition = (xReport.m_nVertices > 0) ? (xReport.m_fSumPositionError / xReport.m_nVertices) : 0.0;
+			double fMeanNormal = (xReport.m_nNormals > 0) ? (xReport.m_fSumNormalDegrees / xReport.m_nNormals) : 0.0;
+			double fMeanTexCoord = (xReport.m_nTexCoords > 0) ? (xReport.m_fSumTexCoordError / xReport.m_nTexCoords) : 0.0;
+			_stprintf_s(pstrDebug, 512, _T("    position max %g (%.2e of AABB) mean %g, normal max %.4f mean %.4f deg, uv max %g mean %g\n"), xReport.m_fMaxPositionError, xReport.m_fMaxRelativePositionError, fMeanPosition, xReport.m_fMaxNormalDegrees, fMeanNormal, xReport.m_fMaxTexCoordError, fMeanTexCoord);
+			OutputDebugString(pstrDebug);
+
+			//16-bit quantization of the AABB, octahedral normals in two snorm16 (acosf alone is off by 0.02 degrees)
+			if ((xReport.m_fMaxRelativePositionError > 1.0e-4f) || (xReport.m_fMaxNormalDegrees > 0.1f)) nFailures++;
+		}
+	}
+
+	return(nFailures);
+}
+#endif
+
@@ -0,0 +1,58 @@
+//-----------------------------------------------------------------------------
+// File: VertexPacking.h
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Mesh.h"
+
+//Single interleaved vertex stream for the illuminated file meshes:
+//	POSITION	R32G32B32_FLOAT (12) or R16G16B16A16_UNORM against the mesh AABB (8)
+//	NORMAL		R16G16_SNORM octahedral (4)
+//	TEXCOORD	R16G16_FLOAT (4)
+//VSPackedLighting reconstructs position as (input * gf4PositionScale + gf4PositionBias), so both position
+//formats use the same shader; the scale/bias are root constants 32..39 of the GameObject parameter.
+#define VERTEX_PACK_QUANTIZE_POSITION		0x01
+
+#define VERTEX_PACK_INPUT_ELEMENTS			3
+
+//Loaded illuminated meshes are created as CMeshPackedFromFile instead of CMeshIlluminatedFromFile
+//#define _WITH_PACKED_VERTEX_STREAMS
+
+//Layout used by CMeshPackedFromFile and CPackedIlluminatedShader (both must agree); float positions unless
+//VERTEX_PACK_QUANTIZE_POSITION is added
+#define PACKED_VERTEX_FLAGS					0
+
+struct PACKEDVERTEXLAYOUT
+{
+	UINT							m_nFlags = 0;
+	UINT							m_nStride = 0;
+
+	UINT							m_nPositionOffset = 0;
+	UINT							m_nNormalOffset = 0;
+	UINT							m_nTexCoordOffset = 0;
+	DXGI_FORMAT						m_dxgiPositionFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+
+	XMFLOAT4						m_xmf4PositionScale = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
+	XMFLOAT4						m_xmf4PositionBias = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+};
+
+void GetPackedVertexLayout(UINT nFlags, PACKEDVERTEXLAYOUT *pLayout);
+void GetPackedVertexLayout(CMeshLoadInfo *pMeshInfo, UINT nFlags, PACKEDVERTEXLAYOUT *pLayout);
+
+//Fills VERTEX_PACK_INPUT_ELEMENTS descriptions (slot 0) matching pLayout; returns the element count
+UINT CreatePackedInputElementDescs(PACKEDVERTEXLAYOUT *pLayout, D3D12_INPUT_ELEMENT_DESC *pd3dInputElementDescs);
+
+//Returns a new[] array of (m_nVertices * m_nStride) bytes; missing normals/uvs are written as zero
+BYTE *PackVertices(CMeshLoadInfo *pMeshInfo, PACKEDVERTEXLAYOUT *pLayout);
+
+void EncodeOctahedralNormal(XMFLOAT3& xmf3Normal, short *pnEncoded);
+XMFLOAT3 DecodeOctahedralNormal(short *pnEncoded);
+
+void QuantizePosition(XMFLOAT3& xmf3Position, PACKEDVERTEXLAYOUT *pLayout, USHORT *pnEncoded);
+XMFLOAT3 DequantizePosition(USHORT *pnEncoded, PACKEDVERTEXLAYOUT *pLayout);
+
+#ifdef _WITH_VERTEX_PACKING_BENCHMARK
+//Returns the files that fail to load or whose packed vertices are off by more than the quantization allows
+int BenchmarkVertexPacking(char **ppstrFileNames, int nFiles);
+#endif
@@ -5,6 +5,7 @@
 #include "stdafx.h"
 
 #include "DDSTextureLoader12.h"
+#include <intrin.h>
 
 UINT gnCbvSrvDescriptorIncrementSize = 0;
 
@@ -97,6 +98,45 @@ ID3D12Resource *CreateBufferResource(ID3D12Device *pd3dDevice, ID3D12GraphicsCom
 	return(pd3dBuffer);
 }
 
+void CreateBufferResources(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, int nBuffers, void **ppData, UINT *pnBytes, D3D12_RESOURCE_STATES *pd3dResourceStates, ID3D12Resource **ppd3dBuffers, ID3D12Resource **ppd3dUploadBuffer)
+{
+	//The copies of every buffer at 256 byte offsets (D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT) of one upload buffer
+	UINT *pnOffsets = new UINT[nBuffers];
+	UINT nUploadBytes = 0;
+	for (int i = 0; i < nBuffers; i++)
+	{
+		pnOffsets[i] = nUploadBytes;
+		nUploadBytes += (pnBytes[i] + 255) & ~255;
+	}
+
+	*ppd3dUploadBuffer = ::CreateBufferResource(pd3dDevice, pd3dCommandList, NULL, nUploadBytes, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_STATE_GENERIC_READ, NULL);
+	D3D12_RANGE d3dReadRange = { 0, 0 };
+	UINT8 *pBufferDataBegin = NULL;
+	(*ppd3dUploadBuffer)->Map(0, &d3dReadRange, (void **)&pBufferDataBegin);
+	for (int i = 0; i < nBuffers; i++) memcpy(pBufferDataBegin + pnOffsets[i], ppData[i], pnBytes[i]);
+	(*ppd3dUploadBuffer)->Unmap(0, NULL);
+
+	D3D12_RESOURCE_BARRIER *pd3dResourceBarriers = new D3D12_RESOURCE_BARRIER[nBuffers];
+	::ZeroMemory(pd3dResourceBarriers, sizeof(D3D12_RESOURCE_BARRIER) * nBuffers);
+	for (int i = 0; i < nBuffers; i++)
+	{
+		//Default heap buffers without data are created in D3D12_RESOURCE_STATE_COPY_DEST
+		ppd3dBuffers[i] = ::CreateBufferResource(pd3dDevice, pd3dCommandList, NULL, pnBytes[i], D3D12_HEAP_TYPE_DEFAULT, pd3dResourceStates[i], NULL);
+		pd3dCommandList->CopyBufferRegion(ppd3dBuffers[i], 0, *ppd3dUploadBuffer, pnOffsets[i], pnBytes[i]);
+
+		pd3dResourceBarriers[i].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+		pd3dResourceBarriers[i].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+		pd3dResourceBarriers[i].Transition.pResource = ppd3dBuffers[i];
+		pd3dResourceBarriers[i].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
+		pd3dResourceBarriers[i].Transition.StateAfter = pd3dResourceStates[i];
+		pd3dResourceBarriers[i].Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	}
+	pd3dCommandList->ResourceBarrier(nBuffers, pd3dResourceBarriers);
+
+	delete[] pd3dResourceBarriers;
+	delete[] pnOffsets;
+}
+
 ID3D12Resource *CreateTextureResourceFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, wchar_t *pszFileName, ID3D12Resource **ppd3dUploadBuffer, D3D12_RESOURCE_STATES d3dResourceStates)
 {
 	ID3D12Resource *pd3dTexture = NULL;
@@ -202,3 +242,18 @@ void SynchronizeResourceTransition(ID3D12GraphicsCommandList* pd3dCommandList, I
 	d3dResourceBarrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
 	pd3dCommandList->ResourceBarrier(1, &d3dResourceBarrier);
 }
+
+bool IsAVX2Supported()
+{
+	int pnInfo[4];
+	::__cpuid(pnInfo, 0);
+	if (pnInfo[0] < 7) return(false);
+
+	//FMA3, OSXSAVE and AVX (leaf 1, ecx), the XMM and YMM state saved by the OS (XCR0), then AVX2 (leaf 7, ebx)
+	int nFeatures = (1 << 12) | (1 << 27) | (1 << 28);
+	::__cpuid(pnInfo, 1);
+	if ((pnInfo[2] & nFeatures) != nFeatures) return(false);
+	if ((::_xgetbv(0) & 0x6) != 0x6) return(false);
+	::__cpuidex(pnInfo, 7, 0);
+	return((pnInfo[1] & (1 << 5)) != 0);
+}
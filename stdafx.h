@@ -64,9 +64,24 @@ using Microsoft::WRL::ComPtr;
 extern UINT gnCbvSrvDescriptorIncrementSize;
 
 extern ID3D12Resource *CreateBufferResource(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, void *pData, UINT nBytes, D3D12_HEAP_TYPE d3dHeapType = D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_STATES d3dResourceStates = D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, ID3D12Resource **ppd3dUploadBuffer = NULL);
+//Default heap buffers of nBuffers blocks of data, copied from one upload buffer, then left in pd3dResourceStates with
+//one barrier call
+extern void CreateBufferResources(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, int nBuffers, void **ppData, UINT *pnBytes, D3D12_RESOURCE_STATES *pd3dResourceStates, ID3D12Resource **ppd3dBuffers, ID3D12Resource **ppd3dUploadBuffer);
 extern ID3D12Resource *CreateTextureResourceFromFile(ID3D12Device *pd3dDevice, ID3D12GraphicsCommandList *pd3dCommandList, wchar_t *pszFileName, ID3D12Resource **ppd3dUploadBuffer, D3D12_RESOURCE_STATES d3dResourceStates = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 extern ID3D12Resource* CreateTexture2DResource(ID3D12Device* pd3dDevice, ID3D12GraphicsCommandList* pd3dCommandList, UINT nWidth, UINT nHeight, DXGI_FORMAT dxgiFormat, D3D12_RESOURCE_FLAGS d3dResourceFlags, D3D12_RESOURCE_STATES d3dResourceStates, D3D12_CLEAR_VALUE* pd3dClearValue);
 
+//Every configuration builds with /arch:AVX2 (the eight lane kernels of CBoxBatch and CHeightMapImage), so the
+//processor needs AVX2 and FMA3 and the OS the YMM state; _tWinMain checks it first
+extern bool IsAVX2Supported();
+
+#ifdef _WITH_CONSOLE_BENCHMARKS
+//The benchmarks report through OutputDebugString; in the console target (Benchmarks.vcxproj) it also prints to stdout
+extern void BenchmarkOutputDebugString(LPCTSTR pstrOutput);
+#undef OutputDebugString
+#define OutputDebugString BenchmarkOutputDebugString
+#endif
+
+
 extern void SynchronizeResourceTransition(ID3D12GraphicsCommandList *pd3dCommandList, ID3D12Resource *pd3dResource, D3D12_RESOURCE_STATES d3dStateBefore, D3D12_RESOURCE_STATES d3dStateAfter);
 
 #define RANDOM_COLOR			XMFLOAT4(rand() / float(RAND_MAX), rand() / float(RAND_MAX), rand() / float(RAND_MAX), rand() / float(RAND_MAX))
@@ -240,6 +255,17 @@ namespace Matrix4x4
 		return(xmmtx4x4Result);
 	}
 
+	//Scale, rotation (slerp) and translation blended separately; t = 0 is the first matrix
+	inline XMFLOAT4X4 Interpolate(XMFLOAT4X4& xmmtx4x4Matrix1, XMFLOAT4X4& xmmtx4x4Matrix2, float t)
+	{
+		XMVECTOR xmvScale1, xmvRotation1, xmvTranslation1, xmvScale2, xmvRotation2, xmvTranslation2;
+		XMMatrixDecompose(&xmvScale1, &xmvRotation1, &xmvTranslation1, XMLoadFloat4x4(&xmmtx4x4Matrix1));
+		XMMatrixDecompose(&xmvScale2, &xmvRotation2, &xmvTranslation2, XMLoadFloat4x4(&xmmtx4x4Matrix2));
+		XMFLOAT4X4 xmmtx4x4Result;
+		XMStoreFloat4x4(&xmmtx4x4Result, XMMatrixAffineTransformation(XMVectorLerp(xmvScale1, xmvScale2, t), XMVectorZero(), XMQuaternionSlerp(xmvRotation1, xmvRotation2, t), XMVectorLerp(xmvTranslation1, xmvTranslation2, t)));
+		return(xmmtx4x4Result);
+	}
+
 	inline XMFLOAT4X4 Transpose(XMFLOAT4X4& xmmtx4x4Matrix)
 	{
 		XMFLOAT4X4 xmmtx4x4Result;